@@ -0,0 +1,259 @@
+#include "capture.h"
+#include "logger.h"
+
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+
+#include <boost/throw_exception.hpp>
+
+namespace Akumuli {
+
+static Logger s_logger_("capture");
+
+static u64 steady_now() {
+    auto ts = std::chrono::steady_clock::now().time_since_epoch();
+    return static_cast<u64>(std::chrono::duration_cast<std::chrono::nanoseconds>(ts).count());
+}
+
+static u64 wall_now() {
+    auto ts = std::chrono::system_clock::now().time_since_epoch();
+    return static_cast<u64>(std::chrono::duration_cast<std::chrono::nanoseconds>(ts).count());
+}
+
+//                       //
+//     CaptureWriter     //
+//                       //
+
+CaptureWriter::CaptureWriter(CaptureSettings const& settings)
+    : settings_(settings)
+    , file_(nullptr)
+    , file_size_(0)
+    , start_(steady_now())
+    , next_id_{0}
+    , sample_counter_{0}
+    , full_{false}
+    , dropped_{0}
+    , stop_(false)
+{
+    file_ = fopen(settings_.path.c_str(), "wb");
+    if (file_ == nullptr) {
+        std::runtime_error err("can't open capture file " + settings_.path + ": " + strerror(errno));
+        BOOST_THROW_EXCEPTION(err);
+    }
+    CaptureFileHeader header = {};
+    memcpy(header.magic, CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC));
+    header.version = CAPTURE_VERSION;
+    header.start_time = wall_now();
+    fwrite(&header, sizeof(header), 1, file_);
+    file_size_ = sizeof(header);
+    active_.reserve(settings_.buffer_size);
+    flushing_.reserve(settings_.buffer_size);
+    thread_ = std::thread(&CaptureWriter::run, this);
+    s_logger_.info() << "Capture started, path: " << settings_.path
+                     << ", sample rate: " << settings_.sample_rate
+                     << ", max size: " << settings_.max_size;
+}
+
+CaptureWriter::~CaptureWriter() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+        cvar_.notify_one();
+    }
+    thread_.join();
+    fclose(file_);
+    s_logger_.info() << "Capture stopped, " << file_size_ << " bytes written, "
+                     << dropped_.load() << " records dropped";
+}
+
+void CaptureWriter::run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        cvar_.wait_for(lock, std::chrono::milliseconds(100));
+        std::swap(active_, flushing_);
+        bool stop = stop_;
+        lock.unlock();
+        if (!flushing_.empty()) {
+            if (fwrite(flushing_.data(), 1, flushing_.size(), file_) != flushing_.size()) {
+                s_logger_.error() << "Capture write error: " << strerror(errno);
+                full_ = true;
+            }
+            fflush(file_);
+            flushing_.clear();
+        }
+        if (stop) {
+            break;
+        }
+        lock.lock();
+    }
+}
+
+u32 CaptureWriter::next_stream_id() {
+    return next_id_++;
+}
+
+bool CaptureWriter::sample() {
+    double rate = settings_.sample_rate;
+    if (rate >= 1.0) {
+        return true;
+    }
+    // Take the item if the running total of `rate` crosses an integer boundary
+    auto n = static_cast<double>(sample_counter_++);
+    return static_cast<u64>((n + 1) * rate) != static_cast<u64>(n * rate);
+}
+
+bool CaptureWriter::write(u32 stream_id, CaptureProtocol protocol, CaptureRecordType type, const char* data, u32 size) {
+    if (full_.load(std::memory_order_relaxed)) {
+        return false;
+    }
+    CaptureRecordHeader header = {};
+    header.timestamp = steady_now() - start_;
+    header.stream_id = stream_id;
+    header.size      = size;
+    header.protocol  = static_cast<u8>(protocol);
+    header.type      = static_cast<u8>(type);
+    size_t recsize = sizeof(header) + size;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (file_size_ + recsize > settings_.max_size) {
+        if (!full_.exchange(true)) {
+            s_logger_.info() << "Capture file reached max size, capture stopped";
+        }
+        return false;
+    }
+    if (active_.size() + recsize > settings_.buffer_size) {
+        dropped_++;
+        cvar_.notify_one();
+        return false;
+    }
+    auto hdr = reinterpret_cast<const char*>(&header);
+    active_.insert(active_.end(), hdr, hdr + sizeof(header));
+    active_.insert(active_.end(), data, data + size);
+    file_size_ += recsize;
+    if (active_.size() > settings_.buffer_size / 2) {
+        cvar_.notify_one();
+    }
+    return true;
+}
+
+u64 CaptureWriter::dropped() const {
+    return dropped_.load();
+}
+
+//                       //
+//     CaptureStream     //
+//                       //
+
+CaptureStream::CaptureStream(std::shared_ptr<CaptureWriter> writer, CaptureProtocol protocol)
+    : writer_(writer)
+    , id_(writer->next_stream_id())
+    , protocol_(protocol)
+    , broken_(false)
+{
+    broken_ = !writer_->write(id_, protocol_, CaptureRecordType::OPEN, nullptr, 0);
+}
+
+CaptureStream::~CaptureStream() {
+    writer_->write(id_, protocol_, CaptureRecordType::CLOSE, nullptr, 0);
+}
+
+void CaptureStream::write(const char* data, size_t size) {
+    if (protocol_ == CaptureProtocol::UDP) {
+        // Datagrams are independent, drop doesn't affect the rest of the stream
+        if (writer_->sample()) {
+            writer_->write(id_, protocol_, CaptureRecordType::DATA, data, static_cast<u32>(size));
+        }
+        return;
+    }
+    if (!broken_) {
+        broken_ = !writer_->write(id_, protocol_, CaptureRecordType::DATA, data, static_cast<u32>(size));
+    }
+}
+
+//                          //
+//     IngestionCapture     //
+//                          //
+
+static std::mutex                     s_capture_mutex_;
+static std::shared_ptr<CaptureWriter> s_capture_;
+static std::atomic<u64>               s_generation_{0};
+
+void IngestionCapture::start(CaptureSettings const& settings) {
+    auto writer = std::make_shared<CaptureWriter>(settings);
+    std::lock_guard<std::mutex> lock(s_capture_mutex_);
+    s_capture_ = writer;
+    s_generation_++;
+}
+
+void IngestionCapture::stop() {
+    std::shared_ptr<CaptureWriter> writer;
+    {
+        std::lock_guard<std::mutex> lock(s_capture_mutex_);
+        std::swap(writer, s_capture_);
+        s_generation_++;
+    }
+    // Writer is destroyed when the last stream is closed
+}
+
+std::unique_ptr<CaptureStream> IngestionCapture::open_stream(CaptureProtocol protocol) {
+    std::shared_ptr<CaptureWriter> writer;
+    {
+        std::lock_guard<std::mutex> lock(s_capture_mutex_);
+        writer = s_capture_;
+    }
+    std::unique_ptr<CaptureStream> result;
+    if (writer && (protocol == CaptureProtocol::UDP || writer->sample())) {
+        result.reset(new CaptureStream(writer, protocol));
+    }
+    return result;
+}
+
+u64 IngestionCapture::generation() {
+    return s_generation_.load();
+}
+
+//                       //
+//     CaptureReader     //
+//                       //
+
+CaptureReader::CaptureReader(std::string const& path)
+    : file_(fopen(path.c_str(), "rb"))
+    , header_{}
+{
+    if (file_ == nullptr) {
+        throw std::runtime_error("can't open capture file " + path + ": " + strerror(errno));
+    }
+    if (fread(&header_, sizeof(header_), 1, file_) != 1
+        || memcmp(header_.magic, CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC)) != 0)
+    {
+        fclose(file_);
+        throw std::runtime_error("not a capture file: " + path);
+    }
+    if (header_.version != CAPTURE_VERSION) {
+        fclose(file_);
+        throw std::runtime_error("unsupported capture file version " + std::to_string(header_.version));
+    }
+}
+
+CaptureReader::~CaptureReader() {
+    fclose(file_);
+}
+
+CaptureFileHeader const& CaptureReader::header() const {
+    return header_;
+}
+
+bool CaptureReader::next(CaptureRecordHeader* header, std::vector<char>* payload) {
+    if (fread(header, sizeof(CaptureRecordHeader), 1, file_) != 1) {
+        return false;
+    }
+    payload->resize(header->size);
+    if (header->size && fread(payload->data(), 1, header->size, file_) != header->size) {
+        // Truncated record (capture wasn't stopped properly)
+        return false;
+    }
+    return true;
+}
+
+}  // namespace
@@ -0,0 +1,183 @@
+/**
+ * Copyright (c) 2017 Eugene Lazin <4lazin@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "akumuli_def.h"
+
+namespace Akumuli {
+
+/** Ingestion capture file format.
+  * File starts with CaptureFileHeader followed by records. Every record is a
+  * CaptureRecordHeader followed by `size` bytes of payload. Payload contains raw
+  * protocol bytes exactly as they were received by the server. Timestamps are
+  * relative to the start of the capture, so the capture can be replayed with
+  * the original timing.
+  */
+static const char CAPTURE_MAGIC[8] = { 'A', 'K', 'U', 'C', 'A', 'P', 'T', '\0' };
+static const u32  CAPTURE_VERSION  = 1;
+
+enum class CaptureProtocol : u8 {
+    RESP     = 0,
+    OPENTSDB = 1,
+    UDP      = 2,
+};
+
+enum class CaptureRecordType : u8 {
+    OPEN  = 0,  //< Connection accepted (no payload)
+    DATA  = 1,  //< Data received (for UDP every record is a datagram)
+    CLOSE = 2,  //< Connection closed (no payload)
+};
+
+struct CaptureFileHeader {
+    char magic[8];
+    u32  version;
+    u32  reserved;
+    u64  start_time;  //< Wall clock time of the capture start (ns since epoch)
+};
+
+struct CaptureRecordHeader {
+    u64 timestamp;   //< Time since capture start in nanoseconds
+    u32 stream_id;   //< Connection id (unique within the capture)
+    u32 size;        //< Payload size
+    u8  protocol;    //< CaptureProtocol
+    u8  type;        //< CaptureRecordType
+    u16 reserved0;
+    u32 reserved1;
+};
+
+static_assert(sizeof(CaptureFileHeader) == 24, "Capture file header size changed");
+static_assert(sizeof(CaptureRecordHeader) == 24, "Capture record header size changed");
+
+struct CaptureSettings {
+    std::string path;         //< Output file
+    double      sample_rate;  //< Fraction of TCP connections (or UDP datagrams) to capture
+    u64         max_size;     //< Capture stops when the file reaches this size
+    u64         buffer_size;  //< Size of the in-memory buffer, data is dropped if the writer can't keep up
+};
+
+/** Capture file writer.
+  * Records are appended to in-memory buffer and written to disk by the background
+  * thread, so the I/O threads only pay for one memcpy per read.
+  */
+class CaptureWriter {
+    CaptureSettings         settings_;
+    FILE*                   file_;
+    std::vector<char>       active_;    //< Buffer that receives new records
+    std::vector<char>       flushing_;  //< Buffer that is being written to disk
+    u64                     file_size_;
+    u64                     start_;     //< Steady clock time of the capture start
+    std::atomic<u32>        next_id_;
+    std::atomic<u64>        sample_counter_;
+    std::atomic<bool>       full_;      //< Max size reached
+    std::atomic<u64>        dropped_;   //< Number of records that didn't fit into the buffer
+    bool                    stop_;
+    std::mutex              mutex_;
+    std::condition_variable cvar_;
+    std::thread             thread_;
+
+    void run();
+
+public:
+    CaptureWriter(CaptureSettings const& settings);
+    ~CaptureWriter();
+
+    CaptureWriter(CaptureWriter const&) = delete;
+    CaptureWriter& operator = (CaptureWriter const&) = delete;
+
+    //! Generate new stream id
+    u32 next_stream_id();
+
+    //! Sampling decision (evenly spread, deterministic for the given `sample_rate`)
+    bool sample();
+
+    /** Append record to the capture.
+      * Returns false if the record was dropped (buffer is full or max size reached).
+      */
+    bool write(u32 stream_id, CaptureProtocol protocol, CaptureRecordType type, const char* data, u32 size);
+
+    //! Number of records dropped because of the buffer overflow
+    u64 dropped() const;
+};
+
+/** Capture of the individual connection.
+  * Stream stops capturing after the first dropped record so the captured
+  * data is always a prefix of the original stream.
+  */
+class CaptureStream {
+    std::shared_ptr<CaptureWriter> writer_;
+    u32                            id_;
+    CaptureProtocol                protocol_;
+    bool                           broken_;
+public:
+    CaptureStream(std::shared_ptr<CaptureWriter> writer, CaptureProtocol protocol);
+    ~CaptureStream();
+
+    //! Capture received bytes
+    void write(const char* data, size_t size);
+};
+
+/** Global ingestion capture.
+  * Capture is configured in `[Capture]` section of the config file.
+  */
+struct IngestionCapture {
+    //! Start capture, all connections opened after this call will be sampled
+    static void start(CaptureSettings const& settings);
+
+    //! Stop capture, connections that are still open will keep writing until closed
+    static void stop();
+
+    /** Create capture stream for the new connection.
+      * Returns nullptr if capture is not enabled or connection wasn't sampled.
+      * UDP datagrams are self-contained so UDP streams are always created and
+      * sampled by datagram.
+      */
+    static std::unique_ptr<CaptureStream> open_stream(CaptureProtocol protocol);
+
+    /** Capture generation, changes on every `start` and `stop` call.
+      * Long lived streams (UDP) should be reopened when generation changes.
+      */
+    static u64 generation();
+};
+
+/** Capture file reader (used by the replay tool).
+  */
+class CaptureReader {
+    FILE*             file_;
+    CaptureFileHeader header_;
+public:
+    //! Open capture file, throws std::runtime_error if file can't be opened or has wrong format
+    CaptureReader(std::string const& path);
+    ~CaptureReader();
+
+    CaptureReader(CaptureReader const&) = delete;
+    CaptureReader& operator = (CaptureReader const&) = delete;
+
+    CaptureFileHeader const& header() const;
+
+    //! Read next record, return false at the end of the file
+    bool next(CaptureRecordHeader* header, std::vector<char>* payload);
+};
+
+}  // namespace
@@ -4,6 +4,7 @@
 #include <thread>
 
 #include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
 
 namespace Akumuli {
 namespace Http {
@@ -44,6 +45,8 @@ static ApiEndpoint get_endpoint(const std::string& path) {
         return ApiEndpoint::SUGGEST;
     } else if (path == "/api/search") {
         return ApiEndpoint::SEARCH;
+    } else if (path == "/api/prepare") {
+        return ApiEndpoint::PREPARE;
     }
     return ApiEndpoint::UNKNOWN;
 }
@@ -127,6 +130,36 @@ static int accept_connection(void           *cls,
             ret = MHD_queue_response(connection, MHD_HTTP_OK, response);
             MHD_destroy_response(response);
             return ret;
+        } else if (path == "/api/stats/probes") {
+            std::string stats = queryproc->get_resource("probes");
+            auto response = MHD_create_response_from_buffer(stats.size(), const_cast<char*>(stats.data()), MHD_RESPMEM_MUST_COPY);
+            int ret = MHD_add_response_header(response, "content-type", "application/json");
+            if (ret == MHD_NO) {
+                return ret;
+            }
+            ret = MHD_queue_response(connection, MHD_HTTP_OK, response);
+            MHD_destroy_response(response);
+            return ret;
+        } else if (path == "/api/stats/memory") {
+            std::string stats = queryproc->get_resource("memory");
+            auto response = MHD_create_response_from_buffer(stats.size(), const_cast<char*>(stats.data()), MHD_RESPMEM_MUST_COPY);
+            int ret = MHD_add_response_header(response, "content-type", "application/json");
+            if (ret == MHD_NO) {
+                return ret;
+            }
+            ret = MHD_queue_response(connection, MHD_HTTP_OK, response);
+            MHD_destroy_response(response);
+            return ret;
+        } else if (path == "/api/queries") {
+            std::string stats = queryproc->get_resource("queries");
+            auto response = MHD_create_response_from_buffer(stats.size(), const_cast<char*>(stats.data()), MHD_RESPMEM_MUST_COPY);
+            int ret = MHD_add_response_header(response, "content-type", "application/json");
+            if (ret == MHD_NO) {
+                return ret;
+            }
+            ret = MHD_queue_response(connection, MHD_HTTP_OK, response);
+            MHD_destroy_response(response);
+            return ret;
         } else if (path == "/api/function-names") {
             std::string stats = queryproc->get_resource("function-names");
             auto response = MHD_create_response_from_buffer(stats.size(), const_cast<char*>(stats.data()), MHD_RESPMEM_MUST_COPY);
@@ -142,6 +175,36 @@ static int accept_connection(void           *cls,
             logger.error() << error_msg << " (GET)";
             return error_response(error_msg.c_str(), MHD_HTTP_NOT_FOUND);
         }
+    } else if (strcmp(method, "DELETE") == 0) {
+        // Cancel running query: DELETE /api/queries/<id>
+        static const char* SIGIL = "";
+        static const std::string PREFIX = "/api/queries/";
+        auto queryproc = static_cast<ReadOperationBuilder*>(cls);
+        if (*con_cls == nullptr) {
+            *con_cls = const_cast<char*>(SIGIL);
+            return MHD_YES;
+        }
+        u64 id = 0;
+        try {
+            if (path.compare(0, PREFIX.size(), PREFIX) != 0) {
+                throw boost::bad_lexical_cast();
+            }
+            id = boost::lexical_cast<u64>(path.substr(PREFIX.size()));
+        } catch (boost::bad_lexical_cast const&) {
+            std::string error_msg = "Invalid url " + path;
+            logger.error() << error_msg << " (DELETE)";
+            return error_response(error_msg.c_str(), MHD_HTTP_NOT_FOUND);
+        }
+        auto status = queryproc->cancel_query(id);
+        if (status != AKU_SUCCESS) {
+            return error_response(aku_error_message(status), MHD_HTTP_NOT_FOUND);
+        }
+        logger.info() << "Query " << id << " cancelled";
+        static const char OK[] = "+OK\r\n";
+        auto response = MHD_create_response_from_buffer(sizeof(OK) - 1, const_cast<char*>(OK), MHD_RESPMEM_PERSISTENT);
+        int ret = MHD_queue_response(connection, MHD_HTTP_OK, response);
+        MHD_destroy_response(response);
+        return ret;
     }
     logger.error() << "Invalid HTTP request, method: " << method << ", path: " << path;
     std::string error_msg = "Invalid request";
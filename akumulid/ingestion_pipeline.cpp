@@ -67,6 +67,11 @@ std::shared_ptr<DbCursor> AkumuliSession::search(std::string query) {
     return std::make_shared<AkumuliCursor>(cursor);
 }
 
+std::shared_ptr<DbCursor> AkumuliSession::prepare(std::string query) {
+    aku_Cursor* cursor = aku_prepare(session_, query.c_str());
+    return std::make_shared<AkumuliCursor>(cursor);
+}
+
 int AkumuliSession::param_id_to_series(aku_ParamId id, char *buffer, size_t buffer_size) {
     return aku_param_id_to_series(session_, id, buffer, buffer_size);
 }
@@ -81,11 +86,10 @@ int AkumuliSession::name_to_param_id_list(const char* begin, const char* end, ak
 
 // Connection //
 
-AkumuliConnection::AkumuliConnection(const char *path)
+AkumuliConnection::AkumuliConnection(const char *path, aku_FineTuneParams const& params)
     : dbpath_(path)
 {
     db_logger_.info() << "Open database at: " << path;
-    aku_FineTuneParams params = {};
     db_ = aku_open_database(dbpath_.c_str(), params);
 }
 
@@ -103,6 +107,11 @@ std::string AkumuliConnection::get_all_stats() {
     std::vector<char> buffer;
     buffer.resize(0x1000);
     int nbytes = aku_json_stats(db_, buffer.data(), buffer.size());
+    if (nbytes < -1) {
+        // Buffer is too small, -nbytes is the required size (without terminator)
+        buffer.resize(static_cast<size_t>(-nbytes) + 1);
+        nbytes = aku_json_stats(db_, buffer.data(), buffer.size());
+    }
     if (nbytes > 0) {
         return std::string(buffer.data(), buffer.data() + nbytes);
     }
@@ -65,6 +65,9 @@ struct DbSession {
     //! Execute search query
     virtual std::shared_ptr<DbCursor> search(std::string query) = 0;
 
+    //! Register prepared query
+    virtual std::shared_ptr<DbCursor> prepare(std::string query) = 0;
+
     //! Convert paramid to series name
     virtual int param_id_to_series(aku_ParamId id, char* buffer, size_t buffer_size) = 0;
 
@@ -94,6 +97,7 @@ public:
     virtual std::shared_ptr<DbCursor> query(std::string query) override;
     virtual std::shared_ptr<DbCursor> suggest(std::string query) override;
     virtual std::shared_ptr<DbCursor> search(std::string query) override;
+    virtual std::shared_ptr<DbCursor> prepare(std::string query) override;
     virtual int param_id_to_series(aku_ParamId id, char *buffer, size_t buffer_size) override;
     virtual aku_Status series_to_param_id(const char *name, size_t size, aku_Sample *sample) override;
     virtual int name_to_param_id_list(const char* begin, const char* end, aku_ParamId* ids, u32 cap) override;
@@ -107,7 +111,7 @@ class AkumuliConnection : public DbConnection {
     aku_Database* db_;
 
 public:
-    AkumuliConnection(const char* path);
+    AkumuliConnection(const char* path, aku_FineTuneParams const& params = aku_FineTuneParams());
 
     virtual ~AkumuliConnection() override;
 
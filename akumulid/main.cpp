@@ -6,6 +6,7 @@
 #include "query_results_pooler.h"
 #include "signal_handler.h"
 #include "logger.h"
+#include "capture.h"
 
 #include <iostream>
 #include <fstream>
@@ -46,10 +47,30 @@ path=~/.akumuli
 # configuration and restart daemon.
 nvolumes=%1%
 
+# Directories used to store volumes, separated by ':' (optional,
+# volumes are stored in `path` by default). If several directories
+# (e.g. on different disks) are specified, volumes are striped across
+# them and `nvolumes` is rounded up to a multiple of their number.
+# volumes_path=/mnt/disk0/akumuli:/mnt/disk1/akumuli
+
+# Directory used to store NB+tree superblocks (optional). Superblocks
+# are read by every query, it makes sense to put them on a faster
+# device. Superblock volumes are 8 times smaller than data volumes.
+# Set `mlock_superblocks` to lock superblock volumes in memory.
+# superblocks_path=/mnt/ssd/akumuli
+# mlock_superblocks=true
+
 # Size of the individual volume. You can use MB or GB suffix.
 # Default value is 4GB (if value is not set).
 volume_size=4GB
 
+# Bypass OS page cache and access volumes using O_DIRECT. Blocks
+# are cached by the in-process block cache instead (its size is
+# set by `block_cache_size`, default value is 256MB). Use it when
+# the host runs other I/O heavy services.
+# direct_io=true
+# block_cache_size=1GB
+
 
 # HTTP API endpoint configuration
 
@@ -82,6 +103,19 @@ pool_size=1
 port=4242
 
 
+# Ingestion capture (uncomment to enable). Raw protocol data received by
+# TCP and UDP servers is written to the file together with timing information.
+# Capture can be replayed using `perf_replay` tool.
+
+#[Capture]
+# output file
+#path=/tmp/akumuli.capture
+# fraction of TCP connections (or UDP datagrams) to capture
+#sample_rate=1.0
+# capture stops when file reaches this size (MB or GB suffix)
+#max_size=1GB
+
+
 
 # Logging configuration
 # This is just a log4cxx configuration without any modifications
@@ -146,7 +180,40 @@ struct ConfigFile {
     }
 
     static boost::filesystem::path get_path(PTree conf) {
-        std::string path = conf.get<std::string>("path");
+        return expand_path(conf.get<std::string>("path"));
+    }
+
+    //! Get list of volume directories separated by ':' (database path by default)
+    static std::string get_volumes_path(PTree conf) {
+        auto volpath = conf.get_optional<std::string>("volumes_path");
+        if (!volpath) {
+            return get_path(conf).string();
+        }
+        std::stringstream input(volpath.get());
+        std::string item;
+        std::string result;
+        while (std::getline(input, item, ':')) {
+            if (item.empty()) {
+                continue;
+            }
+            if (!result.empty()) {
+                result += ":";
+            }
+            result += expand_path(item).string();
+        }
+        return result;
+    }
+
+    //! Get superblock volumes directory (empty if superblocks are stored with the data)
+    static std::string get_superblocks_path(PTree conf) {
+        auto sbpath = conf.get_optional<std::string>("superblocks_path");
+        if (!sbpath) {
+            return std::string();
+        }
+        return expand_path(sbpath.get()).string();
+    }
+
+    static boost::filesystem::path expand_path(std::string path) {
         wordexp_t we;
         int err = wordexp(path.c_str(), &we, 0);
         if (err) {
@@ -172,8 +239,20 @@ struct ConfigFile {
     }
 
     static u64 get_volume_size(PTree conf) {
+        return decode_size(conf.get<std::string>("volume_size", "4GB"));
+    }
+
+    static aku_FineTuneParams get_fine_tune_params(PTree conf) {
+        aku_FineTuneParams params = {};
+        params.direct_io = conf.get<bool>("direct_io", false) ? 1 : 0;
+        params.max_cache_size = decode_size(conf.get<std::string>("block_cache_size", "0"));
+        params.mlock_superblocks = conf.get<bool>("mlock_superblocks", false) ? 1 : 0;
+        return params;
+    }
+
+    //! Decode size with optional MB or GB suffix
+    static u64 decode_size(std::string strsize) {
         u64 result = 0;
-        auto strsize = conf.get<std::string>("volume_size", "4GB");
         try {
             result = boost::lexical_cast<u64>(strsize);
         } catch (boost::bad_lexical_cast const&) {
@@ -236,6 +315,22 @@ struct ConfigFile {
         return settings;
     }
 
+    //! Return true and fill `settings` if ingestion capture is enabled
+    static bool get_capture_settings(PTree conf, CaptureSettings* settings) {
+        if (!conf.count("Capture")) {
+            return false;
+        }
+        settings->path        = conf.get<std::string>("Capture.path");
+        settings->sample_rate = conf.get<double>("Capture.sample_rate", 1.0);
+        settings->max_size    = decode_size(conf.get<std::string>("Capture.max_size", "1GB"));
+        settings->buffer_size = 16*1024*1024;
+        if (settings->sample_rate <= 0.0 || settings->sample_rate > 1.0) {
+            std::runtime_error err("invalid capture sample rate (should be in (0, 1] range)");
+            BOOST_THROW_EXCEPTION(err);
+        }
+        return true;
+    }
+
     static std::vector<ServerSettings> get_server_settings(PTree conf) {
         std::map<std::string, std::function<ServerSettings(PTree)>> mapping = {
             { "TCP", &get_tcp_server },
@@ -369,6 +464,8 @@ static void static_logger(aku_LogLevel tag, const char * msg) {
 /** Create database if database not exists.
   */
 void create_db_files(const char* path,
+                     const char* volumes_path,
+                     const char* superblocks_path,
                      i32 nvolumes,
                      u64 volume_size,
                      bool allocate)
@@ -376,7 +473,12 @@ void create_db_files(const char* path,
     auto full_path = boost::filesystem::path(path) / "db.akumuli";
     if (!boost::filesystem::exists(full_path)) {
         apr_status_t status = APR_SUCCESS;
-        status = aku_create_database_ex("db", path, path, nvolumes, volume_size, allocate);
+        if (*superblocks_path) {
+            status = aku_create_database_split("db", path, volumes_path, superblocks_path,
+                                               nvolumes, volume_size, allocate);
+        } else {
+            status = aku_create_database_ex("db", path, volumes_path, nvolumes, volume_size, allocate);
+        }
         if (status != APR_SUCCESS) {
             char buffer[1024];
             apr_strerror(status, buffer, 1024);
@@ -406,15 +508,23 @@ void cmd_run_server() {
     auto path                   = ConfigFile::get_path(config);
     auto ingestion_servers      = ConfigFile::get_server_settings(config);
     auto full_path              = boost::filesystem::path(path) / "db.akumuli";
+    CaptureSettings capture;
+    bool capture_enabled        = ConfigFile::get_capture_settings(config, &capture);
 
     if (!boost::filesystem::exists(full_path)) {
         std::stringstream fmt;
         fmt << "**ERROR** database file doesn't exists at " << path;
         std::cout << cli_format(fmt.str()) << std::endl;
     } else {
-        auto connection             = std::make_shared<AkumuliConnection>(full_path.c_str());
+        auto params                 = ConfigFile::get_fine_tune_params(config);
+        auto connection             = std::make_shared<AkumuliConnection>(full_path.c_str(), params);
         auto qproc                  = std::make_shared<QueryProcessor>(connection, 1000);
 
+        if (capture_enabled) {
+            IngestionCapture::start(capture);
+            std::cout << cli_format("**OK** ") << "ingestion capture started, path: " << capture.path << std::endl;
+        }
+
         SignalHandler sighandler;
         int srvid = 0;
         std::map<int, std::string> srvnames;
@@ -443,6 +553,9 @@ void cmd_run_server() {
         for(int id: srvids) {
             std::cout << cli_format("**OK** ") << srvnames[id] << " server stopped" << std::endl;
         }
+        if (capture_enabled) {
+            IngestionCapture::stop();
+        }
     }
 }
 
@@ -453,6 +566,8 @@ void cmd_create_database(bool test_db=false, bool allocate=false) {
 
     auto config      = ConfigFile::read_config_file(config_path);
     auto path        = ConfigFile::get_path(config);
+    auto volpath     = ConfigFile::get_volumes_path(config);
+    auto sbpath      = ConfigFile::get_superblocks_path(config);
     auto volumes     = ConfigFile::get_nvolumes(config);
     auto volsize     = ConfigFile::get_volume_size(config);
 
@@ -460,7 +575,7 @@ void cmd_create_database(bool test_db=false, bool allocate=false) {
         volsize = AKU_TEST_DB_SIZE;
     }
 
-    create_db_files(path.c_str(), volumes, volsize, allocate);
+    create_db_files(path.c_str(), volpath.c_str(), sbpath.c_str(), volumes, volsize, allocate);
 }
 
 void cmd_delete_database() {
@@ -35,6 +35,11 @@ ReadBuffer::ReadBuffer(const size_t buffer_size)
     , cons_(0)
     , buffers_allocated_(0)
 {
+    aku_memory_track(AKU_MEM_CONNECTION_BUFFERS, static_cast<i64>(buffer_.capacity()), 1);
+}
+
+ReadBuffer::~ReadBuffer() {
+    aku_memory_track(AKU_MEM_CONNECTION_BUFFERS, -static_cast<i64>(buffer_.capacity()), -1);
 }
 
 Byte ReadBuffer::get() {
@@ -135,7 +140,10 @@ ReadBuffer::BufferT ReadBuffer::pull() {
             cons_ = 0;
         } else {
             // Double the size of the buffer
+            auto prev_capacity = buffer_.capacity();
             buffer_.resize(buffer_.size() * 2);
+            aku_memory_track(AKU_MEM_CONNECTION_BUFFERS,
+                             static_cast<i64>(buffer_.capacity()) - static_cast<i64>(prev_capacity), 0);
         }
     }
     Byte* ptr = buffer_.data() + wpos_;
@@ -381,6 +389,7 @@ void RESPProtocolParser::worker() {
     RESPStream stream(&rdbuf_);
     while(true) {
         bool success;
+        u64 probe = aku_probe_enter(AKU_PROBE_PROTOCOL_PARSE);
         // read id
         rowwidth = parse_ids(stream, paramids, AKU_LIMITS_MAX_ROW_WIDTH);
         if (rowwidth < 0) {
@@ -400,6 +409,7 @@ void RESPProtocolParser::worker() {
         }
 
         rdbuf_.consume();
+        aku_probe_leave(AKU_PROBE_PROTOCOL_PARSE, probe);
 
         sample.payload.type = AKU_PAYLOAD_FLOAT;
         sample.payload.size = sizeof(aku_Sample);
@@ -596,6 +606,7 @@ OpenTSDBResponse OpenTSDBProtocolParser::worker() {
         switch(msgtype) {
         case OpenTSDBMessageType::PUT:
         {
+            u64 probe = aku_probe_enter(AKU_PROBE_PROTOCOL_PARSE);
             // Convert 'put cpu.real 20141210T074343 3.12 host=machine1 region=NW'
             // to 'cpu.real 20141210T074343 3.12 host=machine1 region=NW'
 
@@ -728,6 +739,7 @@ OpenTSDBResponse OpenTSDBProtocolParser::worker() {
 
             sample.payload.float64 = value;
             sample.payload.type = AKU_PAYLOAD_FLOAT;
+            aku_probe_leave(AKU_PROBE_PROTOCOL_PARSE, probe);
 
             // Put value
             status = consumer_->write(sample);
@@ -96,6 +96,8 @@ class ReadBuffer : public ByteStreamReader, public ChunkedWriter {
 public:
     ReadBuffer(const size_t buffer_size);
 
+    ~ReadBuffer();
+
     // ByteStreamReader interface
 public:
     virtual Byte get() override;
@@ -26,6 +26,19 @@ static boost::property_tree::ptree from_json(std::string json) {
     return ptree;
 }
 
+/** Copy text payload (e.g. query profile) to the output buffer as is.
+  * Large documents are split between several samples so separators are not added.
+  */
+static char* format_text(char* begin, char* end, const aku_Sample& sample) {
+    size_t sample_size = std::max(sizeof(aku_Sample), (size_t)sample.payload.size);
+    size_t text_sz = sample_size - sizeof(aku_Sample);
+    if (static_cast<size_t>(end - begin) < text_sz) {
+        return nullptr;
+    }
+    std::copy(sample.payload.data, sample.payload.data + text_sz, begin);
+    return begin + text_sz;
+}
+
 struct CSVOutputFormatter : OutputFormatter {
 
     std::shared_ptr<DbSession> session_;
@@ -43,6 +56,9 @@ struct CSVOutputFormatter : OutputFormatter {
         if(begin >= end) {
             return nullptr;  // not enough space inside the buffer
         }
+        if (sample.payload.type & aku_PData::TEXT) {
+            return format_text(begin, end, sample);
+        }
         int size = end - begin;
 
         bool newline_required = false;
@@ -221,6 +237,9 @@ struct RESPOutputFormatter : OutputFormatter {
         if(begin >= end) {
             return nullptr;  // not enough space inside the buffer
         }
+        if (sample.payload.type & aku_PData::TEXT) {
+            return format_text(begin, end, sample);
+        }
         int size = end - begin;
 
         begin[0] = '+';
@@ -375,6 +394,11 @@ QueryResultsPooler::QueryResultsPooler(std::shared_ptr<DbSession> session, int r
         // readbufsize is too large (bad config probably), use default value
         rdbuf_.resize(DEFAULT_RDBUF_SIZE_);
     }
+    aku_memory_track(AKU_MEM_CONNECTION_BUFFERS, static_cast<i64>(rdbuf_.capacity()), 1);
+}
+
+QueryResultsPooler::~QueryResultsPooler() {
+    aku_memory_track(AKU_MEM_CONNECTION_BUFFERS, -static_cast<i64>(rdbuf_.capacity()), -1);
 }
 
 void QueryResultsPooler::throw_if_started() const {
@@ -452,6 +476,9 @@ void QueryResultsPooler::_init_cursor() {
     case ApiEndpoint::SEARCH:
         cursor_ = session_->search(query_text_);
         break;
+    case ApiEndpoint::PREPARE:
+        cursor_ = session_->prepare(query_text_);
+        break;
     default:
         BOOST_THROW_EXCEPTION(std::runtime_error("Init-cursor failure, invalid endpoint"));
     };
@@ -499,6 +526,7 @@ std::tuple<size_t, bool> QueryResultsPooler::read_some(char *buf, size_t buf_siz
     }
 
     // format output
+    u64 probe = aku_probe_enter(AKU_PROBE_OUTPUT_FORMATTING);
     char* begin = buf;
     char* end = begin + buf_size;
     while(rdbuf_pos_ < rdbuf_top_) {
@@ -512,6 +540,7 @@ std::tuple<size_t, bool> QueryResultsPooler::read_some(char *buf, size_t buf_siz
         assert(sample->payload.size);
         rdbuf_pos_ += sample->payload.size;
     }
+    aku_probe_leave(AKU_PROBE_OUTPUT_FORMATTING, probe);
     return std::make_tuple(begin - buf, false);
 }
 
@@ -550,13 +579,22 @@ std::string QueryProcessor::get_all_stats() {
 }
 
 std::string QueryProcessor::get_resource(std::string name) {
-    size_t outbufsize = 0x1000;
-    char outbuf[outbufsize];
-    aku_Status status = aku_get_resource(name.c_str(), outbuf, &outbufsize);
+    std::vector<char> outbuf(0x1000);
+    size_t outbufsize = outbuf.size();
+    aku_Status status = aku_get_resource(name.c_str(), outbuf.data(), &outbufsize);
+    while (status == AKU_EOVERFLOW) {
+        outbuf.resize(outbuf.size()*2);
+        outbufsize = outbuf.size();
+        status = aku_get_resource(name.c_str(), outbuf.data(), &outbufsize);
+    }
     if (status != AKU_SUCCESS) {
         return "-Invalid resource name";
     }
-    return std::string(outbuf, outbuf + outbufsize);
+    return std::string(outbuf.data(), outbuf.data() + outbufsize);
+}
+
+aku_Status QueryProcessor::cancel_query(u64 query_id) {
+    return aku_cancel_query(query_id);
 }
 
 }  // namespace
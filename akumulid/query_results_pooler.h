@@ -29,6 +29,8 @@ struct QueryResultsPooler : ReadOperation {
 
     QueryResultsPooler(std::shared_ptr<DbSession> session, int readbufsize, ApiEndpoint endpoint);
 
+    ~QueryResultsPooler();
+
     void _init_cursor();
 
     void throw_if_started() const;
@@ -57,6 +59,7 @@ struct QueryProcessor : ReadOperationBuilder {
 
     virtual std::string get_all_stats();
     virtual std::string get_resource(std::string name);
+    virtual aku_Status cancel_query(u64 query_id);
 };
 
 }  // namespace
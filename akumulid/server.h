@@ -63,6 +63,7 @@ enum class ApiEndpoint {
     QUERY,
     SUGGEST,
     SEARCH,
+    PREPARE,
     UNKNOWN,
 };
 
@@ -72,6 +73,7 @@ struct ReadOperationBuilder {
     virtual ReadOperation* create(ApiEndpoint ep)          = 0;
     virtual std::string    get_all_stats()                 = 0;
     virtual std::string    get_resource(std::string name)  = 0;
+    virtual aku_Status     cancel_query(u64 query_id)      = 0;
 };
 
 //! Server interface
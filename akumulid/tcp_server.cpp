@@ -35,11 +35,13 @@ class TelnetSession : public ProtocolSession, public std::enable_shared_from_thi
     std::shared_ptr<DbSession>      spout_;
     ProtocolT                       parser_;
     Logger                          logger_;
+    const CaptureProtocol           protocol_;
+    std::unique_ptr<CaptureStream>  capture_;  //< Not null if session is captured
 
 public:
     typedef Byte* BufferT;
 
-    TelnetSession(IOServiceT *io, std::shared_ptr<DbSession> spout, bool parallel)
+    TelnetSession(IOServiceT *io, std::shared_ptr<DbSession> spout, bool parallel, CaptureProtocol protocol)
         : parallel_(parallel)
         , io_(io)
         , socket_(*io)
@@ -47,6 +49,7 @@ public:
         , spout_(spout)
         , parser_(spout)
     , logger_(make_unique_session_name())
+    , protocol_(protocol)
     {
         logger_.info() << "Session created";
         parser_.start();
@@ -61,28 +64,9 @@ public:
     }
 
     virtual void start() {
-        BufferT buf;
-        size_t buf_size;
-        std::tie(buf, buf_size) = get_next_buffer();
-        if (parallel_) {
-            socket_.async_read_some(
-                    boost::asio::buffer(buf, buf_size),
-                    strand_.wrap(
-                        boost::bind(&TelnetSession<ProtocolT>::handle_read,
-                                    this->shared_from_this(),
-                                    buf,
-                                    boost::asio::placeholders::error,
-                                    boost::asio::placeholders::bytes_transferred)));
-        } else {
-            // Strand is not used here
-            socket_.async_read_some(
-                    boost::asio::buffer(buf, buf_size),
-                    boost::bind(&TelnetSession<ProtocolT>::handle_read,
-                                this->shared_from_this(),
-                                buf,
-                                boost::asio::placeholders::error,
-                                boost::asio::placeholders::bytes_transferred));
-        }
+        // Connection is established, capture stream shouldn't be opened earlier
+        capture_ = IngestionCapture::open_stream(protocol_);
+        read_next();
     }
 
     virtual ErrorCallback get_error_cb() {
@@ -108,6 +92,31 @@ public:
     }
 
 private:
+    void read_next() {
+        BufferT buf;
+        size_t buf_size;
+        std::tie(buf, buf_size) = get_next_buffer();
+        if (parallel_) {
+            socket_.async_read_some(
+                    boost::asio::buffer(buf, buf_size),
+                    strand_.wrap(
+                        boost::bind(&TelnetSession<ProtocolT>::handle_read,
+                                    this->shared_from_this(),
+                                    buf,
+                                    boost::asio::placeholders::error,
+                                    boost::asio::placeholders::bytes_transferred)));
+        } else {
+            // Strand is not used here
+            socket_.async_read_some(
+                    boost::asio::buffer(buf, buf_size),
+                    boost::bind(&TelnetSession<ProtocolT>::handle_read,
+                                this->shared_from_this(),
+                                buf,
+                                boost::asio::placeholders::error,
+                                boost::asio::placeholders::bytes_transferred));
+        }
+    }
+
     /** Allocate new buffer.
       */
     std::tuple<BufferT, size_t> get_next_buffer() {
@@ -123,6 +132,9 @@ private:
             logger_.error() << error.message();
             parser_.close();
         } else {
+            if (capture_) {
+                capture_->write(reinterpret_cast<const char*>(buffer), nbytes);
+            }
             try {
                 auto response = parser_.parse_next(buffer, static_cast<u32>(nbytes));
                 if(response.is_available()) {
@@ -135,7 +147,7 @@ private:
                                                          boost::asio::placeholders::error)
                                              );
                 }
-                start();
+                read_next();
             } catch (StreamError const& stream_error) {
                 // This error is related to client so we need to send it back
                 logger_.error() << stream_error.what();
@@ -215,7 +227,7 @@ struct RESPSessionBuilder : ProtocolSessionBuilder {
 
     virtual std::shared_ptr<ProtocolSession> create(IOServiceT *io, std::shared_ptr<DbSession> session) {
         std::shared_ptr<ProtocolSession> result;
-        result.reset(new RESPSession(io, session, parallel_));
+        result.reset(new RESPSession(io, session, parallel_, CaptureProtocol::RESP));
         return result;
     }
 
@@ -235,7 +247,7 @@ struct OpenTSDBSessionBuilder : ProtocolSessionBuilder {
 
     virtual std::shared_ptr<ProtocolSession> create(IOServiceT *io, std::shared_ptr<DbSession> session) {
         std::shared_ptr<ProtocolSession> result;
-        result.reset(new OpenTSDBSession(io, session, parallel_));
+        result.reset(new OpenTSDBSession(io, session, parallel_, CaptureProtocol::OPENTSDB));
         return result;
     }
 
@@ -495,6 +507,7 @@ void TcpServer::start(SignalHandler* sig, int id) {
             Logger logger("tcp-server-worker");
             try {
                 logger.info() << "Event loop " << cnt << " started";
+                aku_bind_thread_arena(AKU_THREAD_INGESTION);
                 io.run();
                 logger.info() << "Event loop " << cnt << " stopped";
                 self->barrier.wait();
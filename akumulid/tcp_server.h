@@ -22,6 +22,7 @@
 #include <boost/bind.hpp>
 #include <boost/thread/barrier.hpp>
 
+#include "capture.h"
 #include "logger.h"
 #include "protocolparser.h"
 #include "server.h"
@@ -54,7 +55,7 @@ struct ProtocolSession {
     virtual SocketT& socket() = 0;
 
     /**
-     * Initiates data ingestion
+     * Initiates data ingestion (called once, after the connection is accepted)
      */
     virtual void start() = 0;
 
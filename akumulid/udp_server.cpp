@@ -83,6 +83,7 @@ void UdpServer::worker(std::shared_ptr<DbSession> spout) {
         auto thread = pthread_self();
         pthread_setname_np(thread, "UDP-worker");
 #endif
+    aku_bind_thread_arena(AKU_THREAD_INGESTION);
     start_barrier_.wait();
 
     int retval;
@@ -127,6 +128,8 @@ void UdpServer::worker(std::shared_ptr<DbSession> spout) {
         }
 
         auto iobuf = std::make_shared<IOBuf>();
+        std::unique_ptr<CaptureStream> capture;
+        u64 capture_gen = 0;  // generation 0 means that capture was never started
 
         while(true) {
             retval = recvmmsg(sockfd_, iobuf->msgs, NPACKETS, MSG_WAITFORONE, nullptr);
@@ -146,6 +149,13 @@ void UdpServer::worker(std::shared_ptr<DbSession> spout) {
 
             iobuf->pps++;
 
+            auto gen = IngestionCapture::generation();
+            if (gen != capture_gen) {
+                // Capture was started or stopped, old stream (if any) is closed here
+                capture = IngestionCapture::open_stream(CaptureProtocol::UDP);
+                capture_gen = gen;
+            }
+
             for (int i = 0; i < retval; i++) {
                 // reset buffer to receive new message
                 iobuf->bps += iobuf->msgs[i].msg_len;
@@ -153,15 +163,11 @@ void UdpServer::worker(std::shared_ptr<DbSession> spout) {
                 iobuf->msgs[i].msg_len = 0;
 
                 // parse message content
-                PDU pdu = {
-                    std::shared_ptr<Byte>(iobuf, iobuf->bufs[i]),
-                    mlen,
-                    0u,
-                    0u,
-                };
-
                 auto buf = parser.get_next_buffer();
                 memcpy(buf, iobuf->bufs[i], mlen);
+                if (capture) {
+                    capture->write(iobuf->bufs[i], mlen);
+                }
                 try {
                     parser.parse_next(buf, mlen);
                 } catch (StreamError const& err) {
@@ -169,9 +175,6 @@ void UdpServer::worker(std::shared_ptr<DbSession> spout) {
                     logger_.error() << err.what();
                 }
             }
-            if (retval != 0) {
-                iobuf = std::make_shared<IOBuf>();
-            }
         }
     } catch(...) {
         logger_.error() << boost::current_exception_diagnostic_information();
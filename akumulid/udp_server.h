@@ -21,6 +21,7 @@
 
 #include <boost/thread/barrier.hpp>
 
+#include "capture.h"
 #include "ingestion_pipeline.h"
 #include "logger.h"
 #include "protocolparser.h"
@@ -64,6 +65,11 @@ class UdpServer : public std::enable_shared_from_this<UdpServer>, public Server
                 msgs[i].msg_hdr.msg_iov    = &iovecs[i];
                 msgs[i].msg_hdr.msg_iovlen = 1;
             }
+            aku_memory_track(AKU_MEM_CONNECTION_BUFFERS, sizeof(IOBuf), 1);
+        }
+
+        ~IOBuf() {
+            aku_memory_track(AKU_MEM_CONNECTION_BUFFERS, -static_cast<i64>(sizeof(IOBuf)), -1);
         }
 
     } __attribute__((aligned(64)));  // Otherwise struct will be aligned by sizeof(bufs) and this is crazy expensive
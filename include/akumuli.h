@@ -91,6 +91,46 @@ typedef struct {
 } aku_StorageStats;
 
 
+//! Instrumentation probes (see `aku_probe_enter`)
+typedef enum {
+    AKU_PROBE_PROTOCOL_PARSE = 0,   //< Parsing of the incoming messages
+    AKU_PROBE_SERIES_LOOKUP,        //< Series name to id conversion
+    AKU_PROBE_NBTREE_APPEND,        //< NBTreeExtentsList::append
+    AKU_PROBE_LEAF_COMMIT,          //< Leaf node commit
+    AKU_PROBE_APPEND_BLOCK,         //< Block store append_block
+    AKU_PROBE_FLUSH,                //< Block store flush
+    AKU_PROBE_QUERY_PLANNING,       //< Query parsing and planning
+    AKU_PROBE_OPERATOR_READ,        //< Read from the query operator
+    AKU_PROBE_OUTPUT_FORMATTING,    //< Query results formatting
+    AKU_PROBE_MAX,
+} aku_ProbeId;
+
+//! Thread classes, used to bind threads to malloc arenas
+typedef enum {
+    AKU_THREAD_INGESTION,           //< Network workers
+    AKU_THREAD_QUERY,               //< Query execution
+    AKU_THREAD_BACKGROUND,          //< Flush and metadata sync
+} aku_ThreadClass;
+
+//! Memory accounting categories (see `aku_memory_track`)
+typedef enum {
+    AKU_MEM_INDEX_POOL = 0,         //< Series names storage of the index
+    AKU_MEM_INDEX_TABLES,           //< Series name to id table of the index
+    AKU_MEM_INDEX_POSTINGS,         //< Postings lists (metric names and tag-value pairs)
+    AKU_MEM_INDEX_TOPOLOGY,         //< Metric/tag/value tree used by suggest queries
+    AKU_MEM_MATCHER_TABLES,         //< Name/id tables of the series matchers
+    AKU_MEM_MATCHER_POOL,           //< Series names storage of the plain series matchers
+    AKU_MEM_NBTREE_LEAVES,          //< Open leaf nodes of the trees
+    AKU_MEM_NBTREE_SUPERBLOCKS,     //< Open inner nodes of the trees
+    AKU_MEM_CSTORE_COLUMNS,         //< Column store map (one entry per series)
+    AKU_MEM_CSTORE_SESSIONS,        //< Per-session tree caches
+    AKU_MEM_CURSOR_BUFFERS,         //< Query results queued in cursors
+    AKU_MEM_CONNECTION_BUFFERS,     //< Network connection buffers
+    AKU_MEM_BLOCK_CACHE,            //< Cached blocks
+    AKU_MEM_MAX,
+} aku_MemoryCategory;
+
+
 //-------------------
 // Utility functions
 //-------------------
@@ -123,7 +163,9 @@ AKU_EXPORT void aku_console_logger(aku_LogLevel tag, const char* message);
  * @brief Creates storage for new database on the hard drive
  * @param base_file_name database file name (excl suffix)
  * @param metadata_path path to metadata file
- * @param volumes_path path to volumes
+ * @param volumes_path path to volumes, several directories separated by ':' can be
+ *        used to stripe volumes across devices (num_volumes is rounded up to a multiple
+ *        of the number of directories)
  * @param num_volumes number of volumes to create
  */
 AKU_EXPORT aku_Status aku_create_database(const char* base_file_name, const char* metadata_path,
@@ -133,13 +175,28 @@ AKU_EXPORT aku_Status aku_create_database(const char* base_file_name, const char
  * @brief Creates storage for new test database on the hard drive (smaller size then normal DB)
  * @param base_file_name database file name (excl suffix)
  * @param metadata_path path to metadata file
- * @param volumes_path path to volumes
+ * @param volumes_path path to volumes, several directories separated by ':' can be
+ *        used to stripe volumes across devices (num_volumes is rounded up to a multiple
+ *        of the number of directories)
  * @param num_volumes number of volumes to create
  */
 AKU_EXPORT aku_Status aku_create_database_ex(const char* base_file_name, const char* metadata_path,
                                              const char* volumes_path, i32 num_volumes,
                                              u64 page_size, bool allocate);
 
+/**
+ * @brief Creates storage for new database that keeps NB+tree superblocks in a separate volume set
+ * @param base_file_name database file name (excl suffix)
+ * @param metadata_path path to metadata file
+ * @param volumes_path path to volumes (leaf nodes)
+ * @param superblocks_path path to superblock volumes (can be located on a faster device)
+ * @param num_volumes number of volumes to create (0 - expandable storage)
+ * @param page_size size of the individual volume in bytes
+ */
+AKU_EXPORT aku_Status aku_create_database_split(const char* base_file_name, const char* metadata_path,
+                                                const char* volumes_path, const char* superblocks_path,
+                                                i32 num_volumes, u64 page_size, bool allocate);
+
 
 /** Remove all volumes.
   * @param file_name
@@ -237,6 +294,30 @@ AKU_EXPORT aku_Status aku_write(aku_Session* ist, const aku_Sample* sample);
 //---------
 
 /** @brief Query database
+  * Query object with `queries` field executes a batch of queries, series
+  * that are read by several queries of the batch are scanned only once.
+  * Results of every query are prefixed with `:<index>` line (text sample),
+  * failed query produces `-<error message>` line instead of results.
+  * Group-aggregate query with `"progressive": true` option returns several
+  * passes of results, every pass is prefixed with `~<level>` line. Pass with
+  * nonzero level is approximate (computed from the summaries of the subtrees
+  * at that level), the last pass has level 0 and is exact. Refinement can be
+  * limited using `"progressive": {"max-latency": "100ms"}` option.
+  * Select query with `limit` and `"page-token": ""` field returns the first
+  * page of results. If there are more results, page ends with `@<token>`
+  * line. Next page is returned by the same query with `"page-token": "<token>"`.
+  * Pages are resumed from the position of the last sample, not by offset, so
+  * the cost of the page doesn't depend on its position in the output.
+  * Group-aggregate query supports `rate` and `increase` functions for
+  * monotonic counters. They are computed from first/last/min/max values of
+  * the bucket and the last value of the previous bucket, counter resets are
+  * detected by comparing these values.
+  * Aggregate and group-aggregate queries support `variance` and `stddev`
+  * functions (population variance). Trees written by the older versions
+  * don't store the data needed to compute them from the summaries, so
+  * these functions read the data in that case.
+  * Query with `"timeout": "10s"` field fails with AKU_ETIMEOUT error if it
+  * runs longer than specified.
   * @param session should point to opened session instance
   * @param query should contain valid query
   * @return cursor instance
@@ -257,12 +338,30 @@ AKU_EXPORT aku_Cursor* aku_suggest(aku_Session* session, const char* query);
   */
 AKU_EXPORT aku_Cursor* aku_search(aku_Session* session, const char* query);
 
+/** @brief Register prepared query
+  * Cursor returns `{"prepared": id}` JSON document. Prepared query can be executed
+  * using `aku_query` with `{"prepared": id, "range": {"from": ..., "to": ...}}` query.
+  * @param sesson should point to opened session instance
+  * @param query should contain valid query (query template)
+  * @return cursor instance
+  */
+AKU_EXPORT aku_Cursor* aku_prepare(aku_Session* session, const char* query);
+
 /**
  * @brief Close cursor
+ * Query that is still running is cancelled.
  * @param pcursor pointer to cursor
  */
 AKU_EXPORT void aku_cursor_close(aku_Cursor* pcursor);
 
+/** @brief Cancel running query
+  * Ids of the running queries are listed by the "queries" resource (see `aku_get_resource`).
+  * Cancelled query is completed with AKU_ECANCELED error.
+  * @param query_id is a query id
+  * @return AKU_SUCCESS or AKU_ENOT_FOUND if query is not running
+  */
+AKU_EXPORT aku_Status aku_cancel_query(u64 query_id);
+
 /** Read the values under cursor.
   * @param cursor should point to active cursor instance
   * @param dest is an output buffer
@@ -314,7 +413,36 @@ AKU_EXPORT void aku_debug_print(aku_Database* db);
 
 AKU_EXPORT int aku_json_stats(aku_Database* db, char* buffer, size_t size);
 
-/** Get global resource value by name
+/** Register instrumentation event.
+  * @param probe is a probe id
+  * @return token that should be passed to `aku_probe_leave`
+  */
+AKU_EXPORT u64 aku_probe_enter(aku_ProbeId probe);
+
+/** Finish instrumentation event started by `aku_probe_enter`.
+  */
+AKU_EXPORT void aku_probe_leave(aku_ProbeId probe, u64 token);
+
+/** Enable or disable instrumentation (enabled by default).
+  */
+AKU_EXPORT void aku_probe_enable(int enable);
+
+/** Update memory usage of the category.
+  * Used by the application to account for memory that it allocates (e.g. connection buffers).
+  * @param category is a memory category
+  * @param bytes is a number of bytes allocated (or released if negative)
+  * @param objects is a number of objects allocated (or released if negative)
+  */
+AKU_EXPORT void aku_memory_track(aku_MemoryCategory category, i64 bytes, i64 objects);
+
+/** Bind current thread to the malloc arena of the thread class.
+  * Does nothing if jemalloc is not used.
+  */
+AKU_EXPORT void aku_bind_thread_arena(aku_ThreadClass cls);
+
+/** Get global resource value by name.
+  * Supported resources: "function-names", "probes" (instrumentation stats in JSON),
+  * "memory" (memory usage breakdown in JSON), "queries" (running queries in JSON)
   */
 AKU_EXPORT aku_Status aku_get_resource(const char* res_name, char* buf, size_t* bufsize);
 
@@ -66,7 +66,13 @@ typedef struct {
     //! Windth of the sliding window
     u64 window_size;
 
-    //! Cache size limit
+    //! Cache size limit (size of the block cache in bytes if `direct_io` is set, 0 - default)
     u64 max_cache_size;
 
+    //! 0 - volumes are accessed through the page cache, other value - O_DIRECT with in-process block cache
+    u32 direct_io;
+
+    //! 0 - superblock volumes are paged in on demand, other value - superblock volumes are locked in memory
+    u32 mlock_superblocks;
+
 } aku_FineTuneParams;
@@ -67,6 +67,7 @@ typedef struct {
         FLOAT_BIT      = 1 << 4,  /** scalar type */
         TUPLE_BIT      = 1 << 5,  /** tuple type */
         SAX_WORD       = 1 << 10, /** indicates that SAX word is stored in extra payload */
+        TEXT           = 1 << 11, /** indicates that the extra payload contains raw text (e.g. query profile) */
     };
     u16 type;
 
@@ -174,8 +175,10 @@ typedef enum {
     AKU_EREGULLAR_EXPECTED = 21,
     //! Function can't handle missing values
     AKU_EMISSING_DATA_NOT_SUPPORTED = 22,
+    //! Query was cancelled
+    AKU_ECANCELED = 23,
     //! All error codes should be less then AKU_EMAX_ERROR
-    AKU_EMAX_ERROR = 23,
+    AKU_EMAX_ERROR = 24,
     // NOTE: Update status_util.cpp and AKU_EMAX_ERROR to add new error code!
 } aku_Status;
 
@@ -31,6 +31,8 @@
 #include "log_iface.h"
 #include "status_util.h"
 #include "cursor.h"
+#include "instrumentation.h"
+#include "pool.h"
 
 #include <boost/property_tree/ptree.hpp>
 #include <boost/property_tree/json_parser.hpp>
@@ -97,7 +99,11 @@ struct CursorImpl : aku_Cursor {
         : query_(query)
     {
         status_ = AKU_SUCCESS;
-        cursor_ = ConcurrentCursor::make(&StorageSession::query, storage, query_.data());
+        // Query is registered before the start so it can be cancelled at any moment
+        std::unique_ptr<ConcurrentCursor> cursor(new ConcurrentCursor());
+        cursor->register_query(query_);
+        cursor->start(std::bind(&StorageSession::query, storage, cursor.get(), query_.data()));
+        cursor_ = std::move(cursor);
     }
 
     ~CursorImpl() {
@@ -201,6 +207,43 @@ struct SearchCursorImpl : aku_Cursor {
     }
 };
 
+/**
+ * Cursor that returns id of the prepared query.
+ */
+struct PrepareCursorImpl : aku_Cursor {
+    std::unique_ptr<ExternalCursor> cursor_;
+    aku_Status status_;
+    std::string query_;
+
+    PrepareCursorImpl(std::shared_ptr<StorageSession> storage, const char* query)
+        : query_(query)
+    {
+        status_ = AKU_SUCCESS;
+        cursor_ = ConcurrentCursor::make(&StorageSession::prepare, storage, query_.data());
+    }
+
+    ~PrepareCursorImpl() {
+        cursor_->close();
+    }
+
+    bool is_done() const {
+        return cursor_->is_done();
+    }
+
+    bool is_error(aku_Status* out_error_code_or_null) const {
+        if (status_ != AKU_SUCCESS) {
+            *out_error_code_or_null = status_;
+            return false;
+        }
+        return cursor_->is_error(out_error_code_or_null);
+    }
+
+    u32 read_values( void  *values
+                   , u32    values_size )
+    {
+        return cursor_->read(values, values_size);
+    }
+};
 
 
 class Session : public aku_Session {
@@ -242,6 +285,11 @@ public:
         auto res = new SearchCursorImpl(session_, q);
         return res;
     }
+
+    PrepareCursorImpl* prepare(const char* q) {
+        auto res = new PrepareCursorImpl(session_, q);
+        return res;
+    }
 };
 
 /** 
@@ -253,12 +301,12 @@ class DatabaseImpl : public aku_Database
     std::shared_ptr<Storage> storage_;
 public:
     // private fields
-    DatabaseImpl(const char* path)
+    DatabaseImpl(const char* path, aku_FineTuneParams const& params)
     {
         if (path == std::string(":memory:")) {
             storage_ = std::make_shared<Storage>();
         } else {
-            storage_ = std::make_shared<Storage>(path);
+            storage_ = std::make_shared<Storage>(path, params);
         }
     }
 
@@ -266,8 +314,8 @@ public:
         storage_->close();
     }
 
-    static aku_Database* create(const char* path) {
-        DatabaseImpl* ptr = new DatabaseImpl(path);
+    static aku_Database* create(const char* path, aku_FineTuneParams const& params) {
+        DatabaseImpl* ptr = new DatabaseImpl(path, params);
         return static_cast<aku_Database*>(ptr);
     }
 
@@ -307,6 +355,18 @@ aku_Status aku_create_database_ex( const char     *base_file_name
     return Storage::new_database(base_file_name, metadata_path, volumes_path, num_volumes, page_size, allocate);
 }
 
+aku_Status aku_create_database_split( const char     *base_file_name
+                                    , const char     *metadata_path
+                                    , const char     *volumes_path
+                                    , const char     *superblocks_path
+                                    , i32             num_volumes
+                                    , u64             page_size
+                                    , bool            allocate)
+{
+    return Storage::new_database(base_file_name, metadata_path, volumes_path, num_volumes, page_size, allocate,
+                                 superblocks_path);
+}
+
 aku_Status aku_create_database( const char     *base_file_name
                               , const char     *metadata_path
                               , const char     *volumes_path
@@ -349,21 +409,16 @@ aku_Status aku_write(aku_Session* session, const aku_Sample* sample) {
 
 
 aku_Status aku_parse_duration(const char* str, int* value) {
-    try {
-        *value = DateTimeUtil::parse_duration(str, strlen(str));
-    } catch (...) {
-        return AKU_EBAD_ARG;
+    aku_Duration duration = 0;
+    aku_Status status = DateTimeUtil::parse_duration(str, strlen(str), &duration);
+    if (status == AKU_SUCCESS) {
+        *value = static_cast<int>(duration);
     }
-    return AKU_SUCCESS;
+    return status;
 }
 
 aku_Status aku_parse_timestamp(const char* iso_str, aku_Sample* sample) {
-    try {
-        sample->timestamp = DateTimeUtil::from_iso_string(iso_str);
-    } catch (...) {
-        return AKU_EBAD_ARG;
-    }
-    return AKU_SUCCESS;
+    return DateTimeUtil::parse_iso_string(iso_str, strlen(iso_str), &sample->timestamp);
 }
 
 aku_Status aku_series_to_param_id(aku_Session* session, const char* begin, const char* end, aku_Sample* sample) {
@@ -377,8 +432,7 @@ int aku_name_to_param_id_list(aku_Session* ist, const char* begin, const char* e
 }
 
 aku_Database* aku_open_database(const char* path, aku_FineTuneParams parameters) {
-    AKU_UNUSED(parameters);
-    return DatabaseImpl::create(path);
+    return DatabaseImpl::create(path, parameters);
 }
 
 void aku_close_database(aku_Database* db) {
@@ -403,6 +457,16 @@ aku_Cursor* aku_search(aku_Session* session, const char* query) {
     return static_cast<aku_Cursor*>(cursor);
 }
 
+aku_Cursor* aku_prepare(aku_Session* session, const char* query) {
+    auto impl = reinterpret_cast<Session*>(session);
+    auto cursor = impl->prepare(query);
+    return static_cast<aku_Cursor*>(cursor);
+}
+
+aku_Status aku_cancel_query(u64 query_id) {
+    return RunningQueries::cancel(query_id);
+}
+
 void aku_cursor_close(aku_Cursor* pcursor) {
     auto impl = reinterpret_cast<CursorImpl*>(pcursor);
     delete impl;  // destructor calls `close` method
@@ -455,7 +519,7 @@ int aku_json_stats(aku_Database *db, char* buffer, size_t size) {
         std::stringstream out;
         boost::property_tree::json_parser::write_json(out, ptree, true);
         auto str = out.str();
-        if (str.size() > size) {
+        if (str.size() >= size) {
             return -1*static_cast<int>(str.size());
         }
         strcpy(buffer, str.c_str());
@@ -472,16 +536,62 @@ void aku_debug_print(aku_Database *db) {
     AKU_PANIC("Not implemented");
 }
 
+u64 aku_probe_enter(aku_ProbeId probe) {
+    return Instrumentation::enter(probe);
+}
+
+void aku_probe_leave(aku_ProbeId probe, u64 token) {
+    Instrumentation::leave(probe, token);
+}
+
+void aku_probe_enable(int enable) {
+    Instrumentation::set_enabled(enable != 0);
+}
+
+void aku_memory_track(aku_MemoryCategory category, i64 bytes, i64 objects) {
+    if (category < 0 || category >= AKU_MEM_MAX) {
+        return;
+    }
+    MemoryAccounting::add(category, bytes, objects);
+}
+
+void aku_bind_thread_arena(aku_ThreadClass cls) {
+    switch (cls) {
+    case AKU_THREAD_INGESTION:
+        bind_thread_arena(ThreadClass::INGESTION);
+        break;
+    case AKU_THREAD_QUERY:
+        bind_thread_arena(ThreadClass::QUERY);
+        break;
+    case AKU_THREAD_BACKGROUND:
+        bind_thread_arena(ThreadClass::BACKGROUND);
+        break;
+    };
+}
+
 aku_Status aku_get_resource(const char* res_name, char* buf, size_t* bufsize) {
     std::string res(res_name);
-    if (res != "function-names") {
-        return AKU_EBAD_ARG;
-    }
-    auto names = QP::list_query_registry();
     std::string result;
-    for (auto name: names) {
-        result += name;
-        result += "\n";
+    if (res == "function-names") {
+        auto names = QP::list_query_registry();
+        for (auto name: names) {
+            result += name;
+            result += "\n";
+        }
+    } else if (res == "probes") {
+        std::stringstream out;
+        boost::property_tree::json_parser::write_json(out, Instrumentation::get_stats(), true);
+        result = out.str();
+    } else if (res == "memory") {
+        std::stringstream out;
+        boost::property_tree::json_parser::write_json(out, MemoryAccounting::get_stats(), true);
+        result = out.str();
+    } else if (res == "queries") {
+        std::stringstream out;
+        boost::property_tree::json_parser::write_json(out, RunningQueries::get_stats(), true);
+        result = out.str();
+    } else {
+        return AKU_EBAD_ARG;
     }
     if (result.size() > *bufsize) {
         return AKU_EOVERFLOW;
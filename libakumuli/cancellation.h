@@ -0,0 +1,111 @@
+/**
+ * PRIVATE HEADER
+ *
+ * Query cancellation.
+ *
+ * Copyright (c) 2017 Eugene Lazin <4lazin@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#pragma once
+
+#include "akumuli_def.h"
+
+#include <atomic>
+#include <chrono>
+
+namespace Akumuli {
+
+/** Query cancellation token.
+  * Token is owned by the query cursor and checked by the query thread (query plan
+  * executor and tree traversal). Query can be cancelled by the client (cursor
+  * closed before completion), by the timeout, or by the administrator.
+  */
+class QueryCancellation {
+    std::atomic<int> reason_;    //< AKU_SUCCESS if query wasn't cancelled
+    std::atomic<u64> deadline_;  //< Steady clock time in ns (0 - no deadline)
+
+    static u64 now() {
+        auto ts = std::chrono::steady_clock::now().time_since_epoch();
+        return static_cast<u64>(std::chrono::duration_cast<std::chrono::nanoseconds>(ts).count());
+    }
+
+public:
+    QueryCancellation()
+        : reason_{AKU_SUCCESS}
+        , deadline_{0}
+    {
+    }
+
+    QueryCancellation(QueryCancellation const&) = delete;
+    QueryCancellation& operator = (QueryCancellation const&) = delete;
+
+    //! Cancel query, the first reason wins
+    void cancel(aku_Status reason) {
+        int expected = AKU_SUCCESS;
+        reason_.compare_exchange_strong(expected, reason);
+    }
+
+    //! Cancel query with AKU_ETIMEOUT error if it's not finished in `timeout` nanoseconds
+    void set_timeout(u64 timeout) {
+        deadline_.store(now() + timeout, std::memory_order_relaxed);
+    }
+
+    //! Return AKU_SUCCESS if query can proceed or the cancellation reason otherwise
+    aku_Status check() {
+        auto reason = reason_.load(std::memory_order_relaxed);
+        if (reason == AKU_SUCCESS) {
+            auto deadline = deadline_.load(std::memory_order_relaxed);
+            if (deadline == 0 || now() < deadline) {
+                return AKU_SUCCESS;
+            }
+            cancel(AKU_ETIMEOUT);
+            reason = reason_.load();
+        }
+        return static_cast<aku_Status>(reason);
+    }
+
+    //! Token of the current thread (or nullptr if the thread doesn't run a query)
+    static QueryCancellation*& current() {
+        static thread_local QueryCancellation* token = nullptr;
+        return token;
+    }
+
+    //! Check token of the current thread
+    static aku_Status check_current() {
+        auto token = current();
+        return token ? token->check() : AKU_SUCCESS;
+    }
+};
+
+//! Sets cancellation token of the current thread
+class QueryCancellationScope {
+    QueryCancellation* prev_;
+public:
+    QueryCancellationScope(QueryCancellation* token)
+        : prev_(QueryCancellation::current())
+    {
+        QueryCancellation::current() = token;
+    }
+
+    ~QueryCancellationScope() {
+        QueryCancellation::current() = prev_;
+    }
+
+    QueryCancellationScope(QueryCancellationScope const&) = delete;
+    QueryCancellationScope& operator = (QueryCancellationScope const&) = delete;
+};
+
+}  // namespace
@@ -21,6 +21,7 @@
 #include <iostream>
 #include <string.h>
 #include <algorithm>
+#include <map>
 
 // TODO: remove
 #include "log_iface.h"
@@ -44,8 +45,13 @@ namespace {
 ConcurrentCursor::ConcurrentCursor()
     : done_{false}
     , error_code_{AKU_SUCCESS}
+    , query_id_{0}
 {}
 
+void ConcurrentCursor::register_query(std::string const& text) {
+    query_id_ = RunningQueries::add(&cancellation_, text);
+}
+
 
 /**
  * This function copies samples from one buffer to another with respect of individual
@@ -117,9 +123,18 @@ bool ConcurrentCursor::is_error(aku_Status* out_error_code_or_null) const {
 }
 
 void ConcurrentCursor::close() {
-    std::lock_guard<std::mutex> lock(mutex_);
-    done_ = true;
-    cond_.notify_all();
+    if (query_id_) {
+        RunningQueries::remove(query_id_);
+        query_id_ = 0;
+    }
+    // Query that is still running should stop as soon as possible
+    cancellation_.cancel(AKU_ECANCELED);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        done_ = true;
+        cond_.notify_all();
+    }
+    // Producer can't make progress while the lock is held
     if (thread_.joinable()) {
         thread_.join();
     }
@@ -139,6 +154,7 @@ static std::shared_ptr<ConcurrentCursor::BufferT> make_empty() {
     buf->buf.resize(BUFFER_SIZE);
     buf->rdpos = 0;
     buf->wrpos = 0;
+    buf->mem.set(static_cast<i64>(buf->buf.capacity()), 1);
     return buf;
 }
 
@@ -150,6 +166,10 @@ bool ConcurrentCursor::put(aku_Sample const& result) {
     std::unique_lock<std::mutex> lock(mutex_);
     std::shared_ptr<BufferT> top;
     while(true) {
+        if (done_) {
+            // Cursor was closed while waiting for the reader
+            return false;
+        }
         if(queue_.empty()) {
             top = make_empty();
             queue_.push_back(top);
@@ -161,7 +181,11 @@ bool ConcurrentCursor::put(aku_Sample const& result) {
                 top = make_empty();
                 queue_.push_back(top);
             } else {
-                cond_.wait(lock);
+                cond_.wait_for(lock, std::chrono::milliseconds(CURSOR_READ_TIMEOUT));
+                if (cancellation_.check() != AKU_SUCCESS) {
+                    // Reader is stalled and the query was cancelled
+                    return false;
+                }
             }
             continue;
         } else {
@@ -179,4 +203,68 @@ void ConcurrentCursor::complete() {
     cond_.notify_all();
 }
 
+// RunningQueries //
+
+namespace {
+
+struct RunningQuery {
+    QueryCancellation* token;
+    std::string        text;
+    std::chrono::steady_clock::time_point start;
+};
+
+struct RunningQueriesRegistry {
+    std::mutex                   mutex;
+    u64                          next_id = 1;
+    std::map<u64, RunningQuery>  queries;
+
+    static RunningQueriesRegistry& get() {
+        static RunningQueriesRegistry registry;
+        return registry;
+    }
+};
+
+}
+
+u64 RunningQueries::add(QueryCancellation* token, std::string const& text) {
+    auto& reg = RunningQueriesRegistry::get();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    auto id = reg.next_id++;
+    reg.queries[id] = { token, text, std::chrono::steady_clock::now() };
+    return id;
+}
+
+void RunningQueries::remove(u64 id) {
+    auto& reg = RunningQueriesRegistry::get();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    reg.queries.erase(id);
+}
+
+aku_Status RunningQueries::cancel(u64 id) {
+    auto& reg = RunningQueriesRegistry::get();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    auto it = reg.queries.find(id);
+    if (it == reg.queries.end()) {
+        return AKU_ENOT_FOUND;
+    }
+    it->second.token->cancel(AKU_ECANCELED);
+    Logger::msg(AKU_LOG_INFO, "Query " + std::to_string(id) + " cancelled");
+    return AKU_SUCCESS;
+}
+
+boost::property_tree::ptree RunningQueries::get_stats() {
+    auto& reg = RunningQueriesRegistry::get();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    auto now = std::chrono::steady_clock::now();
+    boost::property_tree::ptree result;
+    for (auto const& kv: reg.queries) {
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - kv.second.start);
+        boost::property_tree::ptree item;
+        item.put("query", kv.second.text);
+        item.put("elapsed_ms", elapsed.count());
+        result.add_child(std::to_string(kv.first), item);
+    }
+    return result;
+}
+
 }
@@ -34,6 +34,11 @@
 #include "akumuli.h"
 #include "internal_cursor.h"
 #include "external_cursor.h"
+#include "pool.h"
+#include "instrumentation.h"
+#include "cancellation.h"
+
+#include <boost/property_tree/ptree.hpp>
 
 namespace Akumuli {
 
@@ -55,6 +60,7 @@ struct ConcurrentCursor : Cursor {
         std::vector<u8> buf;
         size_t rdpos;
         size_t wrpos;
+        MemoryTracker mem{AKU_MEM_CURSOR_BUFFERS};
     };
 
     std::thread thread_;
@@ -63,9 +69,14 @@ struct ConcurrentCursor : Cursor {
     std::atomic_bool done_;
     std::deque<std::shared_ptr<BufferT>> queue_;
     aku_Status error_code_;
+    QueryCancellation cancellation_;
+    u64 query_id_;  //< Id in the RunningQueries registry (0 if not registered)
 
     ConcurrentCursor();
 
+    //! Add query to the RunningQueries registry, query is removed on close
+    void register_query(std::string const& text);
+
     // External cursor implementation
 
     virtual u32 read(void* buffer, u32 buffer_size);
@@ -85,7 +96,11 @@ struct ConcurrentCursor : Cursor {
     void complete();
 
     template <class Fn_1arg_caller> void start(Fn_1arg_caller const& fn) {
-        thread_ = std::thread(fn);
+        thread_ = std::thread([this, fn]() {
+            bind_thread_arena(ThreadClass::QUERY);
+            QueryCancellationScope scope(&cancellation_);
+            fn();
+        });
     }
 
     template <class Fn_1arg> static std::unique_ptr<ExternalCursor> make(Fn_1arg const& fn) {
@@ -120,4 +135,22 @@ struct ConcurrentCursor : Cursor {
     }
 };
 
+
+/** Registry of the running queries.
+  * Used to list running queries and to cancel them by id.
+  */
+struct RunningQueries {
+    //! Register query, return query id
+    static u64 add(QueryCancellation* token, std::string const& text);
+
+    //! Unregister query (should be called before the token is destroyed)
+    static void remove(u64 id);
+
+    //! Cancel query, return AKU_ENOT_FOUND if query is not running
+    static aku_Status cancel(u64 id);
+
+    //! List running queries (id, query text and running time)
+    static boost::property_tree::ptree get_stats();
+};
+
 }  // namespace
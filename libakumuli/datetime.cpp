@@ -16,7 +16,12 @@
 
 #include "datetime.h"
 #include <cstdio>
-#include <boost/regex.hpp>
+#include <cstring>
+#include <limits>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 namespace Akumuli {
 
@@ -42,109 +47,243 @@ boost::posix_time::ptime DateTimeUtil::to_boost_ptime(aku_Timestamp timestamp) {
     return ptime;
 }
 
-// parse N digits from string
-static int parse_n_digits(const char* p, int n, const char* error_message = "can't parse digit") {
-    int value = 0;
-    for(int i = 0; i < n; i++) {
-        char c = *p++;
-        // c must be in [0x30:0x39] range
-        if (c > 0x39 || c < 0x30) {
-            BadDateTimeFormat err(error_message);
-            BOOST_THROW_EXCEPTION(err);
+// Fixed layout timestamp parser //
+
+//! Nanoseconds in one second
+static const u64 NS_PER_SEC = 1000000000ull;
+
+//! Static buffer that contains fixed part of the timestamp string padded with zeroes
+struct alignas(16) FixedLayoutBuffer {
+    char data[32];
+};
+
+//! Return bitmask with bit set for each digit in the 16-byte chunk
+static inline u32 digits_mask_16(const char* p) {
+#ifdef __SSE2__
+    __m128i v = _mm_load_si128(reinterpret_cast<const __m128i*>(p));
+    __m128i d = _mm_sub_epi8(v, _mm_set1_epi8('0'));
+    // d is in [0, 9] range only for digits (unsigned comparison)
+    __m128i isdigit = _mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8(9)), d);
+    return static_cast<u32>(_mm_movemask_epi8(isdigit));
+#else
+    u32 mask = 0;
+    for (int i = 0; i < 16; i++) {
+        if (p[i] >= '0' && p[i] <= '9') {
+            mask |= 1u << i;
         }
-        value = value*10 + static_cast<int>(c & 0x0F);
+    }
+    return mask;
+#endif
+}
+
+//! Return bitmask with bit set for each byte equal to the corresponding byte of the template
+static inline u32 match_mask_16(const char* p, const char* tmpl) {
+#ifdef __SSE2__
+    __m128i v = _mm_load_si128(reinterpret_cast<const __m128i*>(p));
+    __m128i t = _mm_loadu_si128(reinterpret_cast<const __m128i*>(tmpl));
+    return static_cast<u32>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, t)));
+#else
+    u32 mask = 0;
+    for (int i = 0; i < 16; i++) {
+        if (p[i] == tmpl[i]) {
+            mask |= 1u << i;
+        }
+    }
+    return mask;
+#endif
+}
+
+//! Convert N digits to number (digits should be validated)
+static inline int digits_to_int(const char* p, int n) {
+    int value = 0;
+    for (int i = 0; i < n; i++) {
+        value = value*10 + (p[i] - '0');
     }
     return value;
 }
 
-aku_Timestamp DateTimeUtil::from_iso_string(const char* iso_str) {
-    u32 len = static_cast<u32>(std::strlen(iso_str));
-    if (len == 0) {
-        BadDateTimeFormat error("empty timestamp value");
-        BOOST_THROW_EXCEPTION(error);
+static inline bool is_digit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+/** Number of days since 1970-01-01 (proleptic Gregorian calendar).
+  * @note H. Hinnant, "chrono-Compatible Low-Level Date Algorithms"
+  */
+static i64 days_from_civil(i64 y, u32 m, u32 d) {
+    y -= m <= 2;
+    const i64 era = (y >= 0 ? y : y - 399) / 400;
+    const u32 yoe = static_cast<u32>(y - era * 400);
+    const u32 doy = (153*(m > 2 ? m - 3 : m + 9) + 2)/5 + d - 1;
+    const u32 doe = yoe * 365 + yoe/4 - yoe/100 + doy;
+    return era * 146097 + static_cast<i64>(doe) - 719468;
+}
+
+static u32 days_in_month(int y, int m) {
+    static const u32 DAYS[] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+    if (m == 2 && (y % 4 == 0 && (y % 100 != 0 || y % 400 == 0))) {
+        return 29;
+    }
+    return DAYS[m - 1];
+}
+
+#define AKU_DT_FAIL(msg) { if (error) { *error = msg; } return AKU_EBAD_ARG; }
+
+//! Parse raw nanosecond timestamp
+static aku_Status parse_raw_timestamp(const char* p, const char* pend, aku_Timestamp* result, const char** error) {
+    u64 value = 0;
+    for (; p != pend; p++) {
+        if (!is_digit(*p)) {
+            AKU_DT_FAIL("unknown timestamp format");
+        }
+        u64 digit = static_cast<u64>(*p - '0');
+        if (value > (std::numeric_limits<u64>::max() - digit) / 10) {
+            AKU_DT_FAIL("can't parse unix-timestamp from string");
+        }
+        value = value*10 + digit;
     }
+    *result = value;
+    return AKU_SUCCESS;
+}
+
+aku_Status DateTimeUtil::parse_iso_string(const char* str, size_t size, aku_Timestamp* result, const char** error) {
+    const char* p = str;
+    const char* pend = str + size;
     // Trim left
-    while(!isdigit(*iso_str)) {
-        iso_str++;
-        len--;
-        if (len == 0) {
-            break;
+    while (p != pend && !is_digit(*p)) {
+        p++;
+    }
+    if (p == pend) {
+        AKU_DT_FAIL("empty timestamp value");
+    }
+    size_t len = static_cast<size_t>(pend - p);
+
+    // Fixed part of the timestamp is validated using 16-byte wide comparisons
+    // with zero-padded copy of the input.
+    FixedLayoutBuffer buf = {};
+    std::memcpy(buf.data, p, std::min(len, sizeof(buf.data)));
+
+    int year, month, day, hour, minute, second;
+    if (len >= 15 && buf.data[8] == 'T') {
+        // Basic format: YYYYMMDDTHHMMSS
+        const u32 DIGITS = 0x7EFF;
+        if ((digits_mask_16(buf.data) & DIGITS) != DIGITS) {
+            AKU_DT_FAIL("bad timestamp format, digit expected");
+        }
+        year   = digits_to_int(buf.data + 0, 4);
+        month  = digits_to_int(buf.data + 4, 2);
+        day    = digits_to_int(buf.data + 6, 2);
+        hour   = digits_to_int(buf.data + 9, 2);
+        minute = digits_to_int(buf.data + 11, 2);
+        second = digits_to_int(buf.data + 13, 2);
+        p += 15;
+    } else if (len >= 19 && buf.data[4] == '-') {
+        // RFC 3339 format: YYYY-MM-DDTHH:MM:SS, 'T' can be replaced by 't' or ' '
+        static const char TEMPLATE[] = "0000-00-00T00:00";
+        const u32 DIGITS = 0xDB6F;
+        const u32 SEPARATORS = 0x2090;
+        u32 digits = digits_mask_16(buf.data);
+        u32 separators = match_mask_16(buf.data, TEMPLATE);
+        char t = buf.data[10];
+        if ((digits & DIGITS) != DIGITS ||
+            (separators & SEPARATORS) != SEPARATORS ||
+            (t != 'T' && t != 't' && t != ' ') ||
+            buf.data[16] != ':' || !is_digit(buf.data[17]) || !is_digit(buf.data[18]))
+        {
+            AKU_DT_FAIL("bad timestamp format");
         }
+        year   = digits_to_int(buf.data + 0, 4);
+        month  = digits_to_int(buf.data + 5, 2);
+        day    = digits_to_int(buf.data + 8, 2);
+        hour   = digits_to_int(buf.data + 11, 2);
+        minute = digits_to_int(buf.data + 14, 2);
+        second = digits_to_int(buf.data + 17, 2);
+        p += 19;
+    } else {
+        return parse_raw_timestamp(p, pend, result, error);
     }
-    if (len < 15 || iso_str[8] != 'T') {
-        // Raw timestamp
-        aku_Timestamp ts;
-        char* end;
-        ts = strtoull(iso_str, &end, 10);
-        if (errno == ERANGE) {
-            BadDateTimeFormat error("can't parse unix-timestamp from string");
-            BOOST_THROW_EXCEPTION(error);
+
+    // Fractional part (optional), extra digits after nanoseconds are ignored
+    u64 nanoseconds = 0;
+    if (p != pend && (*p == '.' || *p == ',')) {
+        p++;
+        int n = 0;
+        for (; p != pend && is_digit(*p); p++, n++) {
+            if (n < 9) {
+                nanoseconds = nanoseconds*10 + static_cast<u64>(*p - '0');
+            }
         }
-        long parsed_len = end - iso_str;
-        if (parsed_len < len) {
-            BadDateTimeFormat error("unknown timestamp format");
-            BOOST_THROW_EXCEPTION(error);
+        if (n == 0) {
+            AKU_DT_FAIL("can't parse fractional part");
         }
-        return ts;
-    }
-    if (len < 15) {
-        BadDateTimeFormat error("bad timestamp format (less then 15 digits)");
-        BOOST_THROW_EXCEPTION(error);
-    }
-    const char* pend = iso_str + len; // should point to zero-terminator
-    // first four digits - year
-    const char* p = iso_str;
-    int year = parse_n_digits(p, 4, "can't parse year from timestamp");
-    p += 4;
-    // then 2 month digits
-    int month = parse_n_digits(p, 2, "can't parse month from timestamp");
-    p += 2;
-    // then 2 date digits
-    int date = parse_n_digits(p, 2, "can't parse date from timestamp");
-    p += 2;
-    // then 'T'
-    if (*p != 'T') {
-        BadDateTimeFormat error("bad timestamp format, 'T' was expected");
-        BOOST_THROW_EXCEPTION(error);
-    }
-    p++;
-    // read two hour digits
-    int hour = parse_n_digits(p, 2, "can't parse hours from timestamp");
-    p += 2;
-    // read two minute digits
-    int minute = parse_n_digits(p, 2, "can't parse minutes from timestamp");
-    p += 2;
-    // read seconds
-    int second = parse_n_digits(p, 2, "can't parse seconds from timestamp");
-    p += 2;
-
-    // optional
-    int nanoseconds = 0;
-    if (p != pend) {
-        // here should go '.' or ',' according to ISO 8601
-        if (*p != '.' && *p != ',') {
-            BadDateTimeFormat error("bad timestamp format, ',' or '.' was expected");
-            BOOST_THROW_EXCEPTION(error);
+        for (; n < 9; n++) {
+            nanoseconds *= 10;
         }
-        p++;
+    }
 
-        // we should have at most 9 digits of nanosecond precision representation
-        int n = pend - p;
-        nanoseconds = parse_n_digits(p, n, "can't parse fractional part");
-        for(int i = 9; i --> n;) {
-            nanoseconds *= 10;
+    // Timezone (optional)
+    i64 offset = 0;
+    if (p != pend) {
+        if (*p == 'Z' || *p == 'z') {
+            p++;
+        } else if (*p == '+' || *p == '-') {
+            i64 sign = *p == '-' ? -1 : 1;
+            p++;
+            size_t rem = static_cast<size_t>(pend - p);
+            int tzh, tzm = 0;
+            if (rem >= 2 && is_digit(p[0]) && is_digit(p[1])) {
+                tzh = digits_to_int(p, 2);
+                p += 2;
+                rem -= 2;
+            } else {
+                AKU_DT_FAIL("bad timezone offset");
+            }
+            bool colon = rem > 0 && *p == ':';
+            if (colon) {
+                p++;
+                rem--;
+            }
+            if (rem >= 2 && is_digit(p[0]) && is_digit(p[1])) {
+                tzm = digits_to_int(p, 2);
+                p += 2;
+            } else if (colon) {
+                AKU_DT_FAIL("bad timezone offset, minutes expected after ':'");
+            }
+            if (tzh > 23 || tzm > 59) {
+                AKU_DT_FAIL("bad timezone offset");
+            }
+            offset = sign*(tzh*3600 + tzm*60);
+        }
+        if (p != pend) {
+            AKU_DT_FAIL("bad timestamp format, unexpected trailing characters");
         }
     }
-    try {
-        auto gregorian_date = boost::gregorian::date(year, month, date);
-        auto time = boost::posix_time::time_duration(hour, minute, second, nanoseconds);
-        auto pt = boost::posix_time::ptime(gregorian_date, time);
-        return DateTimeUtil::from_boost_ptime(pt);
-    } catch (std::out_of_range const& range_error) {
-        // Invalid date parameter
-        BadDateTimeFormat error(range_error.what());
-        BOOST_THROW_EXCEPTION(error);
+
+    if (month < 1 || month > 12 || day < 1 || static_cast<u32>(day) > days_in_month(year, month)) {
+        AKU_DT_FAIL("bad date value");
+    }
+    if (hour > 23 || minute > 59 || second > 60) {
+        AKU_DT_FAIL("bad time value");
     }
+    i64 seconds = days_from_civil(year, static_cast<u32>(month), static_cast<u32>(day))*86400
+                + hour*3600 + minute*60 + second - offset;
+    if (seconds < 0) {
+        AKU_DT_FAIL("timestamp is out of range");
+    }
+    *result = static_cast<u64>(seconds)*NS_PER_SEC + nanoseconds;
+    return AKU_SUCCESS;
+}
+
+#undef AKU_DT_FAIL
+
+aku_Timestamp DateTimeUtil::from_iso_string(const char* iso_str) {
+    aku_Timestamp result = 0;
+    const char* error = nullptr;
+    aku_Status status = parse_iso_string(iso_str, std::strlen(iso_str), &result, &error);
+    if (status != AKU_SUCCESS) {
+        BadDateTimeFormat err(error);
+        BOOST_THROW_EXCEPTION(err);
+    }
+    return result;
 }
 
 int DateTimeUtil::to_iso_string(aku_Timestamp ts, char* buffer, size_t buffer_size) {
@@ -170,52 +309,77 @@ int DateTimeUtil::to_iso_string(aku_Timestamp ts, char* buffer, size_t buffer_si
     return len + 1;
 }
 
-aku_Duration DateTimeUtil::parse_duration(const char* str, size_t size) {
-    static const char* exp = R"(^(\d+)(n|us|s|min|ms|m|h)?$)";
-    static boost::regex regex(exp, boost::regex_constants::optimize);
-    boost::cmatch m;
-    if (!boost::regex_match(str, m, regex)) {
-        BadDateTimeFormat bad_duration("bad duration");
-        BOOST_THROW_EXCEPTION(bad_duration);
+aku_Status DateTimeUtil::parse_duration(const char* str, size_t size, aku_Duration* result) {
+    const char* p = str;
+    const char* pend = str + size;
+    u64 num = 0;
+    for (; p != pend && is_digit(*p); p++) {
+        u64 digit = static_cast<u64>(*p - '0');
+        if (num > (std::numeric_limits<u64>::max() - digit) / 10) {
+            return AKU_EBAD_ARG;
+        }
+        num = num*10 + digit;
     }
-    auto num = m[1];
-    auto unit = m[2].first;
-    auto unitlen = m[2].second - m[2].first;
-    auto K = 0ul;
-    if (unitlen > 0) {
-        switch(unit[0]) {
+    if (p == str) {
+        return AKU_EBAD_ARG;
+    }
+    auto unitlen = pend - p;
+    u64 K = 0ul;
+    switch (unitlen) {
+    case 0:
+        K = 1ul;
+        break;
+    case 1:
+        switch(p[0]) {
         case 'n':  // nanosecond
             K = 1ul;
             break;
-        case 'u':  // microsecond
-            K = 1000ul;
-            break;
         case 's':  // second
-            K = 1000000000ul;
+            K = NS_PER_SEC;
+            break;
+        case 'm':  // minute
+            K = 60*NS_PER_SEC;
+            break;
+        case 'h':  // hour
+            K = 60*60*NS_PER_SEC;
             break;
-        case 'm':
-            switch(unitlen) {
-            case 1:
-            case 3:  // minute
-                K = 60*1000000000ul;
+        }
+        break;
+    case 2:
+        if (p[1] == 's') {
+            switch(p[0]) {
+            case 'u':  // microsecond
+                K = 1000ul;
                 break;
-            case 2:  // milisecond
+            case 'm':  // milisecond
                 K = 1000000ul;
                 break;
             }
-            break;
-        case 'h':  // hour
-            K = 60*60*1000000000ul;
-            break;
         }
-        if (K == 0ul) {
-            BadDateTimeFormat err("unknown time duration unit");
-            BOOST_THROW_EXCEPTION(err);
+        break;
+    case 3:
+        if (p[0] == 'm' && p[1] == 'i' && p[2] == 'n') {
+            K = 60*NS_PER_SEC;
         }
-    } else {
-        K = 1ul;
+        break;
+    }
+    if (K == 0ul) {
+        return AKU_EBAD_ARG;
+    }
+    if (num > std::numeric_limits<u64>::max() / K) {
+        return AKU_EBAD_ARG;
+    }
+    *result = K*num;
+    return AKU_SUCCESS;
+}
+
+aku_Duration DateTimeUtil::parse_duration(const char* str, size_t size) {
+    aku_Duration result = 0;
+    if (parse_duration(str, size, &result) != AKU_SUCCESS) {
+        BadDateTimeFormat bad_duration("bad duration");
+        BOOST_THROW_EXCEPTION(bad_duration);
     }
-    return K*atoll(num.first);
+    return result;
 }
 
 
@@ -49,12 +49,24 @@ struct DateTimeUtil {
     static boost::posix_time::ptime to_boost_ptime(aku_Timestamp timestamp);
 
     /** Convert ISO formatter timestamp to aku_Timestamp value.
-      * @note This function implements ISO 8601 partially compatible parser. Most of the standard is not
-      * supported yet - extended formatting (only basic format is supported), fractions on minutes or hours (
-      * like "20150102T1230.999"), timezones (values is treated as UTC time).
+      * @note This function implements ISO 8601 partially compatible parser. Basic format
+      * ("20150102T123059.999") and RFC 3339 format ("2015-01-02T12:30:59.999+03:00") are
+      * supported, timestamps without timezone are treated as UTC time. Fractions on minutes
+      * or hours (like "20150102T1230.999") are not supported. Raw integer values are treated
+      * as nanosecond timestamps.
+      * @throw BadDateTimeFormat on error
       */
     static aku_Timestamp from_iso_string(const char* iso_str);
 
+    /** Non-throwing version of the `from_iso_string`, suitable for the ingestion path.
+      * @param str is a pointer to the timestamp string (shouldn't be zero-terminated)
+      * @param size is a length of the string
+      * @param result is an output parameter
+      * @param error is an optional output parameter, receives static error message
+      * @return AKU_SUCCESS or AKU_EBAD_ARG
+      */
+    static aku_Status parse_iso_string(const char* str, size_t size, aku_Timestamp* result, const char** error=nullptr);
+
     /** Convert timestamp to string.
       */
     static int to_iso_string(aku_Timestamp ts, char* buffer, size_t buffer_size);
@@ -63,5 +75,10 @@ struct DateTimeUtil {
       * @throw BadDateTimeFormat on error
       */
     static aku_Duration parse_duration(const char* str, size_t size);
+
+    /** Non-throwing version of the `parse_duration`.
+      * @return AKU_SUCCESS or AKU_EBAD_ARG
+      */
+    static aku_Status parse_duration(const char* str, size_t size, aku_Duration* result);
 };
 }
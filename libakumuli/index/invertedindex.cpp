@@ -360,11 +360,18 @@ CMSketch::TVal CMSketch::extract(u64 value) const {
 // InvertedIndex //
 //               //
 
-InvertedIndex::InvertedIndex(u32) {
+InvertedIndex::InvertedIndex(u32)
+    : lists_size_(0)
+    , mem_(AKU_MEM_INDEX_POSTINGS)
+{
 }
 
 void InvertedIndex::add(u64 key, u64 value) {
-    table_[key].add(value);
+    auto& list = table_[key];
+    auto prev_size = list.getSizeInBytes();
+    list.add(value);
+    lists_size_ += list.getSizeInBytes() - prev_size;
+    mem_.set(hashtable_memory_use(table_) + static_cast<i64>(lists_size_), static_cast<i64>(table_.size()));
 }
 
 size_t InvertedIndex::get_size_in_bytes() const {
@@ -707,17 +714,26 @@ IndexQueryResults JoinByTags::query(IndexBase const& index) const {
 
 SeriesNameTopology::SeriesNameTopology()
     : index_(StringTools::create_l3_table(1000))
+    , mem_(AKU_MEM_INDEX_TOPOLOGY, hashtable_memory_use(index_))
 {
 }
 
 void SeriesNameTopology::add_name(StringT name) {
     StringT metric = skip_metric_name(name.first, name.first + name.second);
     StringT tags = std::make_pair(name.first + metric.second, name.second - metric.second);
+    // Nested tables are updated in place so memory use is tracked incrementally
+    const i64 NODE_OVERHEAD = 2*sizeof(void*);
+    i64 delta = 0;
     auto it = index_.find(metric);
     if (it == index_.end()) {
+        auto nbuckets = index_.bucket_count();
         StringTools::L2TableT tagtable = StringTools::create_l2_table(1024);
         index_[metric] = std::move(tagtable);
         it = index_.find(metric);
+        delta += sizeof(IndexT::value_type) + NODE_OVERHEAD;
+        delta += (index_.bucket_count() - nbuckets + it->second.bucket_count()) * sizeof(void*);
+        mem_.add(delta, 1);
+        delta = 0;
     }
     // Iterate through tags
     const char* p = tags.first;
@@ -740,15 +756,25 @@ void SeriesNameTopology::add_name(StringT name) {
         StringTools::L2TableT& tagtable = it->second;
         auto tagit = tagtable.find(tag);
         if (tagit == tagtable.end()) {
+            auto nbuckets = tagtable.bucket_count();
             auto valtab = StringTools::create_set(1024);
             tagtable[tag] = std::move(valtab);
             tagit = tagtable.find(tag);
+            delta += sizeof(StringTools::L2TableT::value_type) + NODE_OVERHEAD;
+            delta += (tagtable.bucket_count() - nbuckets + tagit->second.bucket_count()) * sizeof(void*);
         }
         StringTools::SetT& valueset = tagit->second;
-        valueset.insert(val);
+        auto nbuckets = valueset.bucket_count();
+        if (valueset.insert(val).second) {
+            delta += sizeof(StringTools::SetT::value_type) + NODE_OVERHEAD;
+            delta += (valueset.bucket_count() - nbuckets) * sizeof(void*);
+        }
         // next
         p = skip_space(tag_end, end);
     }
+    if (delta) {
+        mem_.add(delta, 0);
+    }
 }
 
 std::vector<StringT> SeriesNameTopology::list_metric_names() const {
@@ -794,6 +820,7 @@ std::vector<StringT> SeriesNameTopology::list_tag_values(StringT metric, StringT
 
 Index::Index()
     : table_(StringTools::create_table(100000))
+    , table_mem_(AKU_MEM_INDEX_TABLES, hashtable_memory_use(table_))
     , metrics_names_(1024)
     , tagvalue_pairs_(1024)
 {
@@ -847,6 +874,7 @@ std::tuple<aku_Status, StringT> Index::append(const char* begin, const char* end
         write_tags(tags_begin, tags_end, &tagvalue_pairs_, id);
         name = pool_.str(id);  // name now have the same lifetime as pool
         table_[name] = id;
+        table_mem_.set(hashtable_memory_use(table_), static_cast<i64>(table_.size()));
         auto mname = skip_metric_name(buffer, tags_begin);
         if (mname.second == 0) {
             return std::make_tuple(AKU_EBAD_DATA, EMPTY_STRING);
@@ -447,6 +447,8 @@ public:
 class InvertedIndex {
     typedef CompressedPList TVal;
     std::unordered_map<u64, TVal> table_;
+    size_t lists_size_;  //! Total size of all postings lists
+    MemoryTracker mem_;
 public:
     InvertedIndex(u32);
 
@@ -791,6 +793,7 @@ struct JoinByTags : IndexQueryNodeBase {
 class SeriesNameTopology {
     typedef StringTools::L3TableT IndexT;
     IndexT index_;
+    MemoryTracker mem_;
 public:
     SeriesNameTopology();
 
@@ -811,6 +814,7 @@ public:
 class Index : public IndexBase {
     StringPool pool_;
     StringTools::TableT table_;
+    MemoryTracker table_mem_;
     //CMSketch metrics_names_;
     //CMSketch tagvalue_pairs_;
     InvertedIndex metrics_names_;
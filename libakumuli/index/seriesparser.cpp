@@ -19,6 +19,7 @@
 #include "util.h"
 #include "datetime.h"
 #include "status_util.h"
+#include "log_iface.h"
 
 #include <string>
 #include <map>
@@ -36,9 +37,33 @@ namespace Akumuli {
 
 static const StringT EMPTY = std::make_pair(nullptr, 0);
 
+static i64 tagsets_memory_use(SeriesMatcher const* m) {
+    return hashtable_memory_use(m->tagsets)
+         + hashtable_memory_use(m->series_tagsets)
+         + hashtable_memory_use(m->metrics)
+         + hashtable_memory_use(m->metric_tagsets);
+}
+
+static i64 tagsets_memory_use(PlainSeriesMatcher const*) {
+    return 0;
+}
+
+//! Update memory tracker of the matcher, should be called under lock
+template<class Matcher>
+static void update_memory_use(Matcher* m) {
+    i64 bytes = hashtable_memory_use(m->table)
+              + hashtable_memory_use(m->inv_table)
+              + static_cast<i64>(m->names.capacity() * sizeof(typename Matcher::SeriesNameT))
+              + tagsets_memory_use(m);
+    m->mem.set(bytes, static_cast<i64>(m->table.size()));
+}
+
 SeriesMatcher::SeriesMatcher(u64 starting_id)
     : table(StringTools::create_table(0x1000))
     , series_id(starting_id)
+    , mem(AKU_MEM_MATCHER_TABLES, hashtable_memory_use(table))
+    , tagsets(StringTools::create_table(0x1000))
+    , metrics(StringTools::create_table(0x100))
 {
     if (starting_id == 0u) {
         AKU_PANIC("Bad series ID");
@@ -59,6 +84,8 @@ u64 SeriesMatcher::add(const char* begin, const char* end) {
     table[sname] = id;
     inv_table[id] = sname;
     names.push_back(tup);
+    add_tagset(sname, id);
+    update_memory_use(this);
     return id;
 }
 
@@ -77,6 +104,29 @@ void SeriesMatcher::_add(const char*  begin, const char* end, u64 id) {
     StatusUtil::throw_on_error(status);
     table[sname] = id;
     inv_table[id] = sname;
+    add_tagset(sname, id);
+    update_memory_use(this);
+}
+
+void SeriesMatcher::add_tagset(StringT name, u64 id) {
+    // Canonical name is `metric tag1=value1 tag2=value2`, tag-set includes leading space
+    auto space = static_cast<const char*>(memchr(name.first, ' ', static_cast<size_t>(name.second)));
+    int metric_len = space ? static_cast<int>(space - name.first) : name.second;
+    StringT metric = std::make_pair(name.first, metric_len);
+    StringT tagset = std::make_pair(name.first + metric_len, name.second - metric_len);
+
+    auto tsit = tagsets.find(tagset);
+    if (tsit == tagsets.end()) {
+        tsit = tagsets.insert(std::make_pair(tagset, tagsets.size())).first;
+    }
+    auto tsid = static_cast<u32>(tsit->second);
+    series_tagsets[id] = tsid;
+
+    auto mit = metrics.find(metric);
+    if (mit == metrics.end()) {
+        mit = metrics.insert(std::make_pair(metric, metrics.size())).first;
+    }
+    metric_tagsets[mit->second << 32 | tsid] = id;
 }
 
 u64 SeriesMatcher::match(const char* begin, const char* end) const {
@@ -100,9 +150,61 @@ StringT SeriesMatcher::id2str(u64 tokenid) const {
     return it->second;
 }
 
+size_t SeriesMatcher::size() const {
+    std::lock_guard<std::mutex> guard(mutex);
+    return inv_table.size();
+}
+
+std::vector<u64> SeriesMatcher::join(std::vector<std::string> const& metric_names, std::vector<u64> const& ids) const {
+    std::vector<u64> result;
+    result.reserve(metric_names.size() * ids.size());
+    std::lock_guard<std::mutex> guard(mutex);
+    std::vector<u32> tsids;
+    tsids.reserve(ids.size());
+    for (auto id: ids) {
+        auto it = series_tagsets.find(id);
+        if (it == series_tagsets.end()) {
+            // This shouldn't happen but it can happen after memory corruption or data-race.
+            // Clearly indicates an error.
+            Logger::msg(AKU_LOG_ERROR, "Matcher data is broken, can't find tag-set of the series " + std::to_string(id));
+            AKU_PANIC("Matcher data is broken");
+        }
+        tsids.push_back(it->second);
+    }
+    for (auto const& metric: metric_names) {
+        auto mit = metrics.find(std::make_pair(metric.data(), static_cast<int>(metric.size())));
+        if (mit == metrics.end()) {
+            result.resize(result.size() + ids.size(), 0ull);
+            continue;
+        }
+        for (auto tsid: tsids) {
+            auto it = metric_tagsets.find(mit->second << 32 | tsid);
+            result.push_back(it != metric_tagsets.end() ? it->second : 0ull);
+        }
+    }
+    return result;
+}
+
+u64 SeriesMatcher::next_id() const {
+    std::lock_guard<std::mutex> guard(mutex);
+    return series_id;
+}
+
+u64 SeriesMatcher::get_names_since(u64 first, std::vector<SeriesNameT>* names) const {
+    std::lock_guard<std::mutex> guard(mutex);
+    for (u64 id = first; id < series_id; id++) {
+        auto it = inv_table.find(id);
+        if (it != inv_table.end()) {
+            names->push_back(std::make_tuple(it->second.first, it->second.second, id));
+        }
+    }
+    return series_id;
+}
+
 void SeriesMatcher::pull_new_names(std::vector<PlainSeriesMatcher::SeriesNameT> *buffer) {
     std::lock_guard<std::mutex> guard(mutex);
     std::swap(names, *buffer);
+    update_memory_use(this);
 }
 
 std::vector<u64> SeriesMatcher::get_all_ids() const {
@@ -184,6 +286,7 @@ std::vector<StringT> SeriesMatcher::suggest_tag_values(std::string metric, std::
 PlainSeriesMatcher::PlainSeriesMatcher(u64 starting_id)
     : table(StringTools::create_table(0x1000))
     , series_id(starting_id)
+    , mem(AKU_MEM_MATCHER_TABLES, hashtable_memory_use(table))
 {
     if (starting_id == 0u) {
         AKU_PANIC("Bad series ID");
@@ -198,6 +301,7 @@ u64 PlainSeriesMatcher::add(const char* begin, const char* end) {
     table[pstr] = id;
     inv_table[id] = pstr;
     names.push_back(tup);
+    update_memory_use(this);
     return id;
 }
 
@@ -211,6 +315,7 @@ void PlainSeriesMatcher::_add(std::string series, u64 id) {
     std::lock_guard<std::mutex> guard(mutex);
     table[pstr] = id;
     inv_table[id] = pstr;
+    update_memory_use(this);
 }
 
 void PlainSeriesMatcher::_add(const char*  begin, const char* end, u64 id) {
@@ -218,6 +323,7 @@ void PlainSeriesMatcher::_add(const char*  begin, const char* end, u64 id) {
     std::lock_guard<std::mutex> guard(mutex);
     table[pstr] = id;
     inv_table[id] = pstr;
+    update_memory_use(this);
 }
 
 u64 PlainSeriesMatcher::match(const char* begin, const char* end) const {
@@ -245,6 +351,7 @@ StringT PlainSeriesMatcher::id2str(u64 tokenid) const {
 void PlainSeriesMatcher::pull_new_names(std::vector<PlainSeriesMatcher::SeriesNameT> *buffer) {
     std::lock_guard<std::mutex> guard(mutex);
     std::swap(names, *buffer);
+    update_memory_use(this);
 }
 
 std::vector<u64> PlainSeriesMatcher::get_all_ids() const {
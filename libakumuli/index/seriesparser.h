@@ -84,6 +84,15 @@ struct SeriesMatcher : SeriesMatcherBase {
     u64                      series_id;  //! Series ID counter
     std::vector<SeriesNameT> names;      //! List of recently added names
     mutable std::mutex       mutex;      //! Mutex for shared data
+    MemoryTracker            mem;        //! Memory used by `table`, `inv_table`, `names` and tag-set tables
+
+    // Tag-sets. Every distinct canonical tag-set (the part of the series name that
+    // follows the metric name) gets dense tag-set id. Series with the same tag-set
+    // and different metrics can be found without building series names.
+    TableT                             tagsets;         //! Tag-set table (tag-set to tag-set id mapping)
+    std::unordered_map<u64, u32>       series_tagsets;  //! Series id to tag-set id mapping
+    TableT                             metrics;         //! Metric name to dense metric index mapping
+    std::unordered_map<u64, u64>       metric_tagsets;  //! (metric index << 32 | tag-set id) to series id mapping
 
     SeriesMatcher(u64 starting_id=AKU_STARTING_SERIES_ID);
 
@@ -115,6 +124,27 @@ struct SeriesMatcher : SeriesMatcherBase {
       */
     StringT id2str(u64 tokenid) const;
 
+    /** Find series with the same tag-sets as `ids` for every metric in `metrics`.
+      * Result contains `ids.size()` elements for every metric (metric-major order).
+      * Element is 0 if there is no series with such combination of metric and tags.
+      */
+    std::vector<u64> join(std::vector<std::string> const& metrics, std::vector<u64> const& ids) const;
+
+    /** Number of series in the index. The value changes every time new series
+      * is added, so it can be used to detect that cached query results are stale.
+      */
+    size_t size() const;
+
+    //! Value of the series id counter (id of the next series)
+    u64 next_id() const;
+
+    /** Get series added after the series id counter had value `first`.
+      * @param first is a value returned by `next_id`
+      * @param names is an output parameter that will receive names of the new series
+      * @return current value of the series id counter
+      */
+    u64 get_names_since(u64 first, std::vector<SeriesNameT>* names) const;
+
     /** Push all new elements to the buffer.
       * @param buffer is an output parameter that will receive new elements
       */
@@ -129,6 +159,10 @@ struct SeriesMatcher : SeriesMatcherBase {
     std::vector<StringT> suggest_tags(std::string metric, std::string tag_prefix) const;
 
     std::vector<StringT> suggest_tag_values(std::string metric, std::string tag, std::string value_prefix) const;
+
+private:
+    //! Assign tag-set id to the new series, should be called under lock
+    void add_tagset(StringT name, u64 id);
 };
 
 
@@ -152,6 +186,7 @@ struct PlainSeriesMatcher : SeriesMatcherBase {
     u64                      series_id;  //! Series ID counter
     std::vector<SeriesNameT> names;      //! List of recently added names
     mutable std::mutex       mutex;      //! Mutex for shared data
+    MemoryTracker            mem;        //! Memory used by `table`, `inv_table` and `names`
 
     PlainSeriesMatcher(u64 starting_id=AKU_STARTING_SERIES_ID);
 
@@ -25,6 +25,7 @@ namespace Akumuli {
 
 LegacyStringPool::LegacyStringPool()
     : counter{0}
+    , mem_(AKU_MEM_MATCHER_POOL)
 {
 }
 
@@ -54,6 +55,7 @@ LegacyStringPool::StringT LegacyStringPool::add(const char* begin, const char* e
     p -= size - 1;
     int token_size = static_cast<int>(end - begin);
     std::atomic_fetch_add(&counter, 1ul);
+    mem_.add(size, 1);
     return std::make_pair(p, token_size);
 }
 
@@ -132,6 +134,7 @@ std::vector<LegacyStringPool::StringT> LegacyStringPool::regex_match(const char
 
 StringPool::StringPool()
     : counter{0}
+    , mem_(AKU_MEM_INDEX_POOL)
 {
 }
 
@@ -162,6 +165,7 @@ u64 StringPool::add(const char* begin, const char* end) {
     }
     bin->push_back('\0');
     std::atomic_fetch_add(&counter, 1ul);
+    mem_.add(static_cast<i64>(size), 1);
     return bin_index*MAX_BIN_SIZE + offset;
 }
 
@@ -24,6 +24,7 @@
 #include <vector>
 
 #include "akumuli_def.h"
+#include "instrumentation.h"
 
 namespace Akumuli {
 
@@ -48,6 +49,7 @@ struct LegacyStringPool {
     std::deque<std::vector<char>> pool;
     mutable std::mutex            pool_mutex;
     std::atomic<size_t>           counter;
+    MemoryTracker                 mem_;
 
     LegacyStringPool();
     LegacyStringPool(LegacyStringPool const&) = delete;
@@ -80,6 +82,7 @@ public:
     std::deque<std::vector<char>> pool;
     mutable std::mutex            pool_mutex;
     std::atomic<size_t>           counter;
+    MemoryTracker                 mem_;
 
     StringPool();
     StringPool(StringPool const&) = delete;
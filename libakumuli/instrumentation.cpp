@@ -0,0 +1,458 @@
+/**
+ * Copyright (c) 2017 Eugene Lazin <4lazin@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "instrumentation.h"
+#include "util.h"
+
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+
+namespace Akumuli {
+
+// ------------- //
+// Histogram     //
+// ------------- //
+
+LatencyHistogram::LatencyHistogram()
+    : count(0)
+    , sum(0)
+    , max(0)
+{
+    std::fill(buckets, buckets + NBUCKETS, static_cast<u64>(0));
+}
+
+int LatencyHistogram::bucket_index(u64 value) {
+    static const u64 MAXVAL = (1ull << MAX_VALUE_BITS) - 1;
+    if (value < SUB_BUCKETS) {
+        return static_cast<int>(value);
+    }
+    value = std::min(value, MAXVAL);
+    int msb = 63 - __builtin_clzll(value);
+    int magnitude = msb - SUB_BUCKET_BITS + 1;
+    int sub = static_cast<int>(value >> (msb - SUB_BUCKET_BITS)) - SUB_BUCKETS;
+    return magnitude*SUB_BUCKETS + sub;
+}
+
+u64 LatencyHistogram::bucket_upper_bound(int index) {
+    if (index < SUB_BUCKETS) {
+        return static_cast<u64>(index);
+    }
+    int magnitude = index / SUB_BUCKETS;
+    u64 sub = static_cast<u64>(index % SUB_BUCKETS);
+    u64 lower = (SUB_BUCKETS + sub) << (magnitude - 1);
+    return lower + (1ull << (magnitude - 1)) - 1;
+}
+
+void LatencyHistogram::add(u64 value) {
+    count++;
+    sum += value;
+    max = std::max(max, value);
+    buckets[bucket_index(value)]++;
+}
+
+void LatencyHistogram::merge(LatencyHistogram const& other) {
+    count += other.count;
+    sum   += other.sum;
+    max    = std::max(max, other.max);
+    for (int i = 0; i < NBUCKETS; i++) {
+        buckets[i] += other.buckets[i];
+    }
+}
+
+u64 LatencyHistogram::quantile(double q) const {
+    if (count == 0) {
+        return 0;
+    }
+    u64 rank = static_cast<u64>(q * static_cast<double>(count) + 0.5);
+    rank = std::max(rank, static_cast<u64>(1));
+    u64 acc = 0;
+    for (int i = 0; i < NBUCKETS; i++) {
+        acc += buckets[i];
+        if (acc >= rank) {
+            return std::min(bucket_upper_bound(i), max);
+        }
+    }
+    return max;
+}
+
+// --------------- //
+// Per-thread data //
+// --------------- //
+
+namespace {
+
+//! Single writer update, readers can see stale values but never torn ones
+inline void relaxed_add(std::atomic<u64>& counter, u64 value) {
+    counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+struct ProbeSlot {
+    std::atomic<u64> events;
+    std::atomic<u64> count;
+    std::atomic<u64> sum;
+    std::atomic<u64> max;
+    std::atomic<u64> buckets[LatencyHistogram::NBUCKETS];
+
+    ProbeSlot()
+        : events{0}
+        , count{0}
+        , sum{0}
+        , max{0}
+    {
+        for (auto& b: buckets) {
+            b.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    void add(u64 value) {
+        relaxed_add(count, 1);
+        relaxed_add(sum, value);
+        if (value > max.load(std::memory_order_relaxed)) {
+            max.store(value, std::memory_order_relaxed);
+        }
+        relaxed_add(buckets[LatencyHistogram::bucket_index(value)], 1);
+    }
+
+    void copy_to(LatencyHistogram* hist) const {
+        LatencyHistogram tmp;
+        tmp.count = count.load(std::memory_order_relaxed);
+        tmp.sum   = sum.load(std::memory_order_relaxed);
+        tmp.max   = max.load(std::memory_order_relaxed);
+        for (int i = 0; i < LatencyHistogram::NBUCKETS; i++) {
+            tmp.buckets[i] = buckets[i].load(std::memory_order_relaxed);
+        }
+        hist->merge(tmp);
+    }
+};
+
+struct ThreadSlots {
+    ProbeSlot probes[AKU_PROBE_MAX];
+};
+
+/** Registry of all live per-thread slots and accumulated data of the exited threads.
+  * Never deallocated so threads that outlive static destructors can still retire.
+  */
+struct Registry {
+    std::mutex                  mutex;
+    std::vector<ThreadSlots*>   live;
+    LatencyHistogram            retired[AKU_PROBE_MAX];
+    u64                         retired_events[AKU_PROBE_MAX];
+
+    Registry()
+        : retired_events{}
+    {
+    }
+
+    static Registry& get() {
+        static Registry* registry = new Registry();
+        return *registry;
+    }
+};
+
+//! Constant-initialized, doesn't require guarded static access on the hot path
+static std::atomic<bool> g_probes_enabled = {true};
+
+static thread_local ThreadSlots* tls_slots __attribute__((tls_model("initial-exec"))) = nullptr;
+
+//! Moves thread's data to the registry on thread exit
+struct SlotsGuard {
+    ThreadSlots* slots;
+
+    SlotsGuard(ThreadSlots* s)
+        : slots(s)
+    {
+    }
+
+    ~SlotsGuard() {
+        auto& reg = Registry::get();
+        std::lock_guard<std::mutex> guard(reg.mutex);
+        for (int i = 0; i < AKU_PROBE_MAX; i++) {
+            slots->probes[i].copy_to(&reg.retired[i]);
+            reg.retired_events[i] += slots->probes[i].events.load(std::memory_order_relaxed);
+        }
+        reg.live.erase(std::remove(reg.live.begin(), reg.live.end(), slots), reg.live.end());
+        tls_slots = nullptr;
+        delete slots;
+    }
+};
+
+ThreadSlots* register_thread() {
+    auto slots = new ThreadSlots();
+    {
+        auto& reg = Registry::get();
+        std::lock_guard<std::mutex> guard(reg.mutex);
+        reg.live.push_back(slots);
+    }
+    static thread_local SlotsGuard slots_guard(slots);
+    tls_slots = slots;
+    return slots;
+}
+
+inline ProbeSlot& get_slot(aku_ProbeId probe) {
+    auto slots = tls_slots;
+    if (AKU_UNLIKELY(slots == nullptr)) {
+        slots = register_thread();
+    }
+    return slots->probes[probe];
+}
+
+u64 now_ns() {
+    auto ts = std::chrono::steady_clock::now().time_since_epoch();
+    return static_cast<u64>(std::chrono::duration_cast<std::chrono::nanoseconds>(ts).count());
+}
+
+}  // namespace
+
+// ---------------- //
+// Instrumentation  //
+// ---------------- //
+
+u64 Instrumentation::enter(aku_ProbeId probe) {
+    if (!g_probes_enabled.load(std::memory_order_relaxed)) {
+        return 0;
+    }
+    auto& slot = get_slot(probe);
+    u64 n = slot.events.load(std::memory_order_relaxed);
+    slot.events.store(n + 1, std::memory_order_relaxed);
+    if (n % SAMPLE_RATE != 0) {
+        return 0;
+    }
+    return now_ns();
+}
+
+void Instrumentation::leave(aku_ProbeId probe, u64 start) {
+    if (start == 0) {
+        return;
+    }
+    u64 end = now_ns();
+    get_slot(probe).add(end - start);
+}
+
+void Instrumentation::set_enabled(bool enabled) {
+    g_probes_enabled.store(enabled);
+}
+
+bool Instrumentation::is_enabled() {
+    return g_probes_enabled.load();
+}
+
+LatencyHistogram Instrumentation::get_histogram(aku_ProbeId probe) {
+    auto& reg = Registry::get();
+    std::lock_guard<std::mutex> guard(reg.mutex);
+    LatencyHistogram result = reg.retired[probe];
+    for (auto slots: reg.live) {
+        slots->probes[probe].copy_to(&result);
+    }
+    return result;
+}
+
+u64 Instrumentation::get_count(aku_ProbeId probe) {
+    auto& reg = Registry::get();
+    std::lock_guard<std::mutex> guard(reg.mutex);
+    u64 result = reg.retired_events[probe];
+    for (auto slots: reg.live) {
+        result += slots->probes[probe].events.load(std::memory_order_relaxed);
+    }
+    return result;
+}
+
+const char* Instrumentation::probe_name(aku_ProbeId probe) {
+    switch (probe) {
+    case AKU_PROBE_PROTOCOL_PARSE:
+        return "protocol_parse";
+    case AKU_PROBE_SERIES_LOOKUP:
+        return "series_lookup";
+    case AKU_PROBE_NBTREE_APPEND:
+        return "nbtree_append";
+    case AKU_PROBE_LEAF_COMMIT:
+        return "leaf_commit";
+    case AKU_PROBE_APPEND_BLOCK:
+        return "append_block";
+    case AKU_PROBE_FLUSH:
+        return "flush";
+    case AKU_PROBE_QUERY_PLANNING:
+        return "query_planning";
+    case AKU_PROBE_OPERATOR_READ:
+        return "operator_read";
+    case AKU_PROBE_OUTPUT_FORMATTING:
+        return "output_formatting";
+    case AKU_PROBE_MAX:
+        break;
+    };
+    return "unknown";
+}
+
+boost::property_tree::ptree Instrumentation::get_stats() {
+    boost::property_tree::ptree result;
+    for (int i = 0; i < AKU_PROBE_MAX; i++) {
+        auto probe = static_cast<aku_ProbeId>(i);
+        auto hist  = get_histogram(probe);
+        boost::property_tree::ptree item;
+        item.add("count", get_count(probe));
+        item.add("sampled", hist.count);
+        item.add("mean_ns", hist.count ? hist.sum / hist.count : 0);
+        item.add("p50_ns", hist.quantile(0.5));
+        item.add("p90_ns", hist.quantile(0.9));
+        item.add("p99_ns", hist.quantile(0.99));
+        item.add("p999_ns", hist.quantile(0.999));
+        item.add("max_ns", hist.max);
+        result.add_child(probe_name(probe), item);
+    }
+    return result;
+}
+
+// -------------- //
+// Query counters //
+// -------------- //
+
+static thread_local QueryCounters* tls_query_counters = nullptr;
+
+QueryCounters::QueryCounters()
+    : blocks_read(0)
+    , blocks_zero_copy(0)
+    , blocks_cached(0)
+    , leaves_decoded(0)
+    , superblocks_decoded(0)
+    , subtrees_reused(0)
+{
+}
+
+QueryCounters* QueryCounters::current() {
+    return tls_query_counters;
+}
+
+QueryCountersScope::QueryCountersScope(QueryCounters* counters)
+    : prev_(tls_query_counters)
+{
+    tls_query_counters = counters;
+}
+
+QueryCountersScope::~QueryCountersScope() {
+    tls_query_counters = prev_;
+}
+
+void Instrumentation::reset() {
+    auto& reg = Registry::get();
+    std::lock_guard<std::mutex> guard(reg.mutex);
+    for (int i = 0; i < AKU_PROBE_MAX; i++) {
+        reg.retired[i] = LatencyHistogram();
+        reg.retired_events[i] = 0;
+    }
+    for (auto slots: reg.live) {
+        for (auto& slot: slots->probes) {
+            slot.events.store(0, std::memory_order_relaxed);
+            slot.count.store(0, std::memory_order_relaxed);
+            slot.sum.store(0, std::memory_order_relaxed);
+            slot.max.store(0, std::memory_order_relaxed);
+            for (auto& b: slot.buckets) {
+                b.store(0, std::memory_order_relaxed);
+            }
+        }
+    }
+}
+
+// ----------------- //
+// Memory accounting //
+// ----------------- //
+
+namespace {
+
+struct MemoryCounters {
+    std::atomic<i64> bytes;
+    std::atomic<i64> objects;
+};
+
+//! Constant-initialized so static objects can report their memory during initialization
+static MemoryCounters g_memory[AKU_MEM_MAX] = {};
+
+}  // namespace
+
+void MemoryAccounting::add(aku_MemoryCategory cat, i64 bytes, i64 objects) {
+    if (bytes) {
+        g_memory[cat].bytes.fetch_add(bytes, std::memory_order_relaxed);
+    }
+    if (objects) {
+        g_memory[cat].objects.fetch_add(objects, std::memory_order_relaxed);
+    }
+}
+
+i64 MemoryAccounting::get_bytes(aku_MemoryCategory cat) {
+    return g_memory[cat].bytes.load(std::memory_order_relaxed);
+}
+
+i64 MemoryAccounting::get_objects(aku_MemoryCategory cat) {
+    return g_memory[cat].objects.load(std::memory_order_relaxed);
+}
+
+const char* MemoryAccounting::category_name(aku_MemoryCategory cat) {
+    switch (cat) {
+    case AKU_MEM_INDEX_POOL:
+        return "index.pool";
+    case AKU_MEM_INDEX_TABLES:
+        return "index.tables";
+    case AKU_MEM_INDEX_POSTINGS:
+        return "index.postings";
+    case AKU_MEM_INDEX_TOPOLOGY:
+        return "index.topology";
+    case AKU_MEM_MATCHER_TABLES:
+        return "series_matcher.tables";
+    case AKU_MEM_MATCHER_POOL:
+        return "series_matcher.pool";
+    case AKU_MEM_NBTREE_LEAVES:
+        return "nbtree.leaves";
+    case AKU_MEM_NBTREE_SUPERBLOCKS:
+        return "nbtree.superblocks";
+    case AKU_MEM_CSTORE_COLUMNS:
+        return "column_store.columns";
+    case AKU_MEM_CSTORE_SESSIONS:
+        return "column_store.sessions";
+    case AKU_MEM_CURSOR_BUFFERS:
+        return "cursors.buffers";
+    case AKU_MEM_CONNECTION_BUFFERS:
+        return "connections.buffers";
+    case AKU_MEM_BLOCK_CACHE:
+        return "block_cache.blocks";
+    case AKU_MEM_MAX:
+        break;
+    };
+    return "unknown";
+}
+
+boost::property_tree::ptree MemoryAccounting::get_stats() {
+    boost::property_tree::ptree result;
+    i64 total_bytes = 0;
+    i64 total_objects = 0;
+    for (int i = 0; i < AKU_MEM_MAX; i++) {
+        auto cat = static_cast<aku_MemoryCategory>(i);
+        auto bytes = get_bytes(cat);
+        auto objects = get_objects(cat);
+        std::string path = category_name(cat);
+        result.put(path + ".bytes", bytes);
+        result.put(path + ".objects", objects);
+        // Update subtree totals
+        std::string parent = path.substr(0, path.find('.'));
+        result.put(parent + ".total_bytes", result.get<i64>(parent + ".total_bytes", 0) + bytes);
+        total_bytes += bytes;
+        total_objects += objects;
+    }
+    result.put("total_bytes", total_bytes);
+    result.put("total_objects", total_objects);
+    return result;
+}
+
+}  // namespace
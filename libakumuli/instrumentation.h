@@ -0,0 +1,239 @@
+/**
+ * PRIVATE HEADER
+ *
+ * Hot-path instrumentation: per-thread event counters and latency histograms.
+ *
+ * Copyright (c) 2017 Eugene Lazin <4lazin@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#pragma once
+
+#include "akumuli.h"
+
+#include <atomic>
+#include <vector>
+
+#include <boost/property_tree/ptree.hpp>
+
+namespace Akumuli {
+
+/** Log-linear latency histogram (HDR-style).
+  * Values below 16 are stored exactly, larger values are stored with 16 sub-buckets
+  * per power of two (relative error is below 6.25%). Values larger than 2^40ns are
+  * clamped.
+  */
+struct LatencyHistogram {
+    enum {
+        SUB_BUCKET_BITS = 4,
+        SUB_BUCKETS     = 1 << SUB_BUCKET_BITS,
+        MAX_VALUE_BITS  = 40,
+        NBUCKETS        = (MAX_VALUE_BITS - SUB_BUCKET_BITS + 1) * SUB_BUCKETS,
+    };
+
+    u64 count;
+    u64 sum;
+    u64 max;
+    u64 buckets[NBUCKETS];
+
+    LatencyHistogram();
+
+    //! Get bucket index for the value
+    static int bucket_index(u64 value);
+
+    //! Get largest value that maps to the bucket
+    static u64 bucket_upper_bound(int index);
+
+    //! Add value to histogram
+    void add(u64 value);
+
+    //! Merge another histogram into this one
+    void merge(LatencyHistogram const& other);
+
+    //! Get value at quantile q (0 <= q <= 1)
+    u64 quantile(double q) const;
+};
+
+/** Global instrumentation registry.
+  * Each thread writes to its own slot without synchronization (relaxed atomics, single writer),
+  * slots are merged only when stats are requested. Latency is sampled (one event out of
+  * SAMPLE_RATE) to keep clock reads off the hot path, event counts are exact.
+  */
+struct Instrumentation {
+    enum {
+        SAMPLE_RATE = 64,
+    };
+
+    //! Returns non-zero start time if event should be timed
+    static u64 enter(aku_ProbeId probe);
+
+    //! Finish event started by `enter`
+    static void leave(aku_ProbeId probe, u64 start);
+
+    //! Enable or disable all probes
+    static void set_enabled(bool enabled);
+
+    static bool is_enabled();
+
+    //! Get merged histogram for the probe
+    static LatencyHistogram get_histogram(aku_ProbeId probe);
+
+    //! Get total number of events registered by the probe
+    static u64 get_count(aku_ProbeId probe);
+
+    //! Get probe name
+    static const char* probe_name(aku_ProbeId probe);
+
+    //! Get stats for all probes
+    static boost::property_tree::ptree get_stats();
+
+    //! Reset all counters (used by tests)
+    static void reset();
+};
+
+/** Per-query storage counters.
+  * Counters are collected only when the query profiling is enabled or when the query is
+  * executed inside of the `QueryCountersScope`.
+  * Query is executed by a single thread so counters don't need to be atomic.
+  */
+struct QueryCounters {
+    u64 blocks_read;            //< Blocks read from the block store
+    u64 blocks_zero_copy;       //< Blocks accessed through mmap without copying
+    u64 blocks_cached;          //< Blocks found in the block cache
+    u64 leaves_decoded;         //< Leaf nodes decompressed
+    u64 superblocks_decoded;    //< Inner nodes read
+    u64 subtrees_reused;        //< Subtrees answered from SubtreeRef without decompression
+
+    QueryCounters();
+
+    //! Get counters of the current thread (or nullptr if profiling is not enabled)
+    static QueryCounters* current();
+
+    //! Increment counter if profiling is enabled
+    static void inc(u64 QueryCounters::*counter) {
+        auto counters = current();
+        if (counters) {
+            counters->*counter += 1;
+        }
+    }
+};
+
+//! Enables query counters in the current thread
+class QueryCountersScope {
+    QueryCounters* prev_;
+public:
+    QueryCountersScope(QueryCounters* counters);
+    ~QueryCountersScope();
+
+    QueryCountersScope(QueryCountersScope const&) = delete;
+    QueryCountersScope& operator = (QueryCountersScope const&) = delete;
+};
+
+/** RAII probe.
+  * Usage: `ProbeScope probe(AKU_PROBE_FLUSH);` at the beginning of the scope.
+  */
+class ProbeScope {
+    aku_ProbeId probe_;
+    u64 start_;
+    bool active_;
+public:
+    ProbeScope(aku_ProbeId probe)
+        : probe_(probe)
+        , start_(Instrumentation::enter(probe))
+        , active_(true)
+    {
+    }
+
+    ~ProbeScope() {
+        leave();
+    }
+
+    //! Leave the probe before the end of the scope
+    void leave() {
+        if (active_) {
+            active_ = false;
+            Instrumentation::leave(probe_, start_);
+        }
+    }
+
+    ProbeScope(ProbeScope const&) = delete;
+    ProbeScope& operator = (ProbeScope const&) = delete;
+};
+
+/** Global memory accounting.
+  * Data structures report their size changes when they grow or shrink, so the breakdown
+  * can be read at any time without walking the structures under locks. Sizes are estimates:
+  * node-based containers are accounted by the number of nodes and buckets, allocator
+  * overhead is not included.
+  */
+struct MemoryAccounting {
+    //! Add (or remove if negative) bytes and objects to the category
+    static void add(aku_MemoryCategory cat, i64 bytes, i64 objects);
+
+    static i64 get_bytes(aku_MemoryCategory cat);
+
+    static i64 get_objects(aku_MemoryCategory cat);
+
+    //! Get category path in stats tree (e.g. "index.pool")
+    static const char* category_name(aku_MemoryCategory cat);
+
+    //! Get memory usage tree with bytes and object counts (subtrees contain totals)
+    static boost::property_tree::ptree get_stats();
+};
+
+/** Memory usage of a single object in some category.
+  * Holds the amount that the owner reported and releases it in d-tor.
+  */
+class MemoryTracker {
+    aku_MemoryCategory cat_;
+    i64 bytes_;
+    i64 objects_;
+public:
+    MemoryTracker(aku_MemoryCategory cat, i64 bytes = 0, i64 objects = 0)
+        : cat_(cat)
+        , bytes_(bytes)
+        , objects_(objects)
+    {
+        MemoryAccounting::add(cat_, bytes_, objects_);
+    }
+
+    ~MemoryTracker() {
+        MemoryAccounting::add(cat_, -bytes_, -objects_);
+    }
+
+    MemoryTracker(MemoryTracker const&) = delete;
+    MemoryTracker& operator = (MemoryTracker const&) = delete;
+
+    //! Set new size of the object (only the difference is reported)
+    void set(i64 bytes, i64 objects) {
+        MemoryAccounting::add(cat_, bytes - bytes_, objects - objects_);
+        bytes_   = bytes;
+        objects_ = objects;
+    }
+
+    //! Add to the size of the object
+    void add(i64 bytes, i64 objects) {
+        set(bytes_ + bytes, objects_ + objects);
+    }
+};
+
+//! Approximate memory used by the node-based hash table (nodes and buckets array)
+template<class Table>
+i64 hashtable_memory_use(Table const& table) {
+    const size_t node_size = sizeof(typename Table::value_type) + 2*sizeof(void*);
+    return static_cast<i64>(table.size() * node_size + table.bucket_count() * sizeof(void*));
+}
+
+}  // namespace
@@ -19,6 +19,8 @@
 #include "util.h"
 #include "log_iface.h"
 
+#include <iomanip>
+#include <limits>
 #include <sstream>
 
 #include <boost/lexical_cast.hpp>
@@ -93,15 +95,28 @@ MetadataStorage::MetadataStorage(const char* db)
     }
 }
 
-void MetadataStorage::sync_with_metadata_storage(std::function<void(std::vector<SeriesT>*)> pull_new_names) {
+void MetadataStorage::sync_with_metadata_storage(std::function<void(std::vector<SeriesT>*)> pull_new_names,
+                                                 std::function<std::unordered_map<aku_ParamId, ActivityT>()> pull_activity)
+{
     // Make temporary copies under the lock
     std::vector<PlainSeriesMatcher::SeriesNameT>           newnames;
     std::unordered_map<aku_ParamId, std::vector<u64>> rescue_points;
     std::unordered_map<u32, VolumeDesc>               volume_records;
+    std::unordered_map<aku_ParamId, ActivityT>        activity;
+    std::unordered_map<u32, VolumeSummary>            summaries;
     {
         std::lock_guard<std::mutex> guard(sync_lock_);
         std::swap(rescue_points, pending_rescue_points_);
         std::swap(volume_records, pending_volumes_);
+        std::swap(activity, pending_activity_);
+        std::swap(summaries, pending_summaries_);
+    }
+    if (pull_activity) {
+        // Activity is updated before the rescue points are added, ranges pulled
+        // after the swap cover all rescue points saved by this sync
+        for (auto const& kv: pull_activity()) {
+            activity[kv.first] = kv.second;
+        }
     }
     pull_new_names(&newnames);
 
@@ -115,6 +130,12 @@ void MetadataStorage::sync_with_metadata_storage(std::function<void(std::vector<
     // Save volume records
     upsert_volume_records(std::move(volume_records));
 
+    // Save series activity
+    upsert_series_activity(std::move(activity));
+
+    // Save volume summaries
+    upsert_volume_summaries(std::move(summaries));
+
     end_transaction();
 }
 
@@ -180,6 +201,25 @@ void MetadataStorage::create_tables() {
             "addr7 INTEGER"
             ");";
     execute_query(query);
+
+    query =
+            "CREATE TABLE IF NOT EXISTS akumuli_series_activity("
+            "storage_id INTEGER PRIMARY KEY UNIQUE,"
+            "first_ts INTEGER,"
+            "last_ts INTEGER"
+            ");";
+    execute_query(query);
+
+    query =
+            "CREATE TABLE IF NOT EXISTS akumuli_volume_summaries("
+            "id INTEGER PRIMARY KEY UNIQUE,"
+            "generation INTEGER,"
+            "begin_ts INTEGER,"
+            "end_ts INTEGER,"
+            "filter_nblocks INTEGER,"
+            "filter TEXT"
+            ");";
+    execute_query(query);
 }
 
 void MetadataStorage::init_config(const char* db_name,
@@ -220,6 +260,14 @@ bool MetadataStorage::get_config_param(const std::string name, std::string* resu
     return true;
 }
 
+void MetadataStorage::set_config_param(const std::string name, const std::string value, const std::string comment)
+{
+    std::stringstream query;
+    query << "INSERT OR REPLACE INTO akumuli_configuration (name, value, comment)" << std::endl;
+    query << "\tVALUES ('" << name << "', '" << value << "', '" << comment << "');" << std::endl;
+    execute_query(query.str());
+}
+
 void MetadataStorage::init_volumes(std::vector<VolumeDesc> volumes) {
     std::stringstream query;
     query << "INSERT INTO akumuli_volumes (id, path, version, nblocks, capacity, generation)" << std::endl;
@@ -283,6 +331,17 @@ std::vector<MetadataStorage::UntypedTuple> MetadataStorage::select_query(const c
     return tuples;
 }
 
+//! Timestamps that big can't be represented in SQLite
+static i64 timestamp_to_sql(aku_Timestamp ts) {
+    return ts > static_cast<aku_Timestamp>(std::numeric_limits<i64>::max())
+         ? std::numeric_limits<i64>::max()
+         : static_cast<i64>(ts);
+}
+
+static aku_Timestamp timestamp_from_sql(i64 ts) {
+    return ts == std::numeric_limits<i64>::max() ? AKU_MAX_TIMESTAMP : static_cast<aku_Timestamp>(ts);
+}
+
 std::vector<MetadataStorage::VolumeDesc> MetadataStorage::get_volumes() const {
     const char* query =
             "SELECT id, path, version, nblocks, capacity, generation FROM akumuli_volumes;";
@@ -303,6 +362,34 @@ std::vector<MetadataStorage::VolumeDesc> MetadataStorage::get_volumes() const {
     return tuples;
 }
 
+std::vector<MetadataStorage::VolumeSummary> MetadataStorage::get_volume_summaries() const {
+    const char* query =
+            "SELECT id, generation, begin_ts, end_ts, filter_nblocks, filter FROM akumuli_volume_summaries;";
+    std::vector<VolumeSummary> result;
+    try {
+        auto untyped = select_query(query);
+        for (auto const& row: untyped) {
+            if (row.size() != 6 || row.at(5).empty() || row.at(5).size() % 16 != 0) {
+                continue;
+            }
+            VolumeSummary summary;
+            summary.id             = boost::lexical_cast<u32>(row.at(0));
+            summary.generation     = boost::lexical_cast<u32>(row.at(1));
+            summary.begin          = timestamp_from_sql(boost::lexical_cast<i64>(row.at(2)));
+            summary.end            = timestamp_from_sql(boost::lexical_cast<i64>(row.at(3)));
+            summary.filter_nblocks = boost::lexical_cast<u32>(row.at(4));
+            for (size_t i = 0; i < row.at(5).size(); i += 16) {
+                summary.filter.push_back(std::stoull(row.at(5).substr(i, 16), nullptr, 16));
+            }
+            result.push_back(summary);
+        }
+    } catch(...) {
+        Logger::msg(AKU_LOG_ERROR, boost::current_exception_diagnostic_information().c_str());
+        result.clear();
+    }
+    return result;
+}
+
 void MetadataStorage::add_volume(const VolumeDesc &vol) {
     std::string query =
              "INSERT INTO akumuli_volumes (id, path, version, nblocks, capacity, generation) VALUES ";
@@ -369,12 +456,32 @@ void MetadataStorage::add_rescue_point(aku_ParamId id, std::vector<u64>&& val) {
     sync_cvar_.notify_one();
 }
 
+void MetadataStorage::add_series_activity(std::unordered_map<aku_ParamId, ActivityT>&& ranges) {
+    std::lock_guard<std::mutex> guard(sync_lock_);
+    for (auto const& kv: ranges) {
+        pending_activity_[kv.first] = kv.second;
+    }
+}
+
 void MetadataStorage::update_volume(const VolumeDesc& vol) {
     std::lock_guard<std::mutex> guard(sync_lock_);
     pending_volumes_[vol.id] = vol;
     sync_cvar_.notify_one();
 }
 
+void MetadataStorage::update_volume_summary(const VolumeSummary& summary) {
+    std::lock_guard<std::mutex> guard(sync_lock_);
+    auto it = pending_summaries_.find(summary.id);
+    if (it != pending_summaries_.end() && summary.filter.empty() && it->second.generation == summary.generation) {
+        // Keep the filter that wasn't saved yet
+        it->second.begin          = summary.begin;
+        it->second.end            = summary.end;
+        it->second.filter_nblocks = summary.filter_nblocks;
+    } else {
+        pending_summaries_[summary.id] = summary;
+    }
+}
+
 std::string MetadataStorage::get_dbname() {
     std::string dbname;
     bool success = get_config_param("db_name", &dbname);
@@ -466,6 +573,67 @@ void MetadataStorage::upsert_rescue_points(std::unordered_map<aku_ParamId, std::
 
 }
 
+void MetadataStorage::upsert_series_activity(std::unordered_map<aku_ParamId, ActivityT>&& input) {
+    if (input.empty()) {
+        return;
+    }
+    std::stringstream query;
+    typedef std::pair<aku_ParamId, ActivityT> ValueT;
+    std::vector<ValueT> items(input.begin(), input.end());
+    while(!items.empty()) {
+        const size_t batchsize = 500;  // This limit is defined by SQLITE_MAX_COMPOUND_SELECT
+        const size_t newsize = items.size() > batchsize ? items.size() - batchsize : 0;
+        std::vector<ValueT> batch(items.begin() + static_cast<ssize_t>(newsize), items.end());
+        items.resize(newsize);
+        query << "INSERT OR REPLACE INTO akumuli_series_activity (storage_id, first_ts, last_ts) VALUES ";
+        size_t ix = 0;
+        for (auto const& kv: batch) {
+            query << "(" << kv.first << ", "
+                         << timestamp_to_sql(kv.second.first) << ", "
+                         << timestamp_to_sql(kv.second.second) << ")";
+            ix++;
+            if (ix == batch.size()) {
+                query << ";\n";
+            } else {
+                query << ",";
+            }
+        }
+    }
+    execute_query(query.str());
+}
+
+void MetadataStorage::upsert_volume_summaries(std::unordered_map<u32, VolumeSummary>&& input) {
+    if (input.empty()) {
+        return;
+    }
+    std::stringstream query;
+    query << std::hex << std::setfill('0');
+    for (auto const& kv: input) {
+        auto const& summary = kv.second;
+        if (summary.filter.empty()) {
+            // Time range only, filter that was saved earlier is preserved
+            query << "UPDATE akumuli_volume_summaries SET "
+                  << std::dec
+                  << "begin_ts = " << timestamp_to_sql(summary.begin) << ", "
+                  << "end_ts = " << timestamp_to_sql(summary.end) << ", "
+                  << "filter_nblocks = " << summary.filter_nblocks
+                  << " WHERE id = " << summary.id << " AND generation = " << summary.generation << ";\n";
+            continue;
+        }
+        query << "INSERT OR REPLACE INTO akumuli_volume_summaries (id, generation, begin_ts, end_ts, filter_nblocks, filter) VALUES ("
+              << std::dec << summary.id << ", "
+              << summary.generation << ", "
+              << timestamp_to_sql(summary.begin) << ", "
+              << timestamp_to_sql(summary.end) << ", "
+              << summary.filter_nblocks << ", \"" << std::hex;
+        for (auto word: summary.filter) {
+            query << std::setw(16) << word;
+        }
+        query << "\");\n";
+    }
+    execute_query(query.str());
+}
+
 void MetadataStorage::insert_new_names(std::vector<SeriesT> &&items) {
     if (items.size() == 0) {
         return;
@@ -543,6 +711,26 @@ aku_Status MetadataStorage::load_matcher_data(SeriesMatcherBase& matcher) {
     return AKU_SUCCESS;
 }
 
+aku_Status MetadataStorage::load_series_activity(std::unordered_map<aku_ParamId, ActivityT>& mapping) {
+    auto query = "SELECT storage_id, first_ts, last_ts FROM akumuli_series_activity;";
+    try {
+        auto results = select_query(query);
+        for(auto row: results) {
+            if (row.size() != 3) {
+                continue;
+            }
+            auto id    = boost::lexical_cast<u64>(row.at(0));
+            auto first = boost::lexical_cast<i64>(row.at(1));
+            auto last  = boost::lexical_cast<i64>(row.at(2));
+            mapping[id] = std::make_pair(timestamp_from_sql(first), timestamp_from_sql(last));
+        }
+    } catch(...) {
+        Logger::msg(AKU_LOG_ERROR, boost::current_exception_diagnostic_information().c_str());
+        return AKU_EGENERAL;
+    }
+    return AKU_SUCCESS;
+}
+
 aku_Status MetadataStorage::load_rescue_points(std::unordered_map<u64, std::vector<u64>>& mapping) {
     auto query =
         "SELECT storage_id, addr0, addr1, addr2, addr3,"
@@ -55,6 +55,7 @@ struct MetadataStorage : VolumeRegistry {
     typedef std::unique_ptr<apr_dbd_t, AprHandleDeleter> HandleT;
     typedef apr_dbd_prepared_t* PreparedT;
     typedef PlainSeriesMatcher::SeriesNameT SeriesT;
+    typedef std::pair<aku_Timestamp, aku_Timestamp> ActivityT;
 
     // Members
     PoolT           pool_;
@@ -67,6 +68,8 @@ struct MetadataStorage : VolumeRegistry {
     std::condition_variable                           sync_cvar_;
     std::unordered_map<aku_ParamId, std::vector<u64>> pending_rescue_points_;
     std::unordered_map<u32, VolumeDesc>               pending_volumes_;
+    std::unordered_map<aku_ParamId, ActivityT>        pending_activity_;
+    std::unordered_map<u32, VolumeSummary>            pending_summaries_;
 
     /** Create new or open existing db.
       * @throw std::runtime_error in a case of error
@@ -103,6 +106,11 @@ struct MetadataStorage : VolumeRegistry {
      */
     virtual void add_volume(const VolumeDesc& vol);
 
+    /** Read content summaries of the volumes.
+      * Empty list is returned if summaries can't be read.
+      */
+    virtual std::vector<VolumeSummary> get_volume_summaries() const;
+
     /**
      * @brief Get value of the configuration parameter
      * @param param_name is a name of the configuration parameter
@@ -111,6 +119,14 @@ struct MetadataStorage : VolumeRegistry {
      */
     bool get_config_param(const std::string param_name, std::string* value);
 
+    /**
+     * @brief Set value of the configuration parameter (existing value is replaced)
+     * @param param_name is a name of the configuration parameter
+     * @param value is a parameter value
+     * @param comment is a parameter description
+     */
+    void set_config_param(const std::string param_name, const std::string value, const std::string comment);
+
     /** Read larges series id */
     boost::optional<u64> get_prev_largest_id();
 
@@ -118,20 +134,39 @@ struct MetadataStorage : VolumeRegistry {
 
     aku_Status load_rescue_points(std::unordered_map<u64, std::vector<u64>>& mapping);
 
+    //! Read time ranges of the series (see SeriesActivityIndex)
+    aku_Status load_series_activity(std::unordered_map<aku_ParamId, ActivityT>& mapping);
+
     // Synchronization
 
     void add_rescue_point(aku_ParamId id, std::vector<u64>&& val);
 
+    /** Add/update time ranges of the series asynchronously.
+      * Ranges are saved with the next sync, they don't trigger sync themselves.
+      */
+    void add_series_activity(std::unordered_map<aku_ParamId, ActivityT>&& ranges);
+
     /**
      * @brief Add/update volume metadata asynchronously
      * @param vol is a volume description
      */
     virtual void update_volume(const VolumeDesc& vol);
+
+    /** Add/update volume summary asynchronously.
+      * Summary is saved with the next sync, it doesn't trigger sync itself.
+      */
+    virtual void update_volume_summary(const VolumeSummary& summary);
     virtual std::string get_dbname();
 
     aku_Status wait_for_sync_request(int timeout_us);
 
-    void sync_with_metadata_storage(std::function<void(std::vector<SeriesT>*)> pull_new_names);
+    /** Save all pending changes in one transaction.
+      * @param pull_new_names should return new series names
+      * @param pull_activity should return updated series activity ranges, it's called after
+      *        pending rescue points are taken so every saved rescue point has its activity range
+      */
+    void sync_with_metadata_storage(std::function<void(std::vector<SeriesT>*)> pull_new_names,
+                                    std::function<std::unordered_map<aku_ParamId, ActivityT>()> pull_activity = nullptr);
 
     //! Forces `wait_for_sync_request` to return immediately
     void force_sync();
@@ -150,6 +185,10 @@ struct MetadataStorage : VolumeRegistry {
       */
     void upsert_rescue_points(std::unordered_map<aku_ParamId, std::vector<u64> > &&input);
 
+    /** Insert or update time ranges of the series (generate sql query and execute it).
+      */
+    void upsert_series_activity(std::unordered_map<aku_ParamId, ActivityT>&& input);
+
     /**
      * @brief Update volume descriptors
      * This function performs partial update (nblocks, capacity, generation) of the akumuli_volumes
@@ -158,6 +197,10 @@ struct MetadataStorage : VolumeRegistry {
      */
     void upsert_volume_records(std::unordered_map<u32, VolumeDesc>&& input);
 
+    /** Insert or update volume summaries (generate sql query and execute it).
+      */
+    void upsert_volume_summaries(std::unordered_map<u32, VolumeSummary>&& input);
+
 private:
 
     /** Execute query that doesn't return anything.
@@ -0,0 +1,168 @@
+/**
+ * Copyright (c) 2017 Eugene Lazin <4lazin@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "pool.h"
+#include "log_iface.h"
+
+#include <mutex>
+
+// jemalloc control interface, resolved only if jemalloc is linked
+extern "C" int mallctl(const char* name, void* oldp, size_t* oldlenp, void* newp, size_t newlen) __attribute__((weak));
+
+namespace Akumuli {
+
+// --------------- //
+// ThreadLocalPool //
+// --------------- //
+
+namespace {
+
+struct FreeNode {
+    FreeNode* next;
+};
+
+struct FreeList {
+    FreeNode* head;
+    u32       count;
+};
+
+static thread_local bool tls_pool_destroyed = false;
+
+struct PoolCache {
+    FreeList  lists[ThreadLocalPool::NCLASSES];
+    PoolStats stats;
+
+    PoolCache()
+        : lists{}
+        , stats{}
+    {
+    }
+
+    ~PoolCache() {
+        for (auto& list: lists) {
+            while (list.head) {
+                auto next = list.head->next;
+                ::operator delete(list.head);
+                list.head = next;
+            }
+        }
+        tls_pool_destroyed = true;
+    }
+};
+
+PoolCache* get_pool_cache() {
+    if (tls_pool_destroyed) {
+        return nullptr;
+    }
+    static thread_local PoolCache cache;
+    return &cache;
+}
+
+inline size_t size_class(size_t size) {
+    return (size + ThreadLocalPool::GRANULARITY - 1) / ThreadLocalPool::GRANULARITY - 1;
+}
+
+}  // namespace
+
+void* ThreadLocalPool::allocate(size_t size) {
+    if (size == 0 || size > MAX_SIZE) {
+        return ::operator new(size);
+    }
+    auto ix = size_class(size);
+    auto cache = get_pool_cache();
+    if (cache) {
+        auto& list = cache->lists[ix];
+        if (list.head) {
+            auto node = list.head;
+            list.head = node->next;
+            list.count--;
+            cache->stats.hits++;
+            return node;
+        }
+        cache->stats.misses++;
+    }
+    return ::operator new((ix + 1) * GRANULARITY);
+}
+
+void ThreadLocalPool::deallocate(void* ptr, size_t size) {
+    if (ptr == nullptr) {
+        return;
+    }
+    if (size == 0 || size > MAX_SIZE) {
+        ::operator delete(ptr);
+        return;
+    }
+    auto cache = get_pool_cache();
+    if (cache) {
+        auto& list = cache->lists[size_class(size)];
+        if (list.count < MAX_CACHED) {
+            auto node = static_cast<FreeNode*>(ptr);
+            node->next = list.head;
+            list.head = node;
+            list.count++;
+            return;
+        }
+    }
+    ::operator delete(ptr);
+}
+
+PoolStats ThreadLocalPool::get_stats() {
+    auto cache = get_pool_cache();
+    if (cache) {
+        return cache->stats;
+    }
+    return PoolStats{};
+}
+
+// ------------- //
+// Malloc arenas //
+// ------------- //
+
+void bind_thread_arena(ThreadClass cls) {
+    enum {
+        NCLASSES = 3,
+    };
+    static std::mutex mutex;
+    static unsigned arenas[NCLASSES] = {};
+    static bool created[NCLASSES] = {};
+    if (mallctl == nullptr) {
+        return;
+    }
+    auto ix = static_cast<int>(cls);
+    unsigned arena = 0;
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        if (!created[ix]) {
+            size_t sz = sizeof(unsigned);
+            // jemalloc 5 uses `arenas.create`, older versions use `arenas.extend`
+            if (mallctl("arenas.create", &arena, &sz, nullptr, 0) != 0 &&
+                mallctl("arenas.extend", &arena, &sz, nullptr, 0) != 0)
+            {
+                Logger::msg(AKU_LOG_INFO, "Can't create malloc arena");
+                return;
+            }
+            arenas[ix] = arena;
+            created[ix] = true;
+        }
+        arena = arenas[ix];
+    }
+    if (mallctl("thread.arena", nullptr, nullptr, &arena, sizeof(arena)) != 0) {
+        Logger::msg(AKU_LOG_INFO, "Can't bind thread to malloc arena " + std::to_string(arena));
+    }
+}
+
+}  // namespace
@@ -0,0 +1,179 @@
+/**
+ * PRIVATE HEADER
+ *
+ * Thread-local memory pools for the per-sample and per-query paths.
+ *
+ * Copyright (c) 2017 Eugene Lazin <4lazin@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#pragma once
+
+#include "akumuli.h"
+
+#include <memory>
+#include <vector>
+
+namespace Akumuli {
+
+struct PoolStats {
+    u64 hits;       //< Allocations served from the pool
+    u64 misses;     //< Allocations passed to the system allocator
+};
+
+/** Thread-local size-class pool for small objects.
+  * Sizes are rounded up to GRANULARITY, objects larger than MAX_SIZE are passed through
+  * to the system allocator. Freed chunks are cached by the thread that frees them (up to
+  * MAX_CACHED chunks per size class), so memory can migrate between threads but can't
+  * accumulate without bound. Queries are executed by a dedicated thread so the pool
+  * effectively works as a per-query arena that is released when the query completes.
+  */
+struct ThreadLocalPool {
+    enum {
+        GRANULARITY = 16,
+        MAX_SIZE    = 512,
+        NCLASSES    = MAX_SIZE / GRANULARITY,
+        MAX_CACHED  = 256,
+    };
+
+    static void* allocate(size_t size);
+
+    //! Size should be the same as in `allocate` call
+    static void deallocate(void* ptr, size_t size);
+
+    //! Get stats of the current thread
+    static PoolStats get_stats();
+};
+
+/** Standard allocator that uses ThreadLocalPool for single objects.
+  * Use with `std::allocate_shared` to pool both object and control block.
+  */
+template<class T>
+struct PoolAllocator {
+    typedef T value_type;
+
+    PoolAllocator() = default;
+
+    template<class U>
+    PoolAllocator(PoolAllocator<U> const&) {}
+
+    T* allocate(size_t n) {
+        if (n == 1) {
+            return static_cast<T*>(ThreadLocalPool::allocate(sizeof(T)));
+        }
+        return static_cast<T*>(::operator new(n * sizeof(T)));
+    }
+
+    void deallocate(T* ptr, size_t n) {
+        if (n == 1) {
+            ThreadLocalPool::deallocate(ptr, sizeof(T));
+        } else {
+            ::operator delete(ptr);
+        }
+    }
+};
+
+template<class T, class U>
+bool operator == (PoolAllocator<T> const&, PoolAllocator<U> const&) { return true; }
+
+template<class T, class U>
+bool operator != (PoolAllocator<T> const&, PoolAllocator<U> const&) { return false; }
+
+//! Create shared object using ThreadLocalPool
+template<class T, class... Args>
+std::shared_ptr<T> make_pooled(Args&&... args) {
+    return std::allocate_shared<T>(PoolAllocator<T>(), std::forward<Args>(args)...);
+}
+
+/** Base class for objects that are allocated through ThreadLocalPool by `new` operator.
+  * Derived classes that are deleted through the base pointer should have virtual d-tor.
+  */
+struct PooledObject {
+    static void* operator new(size_t size) {
+        return ThreadLocalPool::allocate(size);
+    }
+
+    static void operator delete(void* ptr, size_t size) {
+        ThreadLocalPool::deallocate(ptr, size);
+    }
+};
+
+/** Thread-local cache of the vector buffers.
+  * Used to reuse memory of the temporary buffers (decompressed leaf nodes, block data).
+  */
+template<class T>
+struct BufferPool {
+    enum {
+        MAX_CACHED   = 16,
+        MAX_CAPACITY = 0x10000,
+    };
+
+    //! Replace content of the empty vector with cached buffer (capacity is preserved)
+    static void acquire(std::vector<T>* vec) {
+        auto cache = get_cache();
+        if (cache != nullptr && !cache->empty() && vec->capacity() == 0) {
+            vec->swap(cache->back());
+            cache->pop_back();
+        }
+    }
+
+    //! Return vector's buffer to the cache, vector will be empty
+    static void release(std::vector<T>* vec) {
+        auto cache = get_cache();
+        if (cache != nullptr && cache->size() < MAX_CACHED
+                             && vec->capacity() != 0
+                             && vec->capacity() <= MAX_CAPACITY)
+        {
+            vec->clear();
+            cache->emplace_back();
+            cache->back().swap(*vec);
+        }
+    }
+
+private:
+    typedef std::vector<std::vector<T>> Cache;
+
+    //! Returns nullptr if the thread is exiting and cache is already destroyed
+    static Cache* get_cache() {
+        static thread_local bool destroyed = false;
+        struct Holder {
+            Cache cache;
+            bool* destroyed;
+            ~Holder() {
+                *destroyed = true;
+            }
+        };
+        if (destroyed) {
+            return nullptr;
+        }
+        static thread_local Holder holder = { Cache(), &destroyed };
+        return &holder.cache;
+    }
+};
+
+//! Thread classes, each class uses separate malloc arena (if supported by allocator)
+enum class ThreadClass {
+    INGESTION,
+    QUERY,
+    BACKGROUND,
+};
+
+/** Bind current thread to the jemalloc arena of the thread class.
+  * Threads of the same class have similar allocation patterns and lifetimes, this reduces
+  * fragmentation and contention. Does nothing if jemalloc is not used.
+  */
+void bind_thread_arena(ThreadClass cls);
+
+}  // namespace
@@ -6,8 +6,12 @@ namespace QP {
 Limiter::Limiter(u64 limit, u64 offset, std::shared_ptr<Node> next)
     : limit_(limit)
     , offset_(offset)
+    , skipped_(0)
     , counter_(0)
     , next_(next)
+    , truncated_(false)
+    , last_id_(0)
+    , last_ts_(0)
 {
 }
 
@@ -16,14 +20,18 @@ void Limiter::complete() {
 }
 
 bool Limiter::put(MutableSample &sample) {
-    if (counter_ < offset_) {
+    if (skipped_ < offset_) {
         // continue iteration
+        skipped_++;
         return true;
-    } else if (counter_ >= limit_) {
+    } else if (limit_ != 0 && counter_ >= limit_) {
         // stop iteration
+        truncated_ = true;
         return false;
     }
     counter_++;
+    last_id_ = sample.get_paramid();
+    last_ts_ = sample.get_timestamp();
     return next_->put(sample);
 }
 
@@ -9,10 +9,14 @@ namespace QP {
 
 struct Limiter : Node {
 
-    u64                   limit_;
+    u64                   limit_;     //< Max number of samples (0 - no limit)
     u64                   offset_;
+    u64                   skipped_;
     u64                   counter_;
     std::shared_ptr<Node> next_;
+    bool                  truncated_;  //< Output was stopped by the limit
+    aku_ParamId           last_id_;    //< Last sample passed to the next node
+    aku_Timestamp         last_ts_;
 
     Limiter(u64 limit, u64 offset, std::shared_ptr<Node> next);
 
@@ -5,7 +5,11 @@
 #include <boost/property_tree/json_parser.hpp>
 #include <boost/algorithm/string.hpp>
 #include <boost/exception/diagnostic_information.hpp>
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
 #include <set>
+#include <sstream>
 #include <regex>
 
 #include "datetime.h"
@@ -108,26 +112,12 @@ std::tuple<aku_Status, std::vector<aku_ParamId>> SeriesRetreiver::extract_ids(Se
             ids.push_back(std::get<2>(tup));
         }
         if (metric_.size() > 1) {
+            // Series of the other metrics are found by tag-set id. NOTE: secondary id can be = 0. This means
+            // that there is no such combination of metric and tags. Different strategies can be used to deal
+            // with such cases. Query can leave this element of the tuple blank or discard it.
             std::vector<std::string> tail(metric_.begin() + 1, metric_.end());
-            std::vector<aku_ParamId> full(ids);
-            for (auto metric: tail) {
-                for (auto id: ids) {
-                    StringT name = matcher.id2str(id);
-                    if (name.second == 0) {
-                        // This shouldn't happen but it can happen after memory corruption or data-race.
-                        // Clearly indicates an error.
-                        Logger::msg(AKU_LOG_ERROR, "Matcher data is broken, can read series name for " + std::to_string(id));
-                        AKU_PANIC("Matcher data is broken");
-                    }
-                    std::string series_tags(name.first + first_metric.size(), name.first + name.second);
-                    std::string alt_name = metric + series_tags;
-                    auto sid = matcher.match(alt_name.data(), alt_name.data() + alt_name.size());
-                    full.push_back(sid);  // NOTE: sid (secondary id) can be = 0. This means that there is no such
-                                          // combination of metric and tags. Different strategies can be used to deal with
-                                          // such cases. Query can leave this element of the tuple blank or discard it.
-                }
-            }
-            ids.swap(full);
+            auto secondary = matcher.join(tail, ids);
+            ids.insert(ids.end(), secondary.begin(), secondary.end());
         }
     }
     return std::make_tuple(AKU_SUCCESS, ids);
@@ -487,11 +477,63 @@ static std::pair<u64, u64> parse_limit_offset(boost::property_tree::ptree const&
     }
     auto optoffset = ptree.get_child_optional("offset");
     if (optoffset) {
-        limit = optoffset->get_value<u64>();
+        offset = optoffset->get_value<u64>();
     }
     return std::make_pair(limit, offset);
 }
 
+std::string QueryParser::make_page_token(OrderBy order, aku_ParamId id, aku_Timestamp ts) {
+    std::stringstream str;
+    str << (order == OrderBy::SERIES ? 's' : 't') << std::hex << id << '.' << ts;
+    return str.str();
+}
+
+/** Parse `page-token` field, format:
+  * { "page-token": "" } for the first page and { "page-token": "<token>" }
+  * for the next pages (token is returned by the previous page).
+  * @return status and resume point (disabled for the first page)
+  */
+static std::tuple<aku_Status, bool, ResumePoint> parse_page_token(boost::property_tree::ptree const& ptree, OrderBy order) {
+    ResumePoint result;
+    auto opt = ptree.get_child_optional("page-token");
+    if (!opt) {
+        return std::make_tuple(AKU_SUCCESS, false, result);
+    }
+    if (!ptree.get_child_optional("limit")) {
+        Logger::msg(AKU_LOG_ERROR, "`page-token` can't be used without `limit`");
+        return std::make_tuple(AKU_EQUERY_PARSING_ERROR, true, result);
+    }
+    if (ptree.get_child_optional("offset")) {
+        Logger::msg(AKU_LOG_ERROR, "`page-token` can't be used with `offset`");
+        return std::make_tuple(AKU_EQUERY_PARSING_ERROR, true, result);
+    }
+    auto token = opt->get_value<std::string>();
+    if (token.empty()) {
+        return std::make_tuple(AKU_SUCCESS, true, result);
+    }
+    char expected = order == OrderBy::SERIES ? 's' : 't';
+    std::stringstream str(token.substr(1));
+    char dot = 0;
+    str >> std::hex >> result.id >> dot >> result.timestamp;
+    if (token.at(0) != expected || !str || dot != '.' || !str.eof()) {
+        Logger::msg(AKU_LOG_ERROR, "Invalid page token `" + token + "`");
+        return std::make_tuple(AKU_EQUERY_PARSING_ERROR, true, result);
+    }
+    result.enabled = true;
+    return std::make_tuple(AKU_SUCCESS, true, result);
+}
+
+/** Only select query can be resumed from the page token, other queries would
+  * return the first page again and again.
+  */
+static aku_Status reject_page_token(boost::property_tree::ptree const& ptree) {
+    if (ptree.get_child_optional("page-token")) {
+        Logger::msg(AKU_LOG_ERROR, "`page-token` can be used only with `select` query");
+        return AKU_EQUERY_PARSING_ERROR;
+    }
+    return AKU_SUCCESS;
+}
+
 static std::tuple<aku_Status, aku_Timestamp, aku_Timestamp> parse_range_timestamp(boost::property_tree::ptree const& ptree)
 {
     aku_Timestamp begin = 0, end = 0;
@@ -591,30 +633,520 @@ static std::string to_json(boost::property_tree::ptree const& ptree, bool pretty
 }
 
 
+/** Query JSON reader.
+  * Recursive descent parser that builds the property tree directly. It produces exactly
+  * the same tree as `boost::property_tree::read_json` (array elements have empty keys,
+  * all scalars are stored as text, numbers and literals verbatim) but doesn't use
+  * spirit and iostreams, so small queries are parsed several times faster.
+  */
+class QueryJsonReader {
+    typedef boost::property_tree::ptree PTree;
+
+    //! Nesting limit, real queries have depth < 10
+    static const int MAX_DEPTH = 64;
+
+    const char* begin_;
+    const char* pos_;
+    const char* end_;
+    std::string error_;
+    std::string scratch_;  //< Value of the skipped scalar
+
+    bool fail(const char* msg) {
+        if (error_.empty()) {
+            error_ = std::string(msg) + " at position " + std::to_string(pos_ - begin_);
+        }
+        return false;
+    }
+
+    void skip_ws() {
+        while (pos_ < end_ && (*pos_ == ' ' || *pos_ == '\t' || *pos_ == '\n' || *pos_ == '\r')) {
+            pos_++;
+        }
+    }
+
+    bool expect(char c) {
+        skip_ws();
+        if (pos_ == end_ || *pos_ != c) {
+            return fail("unexpected character");
+        }
+        pos_++;
+        return true;
+    }
+
+    static int hex_digit(char c) {
+        if (c >= '0' && c <= '9') {
+            return c - '0';
+        } else if (c >= 'a' && c <= 'f') {
+            return c - 'a' + 10;
+        } else if (c >= 'A' && c <= 'F') {
+            return c - 'A' + 10;
+        }
+        return -1;
+    }
+
+    bool read_hex4(u32* out) {
+        if (end_ - pos_ < 4) {
+            return fail("invalid escape sequence");
+        }
+        u32 value = 0;
+        for (int i = 0; i < 4; i++) {
+            int d = hex_digit(*pos_++);
+            if (d < 0) {
+                return fail("invalid escape sequence");
+            }
+            value = value*16 + static_cast<u32>(d);
+        }
+        *out = value;
+        return true;
+    }
+
+    static void put_utf8(u32 cp, std::string* out) {
+        if (cp < 0x80) {
+            out->push_back(static_cast<char>(cp));
+        } else if (cp < 0x800) {
+            out->push_back(static_cast<char>(0xC0 | (cp >> 6)));
+            out->push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+        } else if (cp < 0x10000) {
+            out->push_back(static_cast<char>(0xE0 | (cp >> 12)));
+            out->push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+            out->push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+        } else {
+            out->push_back(static_cast<char>(0xF0 | (cp >> 18)));
+            out->push_back(static_cast<char>(0x80 | ((cp >> 12) & 0x3F)));
+            out->push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+            out->push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+        }
+    }
+
+    bool read_string(std::string* out) {
+        if (!expect('"')) {
+            return false;
+        }
+        while (true) {
+            // Copy unescaped run in one go
+            const char* run = pos_;
+            while (pos_ < end_ && *pos_ != '"' && *pos_ != '\\' && static_cast<unsigned char>(*pos_) >= 0x20) {
+                pos_++;
+            }
+            out->append(run, pos_);
+            if (pos_ == end_) {
+                return fail("unterminated string");
+            }
+            char c = *pos_++;
+            if (c == '"') {
+                return true;
+            }
+            if (c != '\\') {
+                pos_--;
+                return fail("control character in string");
+            }
+            if (pos_ == end_) {
+                return fail("unterminated string");
+            }
+            c = *pos_++;
+            switch (c) {
+            case '"':  out->push_back('"');  break;
+            case '\\': out->push_back('\\'); break;
+            case '/':  out->push_back('/');  break;
+            case 'b':  out->push_back('\b'); break;
+            case 'f':  out->push_back('\f'); break;
+            case 'n':  out->push_back('\n'); break;
+            case 'r':  out->push_back('\r'); break;
+            case 't':  out->push_back('\t'); break;
+            case 'u': {
+                u32 cp = 0;
+                if (!read_hex4(&cp)) {
+                    return false;
+                }
+                if (cp >= 0xD800 && cp < 0xDC00) {
+                    // Surrogate pair
+                    u32 low = 0;
+                    if (end_ - pos_ < 2 || pos_[0] != '\\' || pos_[1] != 'u') {
+                        return fail("invalid surrogate pair");
+                    }
+                    pos_ += 2;
+                    if (!read_hex4(&low)) {
+                        return false;
+                    }
+                    if (low < 0xDC00 || low >= 0xE000) {
+                        return fail("invalid surrogate pair");
+                    }
+                    cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                } else if (cp >= 0xDC00 && cp < 0xE000) {
+                    return fail("invalid surrogate pair");
+                }
+                put_utf8(cp, out);
+            } break;
+            default:
+                return fail("invalid escape sequence");
+            }
+        }
+    }
+
+    bool read_number(std::string* out) {
+        const char* start = pos_;
+        auto digits = [this]() {
+            const char* p = pos_;
+            while (pos_ < end_ && *pos_ >= '0' && *pos_ <= '9') {
+                pos_++;
+            }
+            return pos_ - p;
+        };
+        if (pos_ < end_ && *pos_ == '-') {
+            pos_++;
+        }
+        if (pos_ < end_ && *pos_ == '0') {
+            pos_++;
+        } else if (digits() == 0) {
+            return fail("invalid number");
+        }
+        if (pos_ < end_ && *pos_ == '.') {
+            pos_++;
+            if (digits() == 0) {
+                return fail("invalid number");
+            }
+        }
+        if (pos_ < end_ && (*pos_ == 'e' || *pos_ == 'E')) {
+            pos_++;
+            if (pos_ < end_ && (*pos_ == '+' || *pos_ == '-')) {
+                pos_++;
+            }
+            if (digits() == 0) {
+                return fail("invalid number");
+            }
+        }
+        out->assign(start, pos_);
+        return true;
+    }
+
+    bool read_literal(const char* lit, std::string* out) {
+        size_t len = strlen(lit);
+        if (static_cast<size_t>(end_ - pos_) < len || memcmp(pos_, lit, len) != 0) {
+            return fail("unexpected character");
+        }
+        pos_ += len;
+        out->assign(lit, len);
+        return true;
+    }
+
+    //! Read value into `out`, if `out` is null the value is validated and skipped
+    bool read_value(PTree* out, int depth) {
+        skip_ws();
+        if (pos_ == end_) {
+            return fail("unexpected end of input");
+        }
+        std::string* text = &scratch_;
+        if (out) {
+            text = &out->data();
+        } else {
+            scratch_.clear();
+        }
+        switch (*pos_) {
+        case '{':
+            return read_object(out, depth + 1);
+        case '[':
+            return read_array(out, depth + 1);
+        case '"':
+            return read_string(text);
+        case 't':
+            return read_literal("true", text);
+        case 'f':
+            return read_literal("false", text);
+        case 'n':
+            return read_literal("null", text);
+        default:
+            return read_number(text);
+        }
+    }
+
+    bool read_object(PTree* out, int depth) {
+        if (depth > MAX_DEPTH) {
+            return fail("document is nested too deeply");
+        }
+        pos_++;  // '{'
+        skip_ws();
+        if (pos_ < end_ && *pos_ == '}') {
+            pos_++;
+            return true;
+        }
+        while (true) {
+            std::string key;
+            if (!read_string(&key) || !expect(':')) {
+                return false;
+            }
+            PTree* child = nullptr;
+            if (out) {
+                child = &out->push_back(std::make_pair(std::move(key), PTree()))->second;
+            }
+            if (!read_value(child, depth)) {
+                return false;
+            }
+            skip_ws();
+            if (pos_ == end_) {
+                return fail("unexpected end of input");
+            }
+            char c = *pos_++;
+            if (c == '}') {
+                return true;
+            }
+            if (c != ',') {
+                pos_--;
+                return fail("expected ',' or '}'");
+            }
+        }
+    }
+
+    bool read_array(PTree* out, int depth) {
+        if (depth > MAX_DEPTH) {
+            return fail("document is nested too deeply");
+        }
+        pos_++;  // '['
+        skip_ws();
+        if (pos_ < end_ && *pos_ == ']') {
+            pos_++;
+            return true;
+        }
+        while (true) {
+            PTree* child = nullptr;
+            if (out) {
+                child = &out->push_back(std::make_pair(std::string(), PTree()))->second;
+            }
+            if (!read_value(child, depth)) {
+                return false;
+            }
+            skip_ws();
+            if (pos_ == end_) {
+                return fail("unexpected end of input");
+            }
+            char c = *pos_++;
+            if (c == ']') {
+                return true;
+            }
+            if (c != ',') {
+                pos_--;
+                return fail("expected ',' or ']'");
+            }
+        }
+    }
+
+    bool finish() {
+        skip_ws();
+        if (pos_ != end_) {
+            return fail("garbage after data");
+        }
+        return true;
+    }
+
+public:
+    typedef std::pair<const char*, const char*> Span;
+
+    QueryJsonReader(const char* begin, const char* end)
+        : begin_(begin)
+        , pos_(begin)
+        , end_(end)
+    {
+    }
+
+    QueryJsonReader(Span span)
+        : QueryJsonReader(span.first, span.second)
+    {
+    }
+
+    //! Parse document, on error return false and set error message
+    bool parse(PTree* out) {
+        return read_value(out, 0) && finish();
+    }
+
+    /** Scan top level object without building the tree.
+      * Every member is returned as a key and the span of its raw value text.
+      */
+    bool scan_members(std::vector<std::pair<std::string, Span>>* out) {
+        skip_ws();
+        if (pos_ == end_ || *pos_ != '{') {
+            return fail("object expected");
+        }
+        pos_++;
+        skip_ws();
+        if (pos_ < end_ && *pos_ == '}') {
+            pos_++;
+            return finish();
+        }
+        while (true) {
+            std::string key;
+            if (!read_string(&key) || !expect(':')) {
+                return false;
+            }
+            skip_ws();
+            const char* value = pos_;
+            if (!read_value(nullptr, 1)) {
+                return false;
+            }
+            out->push_back(std::make_pair(std::move(key), std::make_pair(value, pos_)));
+            skip_ws();
+            if (pos_ == end_) {
+                return fail("unexpected end of input");
+            }
+            char c = *pos_++;
+            if (c == '}') {
+                return finish();
+            }
+            if (c != ',') {
+                pos_--;
+                return fail("expected ',' or '}'");
+            }
+        }
+    }
+
+    //! Read scalar value (strings are unescaped, numbers and literals are returned verbatim)
+    bool read_scalar(std::string* out) {
+        skip_ws();
+        if (pos_ < end_ && (*pos_ == '{' || *pos_ == '[')) {
+            return fail("scalar expected");
+        }
+        if (!read_value(nullptr, 0) || !finish()) {
+            return false;
+        }
+        out->swap(scratch_);
+        return true;
+    }
+
+    std::string const& error() const {
+        return error_;
+    }
+};
+
+
 // ///////////////// //
 // QueryParser class //
 // ///////////////// //
 
 std::tuple<aku_Status, boost::property_tree::ptree> QueryParser::parse_json(const char* query) {
-    //! C-string to streambuf adapter
-    struct MemStreambuf : std::streambuf {
-        MemStreambuf(const char* buf) {
-            char* p = const_cast<char*>(buf);
-            setg(p, p, p+strlen(p));
-        }
-    };
-
     boost::property_tree::ptree ptree;
-    MemStreambuf strbuf(query);
-    std::istream stream(&strbuf);
-    try {
-        boost::property_tree::json_parser::read_json(stream, ptree);
-    } catch (boost::property_tree::json_parser_error const& e) {
+    QueryJsonReader reader(query, query + strlen(query));
+    if (!reader.parse(&ptree)) {
         // Error, bad query
-        Logger::msg(AKU_LOG_ERROR, e.what());
-        return std::make_tuple(AKU_EQUERY_PARSING_ERROR, ptree);
+        Logger::msg(AKU_LOG_ERROR, "Query parsing error: " + reader.error());
+        return std::make_tuple(AKU_EQUERY_PARSING_ERROR, boost::property_tree::ptree());
+    }
+    return std::make_tuple(AKU_SUCCESS, std::move(ptree));
+}
+
+//! Parse timestamp value of the `range` field
+static aku_Status parse_range_value(QueryJsonReader::Span span, const char* name, aku_Timestamp* out) {
+    QueryJsonReader reader(span);
+    std::string value;
+    if (!reader.read_scalar(&value)) {
+        Logger::msg(AKU_LOG_ERROR, std::string("Invalid '") + name + "' field, " + reader.error());
+        return AKU_EQUERY_PARSING_ERROR;
+    }
+    try {
+        *out = DateTimeUtil::from_iso_string(value.c_str());
+    } catch (std::exception const& e) {
+        Logger::msg(AKU_LOG_ERROR, std::string("Can't parse ") + name + " timestamp, " + e.what());
+        return AKU_EQUERY_PARSING_ERROR;
+    }
+    return AKU_SUCCESS;
+}
+
+//! Parse query timeout value (time-duration, should be greater than zero)
+static aku_Status parse_timeout_value(std::string const& value, u64* out) {
+    u64 timeout = 0;
+    try {
+        timeout = DateTimeUtil::parse_duration(value.data(), value.size());
+    } catch (const BadDateTimeFormat&) {
+        Logger::msg(AKU_LOG_ERROR, "Can't parse time-duration: " + value);
+        return AKU_EQUERY_PARSING_ERROR;
+    }
+    if (timeout == 0) {
+        Logger::msg(AKU_LOG_ERROR, "Query timeout should be greater than zero");
+        return AKU_EQUERY_PARSING_ERROR;
+    }
+    *out = timeout;
+    return AKU_SUCCESS;
+}
+
+aku_Status QueryParser::parse_prepared_execution(const char* query, PreparedExecution* out) {
+    if (strstr(query, "\"prepared\"") == nullptr) {
+        return AKU_ENOT_FOUND;
+    }
+    typedef std::vector<std::pair<std::string, QueryJsonReader::Span>> Members;
+    Members members;
+    QueryJsonReader reader(query, query + strlen(query));
+    if (!reader.scan_members(&members)) {
+        Logger::msg(AKU_LOG_ERROR, "Query parsing error: " + reader.error());
+        return AKU_EQUERY_PARSING_ERROR;
+    }
+    auto is_prepared = [](Members::value_type const& kv) { return kv.first == "prepared"; };
+    if (std::none_of(members.begin(), members.end(), is_prepared)) {
+        return AKU_ENOT_FOUND;
+    }
+    *out = PreparedExecution();
+    for (auto const& kv: members) {
+        if (kv.first == "prepared") {
+            QueryJsonReader idreader(kv.second);
+            std::string id;
+            if (!idreader.read_scalar(&id) || id.empty() || id.find_first_not_of("0123456789") != std::string::npos) {
+                Logger::msg(AKU_LOG_ERROR, "Invalid prepared query id");
+                return AKU_EQUERY_PARSING_ERROR;
+            }
+            errno = 0;
+            auto value = strtoull(id.c_str(), nullptr, 10);
+            if (errno == ERANGE) {
+                Logger::msg(AKU_LOG_ERROR, "Prepared query id is out of range");
+                return AKU_EQUERY_PARSING_ERROR;
+            }
+            out->id = static_cast<u64>(value);
+        } else if (kv.first == "range") {
+            Members range;
+            QueryJsonReader rreader(kv.second);
+            if (!rreader.scan_members(&range)) {
+                Logger::msg(AKU_LOG_ERROR, "Invalid 'range' field, " + rreader.error());
+                return AKU_EQUERY_PARSING_ERROR;
+            }
+            bool begin_set = false, end_set = false;
+            for (auto const& rkv: range) {
+                aku_Status status = AKU_SUCCESS;
+                if (rkv.first == "from") {
+                    status = parse_range_value(rkv.second, "begin", &out->begin);
+                    begin_set = true;
+                } else if (rkv.first == "to") {
+                    status = parse_range_value(rkv.second, "end", &out->end);
+                    end_set = true;
+                }
+                if (status != AKU_SUCCESS) {
+                    return status;
+                }
+            }
+            if (!begin_set || !end_set) {
+                return AKU_EQUERY_PARSING_ERROR;
+            }
+            out->range = true;
+        } else if (kv.first == "profile") {
+            std::string flag;
+            QueryJsonReader freader(kv.second);
+            if (!freader.read_scalar(&flag) || (flag != "true" && flag != "false")) {
+                Logger::msg(AKU_LOG_ERROR, "Invalid 'profile' field, boolean expected");
+                return AKU_EQUERY_PARSING_ERROR;
+            }
+            out->profile = flag == "true";
+        } else if (kv.first == "timeout") {
+            std::string value;
+            QueryJsonReader treader(kv.second);
+            if (!treader.read_scalar(&value)) {
+                Logger::msg(AKU_LOG_ERROR, "Invalid 'timeout' field, time-duration expected");
+                return AKU_EQUERY_PARSING_ERROR;
+            }
+            auto status = parse_timeout_value(value, &out->timeout);
+            if (status != AKU_SUCCESS) {
+                return status;
+            }
+        } else if (kv.first != "output") {
+            // Output format is handled by the server
+            Logger::msg(AKU_LOG_ERROR, "Unexpected field '" + kv.first + "' in prepared query execution request");
+            return AKU_EQUERY_PARSING_ERROR;
+        }
     }
-    return std::make_tuple(AKU_SUCCESS, ptree);
+    return AKU_SUCCESS;
 }
 
 std::tuple<aku_Status, QueryKind> QueryParser::get_query_kind(boost::property_tree::ptree const& ptree) {
@@ -642,6 +1174,63 @@ std::tuple<aku_Status, QueryKind> QueryParser::get_query_kind(boost::property_tr
     return std::make_tuple(AKU_EQUERY_PARSING_ERROR, QueryKind::SELECT);
 }
 
+std::tuple<aku_Status, bool> QueryParser::parse_profile_flag(boost::property_tree::ptree const& ptree) {
+    auto flag = ptree.get_child_optional("profile");
+    if (!flag) {
+        return std::make_tuple(AKU_SUCCESS, false);
+    }
+    auto value = flag->get_value<std::string>();
+    if (value == "true") {
+        return std::make_tuple(AKU_SUCCESS, true);
+    } else if (value == "false") {
+        return std::make_tuple(AKU_SUCCESS, false);
+    }
+    Logger::msg(AKU_LOG_ERROR, "Invalid `profile` value `" + value + "`, true or false expected");
+    return std::make_tuple(AKU_EQUERY_PARSING_ERROR, false);
+}
+
+std::tuple<aku_Status, ProgressiveOptions> QueryParser::parse_progressive(boost::property_tree::ptree const& ptree) {
+    ProgressiveOptions result;
+    auto opt = ptree.get_child_optional("progressive");
+    if (!opt) {
+        return std::make_tuple(AKU_SUCCESS, result);
+    }
+    if (opt->empty()) {
+        auto value = opt->get_value<std::string>();
+        if (value == "true" || value == "false") {
+            result.enabled = value == "true";
+            return std::make_tuple(AKU_SUCCESS, result);
+        }
+        Logger::msg(AKU_LOG_ERROR, "Invalid `progressive` value `" + value + "`, true, false or object expected");
+        return std::make_tuple(AKU_EQUERY_PARSING_ERROR, result);
+    }
+    result.enabled = true;
+    for (auto const& kv: *opt) {
+        if (kv.first != "max-latency") {
+            Logger::msg(AKU_LOG_ERROR, "Unexpected `" + kv.first + "` field in `progressive` statement");
+            return std::make_tuple(AKU_EQUERY_PARSING_ERROR, result);
+        }
+        auto value = kv.second.get_value<std::string>();
+        try {
+            result.max_latency = DateTimeUtil::parse_duration(value.data(), value.size());
+        } catch (const BadDateTimeFormat&) {
+            Logger::msg(AKU_LOG_ERROR, "Can't parse time-duration: " + value);
+            return std::make_tuple(AKU_EQUERY_PARSING_ERROR, result);
+        }
+    }
+    return std::make_tuple(AKU_SUCCESS, result);
+}
+
+std::tuple<aku_Status, u64> QueryParser::parse_timeout(boost::property_tree::ptree const& ptree) {
+    auto opt = ptree.get_child_optional("timeout");
+    if (!opt) {
+        return std::make_tuple(AKU_SUCCESS, 0ull);
+    }
+    u64 timeout = 0;
+    auto status = parse_timeout_value(opt->get_value<std::string>(), &timeout);
+    return std::make_tuple(status, timeout);
+}
+
 aku_Status validate_query(boost::property_tree::ptree const& ptree) {
     static const std::vector<std::string> UNIQUE_STMTS = {
         "select",
@@ -661,7 +1250,11 @@ aku_Status validate_query(boost::property_tree::ptree const& ptree) {
         "range",
         "where",
         "group-aggregate",
-        "apply"
+        "apply",
+        "profile",
+        "progressive",
+        "page-token",
+        "timeout"
     };
     std::set<std::string> keywords;
     for (const auto& item: ptree) {
@@ -1012,6 +1605,17 @@ std::tuple<aku_Status, ReshapeRequest> QueryParser::parse_select_query(
         return std::make_tuple(status, result);
     }
 
+    // Page token
+    bool paged;
+    std::tie(status, paged, result.resume) = parse_page_token(ptree, order);
+    if (status != AKU_SUCCESS) {
+        return std::make_tuple(status, result);
+    }
+    if (paged && (groupbytag || ptree.get_child_optional("apply"))) {
+        Logger::msg(AKU_LOG_ERROR, "`page-token` can't be used with `group-by` and `apply`");
+        return std::make_tuple(AKU_EQUERY_PARSING_ERROR, result);
+    }
+
     // Initialize request
     result.agg.enabled = false;
     result.select.begin = ts_begin;
@@ -1037,6 +1641,10 @@ std::tuple<aku_Status, ReshapeRequest> QueryParser::parse_aggregate_query(boost:
     if (status != AKU_SUCCESS) {
         return std::make_tuple(status, result);
     }
+    status = reject_page_token(ptree);
+    if (status != AKU_SUCCESS) {
+        return std::make_tuple(status, result);
+    }
 
     Logger::msg(AKU_LOG_INFO, "Parsing query:");
     Logger::msg(AKU_LOG_INFO, to_json(ptree, true).c_str());
@@ -1147,6 +1755,10 @@ std::tuple<aku_Status, ReshapeRequest> QueryParser::parse_group_aggregate_query(
     if (status != AKU_SUCCESS) {
         return std::make_tuple(status, result);
     }
+    status = reject_page_token(ptree);
+    if (status != AKU_SUCCESS) {
+        return std::make_tuple(status, result);
+    }
 
     Logger::msg(AKU_LOG_INFO, "Parsing query:");
     Logger::msg(AKU_LOG_INFO, to_json(ptree, true).c_str());
@@ -1264,6 +1876,10 @@ std::tuple<aku_Status, ReshapeRequest> QueryParser::parse_join_query(boost::prop
     if (status != AKU_SUCCESS) {
         return std::make_tuple(status, result);
     }
+    status = reject_page_token(ptree);
+    if (status != AKU_SUCCESS) {
+        return std::make_tuple(status, result);
+    }
 
     std::vector<std::string> metrics;
     std::tie(status, metrics) = parse_join_stmt(ptree);
@@ -1327,16 +1943,20 @@ std::tuple<aku_Status, ReshapeRequest> QueryParser::parse_join_query(boost::prop
 struct TerminalNode : QP::Node {
 
     InternalCursor* cursor;
+    bool failed;  //< Error was sent to the cursor, cursor shouldn't be completed after that
 
     TerminalNode(InternalCursor* cur)
         : cursor(cur)
+        , failed(false)
     {
     }
 
     // Node interface
 
     void complete() {
-        cursor->complete();
+        if (!failed) {
+            cursor->complete();
+        }
     }
 
     bool put(MutableSample& sample) {
@@ -1344,7 +1964,10 @@ struct TerminalNode : QP::Node {
     }
 
     void set_error(aku_Status status) {
-        cursor->set_error(status);
+        if (!failed) {
+            failed = true;
+            cursor->set_error(status);
+        }
     }
 
     int get_requirements() const {
@@ -1381,6 +2004,15 @@ std::tuple<aku_Status, std::vector<std::shared_ptr<Node>>> QueryParser::parse_pr
     auto prev = terminal;
     std::vector<std::shared_ptr<Node>> result;
 
+    // Nodes are created from the terminal to the root but the result
+    // should start from the root (limiter is the last one before the terminal).
+    auto limoff = parse_limit_offset(ptree);
+    if (limoff.first != 0 || limoff.second != 0) {
+        auto node = std::make_shared<QP::Limiter>(limoff.first, limoff.second, prev);
+        result.push_back(node);
+        prev = node;
+    }
+
     auto apply = ptree.get_child_optional("apply");
     if (apply) {
         for (auto it = apply->rbegin(); it != apply->rend(); it++) {
@@ -1396,13 +2028,7 @@ std::tuple<aku_Status, std::vector<std::shared_ptr<Node>>> QueryParser::parse_pr
         }
     }
 
-    auto limoff = parse_limit_offset(ptree);
-    if (limoff.first != 0 || limoff.second != 0) {
-        auto node = std::make_shared<QP::Limiter>(limoff.first, limoff.second, prev);
-        result.push_back(node);
-        prev = node;
-    }
-
+    std::reverse(result.begin(), result.end());
     result.push_back(terminal);
     return std::make_tuple(AKU_SUCCESS, result);
 }
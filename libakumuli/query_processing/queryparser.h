@@ -47,10 +47,50 @@ public:
 };
 
 
+//! Prepared query execution request
+struct PreparedExecution {
+    u64           id;       //< Prepared query id
+    bool          range;    //< Range is set (otherwise range of the query template is used)
+    aku_Timestamp begin;
+    aku_Timestamp end;
+    bool          profile;  //< Profile the query
+    u64           timeout;  //< Query timeout in nanoseconds (0 - timeout of the query template is used)
+
+    PreparedExecution()
+        : id(0)
+        , range(false)
+        , begin(0)
+        , end(0)
+        , profile(false)
+        , timeout(0)
+    {
+    }
+};
+
+//! Progressive execution of the group-aggregate query
+struct ProgressiveOptions {
+    bool         enabled;
+    u64          max_latency;  //< Refinement stops when the next pass doesn't fit, ns (0 - no limit)
+
+    ProgressiveOptions()
+        : enabled(false)
+        , max_latency(0)
+    {
+    }
+};
+
 struct QueryParser {
 
     static std::tuple<aku_Status, boost::property_tree::ptree> parse_json(const char* query);
 
+    /** Parse prepared query execution request (`{"prepared": id, "range": {...}}`).
+      * Request is scanned without building the property tree.
+      * @param query is a query text
+      * @param out receives parsed request
+      * @return AKU_ENOT_FOUND if the query is not an execution request
+      */
+    static aku_Status parse_prepared_execution(const char* query, PreparedExecution* out);
+
     /** Determain type of query.
       */
     static std::tuple<aku_Status, QueryKind> get_query_kind(boost::property_tree::ptree const& ptree);
@@ -102,6 +142,31 @@ struct QueryParser {
     static std::tuple<aku_Status, ReshapeRequest> parse_group_aggregate_query(boost::property_tree::ptree const& ptree,
                                                                               SeriesMatcher const& matcher);
 
+    /** Check `"profile": true` query option.
+      * @param ptree is a json query
+      * @return status and value of the option (false if not set)
+      */
+    static std::tuple<aku_Status, bool> parse_profile_flag(boost::property_tree::ptree const& ptree);
+
+    /** Create page token for the select query.
+      * Token encodes the order of the output and position of the last
+      * sample returned by the page.
+      */
+    static std::string make_page_token(OrderBy order, aku_ParamId id, aku_Timestamp ts);
+
+    /** Parse `progressive` query option, format:
+      * `"progressive": true` or `"progressive": { "max-latency": "100ms" }`
+      * @param ptree is a json query
+      * @return status and options (disabled if not set)
+      */
+    static std::tuple<aku_Status, ProgressiveOptions> parse_progressive(boost::property_tree::ptree const& ptree);
+
+    /** Parse `timeout` query option, format: `"timeout": "10s"`.
+      * @param ptree is a json query
+      * @return status and timeout in nanoseconds (0 if not set)
+      */
+    static std::tuple<aku_Status, u64> parse_timeout(boost::property_tree::ptree const& ptree);
+
     /** Parse stream processing pipeline.
       * @param ptree contains query
       * @returns vector of Nodes in proper order
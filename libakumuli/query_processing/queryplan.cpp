@@ -8,17 +8,516 @@
 #include "storage_engine/operators/join.h"
 #include "log_iface.h"
 #include "status_util.h"
+#include "cancellation.h"
+#include "instrumentation.h"
+
+#include <chrono>
 
 namespace Akumuli {
 namespace QP {
 
 using namespace StorageEngine;
 
+// ------------- //
+// Query profile //
+// ------------- //
+
+QueryProfile::QueryProfile()
+    : nseries(0)
+    , noperators(0)
+    , operator_samples(0)
+    , materialized_samples(0)
+    , output_samples(0)
+    , planning_time(0)
+    , execute_time(0)
+    , operators_time(0)
+    , read_time(0)
+    , processing_time(0)
+{
+}
+
+u64 QueryProfile::now() {
+    auto ts = std::chrono::steady_clock::now().time_since_epoch();
+    return static_cast<u64>(std::chrono::duration_cast<std::chrono::nanoseconds>(ts).count());
+}
+
+boost::property_tree::ptree QueryProfile::to_ptree() const {
+    boost::property_tree::ptree result;
+    boost::property_tree::ptree plan;
+    for (auto const& step: steps) {
+        boost::property_tree::ptree item;
+        item.put("", step);
+        plan.push_back(std::make_pair("", item));
+    }
+    result.add_child("plan", plan);
+    result.put("series", nseries);
+    result.put("operators", noperators);
+    result.put("samples.operators", operator_samples);
+    result.put("samples.materialized", materialized_samples);
+    result.put("samples.output", output_samples);
+    result.put("blocks.read", counters.blocks_read);
+    result.put("blocks.zero_copy", counters.blocks_zero_copy);
+    result.put("blocks.cached", counters.blocks_cached);
+    result.put("nodes.leaves_decoded", counters.leaves_decoded);
+    result.put("nodes.superblocks_decoded", counters.superblocks_decoded);
+    result.put("nodes.subtrees_reused", counters.subtrees_reused);
+    result.put("time_ns.planning", planning_time);
+    result.put("time_ns.execute", execute_time);
+    result.put("time_ns.operators", operators_time);
+    result.put("time_ns.materialization", read_time > operators_time ? read_time - operators_time : 0);
+    result.put("time_ns.processing", processing_time);
+    return result;
+}
+
+/**
+ * Storage level operator decorator used by the query profiler
+ */
+template<class TVal>
+struct ProfiledOperator : SeriesOperator<TVal> {
+    typedef typename SeriesOperator<TVal>::Direction Direction;
+    std::unique_ptr<SeriesOperator<TVal>> op_;
+    QueryProfile* profile_;
+
+    ProfiledOperator(std::unique_ptr<SeriesOperator<TVal>>&& op, QueryProfile* profile)
+        : op_(std::move(op))
+        , profile_(profile)
+    {
+    }
+
+    virtual std::tuple<aku_Status, size_t> read(aku_Timestamp *destts, TVal *destval, size_t size) {
+        auto start = QueryProfile::now();
+        auto result = op_->read(destts, destval, size);
+        profile_->operators_time += QueryProfile::now() - start;
+        profile_->operator_samples += std::get<1>(result);
+        return result;
+    }
+
+    virtual Direction get_direction() {
+        return op_->get_direction();
+    }
+};
+
+//! Wrap all operators if profiling is enabled
+template<class TVal>
+static void instrument(std::vector<std::unique_ptr<SeriesOperator<TVal>>>* ops, QueryProfile* profile) {
+    if (profile == nullptr) {
+        return;
+    }
+    profile->noperators += ops->size();
+    for (auto& op: *ops) {
+        std::unique_ptr<SeriesOperator<TVal>> wrapped(new ProfiledOperator<TVal>(std::move(op), profile));
+        op = std::move(wrapped);
+    }
+}
+
+// ----------- //
+// Shared scan //
+// ----------- //
+
+/**
+ * Operator that replays part of the data read by the shared scan
+ */
+struct BufferedScanOperator : RealValuedOperator {
+    std::shared_ptr<const void> owner_;  //< Keeps data alive
+    aku_Timestamp const* ts_;
+    double const* xs_;
+    size_t pos_;
+    size_t end_;
+    bool forward_;
+
+    BufferedScanOperator(std::shared_ptr<const void> owner,
+                         aku_Timestamp const* ts,
+                         double const* xs,
+                         size_t begin,
+                         size_t end,
+                         bool forward)
+        : owner_(owner)
+        , ts_(ts)
+        , xs_(xs)
+        , pos_(begin)
+        , end_(end)
+        , forward_(forward)
+    {
+    }
+
+    virtual std::tuple<aku_Status, size_t> read(aku_Timestamp *destts, double *destval, size_t size) {
+        size_t n = std::min(size, end_ - pos_);
+        if (n == 0) {
+            return std::make_tuple(AKU_ENO_DATA, 0ul);
+        }
+        if (forward_) {
+            std::copy(ts_ + pos_, ts_ + pos_ + n, destts);
+            std::copy(xs_ + pos_, xs_ + pos_ + n, destval);
+        } else {
+            // Range [pos_, end_) is read from the end
+            std::reverse_copy(ts_ + end_ - n, ts_ + end_, destts);
+            std::reverse_copy(xs_ + end_ - n, xs_ + end_, destval);
+            end_ -= n;
+            return std::make_tuple(AKU_SUCCESS, n);
+        }
+        pos_ += n;
+        return std::make_tuple(AKU_SUCCESS, n);
+    }
+
+    virtual Direction get_direction() {
+        return forward_ ? Direction::FORWARD : Direction::BACKWARD;
+    }
+};
+
+/**
+ * Operator that replays aggregation result computed by the shared scan
+ */
+struct BufferedAggregateOperator : AggregateOperator {
+    std::shared_ptr<const void> owner_;  //< Keeps data alive
+    aku_Timestamp const* ts_;
+    AggregationResult const* xs_;
+    size_t pos_;
+    size_t end_;
+    bool forward_;
+
+    BufferedAggregateOperator(std::shared_ptr<const void> owner,
+                              aku_Timestamp const* ts,
+                              AggregationResult const* xs,
+                              size_t size,
+                              bool forward)
+        : owner_(owner)
+        , ts_(ts)
+        , xs_(xs)
+        , pos_(0)
+        , end_(size)
+        , forward_(forward)
+    {
+    }
+
+    virtual std::tuple<aku_Status, size_t> read(aku_Timestamp *destts, AggregationResult *destval, size_t size) {
+        size_t n = std::min(size, end_ - pos_);
+        if (n == 0) {
+            return std::make_tuple(AKU_ENO_DATA, 0ul);
+        }
+        // Buckets are stored in the output order
+        std::copy(ts_ + pos_, ts_ + pos_ + n, destts);
+        std::copy(xs_ + pos_, xs_ + pos_ + n, destval);
+        pos_ += n;
+        return std::make_tuple(AKU_SUCCESS, n);
+    }
+
+    virtual Direction get_direction() {
+        return forward_ ? Direction::FORWARD : Direction::BACKWARD;
+    }
+};
+
+//! Convert scan range to semi-open [lo, hi) range
+static std::pair<aku_Timestamp, aku_Timestamp> scan_bounds(aku_Timestamp begin, aku_Timestamp end) {
+    if (begin <= end) {
+        return std::make_pair(begin, end);
+    }
+    // Backward scan returns (end, begin] range
+    auto hi = begin == AKU_MAX_TIMESTAMP ? begin : begin + 1;
+    return std::make_pair(end + 1, hi);
+}
+
+bool SharedScan::AggKey::operator < (AggKey const& other) const {
+    return std::tie(id, begin, end, step, level, need_m2)
+         < std::tie(other.id, other.begin, other.end, other.step, other.level, other.need_m2);
+}
+
+SharedScan::SharedScan(size_t capacity)
+    : capacity_(capacity)
+    , size_(0)
+    , reused_(0)
+    , linked_(false)
+{
+}
+
+void SharedScan::add(std::vector<aku_ParamId> const& ids, aku_Timestamp begin, aku_Timestamp end) {
+    auto bounds = scan_bounds(begin, end);
+    for (auto id: ids) {
+        auto it = entries_.find(id);
+        if (it == entries_.end()) {
+            Entry entry = { bounds.first, bounds.second, 1, false, nullptr };
+            entries_[id] = entry;
+        } else {
+            it->second.lo = std::min(it->second.lo, bounds.first);
+            it->second.hi = std::max(it->second.hi, bounds.second);
+            it->second.refs++;
+        }
+    }
+}
+
+aku_Status SharedScan::load(const ColumnStore& cstore, aku_ParamId id, Entry* entry) {
+    entry->loaded = true;
+    std::vector<std::unique_ptr<RealValuedOperator>> ops;
+    auto status = cstore.scan({id}, entry->lo, entry->hi, &ops);
+    if (status != AKU_SUCCESS) {
+        return status;
+    }
+    auto buffer = std::make_shared<Buffer>();
+    const size_t chunk = 0x1000;
+    size_t size = 0;
+    while (true) {
+        if (size_ + size + chunk > capacity_) {
+            // Series doesn't fit, scans will read it from the column store
+            return AKU_SUCCESS;
+        }
+        buffer->ts.resize(size + chunk);
+        buffer->xs.resize(size + chunk);
+        size_t n;
+        std::tie(status, n) = ops.front()->read(buffer->ts.data() + size, buffer->xs.data() + size, chunk);
+        size += n;
+        if (status == AKU_ENO_DATA || status == AKU_EUNAVAILABLE) {
+            break;
+        }
+        if (status != AKU_SUCCESS) {
+            return status;
+        }
+    }
+    buffer->ts.resize(size);
+    buffer->xs.resize(size);
+    size_ += size;
+    entry->buffer = buffer;
+    return AKU_SUCCESS;
+}
+
+aku_Status SharedScan::acquire(const ColumnStore& cstore, aku_ParamId id, Entry* entry, std::shared_ptr<Buffer>* dest) {
+    if (!entry->loaded && entry->refs > 1) {
+        auto status = load(cstore, id, entry);
+        if (status != AKU_SUCCESS) {
+            return status;
+        }
+    }
+    entry->refs--;
+    *dest = entry->buffer;
+    if (entry->refs == 0 && entry->buffer) {
+        // Last user of the series, memory is released when the operator is destroyed
+        size_ -= entry->buffer->ts.size();
+        entry->buffer.reset();
+    }
+    return AKU_SUCCESS;
+}
+
+void SharedScan::link() {
+    if (linked_) {
+        return;
+    }
+    linked_ = true;
+    for (auto& kv: aggregates_) {
+        auto const& key = kv.first;
+        auto it = entries_.find(key.id);
+        if (key.level != 0 || it == entries_.end()) {
+            // Approximate aggregation uses the tree metadata
+            continue;
+        }
+        auto bounds = scan_bounds(key.begin, key.end);
+        if (it->second.lo <= bounds.first && bounds.second <= it->second.hi) {
+            // Aggregation is computed once and shared by all its operators
+            kv.second.from_scan = true;
+            it->second.refs++;
+        }
+    }
+}
+
+aku_Status SharedScan::scan(const ColumnStore& cstore,
+                            std::vector<aku_ParamId> const& ids,
+                            aku_Timestamp begin,
+                            aku_Timestamp end,
+                            std::vector<std::unique_ptr<RealValuedOperator>>* dest)
+{
+    link();
+    auto bounds = scan_bounds(begin, end);
+    for (auto id: ids) {
+        auto it = entries_.find(id);
+        if (it == entries_.end()) {
+            AKU_PANIC("Shared scan is not registered");
+        }
+        std::shared_ptr<Buffer> buffer;
+        auto status = acquire(cstore, id, &it->second, &buffer);
+        if (status != AKU_SUCCESS) {
+            return status;
+        }
+        if (!buffer) {
+            // Series is used only once or doesn't fit into the buffer
+            status = cstore.scan({id}, begin, end, dest);
+            if (status != AKU_SUCCESS) {
+                return status;
+            }
+            continue;
+        }
+        auto const& ts = buffer->ts;
+        auto lo = std::lower_bound(ts.begin(), ts.end(), bounds.first) - ts.begin();
+        auto hi = std::lower_bound(ts.begin(), ts.end(), bounds.second) - ts.begin();
+        std::unique_ptr<RealValuedOperator> op(
+                    new BufferedScanOperator(buffer,
+                                             buffer->ts.data(),
+                                             buffer->xs.data(),
+                                             static_cast<size_t>(lo),
+                                             static_cast<size_t>(hi),
+                                             begin <= end));
+        dest->push_back(std::move(op));
+        reused_++;
+    }
+    return AKU_SUCCESS;
+}
+
+void SharedScan::add_aggregate(std::vector<aku_ParamId> const& ids,
+                               aku_Timestamp begin,
+                               aku_Timestamp end,
+                               aku_Timestamp step,
+                               u16 level,
+                               bool need_m2)
+{
+    for (auto id: ids) {
+        AggKey key = { id, begin, end, step, level, need_m2 };
+        aggregates_[key].refs++;
+    }
+}
+
+aku_Status SharedScan::load(const ColumnStore& cstore, AggKey const& key, std::shared_ptr<AggBuffer>* dest) {
+    std::vector<std::unique_ptr<AggregateOperator>> ops;
+    auto status = key.step ? cstore.group_aggregate({key.id}, key.begin, key.end, key.step, &ops, key.level, key.need_m2)
+                           : cstore.aggregate({key.id}, key.begin, key.end, &ops, key.need_m2);
+    if (status != AKU_SUCCESS) {
+        return status;
+    }
+    auto buffer = std::make_shared<AggBuffer>();
+    const size_t chunk = 0x100;
+    size_t size = 0;
+    while (true) {
+        if (size_ + size + chunk > capacity_) {
+            // Result doesn't fit, operators will read it from the column store
+            return AKU_SUCCESS;
+        }
+        buffer->ts.resize(size + chunk);
+        buffer->xs.resize(size + chunk, INIT_AGGRES);
+        size_t n;
+        std::tie(status, n) = ops.front()->read(buffer->ts.data() + size, buffer->xs.data() + size, chunk);
+        size += n;
+        if (status == AKU_ENO_DATA || status == AKU_EUNAVAILABLE || n == 0) {
+            break;
+        }
+        if (status != AKU_SUCCESS) {
+            return status;
+        }
+    }
+    buffer->ts.resize(size);
+    buffer->xs.resize(size);
+    *dest = buffer;
+    return AKU_SUCCESS;
+}
+
+std::shared_ptr<SharedScan::AggBuffer> SharedScan::compute(Buffer const& data, AggKey const& key) {
+    // Same as the leaf level of the NB+tree aggregation
+    auto bounds = scan_bounds(key.begin, key.end);
+    auto const& ts = data.ts;
+    auto lo = static_cast<size_t>(std::lower_bound(ts.begin(), ts.end(), bounds.first) - ts.begin());
+    auto hi = static_cast<size_t>(std::lower_bound(ts.begin(), ts.end(), bounds.second) - ts.begin());
+    const bool forward = key.begin <= key.end;
+    auto result = std::make_shared<AggBuffer>();
+    AggregationResult outval = INIT_AGGRES;
+    u64 bin = 0;
+    for (size_t i = 0; i < hi - lo; i++) {
+        size_t ix = forward ? lo + i : hi - 1 - i;
+        if (key.step) {
+            aku_Timestamp normts = forward ? ts[ix] - key.begin
+                                           : key.begin - ts[ix];
+            if (outval.cnt > 0 && normts / key.step != bin) {
+                result->ts.push_back(outval._begin);
+                result->xs.push_back(outval);
+                outval = INIT_AGGRES;
+            }
+            bin = normts / key.step;
+        }
+        outval.add(ts[ix], data.xs[ix], forward);
+    }
+    if (outval.cnt > 0) {
+        result->ts.push_back(outval._begin);
+        result->xs.push_back(outval);
+    }
+    return result;
+}
+
+aku_Status SharedScan::aggregate(const ColumnStore& cstore,
+                                 std::vector<aku_ParamId> const& ids,
+                                 aku_Timestamp begin,
+                                 aku_Timestamp end,
+                                 aku_Timestamp step,
+                                 u16 level,
+                                 bool need_m2,
+                                 std::vector<std::unique_ptr<AggregateOperator>>* dest)
+{
+    link();
+    for (auto id: ids) {
+        AggKey key = { id, begin, end, step, level, need_m2 };
+        auto it = aggregates_.find(key);
+        if (it == aggregates_.end()) {
+            AKU_PANIC("Shared aggregation is not registered");
+        }
+        AggEntry& entry = it->second;
+        std::shared_ptr<AggBuffer> buffer = entry.buffer;
+        bool fresh = false;  // Result was read from the column store
+        if (!entry.loaded) {
+            entry.loaded = true;
+            aku_Status status = AKU_SUCCESS;
+            if (entry.from_scan) {
+                std::shared_ptr<Buffer> data;
+                status = acquire(cstore, id, &entries_.at(id), &data);
+                if (status == AKU_SUCCESS && data) {
+                    buffer = compute(*data, key);
+                }
+            }
+            if (status == AKU_SUCCESS && !buffer && entry.refs > 1) {
+                status = load(cstore, key, &buffer);
+                fresh = true;
+            }
+            if (status != AKU_SUCCESS) {
+                return status;
+            }
+            if (buffer && entry.refs > 1 && size_ + buffer->ts.size() <= capacity_) {
+                size_ += buffer->ts.size();
+                entry.buffer = buffer;
+            }
+        }
+        entry.refs--;
+        if (!buffer) {
+            // Aggregation is used only once or doesn't fit into the buffer
+            auto status = step ? cstore.group_aggregate({id}, begin, end, step, dest, level, need_m2)
+                               : cstore.aggregate({id}, begin, end, dest, need_m2);
+            if (status != AKU_SUCCESS) {
+                return status;
+            }
+            continue;
+        }
+        std::unique_ptr<AggregateOperator> op(
+                    new BufferedAggregateOperator(buffer,
+                                                  buffer->ts.data(),
+                                                  buffer->xs.data(),
+                                                  buffer->ts.size(),
+                                                  begin <= end));
+        dest->push_back(std::move(op));
+        if (!fresh) {
+            reused_++;
+        }
+        if (entry.refs == 0 && entry.buffer) {
+            size_ -= entry.buffer->ts.size();
+            entry.buffer.reset();
+        }
+    }
+    return AKU_SUCCESS;
+}
+
+size_t SharedScan::reused() const {
+    return reused_;
+}
+
 /**
  * Tier-1 operator
  */
 struct ProcessingPrelude {
+    //! Query profile (null if profiling is disabled)
+    QueryProfile* profile_ = nullptr;
+
     virtual ~ProcessingPrelude() = default;
+    //! Get description of the processing step
+    virtual std::string describe() const = 0;
     //! Compute processing step result (list of low level operators)
     virtual aku_Status apply(const ColumnStore& cstore) = 0;
     //! Get result of the processing step
@@ -34,6 +533,9 @@ struct MaterializationStep {
 
     virtual ~MaterializationStep() = default;
 
+    //! Get description of the processing step
+    virtual std::string describe() const = 0;
+
     //! Compute processing step result (list of low level operators)
     virtual aku_Status apply(ProcessingPrelude* prelude) = 0;
 
@@ -53,17 +555,49 @@ struct ScanProcessingStep : ProcessingPrelude {
     aku_Timestamp begin_;
     aku_Timestamp end_;
     std::vector<aku_ParamId> ids_;
+    SharedScan* shared_;
+    std::vector<aku_Timestamp> begins_;  //< Per-series scan start (resumed query)
 
     template<class T>
-    ScanProcessingStep(aku_Timestamp begin, aku_Timestamp end, T&& t)
+    ScanProcessingStep(aku_Timestamp begin, aku_Timestamp end, T&& t, SharedScan* shared = nullptr)
         : begin_(begin)
         , end_(end)
         , ids_(std::forward<T>(t))
+        , shared_(shared)
     {
+        if (shared_) {
+            shared_->add(ids_, begin_, end_);
+        }
+    }
+
+    ScanProcessingStep(std::vector<aku_Timestamp>&& begins, aku_Timestamp end, std::vector<aku_ParamId>&& ids)
+        : begin_(end)
+        , end_(end)
+        , ids_(std::move(ids))
+        , shared_(nullptr)
+        , begins_(std::move(begins))
+    {
+    }
+
+    virtual std::string describe() const {
+        return shared_ ? "shared-scan" : "scan";
     }
 
     virtual aku_Status apply(const ColumnStore& cstore) {
-        return cstore.scan(ids_, begin_, end_, &scanlist_);
+        if (!begins_.empty()) {
+            for (size_t i = 0; i < ids_.size(); i++) {
+                auto status = cstore.scan({ ids_.at(i) }, begins_.at(i), end_, &scanlist_);
+                if (status != AKU_SUCCESS) {
+                    return status;
+                }
+            }
+            instrument(&scanlist_, profile_);
+            return AKU_SUCCESS;
+        }
+        auto status = shared_ ? shared_->scan(cstore, ids_, begin_, end_, &scanlist_)
+                              : cstore.scan(ids_, begin_, end_, &scanlist_);
+        instrument(&scanlist_, profile_);
+        return status;
     }
 
     virtual aku_Status extract_result(std::vector<std::unique_ptr<RealValuedOperator>>* dest) {
@@ -84,17 +618,31 @@ struct AggregateProcessingStep : ProcessingPrelude {
     aku_Timestamp begin_;
     aku_Timestamp end_;
     std::vector<aku_ParamId> ids_;
+    bool need_m2_;
+    SharedScan* shared_;
 
     template<class T>
-    AggregateProcessingStep(aku_Timestamp begin, aku_Timestamp end, T&& t)
+    AggregateProcessingStep(aku_Timestamp begin, aku_Timestamp end, T&& t, bool need_m2 = false, SharedScan* shared = nullptr)
         : begin_(begin)
         , end_(end)
         , ids_(std::forward<T>(t))
+        , need_m2_(need_m2)
+        , shared_(shared)
     {
+        if (shared_) {
+            shared_->add_aggregate(ids_, begin_, end_, 0, 0, need_m2_);
+        }
+    }
+
+    virtual std::string describe() const {
+        return shared_ ? "shared-aggregate" : "aggregate";
     }
 
     virtual aku_Status apply(const ColumnStore& cstore) {
-        return cstore.aggregate(ids_, begin_, end_, &agglist_);
+        auto status = shared_ ? shared_->aggregate(cstore, ids_, begin_, end_, 0, 0, need_m2_, &agglist_)
+                              : cstore.aggregate(ids_, begin_, end_, &agglist_, need_m2_);
+        instrument(&agglist_, profile_);
+        return status;
     }
 
     virtual aku_Status extract_result(std::vector<std::unique_ptr<RealValuedOperator>>* dest) {
@@ -116,19 +664,40 @@ struct GroupAggregateProcessingStep : ProcessingPrelude {
     aku_Timestamp begin_;
     aku_Timestamp end_;
     aku_Timestamp step_;
+    u16 level_;
     std::vector<aku_ParamId> ids_;
+    bool need_m2_;
+    SharedScan* shared_;
 
     template<class T>
-    GroupAggregateProcessingStep(aku_Timestamp begin, aku_Timestamp end, aku_Timestamp step, T&& t)
+    GroupAggregateProcessingStep(aku_Timestamp begin, aku_Timestamp end, aku_Timestamp step, u16 level, T&& t,
+                                 bool need_m2 = false, SharedScan* shared = nullptr)
         : begin_(begin)
         , end_(end)
         , step_(step)
+        , level_(level)
         , ids_(std::forward<T>(t))
+        , need_m2_(need_m2)
+        , shared_(shared)
     {
+        if (shared_) {
+            shared_->add_aggregate(ids_, begin_, end_, step_, level_, need_m2_);
+        }
+    }
+
+    virtual std::string describe() const {
+        std::string name = shared_ ? "shared-group-aggregate" : "group-aggregate";
+        if (level_) {
+            return name + " (approximate, level " + std::to_string(level_) + ")";
+        }
+        return name;
     }
 
     virtual aku_Status apply(const ColumnStore& cstore) {
-        return cstore.group_aggregate(ids_, begin_, end_, step_, &agglist_);
+        auto status = shared_ ? shared_->aggregate(cstore, ids_, begin_, end_, step_, level_, need_m2_, &agglist_)
+                              : cstore.group_aggregate(ids_, begin_, end_, step_, &agglist_, level_, need_m2_);
+        instrument(&agglist_, profile_);
+        return status;
     }
 
     virtual aku_Status extract_result(std::vector<std::unique_ptr<RealValuedOperator>>* dest) {
@@ -164,6 +733,10 @@ struct MergeBy : MaterializationStep {
     {
     }
 
+    std::string describe() const {
+        return order == OrderBy::SERIES ? "merge-by-series" : "merge-by-time";
+    }
+
     aku_Status apply(ProcessingPrelude* prelude) {
         std::vector<std::unique_ptr<RealValuedOperator>> iters;
         auto status = prelude->extract_result(&iters);
@@ -197,6 +770,10 @@ struct Chain : MaterializationStep {
     {
     }
 
+    std::string describe() const {
+        return "chain";
+    }
+
     aku_Status apply(ProcessingPrelude *prelude) {
         std::vector<std::unique_ptr<RealValuedOperator>> iters;
         auto status = prelude->extract_result(&iters);
@@ -234,6 +811,10 @@ struct Aggregate : MaterializationStep {
     {
     }
 
+    std::string describe() const {
+        return "aggregate-materializer";
+    }
+
     aku_Status apply(ProcessingPrelude *prelude) {
         std::vector<std::unique_ptr<AggregateOperator>> iters;
         auto status = prelude->extract_result(&iters);
@@ -272,6 +853,10 @@ struct AggregateCombiner : MaterializationStep {
     {
     }
 
+    std::string describe() const {
+        return "aggregate-combiner";
+    }
+
     aku_Status apply(ProcessingPrelude *prelude) {
         std::vector<std::unique_ptr<AggregateOperator>> iters;
         auto status = prelude->extract_result(&iters);
@@ -333,6 +918,10 @@ struct Join : MaterializationStep {
     {
     }
 
+    std::string describe() const {
+        return order_ == OrderBy::SERIES ? "join-concat" : "merge-join";
+    }
+
     aku_Status apply(ProcessingPrelude *prelude) {
         int inc = cardinality_;
         std::vector<std::unique_ptr<RealValuedOperator>> scanlist;
@@ -391,6 +980,10 @@ struct SeriesOrderAggregate : MaterializationStep {
     {
     }
 
+    std::string describe() const {
+        return "series-order-aggregate";
+    }
+
     aku_Status apply(ProcessingPrelude *prelude) {
         std::vector<std::unique_ptr<AggregateOperator>> iters;
         auto status = prelude->extract_result(&iters);
@@ -422,6 +1015,10 @@ struct TimeOrderAggregate : MaterializationStep {
     {
     }
 
+    std::string describe() const {
+        return "time-order-aggregate";
+    }
+
     aku_Status apply(ProcessingPrelude *prelude) {
         std::vector<std::unique_ptr<AggregateOperator>> iters;
         auto status = prelude->extract_result(&iters);
@@ -471,11 +1068,68 @@ struct TwoStepQueryPlan : IQueryPlan {
         }
         return column_->read(dest, size);
     }
+
+    void set_profile(QueryProfile* profile) {
+        prelude_->profile_ = profile;
+        profile->steps.push_back(prelude_->describe());
+        profile->steps.push_back(mater_->describe());
+    }
 };
 
 // ----------- Query plan builder ------------ //
 
-static std::tuple<aku_Status, std::unique_ptr<IQueryPlan>> scan_query_plan(ReshapeRequest const& req) {
+/** Compute scan ranges of the query that continues after the resume point.
+  * In series order series are returned one by one, so series returned by the
+  * previous pages are skipped. In time order samples are ordered by timestamp and
+  * then by id, so the scan of every series starts from the resume point.
+  */
+static aku_Status resume_scan(ReshapeRequest const& req,
+                              std::vector<aku_ParamId>* ids,
+                              std::vector<aku_Timestamp>* begins)
+{
+    auto const& all = req.select.columns.at(0).ids;
+    auto const& resume = req.resume;
+    auto end = req.select.end;
+    bool forward = req.select.begin < end;
+    // Next timestamp after `ts` in scan direction, returns false if it's out of range
+    auto next = [forward, end](aku_Timestamp ts, aku_Timestamp* out) {
+        if (forward) {
+            *out = ts + 1;
+            return *out < end;
+        }
+        *out = ts - 1;
+        return ts != 0 && *out > end;
+    };
+    if (req.order_by == OrderBy::SERIES) {
+        auto it = std::find(all.begin(), all.end(), resume.id);
+        if (it == all.end()) {
+            Logger::msg(AKU_LOG_ERROR, "Series from the page token is not found");
+            return AKU_ENOT_FOUND;
+        }
+        aku_Timestamp begin;
+        if (next(resume.timestamp, &begin)) {
+            ids->push_back(*it);
+            begins->push_back(begin);
+        }
+        for (it++; it != all.end(); it++) {
+            ids->push_back(*it);
+            begins->push_back(req.select.begin);
+        }
+    } else {
+        for (auto id: all) {
+            // Samples with the same timestamp are ordered by id
+            bool returned = forward ? id <= resume.id : id >= resume.id;
+            aku_Timestamp begin = resume.timestamp;
+            if (!returned || next(resume.timestamp, &begin)) {
+                ids->push_back(id);
+                begins->push_back(begin);
+            }
+        }
+    }
+    return AKU_SUCCESS;
+}
+
+static std::tuple<aku_Status, std::unique_ptr<IQueryPlan>> scan_query_plan(ReshapeRequest const& req, SharedScan* shared) {
     // Hardwired query plan for scan query
     // Tier1
     // - List of range scan operators
@@ -495,9 +1149,28 @@ static std::tuple<aku_Status, std::unique_ptr<IQueryPlan>> scan_query_plan(Resha
     }
 
     std::unique_ptr<ProcessingPrelude> t1stage;
-    t1stage.reset(new ScanProcessingStep(req.select.begin, req.select.end, req.select.columns.at(0).ids));
-
     std::unique_ptr<MaterializationStep> t2stage;
+    if (req.resume.enabled) {
+        // Resumed query, group-by is rejected by the parser
+        std::vector<aku_ParamId> ids;
+        std::vector<aku_Timestamp> begins;
+        auto status = resume_scan(req, &ids, &begins);
+        if (status != AKU_SUCCESS) {
+            return std::make_tuple(status, std::move(result));
+        }
+        auto t2ids = ids;
+        t1stage.reset(new ScanProcessingStep(std::move(begins), req.select.end, std::move(ids)));
+        if (req.order_by == OrderBy::SERIES) {
+            t2stage.reset(new Chain(std::move(t2ids)));
+        } else {
+            t2stage.reset(new MergeBy<OrderBy::TIME>(std::move(t2ids)));
+        }
+        result.reset(new TwoStepQueryPlan(std::move(t1stage), std::move(t2stage)));
+        return std::make_tuple(AKU_SUCCESS, std::move(result));
+    }
+
+    t1stage.reset(new ScanProcessingStep(req.select.begin, req.select.end, req.select.columns.at(0).ids, shared));
+
     if (req.group_by.enabled) {
         std::vector<aku_ParamId> ids;
         for(auto id: req.select.columns.at(0).ids) {
@@ -524,7 +1197,7 @@ static std::tuple<aku_Status, std::unique_ptr<IQueryPlan>> scan_query_plan(Resha
     return std::make_tuple(AKU_SUCCESS, std::move(result));
 }
 
-static std::tuple<aku_Status, std::unique_ptr<IQueryPlan>> aggregate_query_plan(ReshapeRequest const& req) {
+static std::tuple<aku_Status, std::unique_ptr<IQueryPlan>> aggregate_query_plan(ReshapeRequest const& req, SharedScan* shared) {
     // Hardwired query plan for aggregate query
     // Tier1
     // - List of aggregate operators
@@ -546,7 +1219,8 @@ static std::tuple<aku_Status, std::unique_ptr<IQueryPlan>> aggregate_query_plan(
     }
 
     std::unique_ptr<ProcessingPrelude> t1stage;
-    t1stage.reset(new AggregateProcessingStep(req.select.begin, req.select.end, req.select.columns.at(0).ids));
+    t1stage.reset(new AggregateProcessingStep(req.select.begin, req.select.end, req.select.columns.at(0).ids,
+                                              Aggregation::needs_m2(req.agg.func), shared));
 
     std::unique_ptr<MaterializationStep> t2stage;
     if (req.group_by.enabled) {
@@ -567,7 +1241,7 @@ static std::tuple<aku_Status, std::unique_ptr<IQueryPlan>> aggregate_query_plan(
     return std::make_tuple(AKU_SUCCESS, std::move(result));
 }
 
-static std::tuple<aku_Status, std::unique_ptr<IQueryPlan>> join_query_plan(ReshapeRequest const& req) {
+static std::tuple<aku_Status, std::unique_ptr<IQueryPlan>> join_query_plan(ReshapeRequest const& req, SharedScan* shared) {
     std::unique_ptr<IQueryPlan> result;
 
     // Group-by and aggregation is not supported currently
@@ -583,7 +1257,7 @@ static std::tuple<aku_Status, std::unique_ptr<IQueryPlan>> join_query_plan(Resha
             t1ids.push_back(req.select.columns.at(static_cast<size_t>(c)).ids.at(i));
         }
     }
-    t1stage.reset(new ScanProcessingStep(req.select.begin, req.select.end, std::move(t1ids)));
+    t1stage.reset(new ScanProcessingStep(req.select.begin, req.select.end, std::move(t1ids), shared));
 
     std::unique_ptr<MaterializationStep> t2stage;
 
@@ -597,7 +1271,7 @@ static std::tuple<aku_Status, std::unique_ptr<IQueryPlan>> join_query_plan(Resha
     return std::make_tuple(AKU_SUCCESS, std::move(result));
 }
 
-static std::tuple<aku_Status, std::unique_ptr<IQueryPlan>> group_aggregate_query_plan(ReshapeRequest const& req) {
+static std::tuple<aku_Status, std::unique_ptr<IQueryPlan>> group_aggregate_query_plan(ReshapeRequest const& req, SharedScan* shared) {
     // Hardwired query plan for group aggregate query
     // Tier1
     // - List of group aggregate operators
@@ -616,7 +1290,9 @@ static std::tuple<aku_Status, std::unique_ptr<IQueryPlan>> group_aggregate_query
     }
 
     std::unique_ptr<ProcessingPrelude> t1stage;
-    t1stage.reset(new GroupAggregateProcessingStep(req.select.begin, req.select.end, req.agg.step, req.select.columns.at(0).ids));
+    t1stage.reset(new GroupAggregateProcessingStep(req.select.begin, req.select.end, req.agg.step, req.agg.level,
+                                                   req.select.columns.at(0).ids, Aggregation::needs_m2(req.agg.func),
+                                                   shared));
 
     std::unique_ptr<MaterializationStep> t2stage;
     if (req.order_by == OrderBy::SERIES) {
@@ -630,21 +1306,43 @@ static std::tuple<aku_Status, std::unique_ptr<IQueryPlan>> group_aggregate_query
 }
 
 std::tuple<aku_Status, std::unique_ptr<IQueryPlan>> QueryPlanBuilder::create(const ReshapeRequest& req) {
+    return create(req, nullptr);
+}
+
+std::tuple<aku_Status, std::unique_ptr<IQueryPlan>> QueryPlanBuilder::create(const ReshapeRequest& req, SharedScan* shared) {
     if (req.agg.enabled && req.agg.step == 0) {
         // Aggregate query
-        return aggregate_query_plan(req);
+        return aggregate_query_plan(req, shared);
     } else if (req.agg.enabled && req.agg.step != 0) {
         // Group aggregate query
-        return group_aggregate_query_plan(req);
+        return group_aggregate_query_plan(req, shared);
     } else if (req.agg.enabled == false && req.select.columns.size() > 1) {
         // Join query
-        return join_query_plan(req);
+        return join_query_plan(req, shared);
     }
-    return scan_query_plan(req);
+    return scan_query_plan(req, shared);
 }
 
-void QueryPlanExecutor::execute(const StorageEngine::ColumnStore& cstore, std::unique_ptr<QP::IQueryPlan>&& iter, QP::IStreamProcessor& qproc) {
-    aku_Status status = iter->execute(cstore);
+void QueryPlanExecutor::execute(const StorageEngine::ColumnStore& cstore, std::unique_ptr<QP::IQueryPlan>&& iter, QP::IStreamProcessor& qproc,
+                                QueryProfile* profile)
+{
+    // Query without profiling is accounted to the enclosing scope (if any)
+    QueryCountersScope counters(profile ? &profile->counters : QueryCounters::current());
+    u64 start = 0;
+    if (profile) {
+        iter->set_profile(profile);
+        start = QueryProfile::now();
+    }
+    aku_Status status = QueryCancellation::check_current();
+    if (status != AKU_SUCCESS) {
+        Logger::msg(AKU_LOG_INFO, "Query cancelled, " + StatusUtil::str(status));
+        qproc.set_error(status);
+        return;
+    }
+    status = iter->execute(cstore);
+    if (profile) {
+        profile->execute_time += QueryProfile::now() - start;
+    }
     if (status != AKU_SUCCESS) {
         Logger::msg(AKU_LOG_ERROR, "Query plan error" + StatusUtil::str(status));
         qproc.set_error(status);
@@ -655,9 +1353,25 @@ void QueryPlanExecutor::execute(const StorageEngine::ColumnStore& cstore, std::u
     dest.resize(dest_size);
     while(status == AKU_SUCCESS) {
         size_t size;
+        auto reason = QueryCancellation::check_current();
+        if (reason != AKU_SUCCESS) {
+            Logger::msg(AKU_LOG_INFO, "Query cancelled, " + StatusUtil::str(reason));
+            qproc.set_error(reason);
+            return;
+        }
         // This is OK because normal query (aggregate or select) will write fixed size samples with size = sizeof(aku_Sample).
         //
-        std::tie(status, size) = iter->read(reinterpret_cast<u8*>(dest.data()), dest_size);
+        if (profile) {
+            start = QueryProfile::now();
+        }
+        {
+            ProbeScope probe(AKU_PROBE_OPERATOR_READ);
+            std::tie(status, size) = iter->read(reinterpret_cast<u8*>(dest.data()), dest_size);
+        }
+        if (profile) {
+            profile->read_time += QueryProfile::now() - start;
+            start = QueryProfile::now();
+        }
         if (status != AKU_SUCCESS && (status != AKU_ENO_DATA && status != AKU_EUNAVAILABLE)) {
             Logger::msg(AKU_LOG_ERROR, "Iteration error " + StatusUtil::str(status));
             qproc.set_error(status);
@@ -667,12 +1381,25 @@ void QueryPlanExecutor::execute(const StorageEngine::ColumnStore& cstore, std::u
         size_t pos = 0;
         while(pos < size) {
             aku_Sample const* sample = reinterpret_cast<aku_Sample const*>(dest.data() + pos);
+            if (profile) {
+                profile->materialized_samples++;
+            }
             if (!qproc.put(*sample)) {
                 Logger::msg(AKU_LOG_TRACE, "Iteration stopped by client");
+                auto reason = QueryCancellation::check_current();
+                if (reason != AKU_SUCCESS) {
+                    qproc.set_error(reason);
+                }
+                if (profile) {
+                    profile->processing_time += QueryProfile::now() - start;
+                }
                 return;
             }
             pos += sample->payload.size;
         }
+        if (profile) {
+            profile->processing_time += QueryProfile::now() - start;
+        }
     }
 }
 
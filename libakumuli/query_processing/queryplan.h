@@ -1,15 +1,47 @@
 #pragma once
 
+#include <map>
 #include <memory>
+#include <unordered_map>
 #include <vector>
 
 #include "index/seriesparser.h"
+#include "instrumentation.h"
 #include "queryprocessor_framework.h"
 #include "storage_engine/column_store.h"
 
+#include <boost/property_tree/ptree.hpp>
+
 namespace Akumuli {
 namespace QP {
 
+/**
+ * Query profile (collected if `"profile": true` is set in the query).
+ * All timings are in nanoseconds.
+ */
+struct QueryProfile {
+    std::vector<std::string> steps;     //< Query plan steps
+    u64 nseries;                        //< Number of series selected by the query
+    u64 noperators;                     //< Number of storage level operators
+    u64 operator_samples;               //< Samples produced by storage level operators
+    u64 materialized_samples;           //< Samples produced by the query plan
+    u64 output_samples;                 //< Samples produced by the processing nodes
+    QueryCounters counters;             //< Storage level counters
+    u64 planning_time;                  //< Query parsing, index resolution and planning
+    u64 execute_time;                   //< Operators creation
+    u64 operators_time;                 //< Time spent inside storage level operators
+    u64 read_time;                      //< Materialization time (includes operators time)
+    u64 processing_time;                //< Time spent in processing nodes
+
+    QueryProfile();
+
+    //! Convert to property tree (will be serialized as JSON)
+    boost::property_tree::ptree to_ptree() const;
+
+    //! Current time for profiling purposes
+    static u64 now();
+};
+
 /**
  * Query plan interface
  */
@@ -29,15 +61,128 @@ struct IQueryPlan {
       * @return status of the operation (success or error code) and number of written bytes
       */
     virtual std::tuple<aku_Status, size_t> read(u8 *dest, size_t size) = 0;
+
+    /** Enable profiling. Should be called before `execute`.
+      * Adds plan steps to the profile and instruments storage level operators.
+      */
+    virtual void set_profile(QueryProfile* profile) = 0;
+};
+
+/**
+ * Scan shared by the queries of the batch.
+ * Series that are scanned by several queries are read from the column store
+ * once (union of all ranges) and the decoded data is replayed to every scan
+ * operator that needs it. Aggregations are shared the same way: identical
+ * aggregations (same series, range, step and level) are computed once, exact
+ * aggregations of the buffered series are computed from the buffer. All scans
+ * and aggregations should be registered before the first operator is created.
+ */
+class SharedScan {
+    struct Buffer {
+        std::vector<aku_Timestamp> ts;
+        std::vector<double>        xs;
+    };
+    struct Entry {
+        aku_Timestamp           lo;      //< Lower bound of the union range (inclusive)
+        aku_Timestamp           hi;      //< Upper bound of the union range (exclusive)
+        int                     refs;    //< Number of scans that wasn't created yet
+        bool                    loaded;  //< Data was read (`buffer` is null if it didn't fit)
+        std::shared_ptr<Buffer> buffer;
+    };
+    struct AggBuffer {
+        std::vector<aku_Timestamp>                    ts;
+        std::vector<StorageEngine::AggregationResult> xs;
+    };
+    struct AggKey {
+        aku_ParamId   id;
+        aku_Timestamp begin;
+        aku_Timestamp end;
+        aku_Timestamp step;     //< Zero for the aggregate query
+        u16           level;
+        bool          need_m2;
+
+        bool operator < (AggKey const& other) const;
+    };
+    struct AggEntry {
+        int                        refs;       //< Number of operators that wasn't created yet
+        bool                       loaded;     //< Result was computed (`buffer` is null if it didn't fit)
+        bool                       from_scan;  //< Result can be computed from the scan buffer
+        std::shared_ptr<AggBuffer> buffer;
+    };
+    std::unordered_map<aku_ParamId, Entry> entries_;
+    std::map<AggKey, AggEntry> aggregates_;
+    size_t capacity_;  //< Max number of buffered data points (or aggregates)
+    size_t size_;      //< Number of buffered data points (or aggregates)
+    size_t reused_;    //< Number of operators served from the buffer
+    bool   linked_;    //< Aggregations are linked to scans
+
+    aku_Status load(const StorageEngine::ColumnStore& cstore, aku_ParamId id, Entry* entry);
+
+    //! Take one reference to the series data, `dest` is null if the series is not buffered
+    aku_Status acquire(const StorageEngine::ColumnStore& cstore, aku_ParamId id, Entry* entry, std::shared_ptr<Buffer>* dest);
+
+    //! Read aggregation result from the column store, `dest` is null if it didn't fit
+    aku_Status load(const StorageEngine::ColumnStore& cstore, AggKey const& key, std::shared_ptr<AggBuffer>* dest);
+
+    //! Compute exact aggregation from the series data
+    static std::shared_ptr<AggBuffer> compute(Buffer const& data, AggKey const& key);
+
+    //! Count exact aggregations covered by the scans as users of the scan buffer
+    void link();
+
+public:
+    //! Default limit is 4M data points (64MB)
+    SharedScan(size_t capacity = 0x400000);
+
+    //! Register scan of the series in [begin, end) range (or (end, begin] if end < begin)
+    void add(std::vector<aku_ParamId> const& ids, aku_Timestamp begin, aku_Timestamp end);
+
+    //! Create scan operators, same as ColumnStore::scan
+    aku_Status scan(const StorageEngine::ColumnStore& cstore,
+                    std::vector<aku_ParamId> const& ids,
+                    aku_Timestamp begin,
+                    aku_Timestamp end,
+                    std::vector<std::unique_ptr<StorageEngine::RealValuedOperator>>* dest);
+
+    //! Register aggregation of the series, `step` is zero for the aggregate query
+    void add_aggregate(std::vector<aku_ParamId> const& ids,
+                       aku_Timestamp begin,
+                       aku_Timestamp end,
+                       aku_Timestamp step,
+                       u16 level,
+                       bool need_m2);
+
+    //! Create aggregate operators, same as ColumnStore::aggregate (or ColumnStore::group_aggregate if `step` is set)
+    aku_Status aggregate(const StorageEngine::ColumnStore& cstore,
+                         std::vector<aku_ParamId> const& ids,
+                         aku_Timestamp begin,
+                         aku_Timestamp end,
+                         aku_Timestamp step,
+                         u16 level,
+                         bool need_m2,
+                         std::vector<std::unique_ptr<StorageEngine::AggregateOperator>>* dest);
+
+    //! Number of operators that didn't touch the column store
+    size_t reused() const;
 };
 
 struct QueryPlanBuilder {
     static std::tuple<aku_Status, std::unique_ptr<IQueryPlan> > create(const ReshapeRequest& req);
+
+    /** Create query plan that uses shared scan.
+      * Scans of the plan are registered in `shared`, plan should be executed
+      * after all plans of the batch are created.
+      */
+    static std::tuple<aku_Status, std::unique_ptr<IQueryPlan> > create(const ReshapeRequest& req, SharedScan* shared);
 };
 
 struct QueryPlanExecutor {
 
-    void execute(const StorageEngine::ColumnStore& cstore, std::unique_ptr<QP::IQueryPlan>&& iter, QP::IStreamProcessor& qproc);
+    /** Execute query plan and pass results to the query processor.
+      * @param profile is an optional query profile, all counters will be updated if set
+      */
+    void execute(const StorageEngine::ColumnStore& cstore, std::unique_ptr<QP::IQueryPlan>&& iter, QP::IStreamProcessor& qproc,
+                 QueryProfile* profile = nullptr);
 };
 
 }}  // namespaces
@@ -44,6 +44,7 @@ struct Aggregation {
     bool enabled;
     std::vector<AggregationFunction> func;
     u64 step;  // 0 if group by time disabled
+    u16 level = 0;  // approximation level of the group-aggregate query, 0 - exact result
 
     static std::string to_string(AggregationFunction f) {
         switch(f) {
@@ -61,6 +62,14 @@ struct Aggregation {
             return "min";
         case AggregationFunction::MIN_TIMESTAMP:
             return "min_timestamp";
+        case AggregationFunction::RATE:
+            return "rate";
+        case AggregationFunction::INCREASE:
+            return "increase";
+        case AggregationFunction::VARIANCE:
+            return "variance";
+        case AggregationFunction::STDDEV:
+            return "stddev";
         };
         AKU_PANIC("Invalid aggregation function");
     }
@@ -80,9 +89,27 @@ struct Aggregation {
             return std::make_tuple(AKU_SUCCESS, AggregationFunction::MAX_TIMESTAMP);
         } else if (str == "mean") {
             return std::make_tuple(AKU_SUCCESS, AggregationFunction::MEAN);
+        } else if (str == "rate") {
+            return std::make_tuple(AKU_SUCCESS, AggregationFunction::RATE);
+        } else if (str == "increase") {
+            return std::make_tuple(AKU_SUCCESS, AggregationFunction::INCREASE);
+        } else if (str == "variance") {
+            return std::make_tuple(AKU_SUCCESS, AggregationFunction::VARIANCE);
+        } else if (str == "stddev") {
+            return std::make_tuple(AKU_SUCCESS, AggregationFunction::STDDEV);
         }
         return std::make_tuple(AKU_EBAD_ARG, AggregationFunction::CNT);
     }
+
+    //! Check if some of the functions require `m2` component of the aggregate
+    static bool needs_m2(std::vector<AggregationFunction> const& funcs) {
+        for (auto f: funcs) {
+            if (f == AggregationFunction::VARIANCE || f == AggregationFunction::STDDEV) {
+                return true;
+            }
+        }
+        return false;
+    }
 };
 
 struct Column {
@@ -117,12 +144,20 @@ enum class OrderBy {
     TIME,
 };
 
+//! Position of the last sample returned by the previous page of the query
+struct ResumePoint {
+    bool          enabled = false;
+    aku_ParamId   id = 0;
+    aku_Timestamp timestamp = 0;
+};
+
 //! Reshape request defines what should be sent to query processor
 struct ReshapeRequest {
     Aggregation  agg;
     Selection select;
     GroupBy group_by;
     OrderBy order_by;
+    ResumePoint resume;
 };
 
 
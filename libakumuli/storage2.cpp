@@ -21,14 +21,19 @@
 #include "queryprocessor.h"
 #include "query_processing/queryparser.h"
 #include "query_processing/queryplan.h"
+#include "query_processing/limiter.h"
 #include "log_iface.h"
 #include "status_util.h"
 #include "datetime.h"
 #include "akumuli_version.h"
+#include "instrumentation.h"
+#include "cancellation.h"
+#include "pool.h"
 
 #include <algorithm>
 #include <atomic>
 #include <sstream>
+#include <cstring>
 #include <cassert>
 #include <functional>
 
@@ -56,7 +61,10 @@ static apr_status_t create_metadata_page(const char* db_name
                                         , const char* file_name
                                         , std::vector<std::string> const& page_file_names
                                         , std::vector<u32> const& capacities
-                                        , const char* bstore_type )
+                                        , const char* bstore_type
+                                        , u32 stripe_width = 1
+                                        , std::vector<std::string> const& superblock_file_names = std::vector<std::string>()
+                                        , std::vector<u32> const& superblock_capacities = std::vector<u32>() )
 {
     using namespace std;
     try {
@@ -67,6 +75,10 @@ static apr_status_t create_metadata_page(const char* db_name
         apr_rfc822_date(date_time, now);
 
         storage->init_config(db_name, date_time, bstore_type);
+        if (stripe_width > 1) {
+            storage->set_config_param("stripe_width", std::to_string(stripe_width),
+                                      "Number of stripes used by the striped blockstore.");
+        }
 
         std::vector<MetadataStorage::VolumeDesc> desc;
         u32 ix = 0;
@@ -81,6 +93,17 @@ static apr_status_t create_metadata_page(const char* db_name
             desc.push_back(volume);
             ix++;
         }
+        // Superblock volume set uses separate range of ids
+        for (u32 sbix = 0; sbix < superblock_file_names.size(); sbix++) {
+            MetadataStorage::VolumeDesc volume;
+            volume.path = superblock_file_names[sbix];
+            volume.generation = sbix;
+            volume.capacity = superblock_capacities[sbix];
+            volume.id = StorageEngine::SUPERBLOCK_VOLUME_BASE + sbix;
+            volume.nblocks = 0;
+            volume.version = AKUMULI_VERSION;
+            desc.push_back(volume);
+        }
         storage->init_volumes(desc);
 
     } catch (std::exception const& err) {
@@ -122,6 +145,7 @@ aku_Status StorageSession::write(aku_Sample const& sample) {
 }
 
 aku_Status StorageSession::init_series_id(const char* begin, const char* end, aku_Sample *sample) {
+    ProbeScope probe(AKU_PROBE_SERIES_LOOKUP);
     // Series name normalization procedure. Most likeley a bottleneck but
     // can be easily parallelized.
     const char* ksbegin = nullptr;
@@ -262,6 +286,10 @@ void StorageSession::search(InternalCursor* cur, const char* query) const {
     storage_->search(this, cur, query);
 }
 
+void StorageSession::prepare(InternalCursor* cur, const char* query) const {
+    storage_->prepare(this, cur, query);
+}
+
 void StorageSession::set_series_matcher(std::shared_ptr<PlainSeriesMatcher> matcher) const {
     matcher_substitute_ = matcher;
 }
@@ -275,6 +303,7 @@ void StorageSession::clear_series_matcher() const {
 Storage::Storage()
     : done_{0}
     , close_barrier_(2)
+    , prepared_next_id_(0)
 {
     //! In-memory SQLite database
     metadata_.reset(new MetadataStorage(":memory:"));
@@ -285,9 +314,66 @@ Storage::Storage()
     start_sync_worker();
 }
 
-Storage::Storage(const char* path)
+//! Open file storage of the specified type
+static std::shared_ptr<StorageEngine::BlockStore> open_file_storage(std::string const& bstore_type,
+                                                                    std::shared_ptr<VolumeRegistry> registry,
+                                                                    u32 stripe_width,
+                                                                    StorageEngine::FileStorageParams const& params)
+{
+    std::shared_ptr<StorageEngine::BlockStore> bstore;
+    if (bstore_type == "FixedSizeFileStorage") {
+        Logger::msg(AKU_LOG_INFO, "Open as fxied size storage");
+        bstore = StorageEngine::FixedSizeFileStorage::open(registry, params);
+    } else if (bstore_type == "ExpandableFileStorage") {
+        Logger::msg(AKU_LOG_INFO, "Open as expandable storage");
+        bstore = StorageEngine::ExpandableFileStorage::open(registry, params);
+    } else if (bstore_type == "StripedFileStorage") {
+        Logger::msg(AKU_LOG_INFO, "Open as striped storage, stripe width: " + std::to_string(stripe_width));
+        bstore = StorageEngine::StripedFileStorage::open(registry, stripe_width, params);
+    } else {
+        Logger::msg(AKU_LOG_ERROR, "Unknown blockstore type (" + bstore_type + ")");
+        AKU_PANIC("Unknown blockstore type (" + bstore_type + ")");
+    }
+    return bstore;
+}
+
+/** Open blockstore described by the metadata storage.
+  * If database has superblock volume set, superblocks are stored separately
+  * (see SplitBlockStore).
+  */
+static std::shared_ptr<StorageEngine::BlockStore> open_blockstore(std::shared_ptr<MetadataStorage> meta,
+                                                                  StorageEngine::FileStorageParams const& params,
+                                                                  bool lock_superblocks)
+{
+    using namespace StorageEngine;
+    std::string bstore_type = "FixedSizeFileStorage";
+    std::string stripe_width = "1";
+    meta->get_config_param("blockstore_type", &bstore_type);
+    meta->get_config_param("stripe_width", &stripe_width);
+    auto width = static_cast<u32>(std::stoul(stripe_width));
+    bool split = false;
+    for (auto const& vol: meta->get_volumes()) {
+        split |= vol.id >= SUPERBLOCK_VOLUME_BASE;
+    }
+    if (!split) {
+        return open_file_storage(bstore_type, meta, width, params);
+    }
+    auto leaves_registry = std::make_shared<VolumeRegistryView>(meta, 0u, SUPERBLOCK_VOLUME_BASE, "");
+    auto sblock_registry = std::make_shared<VolumeRegistryView>(meta, SUPERBLOCK_VOLUME_BASE, SUPERBLOCK_VOLUME_BASE, "_sb");
+    auto leaves = open_file_storage(bstore_type, leaves_registry, width, params);
+    // Superblock volume set is not striped, it's small enough to fit on one device
+    auto sblock_type = bstore_type == "ExpandableFileStorage" ? bstore_type : std::string("FixedSizeFileStorage");
+    auto sblock_params = params;
+    sblock_params.lock_in_memory = lock_superblocks;
+    Logger::msg(AKU_LOG_INFO, "Open superblock volume set");
+    auto sblocks = open_file_storage(sblock_type, sblock_registry, 1, sblock_params);
+    return std::make_shared<SplitBlockStore>(leaves, sblocks);
+}
+
+Storage::Storage(const char* path, aku_FineTuneParams const& params)
     : done_{0}
     , close_barrier_(2)
+    , prepared_next_id_(0)
 {
     metadata_.reset(new MetadataStorage(path));
 
@@ -299,20 +385,15 @@ Storage::Storage(const char* path)
     for (auto vol: volumes) {
         volpaths.push_back(vol.path);
     }
-    std::string bstore_type = "FixedSizeFileStorage";
-    std::string db_name = "db";
-    metadata_->get_config_param("blockstore_type", &bstore_type);
-    metadata_->get_config_param("db_name", &db_name);
-    if (bstore_type == "FixedSizeFileStorage") {
-        Logger::msg(AKU_LOG_INFO, "Open as fxied size storage");
-        bstore_ = StorageEngine::FixedSizeFileStorage::open(metadata_);
-    } else if (bstore_type == "ExpandableFileStorage") {
-        Logger::msg(AKU_LOG_INFO, "Open as expandable storage");
-        bstore_ = StorageEngine::ExpandableFileStorage::open(metadata_);
-    } else {
-        Logger::msg(AKU_LOG_ERROR, "Unknown blockstore type (" + bstore_type + ")");
-        AKU_PANIC("Unknown blockstore type (" + bstore_type + ")");
+    StorageEngine::FileStorageParams bstore_params;
+    if (params.direct_io) {
+        const u64 DEFAULT_CACHE_SIZE = 256*1024*1024;  // 256MB
+        u64 cache_size = params.max_cache_size ? params.max_cache_size : DEFAULT_CACHE_SIZE;
+        bstore_params.direct_io  = true;
+        bstore_params.cache_size = static_cast<size_t>(cache_size / StorageEngine::AKU_BLOCK_SIZE);
+        Logger::msg(AKU_LOG_INFO, "Direct I/O enabled, block cache size: " + std::to_string(cache_size));
     }
+    bstore_ = open_blockstore(metadata_, bstore_params, params.mlock_superblocks != 0);
     cstore_ = std::make_shared<StorageEngine::ColumnStore>(bstore_);
     // Update series matcher
     boost::optional<u64> baseline = metadata_->get_prev_largest_id();
@@ -332,6 +413,14 @@ Storage::Storage(const char* path)
         AKU_PANIC("Can't read rescue points");
     }
     cstore_->open_or_restore(mapping, true);
+    std::unordered_map<aku_ParamId, MetadataStorage::ActivityT> activity;
+    status = metadata_->load_series_activity(activity);
+    if (status != AKU_SUCCESS) {
+        // Index is an optimization, all series are considered active without it
+        Logger::msg(AKU_LOG_ERROR, "Can't read series activity");
+    } else {
+        cstore_->restore_activity(activity);
+    }
     start_sync_worker();
 }
 
@@ -574,7 +663,7 @@ aku_Status Storage::generate_report(const char* path, const char *output) {
         volpaths.push_back(vol.path);
     }
 
-    auto bstore = StorageEngine::FixedSizeFileStorage::open(metadata);
+    auto bstore = open_blockstore(metadata, StorageEngine::FileStorageParams(), false);
 
     // Load series matcher data
     PlainSeriesMatcher matcher;
@@ -633,7 +722,7 @@ aku_Status Storage::generate_recovery_report(const char* path, const char *outpu
         volpaths.push_back(vol.path);
     }
 
-    auto bstore = StorageEngine::FixedSizeFileStorage::open(metadata);
+    auto bstore = open_blockstore(metadata, StorageEngine::FileStorageParams(), false);
     auto cstore = std::make_shared<StorageEngine::ColumnStore>(bstore);
 
     // Load series matcher data
@@ -705,6 +794,7 @@ Storage::Storage(std::shared_ptr<MetadataStorage>                  meta,
     , done_{0}
     , close_barrier_(2)
     , metadata_(meta)
+    , prepared_next_id_(0)
 {
     if (start_worker) {
         start_sync_worker();
@@ -726,11 +816,16 @@ void Storage::start_sync_worker() {
             global_matcher_.pull_new_names(names);
         };
 
+        auto get_activity = [this]() {
+            return cstore_->pull_activity_changes();
+        };
+
+        bind_thread_arena(ThreadClass::BACKGROUND);
         while(done_.load() == 0) {
             auto status = metadata_->wait_for_sync_request(SYNC_REQUEST_TIMEOUT);
             if (status == AKU_SUCCESS) {
                 bstore_->flush();
-                metadata_->sync_with_metadata_storage(get_names);
+                metadata_->sync_with_metadata_storage(get_names, get_activity);
             }
         }
 
@@ -755,7 +850,8 @@ void Storage::close() {
             metadata_->add_rescue_point(id, std::move(vals));
         }
         // Save finall mapping (should contain all affected columns)
-        metadata_->sync_with_metadata_storage(boost::bind(&SeriesMatcher::pull_new_names, &global_matcher_, _1));
+        metadata_->sync_with_metadata_storage(boost::bind(&SeriesMatcher::pull_new_names, &global_matcher_, _1),
+                                              [this]() { return cstore_->pull_activity_changes(); });
     }
     bstore_->flush();
 }
@@ -807,7 +903,8 @@ int Storage::get_series_name(aku_ParamId id, char* buffer, size_t buffer_size, P
     return static_cast<int>(str.second);
 }
 
-aku_Status Storage::parse_query(boost::property_tree::ptree const& ptree, QP::ReshapeRequest* req) const {
+//! Create reshape request for the query, series are resolved using `matcher`
+static aku_Status resolve_query(boost::property_tree::ptree const& ptree, SeriesMatcher const& matcher, QP::ReshapeRequest* req) {
     using namespace QP;
     QueryKind kind;
     aku_Status status;
@@ -821,25 +918,25 @@ aku_Status Storage::parse_query(boost::property_tree::ptree const& ptree, QP::Re
         Logger::msg(AKU_LOG_ERROR, "Metadata query is not supported");
         return AKU_EBAD_ARG;
     case QueryKind::AGGREGATE:
-        std::tie(status, *req) = QueryParser::parse_aggregate_query(ptree, global_matcher_);
+        std::tie(status, *req) = QueryParser::parse_aggregate_query(ptree, matcher);
         if (status != AKU_SUCCESS) {
             return status;
         }
         break;
     case QueryKind::GROUP_AGGREGATE:
-        std::tie(status, *req) = QueryParser::parse_group_aggregate_query(ptree, global_matcher_);
+        std::tie(status, *req) = QueryParser::parse_group_aggregate_query(ptree, matcher);
         if (status != AKU_SUCCESS) {
             return status;
         }
         break;
     case QueryKind::SELECT:
-        std::tie(status, *req) = QueryParser::parse_select_query(ptree, global_matcher_);
+        std::tie(status, *req) = QueryParser::parse_select_query(ptree, matcher);
         if (status != AKU_SUCCESS) {
             return status;
         }
         break;
     case QueryKind::JOIN:
-        std::tie(status, *req) = QueryParser::parse_join_query(ptree, global_matcher_);
+        std::tie(status, *req) = QueryParser::parse_join_query(ptree, matcher);
         if (status != AKU_SUCCESS) {
             return status;
         }
@@ -848,24 +945,577 @@ aku_Status Storage::parse_query(boost::property_tree::ptree const& ptree, QP::Re
     return AKU_SUCCESS;
 }
 
-void Storage::query(StorageSession const* session, InternalCursor* cur, const char* query) const {
+aku_Status Storage::parse_query(boost::property_tree::ptree const& ptree, QP::ReshapeRequest* req) const {
+    return resolve_query(ptree, global_matcher_, req);
+}
+
+/** Check if any of the new series can be selected by the query template.
+  * Template is resolved against the matcher that contains only the new series.
+  * Join template is resolved once for every metric as the first metric of the join,
+  * otherwise new series of the other metrics wouldn't be found.
+  */
+static bool matches_new_series(boost::property_tree::ptree const& ptree,
+                               std::vector<SeriesMatcher::SeriesNameT> const& names)
+{
     using namespace QP;
+    if (names.empty()) {
+        return false;
+    }
+    SeriesMatcher matcher;
+    for (auto const& name: names) {
+        matcher._add(std::get<0>(name), std::get<0>(name) + std::get<1>(name), std::get<2>(name));
+    }
+    std::vector<boost::property_tree::ptree> variants;
+    auto join = ptree.get_child_optional("join");
+    if (join) {
+        for (size_t i = 0; i < join->size(); i++) {
+            boost::property_tree::ptree rotated;
+            auto it = join->begin();
+            std::advance(it, i);
+            for (size_t k = 0; k < join->size(); k++) {
+                rotated.push_back(*it);
+                if (++it == join->end()) {
+                    it = join->begin();
+                }
+            }
+            variants.push_back(ptree);
+            variants.back().put_child("join", rotated);
+        }
+    } else {
+        variants.push_back(ptree);
+    }
+    for (auto const& variant: variants) {
+        ReshapeRequest req;
+        if (resolve_query(variant, matcher, &req) != AKU_SUCCESS) {
+            // Series names from the where clause are not found
+            continue;
+        }
+        for (auto const& col: req.select.columns) {
+            for (auto id: col.ids) {
+                if (id != 0) {
+                    return true;
+                }
+            }
+        }
+    }
+    return false;
+}
+
+/** Cursor used by profiled queries.
+  * Counts and discards query results, errors are forwarded to the real cursor.
+  */
+struct ProfilingCursor : InternalCursor {
+    InternalCursor*   cur_;
+    QP::QueryProfile* profile_;
+    bool              error_;
+
+    ProfilingCursor(InternalCursor* cur, QP::QueryProfile* profile)
+        : cur_(cur)
+        , profile_(profile)
+        , error_(false)
+    {
+    }
+
+    virtual bool put(aku_Sample const&) {
+        profile_->output_samples++;
+        return true;
+    }
+
+    virtual void complete() {
+    }
+
+    virtual void set_error(aku_Status error_code) {
+        error_ = true;
+        cur_->set_error(error_code);
+    }
+};
+
+//! Write text to the cursor as a sequence of text samples, return false if cursor was closed
+static bool put_text(InternalCursor* cur, std::string const& text) {
+    // Chunk should fit into the read buffer of the client
+    static const size_t CHUNK_SIZE = 512;
+    std::vector<char> buffer(sizeof(aku_Sample) + CHUNK_SIZE);
+    for (size_t pos = 0; pos < text.size(); pos += CHUNK_SIZE) {
+        size_t len = std::min(CHUNK_SIZE, text.size() - pos);
+        aku_Sample* sample = reinterpret_cast<aku_Sample*>(buffer.data());
+        std::memset(sample, 0, sizeof(aku_Sample));
+        sample->payload.type = aku_PData::TEXT;
+        sample->payload.size = static_cast<u16>(sizeof(aku_Sample) + len);
+        std::copy(text.begin() + static_cast<ptrdiff_t>(pos),
+                  text.begin() + static_cast<ptrdiff_t>(pos + len),
+                  sample->payload.data);
+        if (!cur->put(*sample)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+//! Send text to the cursor as a sequence of text samples
+static void send_text(InternalCursor* cur, std::string const& text) {
+    put_text(cur, text);
+    cur->complete();
+}
+
+/** Cursor used by the paged query.
+  * Sends the page token of the next page before completion if the output was
+  * truncated by the limit.
+  */
+struct PaginationCursor : InternalCursor {
+    InternalCursor*              cur_;
+    QP::OrderBy                  order_;
+    std::shared_ptr<QP::Limiter> limiter_;
+
+    PaginationCursor(InternalCursor* cur, QP::OrderBy order)
+        : cur_(cur)
+        , order_(order)
+    {
+    }
+
+    virtual bool put(aku_Sample const& sample) {
+        return cur_->put(sample);
+    }
+
+    virtual void complete() {
+        if (limiter_ && limiter_->truncated_) {
+            auto token = QP::QueryParser::make_page_token(order_, limiter_->last_id_, limiter_->last_ts_);
+            put_text(cur_, "@" + token + "\r\n");
+        }
+        cur_->complete();
+    }
+
+    virtual void set_error(aku_Status error_code) {
+        cur_->set_error(error_code);
+    }
+};
+
+//! Send query profile to the cursor as a sequence of text samples
+static void send_profile(InternalCursor* cur, QP::QueryProfile const& profile) {
+    std::stringstream out;
+    boost::property_tree::json_parser::write_json(out, profile.to_ptree(), true);
+    send_text(cur, out.str());
+}
+
+//! Max number of prepared queries, the oldest one is removed when the limit is reached
+static const size_t MAX_PREPARED_QUERIES = 1024;
+
+void Storage::prepare(StorageSession const* session, InternalCursor* cur, const char* query) const {
+    using namespace QP;
+    AKU_UNUSED(session);
     boost::property_tree::ptree ptree;
     aku_Status status;
-    session->clear_series_matcher();
     std::tie(status, ptree) = QueryParser::parse_json(query);
     if (status != AKU_SUCCESS) {
         cur->set_error(status);
         return;
     }
+    if (ptree.count("prepared")) {
+        Logger::msg(AKU_LOG_ERROR, "Prepared query can't reference another prepared query");
+        cur->set_error(AKU_EQUERY_PARSING_ERROR);
+        return;
+    }
+    if (ptree.count("page-token")) {
+        // Token of the template can't be changed by the execution
+        Logger::msg(AKU_LOG_ERROR, "Prepared query can't be paged");
+        cur->set_error(AKU_EQUERY_PARSING_ERROR);
+        return;
+    }
     QueryKind kind;
     std::tie(status, kind) = QueryParser::get_query_kind(ptree);
     if (status != AKU_SUCCESS) {
         cur->set_error(status);
         return;
     }
-    std::shared_ptr<IStreamProcessor> proc;
+    auto prepared = std::make_shared<PreparedQuery>();
+    prepared->group_by_time = kind == QueryKind::GROUP_AGGREGATE;
+    prepared->next_id = global_matcher_.next_id();
+    // Validate the template and resolve series ids
+    status = parse_query(ptree, &prepared->req);
+    if (status != AKU_SUCCESS) {
+        cur->set_error(status);
+        return;
+    }
+    prepared->ptree = std::move(ptree);
+    u64 id;
+    {
+        std::lock_guard<std::mutex> guard(prepared_lock_);
+        auto it = prepared_ids_.find(query);
+        if (it != prepared_ids_.end()) {
+            id = it->second;
+        } else {
+            if (prepared_.size() == MAX_PREPARED_QUERIES) {
+                auto oldest = prepared_.begin();
+                for (auto jt = prepared_ids_.begin(); jt != prepared_ids_.end(); jt++) {
+                    if (jt->second == oldest->first) {
+                        prepared_ids_.erase(jt);
+                        break;
+                    }
+                }
+                prepared_.erase(oldest);
+            }
+            id = ++prepared_next_id_;
+            prepared_ids_[query] = id;
+        }
+        prepared_[id] = prepared;
+    }
+    send_text(cur, "{\"prepared\": " + std::to_string(id) + "}\n");
+}
+
+aku_Status Storage::prepared_query(QP::PreparedExecution const& exec,
+                                   std::shared_ptr<PreparedQuery>* out,
+                                   QP::ReshapeRequest* req) const
+{
+    using namespace QP;
+    std::shared_ptr<PreparedQuery> prepared;
+    {
+        std::lock_guard<std::mutex> guard(prepared_lock_);
+        auto it = prepared_.find(exec.id);
+        if (it == prepared_.end()) {
+            Logger::msg(AKU_LOG_ERROR, "Prepared query " + std::to_string(exec.id) + " not found");
+            return AKU_ENOT_FOUND;
+        }
+        prepared = it->second;
+    }
+    {
+        std::lock_guard<std::mutex> guard(prepared->lock);
+        std::vector<SeriesMatcher::SeriesNameT> names;
+        auto next_id = global_matcher_.get_names_since(prepared->next_id, &names);
+        if (next_id != prepared->next_id) {
+            // New series were added, ids are resolved again only if some of them match the query
+            if (matches_new_series(prepared->ptree, names)) {
+                ReshapeRequest fresh;
+                aku_Status status = parse_query(prepared->ptree, &fresh);
+                if (status != AKU_SUCCESS) {
+                    return status;
+                }
+                prepared->req = std::move(fresh);
+            }
+            prepared->next_id = next_id;
+        }
+        *req = prepared->req;
+    }
+    if (exec.range) {
+        req->select.begin = exec.begin;
+        req->select.end = exec.end;
+    }
+    *out = prepared;
+    return AKU_SUCCESS;
+}
+
+/** Cursor used by the parts of the compound query (batch item or progressive pass).
+  * Results are forwarded to the real cursor, completion and errors are
+  * handled by the compound query.
+  */
+struct SubqueryCursor : InternalCursor {
+    typedef std::unordered_map<aku_ParamId, aku_ParamId> IdMap;
+
+    InternalCursor*  cur_;
+    aku_Status       error_;
+    bool             closed_;
+    IdMap const*     ids_;     //< Series ids of the output (null if ids are not changed)
+    std::vector<u64> buffer_;  //< Copy of the sample with the new id
+
+    SubqueryCursor(InternalCursor* cur, IdMap const* ids = nullptr)
+        : cur_(cur)
+        , error_(AKU_SUCCESS)
+        , closed_(false)
+        , ids_(ids)
+    {
+    }
+
+    virtual bool put(aku_Sample const& sample) {
+        aku_Sample const* out = &sample;
+        if (ids_ && (sample.payload.type & aku_PData::TEXT) == 0) {
+            auto it = ids_->find(sample.paramid);
+            if (it != ids_->end()) {
+                // Tuples are larger than aku_Sample, the whole sample should be copied
+                size_t size = std::max(static_cast<size_t>(sample.payload.size), sizeof(aku_Sample));
+                buffer_.resize((size + sizeof(u64) - 1) / sizeof(u64));
+                memcpy(buffer_.data(), &sample, size);
+                auto copy = reinterpret_cast<aku_Sample*>(buffer_.data());
+                copy->paramid = it->second;
+                out = copy;
+            }
+        }
+        if (!cur_->put(*out)) {
+            closed_ = true;
+            return false;
+        }
+        return true;
+    }
+
+    virtual void complete() {
+    }
+
+    virtual void set_error(aku_Status error_code) {
+        error_ = error_code;
+    }
+};
+
+/** Drop series that don't have data in the query range (according to the
+  * activity index) so the query plan doesn't open their trees.
+  * Join queries are not filtered, their columns should stay aligned.
+  * @return false if none of the series has data in the query range
+  */
+static bool drop_inactive_series(StorageEngine::ColumnStore const& cstore, QP::ReshapeRequest* req) {
+    if (req->select.columns.size() != 1) {
+        return true;
+    }
+    auto& ids = req->select.columns.front().ids;
+    cstore.drop_inactive(&ids, req->select.begin, req->select.end);
+    return !ids.empty();
+}
+
+//! Execute query plan, output and errors are sent to the subquery cursor
+static void run_subquery(StorageEngine::ColumnStore const& cstore,
+                         SubqueryCursor* cur,
+                         boost::property_tree::ptree const& topology,
+                         bool groupbytime,
+                         std::unique_ptr<QP::IQueryPlan>&& plan)
+{
+    using namespace QP;
+    std::vector<std::shared_ptr<Node>> nodes;
+    std::tie(cur->error_, nodes) = QueryParser::parse_processing_topology(topology, cur);
+    if (cur->error_ != AKU_SUCCESS) {
+        return;
+    }
+    ScanQueryProcessor proc(nodes, groupbytime);
+    if (proc.start()) {
+        QueryPlanExecutor executor;
+        executor.execute(cstore, std::move(plan), proc);
+        proc.stop();
+    }
+}
+
+//! Max number of queries in a batch
+static const size_t MAX_BATCH_SIZE = 256;
+
+void Storage::batch_query(StorageSession const* session,
+                          InternalCursor* cur,
+                          boost::property_tree::ptree const& batch) const
+{
+    using namespace QP;
+    if (batch.empty() || batch.size() > MAX_BATCH_SIZE) {
+        Logger::msg(AKU_LOG_ERROR, "Query batch should contain from 1 to " + std::to_string(MAX_BATCH_SIZE) + " queries");
+        cur->set_error(AKU_EQUERY_PARSING_ERROR);
+        return;
+    }
+    struct BatchItem {
+        aku_Status status;
+        bool groupbytime;
+        boost::property_tree::ptree const* ptree;
+        std::unique_ptr<IQueryPlan> plan;
+        std::shared_ptr<PlainSeriesMatcher> matcher;  //< Series names of join and group-by query
+        std::vector<aku_ParamId> ids;                 //< Output ids of the query without matcher
+        SubqueryCursor::IdMap idmap;                  //< Output ids of the query with matcher
+    };
+    // All queries are planned before execution so the shared scan
+    // knows which series are read more than once.
+    SharedScan shared;
+    std::vector<BatchItem> items;
+    bool has_matcher = false;
+    for (auto const& child: batch) {
+        BatchItem item = { AKU_SUCCESS, false, &child.second, nullptr, nullptr, {}, {} };
+        QueryKind kind;
+        ReshapeRequest req;
+        if (child.second.get_child_optional("timeout")) {
+            // All queries of the batch are executed together
+            Logger::msg(AKU_LOG_ERROR, "Timeout can be set only for the whole batch");
+            item.status = AKU_EQUERY_PARSING_ERROR;
+        } else {
+            std::tie(item.status, kind) = QueryParser::get_query_kind(child.second);
+        }
+        if (item.status == AKU_SUCCESS) {
+            item.groupbytime = kind == QueryKind::GROUP_AGGREGATE;
+            item.status = parse_query(child.second, &req);
+        }
+        if (item.status == AKU_SUCCESS) {
+            if (req.select.columns.empty()) {
+                item.status = AKU_EQUERY_PARSING_ERROR;
+            } else if (req.select.columns.at(0).ids.empty()) {
+                item.status = AKU_ENOT_FOUND;
+            }
+        }
+        if (item.status == AKU_SUCCESS && drop_inactive_series(*cstore_, &req)) {
+            // Query without active series doesn't have a plan and returns nothing
+            std::tie(item.status, item.plan) = QueryPlanBuilder::create(req, &shared);
+        }
+        if (item.status == AKU_SUCCESS && item.plan) {
+            item.matcher = req.select.matcher;
+            if (!item.matcher) {
+                item.ids = req.select.columns.at(0).ids;
+            }
+            has_matcher |= static_cast<bool>(item.matcher);
+        }
+        items.push_back(std::move(item));
+    }
+    if (has_matcher) {
+        // Series names of join and group-by queries are formatted using their
+        // own matchers. Names of all queries are merged into the batch matcher,
+        // new ids are allocated after the ids of the global matcher so the ids
+        // of the queries without matcher are not changed.
+        auto matcher = std::make_shared<PlainSeriesMatcher>(std::max(global_matcher_.next_id(), AKU_STARTING_SERIES_ID));
+        for (auto& item: items) {
+            if (item.matcher) {
+                for (auto id: item.matcher->get_all_ids()) {
+                    auto name = item.matcher->id2str(id);
+                    auto newid = matcher->match(name.first, name.first + name.second);
+                    if (newid == 0) {
+                        newid = matcher->add(name.first, name.first + name.second);
+                    }
+                    if (newid != id) {
+                        item.idmap[id] = newid;
+                    }
+                }
+            } else {
+                for (auto id: item.ids) {
+                    auto name = global_matcher_.id2str(id);
+                    if (name.first != nullptr && matcher->id2str(id).first == nullptr) {
+                        matcher->_add(name.first, name.first + name.second, id);
+                    }
+                }
+            }
+        }
+        session->set_series_matcher(matcher);
+    }
+    // Results of the i-th query are prefixed with ":i\r\n" line,
+    // failed query produces "-error\r\n" line instead.
+    for (size_t i = 0; i < items.size(); i++) {
+        auto& item = items.at(i);
+        if (!put_text(cur, ":" + std::to_string(i) + "\r\n")) {
+            return;
+        }
+        SubqueryCursor itemcur(cur, item.idmap.empty() ? nullptr : &item.idmap);
+        itemcur.error_ = item.status;
+        if (item.status == AKU_SUCCESS && item.plan) {
+            run_subquery(*cstore_, &itemcur, *item.ptree, item.groupbytime, std::move(item.plan));
+        }
+        if (itemcur.closed_) {
+            return;
+        }
+        if (itemcur.error_ != AKU_SUCCESS) {
+            if (!put_text(cur, std::string("-") + StatusUtil::c_str(itemcur.error_) + "\r\n")) {
+                return;
+            }
+        }
+    }
+    Logger::msg(AKU_LOG_TRACE, "Query batch completed, " + std::to_string(shared.reused()) + " operators reused");
+    cur->complete();
+}
+
+void Storage::progressive_query(InternalCursor* cur,
+                                boost::property_tree::ptree const& topology,
+                                QP::ReshapeRequest req,
+                                QP::ProgressiveOptions const& options) const
+{
+    using namespace QP;
+    // The first pass uses summaries stored in the top level nodes, every
+    // next pass reads one more level of the tree, the last pass is exact.
+    u16 height = cstore_->get_height(req.select.columns.at(0).ids);
+    u16 level = height > 1 ? static_cast<u16>(height - 1) : 0;
+    u64 start = QueryProfile::now();
+    while (true) {
+        // Results of every pass are prefixed with "~level\r\n" line
+        if (!put_text(cur, "~" + std::to_string(level) + "\r\n")) {
+            return;
+        }
+        u64 pass_start = QueryProfile::now();
+        req.agg.level = level;
+        SubqueryCursor passcur(cur);
+        std::unique_ptr<IQueryPlan> plan;
+        std::tie(passcur.error_, plan) = QueryPlanBuilder::create(req);
+        if (passcur.error_ == AKU_SUCCESS) {
+            run_subquery(*cstore_, &passcur, topology, true, std::move(plan));
+        }
+        if (passcur.closed_) {
+            return;
+        }
+        if (passcur.error_ != AKU_SUCCESS) {
+            put_text(cur, std::string("-") + StatusUtil::c_str(passcur.error_) + "\r\n");
+            break;
+        }
+        if (level == 0) {
+            break;
+        }
+        if (options.max_latency) {
+            // Next pass reads about `fanout` times more nodes, superblocks are
+            // compressed so the guaranteed fanout is used instead of the max one
+            u64 now = QueryProfile::now();
+            u64 estimate = (now - pass_start) * StorageEngine::AKU_NBTREE_MIN_FANOUT;
+            if (now - start + estimate > options.max_latency) {
+                break;
+            }
+        }
+        level--;
+    }
+    cur->complete();
+}
+
+void Storage::query(StorageSession const* session, InternalCursor* cur, const char* query) const {
+    using namespace QP;
+    boost::property_tree::ptree ptree;
+    aku_Status status;
+    ProbeScope planning_probe(AKU_PROBE_QUERY_PLANNING);
+    u64 planning_start = QueryProfile::now();
+    session->clear_series_matcher();
+    bool profiling = false;
+    QueryKind kind = QueryKind::SELECT;
     ReshapeRequest req;
+    std::shared_ptr<PreparedQuery> prepared;
+    PreparedExecution exec;
+    status = QueryParser::parse_prepared_execution(query, &exec);
+    if (status == AKU_SUCCESS) {
+        // Prepared query, the query text is not parsed and series are not resolved
+        profiling = exec.profile;
+        status = prepared_query(exec, &prepared, &req);
+        if (prepared && prepared->group_by_time) {
+            kind = QueryKind::GROUP_AGGREGATE;
+        }
+        u64 timeout = exec.timeout;
+        if (status == AKU_SUCCESS && timeout == 0) {
+            // Timeout of the query template
+            std::tie(status, timeout) = QueryParser::parse_timeout(prepared->ptree);
+        }
+        auto token = QueryCancellation::current();
+        if (status == AKU_SUCCESS && timeout && token) {
+            token->set_timeout(timeout);
+        }
+    } else if (status == AKU_ENOT_FOUND) {
+        std::tie(status, ptree) = QueryParser::parse_json(query);
+        if (status != AKU_SUCCESS) {
+            cur->set_error(status);
+            return;
+        }
+        u64 timeout;
+        std::tie(status, timeout) = QueryParser::parse_timeout(ptree);
+        if (status != AKU_SUCCESS) {
+            cur->set_error(status);
+            return;
+        }
+        auto token = QueryCancellation::current();
+        if (timeout && token) {
+            token->set_timeout(timeout);
+        }
+        auto batch = ptree.get_child_optional("queries");
+        if (batch) {
+            planning_probe.leave();
+            batch_query(session, cur, *batch);
+            return;
+        }
+        std::tie(status, profiling) = QueryParser::parse_profile_flag(ptree);
+        if (status != AKU_SUCCESS) {
+            cur->set_error(status);
+            return;
+        }
+        std::tie(status, kind) = QueryParser::get_query_kind(ptree);
+    }
+    if (status != AKU_SUCCESS) {
+        cur->set_error(status);
+        return;
+    }
+    QueryProfile profile;
+    ProfilingCursor profcur(cur, &profile);
+    std::shared_ptr<IStreamProcessor> proc;
 
     if (kind == QueryKind::SELECT_META) {
         std::vector<aku_ParamId> ids;
@@ -881,22 +1531,48 @@ void Storage::query(StorageSession const* session, InternalCursor* cur, const ch
             return;
         }
         proc = std::make_shared<MetadataQueryProcessor>(nodes.front(), std::move(ids));
+        planning_probe.leave();
         if (proc->start()) {
             proc->stop();
         }
         return;
     } else {
-        status = parse_query(ptree, &req);
+        if (!prepared) {
+            status = parse_query(ptree, &req);
+            if (status != AKU_SUCCESS) {
+                cur->set_error(status);
+                return;
+            }
+        }
+        auto const& topology = prepared ? prepared->ptree : ptree;
+        ProgressiveOptions progressive;
+        std::tie(status, progressive) = QueryParser::parse_progressive(topology);
         if (status != AKU_SUCCESS) {
             cur->set_error(status);
             return;
         }
+        if (progressive.enabled && (kind != QueryKind::GROUP_AGGREGATE || profiling)) {
+            Logger::msg(AKU_LOG_ERROR, "Only group-aggregate query can be progressive (without profiling)");
+            cur->set_error(AKU_EQUERY_PARSING_ERROR);
+            return;
+        }
+        PaginationCursor pagecur(cur, req.order_by);
+        bool paged = !profiling && kind == QueryKind::SELECT && topology.get_child_optional("page-token");
         std::vector<std::shared_ptr<Node>> nodes;
-        std::tie(status, nodes) = QueryParser::parse_processing_topology(ptree, cur);
+        std::tie(status, nodes) = QueryParser::parse_processing_topology(topology, profiling ? &profcur
+                                                                                 : paged ? &pagecur
+                                                                                 : cur);
         if (status != AKU_SUCCESS) {
             cur->set_error(status);
             return;
         }
+        if (paged) {
+            for (auto const& node: nodes) {
+                if (auto limiter = std::dynamic_pointer_cast<Limiter>(node)) {
+                    pagecur.limiter_ = limiter;
+                }
+            }
+        }
         bool groupbytime = kind == QueryKind::GROUP_AGGREGATE;
         proc = std::make_shared<ScanQueryProcessor>(nodes, groupbytime);
         if (req.select.matcher) {
@@ -913,18 +1589,43 @@ void Storage::query(StorageSession const* session, InternalCursor* cur, const ch
             cur->set_error(AKU_ENOT_FOUND);
             return;
         }
+        if (!drop_inactive_series(*cstore_, &req)) {
+            // Query result is empty
+            planning_probe.leave();
+            if (proc->start()) {
+                proc->stop();
+            }
+            if (profiling && !profcur.error_) {
+                send_profile(cur, profile);
+            }
+            return;
+        }
+        if (progressive.enabled) {
+            planning_probe.leave();
+            progressive_query(cur, topology, req, progressive);
+            return;
+        }
         std::unique_ptr<QP::IQueryPlan> query_plan;
         std::tie(status, query_plan) = QP::QueryPlanBuilder::create(req);
         if (status != AKU_SUCCESS) {
             cur->set_error(status);
             return;
         }
-        // TODO: log query plan if required
+        planning_probe.leave();
+        if (profiling) {
+            profile.planning_time = QueryProfile::now() - planning_start;
+            for (auto const& col: req.select.columns) {
+                profile.nseries += col.ids.size();
+            }
+        }
         if (proc->start()) {
             QueryPlanExecutor executor;
-            executor.execute(*cstore_, std::move(query_plan), *proc);
+            executor.execute(*cstore_, std::move(query_plan), *proc, profiling ? &profile : nullptr);
             proc->stop();
         }
+        if (profiling && !profcur.error_) {
+            send_profile(cur, profile);
+        }
     }
 }
 
@@ -998,7 +1699,8 @@ aku_Status Storage::new_database( const char     *base_file_name
                                 , const char     *volumes_path
                                 , i32             num_volumes
                                 , u64             volume_size
-                                , bool            allocate)
+                                , bool            allocate
+                                , const char     *superblocks_path)
 {
     // Check for max volume size
     const u64 MAX_SIZE = 0x100000000 * 4096 - 1;  // 15TB
@@ -1013,22 +1715,46 @@ aku_Status Storage::new_database( const char     *base_file_name
     // Create volumes and metapage
     u32 volsize = static_cast<u32>(volume_size / 4096);
 
-    boost::filesystem::path volpath(volumes_path);
+    // Volumes path can contain several directories separated by ':' (one
+    // per device), in this case volumes are striped across these directories.
+    std::vector<boost::filesystem::path> volpaths;
+    std::stringstream volpathlist(volumes_path);
+    std::string volpathstr;
+    while (std::getline(volpathlist, volpathstr, ':')) {
+        if (!volpathstr.empty()) {
+            volpaths.push_back(boost::filesystem::absolute(boost::filesystem::path(volpathstr)));
+        }
+    }
+    if (volpaths.empty()) {
+        Logger::msg(AKU_LOG_ERROR, "Volumes path is empty");
+        return AKU_EBAD_ARG;
+    }
+    u32 stripe_width = static_cast<u32>(volpaths.size());
     boost::filesystem::path metpath(metadata_path);
-    volpath = boost::filesystem::absolute(volpath);
     metpath = boost::filesystem::absolute(metpath);
     std::string sqlitebname = std::string(base_file_name) + ".akumuli";
     boost::filesystem::path sqlitepath = metpath / sqlitebname;
 
-    if (!boost::filesystem::exists(volpath)) {
-        Logger::msg(AKU_LOG_INFO, std::string(volumes_path) + " doesn't exists, trying to create directory");
-        boost::filesystem::create_directories(volpath);
-    } else {
-        if (!boost::filesystem::is_directory(volpath)) {
-            Logger::msg(AKU_LOG_ERROR, std::string(volumes_path) + " is not a directory");
-            return AKU_EBAD_ARG;
+    boost::filesystem::path sblockpath;
+    if (superblocks_path != nullptr && *superblocks_path != '\0') {
+        sblockpath = boost::filesystem::absolute(boost::filesystem::path(superblocks_path));
+        volpaths.push_back(sblockpath);
+    }
+
+    for (auto const& volpath: volpaths) {
+        if (!boost::filesystem::exists(volpath)) {
+            Logger::msg(AKU_LOG_INFO, volpath.string() + " doesn't exists, trying to create directory");
+            boost::filesystem::create_directories(volpath);
+        } else {
+            if (!boost::filesystem::is_directory(volpath)) {
+                Logger::msg(AKU_LOG_ERROR, volpath.string() + " is not a directory");
+                return AKU_EBAD_ARG;
+            }
         }
     }
+    if (!sblockpath.empty()) {
+        volpaths.pop_back();
+    }
 
     if (!boost::filesystem::exists(metpath)) {
         Logger::msg(AKU_LOG_INFO, std::string(metadata_path) + " doesn't exists, trying to create directory");
@@ -1046,17 +1772,49 @@ aku_Status Storage::new_database( const char     *base_file_name
     }
 
     i32 actual_nvols = (num_volumes == 0) ? 1 : num_volumes;
+    if (stripe_width > 1) {
+        if (num_volumes == 0) {
+            Logger::msg(AKU_LOG_ERROR, "Expandable storage can't be striped across several directories");
+            return AKU_EBAD_ARG;
+        }
+        // Every row of the striped storage should contain one volume per directory
+        i32 nstripes = static_cast<i32>(stripe_width);
+        if (actual_nvols % nstripes != 0) {
+            actual_nvols += nstripes - actual_nvols % nstripes;
+            Logger::msg(AKU_LOG_INFO, "Number of volumes rounded up to " + std::to_string(actual_nvols) +
+                                      " to fill " + std::to_string(stripe_width) + " stripes");
+        }
+    }
     std::vector<std::tuple<u32, std::string>> paths;
     for (i32 i = 0; i < actual_nvols; i++) {
         std::string basename = std::string(base_file_name) + "_" + std::to_string(i) + ".vol";
-        boost::filesystem::path p = volpath / basename;
+        boost::filesystem::path p = volpaths.at(static_cast<u32>(i) % stripe_width) / basename;
         paths.push_back(std::make_tuple(volsize, p.string()));
     }
+    // Superblock volume set mirrors the main one (one superblock volume per leaf volume)
+    // but it's much smaller. Full superblock has at least AKU_NBTREE_MIN_FANOUT children.
+    // Most of the space is reserved for the upper levels of the trees and for partial
+    // superblocks written on close, superblocks shouldn't be recycled before the leaves
+    // they refer to.
+    std::vector<std::tuple<u32, std::string>> sbpaths;
+    if (!sblockpath.empty()) {
+        const u32 MIN_SBLOCK_VOLSIZE = static_cast<u32>(MIN_SIZE / 4096);
+        const u32 SBLOCK_VOLSIZE_RATIO = StorageEngine::AKU_NBTREE_MIN_FANOUT / 4;
+        u32 sbvolsize = std::max(volsize / SBLOCK_VOLSIZE_RATIO, MIN_SBLOCK_VOLSIZE);
+        for (i32 i = 0; i < actual_nvols; i++) {
+            std::string basename = std::string(base_file_name) + "_sb_" + std::to_string(i) + ".vol";
+            boost::filesystem::path p = sblockpath / basename;
+            sbpaths.push_back(std::make_tuple(sbvolsize, p.string()));
+        }
+        StorageEngine::FileStorage::create(sbpaths);
+    }
 
     StorageEngine::FileStorage::create(paths);
 
     if (allocate) {
-        for (const auto& path: paths) {
+        std::vector<std::tuple<u32, std::string>> allpaths(paths);
+        std::copy(sbpaths.begin(), sbpaths.end(), std::back_inserter(allpaths));
+        for (const auto& path: allpaths) {
             const auto& p = std::get<1>(path);
             int fd = open(p.c_str(), O_WRONLY);
             if (fd < 0) {
@@ -1082,12 +1840,27 @@ aku_Status Storage::new_database( const char     *base_file_name
         msizes.push_back(std::get<0>(p));
         mpaths.push_back(std::get<1>(p));
     }
+    std::vector<std::string> sbmpaths;
+    std::vector<u32> sbmsizes;
+    for (auto p: sbpaths) {
+        sbmsizes.push_back(std::get<0>(p));
+        sbmpaths.push_back(std::get<1>(p));
+    }
+    if (!sbpaths.empty()) {
+        Logger::msg(AKU_LOG_INFO, "Superblocks will be stored in " + sblockpath.string());
+    }
     if (num_volumes == 0) {
         Logger::msg(AKU_LOG_INFO, "Creating expandable file storage");
-        create_metadata_page(base_file_name, sqlitepath.c_str(), mpaths, msizes, "ExpandableFileStorage");
+        create_metadata_page(base_file_name, sqlitepath.c_str(), mpaths, msizes, "ExpandableFileStorage",
+                             1, sbmpaths, sbmsizes);
+    } else if (stripe_width > 1) {
+        Logger::msg(AKU_LOG_INFO, "Creating striped file storage");
+        create_metadata_page(base_file_name, sqlitepath.c_str(), mpaths, msizes, "StripedFileStorage",
+                             stripe_width, sbmpaths, sbmsizes);
     } else {
         Logger::msg(AKU_LOG_INFO, "Creating fixed file storage");
-        create_metadata_page(base_file_name, sqlitepath.c_str(), mpaths, msizes, "FixedSizeFileStorage");
+        create_metadata_page(base_file_name, sqlitepath.c_str(), mpaths, msizes, "FixedSizeFileStorage",
+                             1, sbmpaths, sbmsizes);
     }
     return AKU_SUCCESS;
 }
@@ -1102,14 +1875,13 @@ aku_Status Storage::remove_storage(const char* file_name, bool force) {
         // Bad database
         return AKU_EBAD_ARG;
     }
-    std::vector<std::string> volume_names(volumes.size(), "");
-
+    std::vector<std::string> volume_names;
     for(auto it: volumes) {
-        volume_names.at(it.id) = it.path;
+        volume_names.push_back(it.path);
     }
     if (!force) {
         // Check whether or not database is empty
-        auto fstore = StorageEngine::FixedSizeFileStorage::open(meta);
+        auto fstore = open_blockstore(meta, StorageEngine::FileStorageParams(), false);
         auto stats = fstore->get_stats();
         if (stats.nblocks != 0) {
             // DB is not empty
@@ -1164,7 +1936,14 @@ boost::property_tree::ptree Storage::get_stats() {
         std::string path = "volume_" + std::to_string(ix++);
         result.put(path + ".free_space", free_vol);
         result.put(path + ".file_name", name);
+        result.put(path + ".direct_io", stats.direct_io);
     }
+    auto lockstats = ScalableRWLock::get_stats();
+    result.put("nbtree_locks.rd_contended", lockstats.rd_contended);
+    result.put("nbtree_locks.wr_contended", lockstats.wr_contended);
+    result.put("nbtree_locks.revocations", lockstats.revocations);
+    result.add_child("probes", Instrumentation::get_stats());
+    result.add_child("memory", MemoryAccounting::get_stats());
     return result;
 }
 
@@ -18,12 +18,15 @@
 #pragma once
 #include <atomic>
 #include <cstddef>
+#include <map>
 #include <memory>
 #include <mutex>
 #include <thread>
+#include <unordered_map>
 #include <vector>
 
 #include "akumuli_def.h"
+#include "akumuli_config.h"
 #include "metadatastorage.h"
 #include "index/seriesparser.h"
 #include "util.h"
@@ -38,6 +41,11 @@
 
 namespace Akumuli {
 
+namespace QP {
+struct PreparedExecution;
+struct ProgressiveOptions;
+}
+
 class Storage;
 
 class StorageSession : public std::enable_shared_from_this<StorageSession> {
@@ -80,11 +88,30 @@ public:
      */
     void search(InternalCursor* cur, const char* query) const;
 
+    /**
+     * @brief register prepared query
+     * @param cur is a pointer to internal cursor
+     * @param query is a string that contains query template
+     */
+    void prepare(InternalCursor* cur, const char* query) const;
+
     // Temporary reset series matcher
     void set_series_matcher(std::shared_ptr<PlainSeriesMatcher> matcher) const;
     void clear_series_matcher() const;
 };
 
+/** Prepared query.
+  * Query template is parsed once, resolved ids and reshape request are cached
+  * and reused until new series that match the template are added to the index.
+  */
+struct PreparedQuery {
+    boost::property_tree::ptree ptree;          //< Parsed query template
+    bool                        group_by_time;  //< Query kind is `group-aggregate`
+    std::mutex                  lock;           //< Protects `req` and `next_id`
+    QP::ReshapeRequest          req;            //< Cached reshape request
+    u64                         next_id;        //< Series added after this id weren't checked against the template
+};
+
 class Storage : public std::enable_shared_from_this<Storage> {
     std::shared_ptr<StorageEngine::BlockStore> bstore_;
     std::shared_ptr<StorageEngine::ColumnStore> cstore_;
@@ -93,17 +120,39 @@ class Storage : public std::enable_shared_from_this<Storage> {
     mutable std::mutex lock_;
     SeriesMatcher global_matcher_;
     std::shared_ptr<MetadataStorage> metadata_;
+    // Prepared queries
+    mutable std::mutex prepared_lock_;
+    mutable std::map<u64, std::shared_ptr<PreparedQuery>> prepared_;  //< Id to query mapping (ordered by age)
+    mutable std::unordered_map<std::string, u64> prepared_ids_;       //< Query text to id mapping
+    mutable u64 prepared_next_id_;
 
     void start_sync_worker();
 
     aku_Status parse_query(const boost::property_tree::ptree &ptree, QP::ReshapeRequest* req) const;
+
+    //! Find prepared query and create reshape request for it
+    aku_Status prepared_query(const QP::PreparedExecution& exec,
+                              std::shared_ptr<PreparedQuery>* out,
+                              QP::ReshapeRequest* req) const;
+
+    /** Execute batch of queries (the "queries" field of the query object).
+      * Series matcher of the session is replaced if some of the queries use
+      * their own matchers (join and group-by queries).
+      */
+    void batch_query(StorageSession const* session, InternalCursor* cur, const boost::property_tree::ptree& batch) const;
+
+    //! Execute group-aggregate query in several passes, from approximate to exact results
+    void progressive_query(InternalCursor* cur,
+                           const boost::property_tree::ptree& topology,
+                           QP::ReshapeRequest req,
+                           const QP::ProgressiveOptions& options) const;
 public:
 
     // Create empty in-memory storage
     Storage();
 
     // Open file-backed storage
-    Storage(const char* path);
+    Storage(const char* path, aku_FineTuneParams const& params = aku_FineTuneParams());
 
     /** C-tor for test */
     Storage(std::shared_ptr<MetadataStorage>            meta,
@@ -137,6 +186,17 @@ public:
      */
     void search(StorageSession const* session, InternalCursor* cur, const char* query) const;
 
+    /**
+     * @brief register prepared query
+     * Query template is validated and stored, its id is sent to the cursor
+     * as a JSON document (`{"prepared": id}`). Query can be executed by sending
+     * `{"prepared": id, "range": {...}}` to `query` method, range is optional.
+     * @param session is a session pointer
+     * @param cur is an internal cursor
+     * @param query is a query string (JSON)
+     */
+    void prepare(StorageSession const* session, InternalCursor* cur, const char* query) const;
+
     void debug_print() const;
 
     void _update_rescue_points(aku_ParamId id, std::vector<StorageEngine::LogicAddr>&& rpoints);
@@ -152,6 +212,8 @@ public:
       * @param volumes_path is a path to volumes storage
       * @param num_volumes defines how many volumes should be crated
       * @param page_size is a size of the individual page in bytes
+      * @param superblocks_path is a path to superblock volumes (if null, superblocks
+      *        are stored together with leaf nodes)
       * @return operation status
       */
     static aku_Status new_database( const char     *base_file_name
@@ -159,7 +221,8 @@ public:
                                   , const char     *volumes_path
                                   , i32             num_volumes
                                   , u64             page_size
-                                  , bool            allocate);
+                                  , bool            allocate
+                                  , const char     *superblocks_path = nullptr);
 
     /**
      * @brief Open storage and generate report (dont' modify anything)
@@ -16,89 +16,99 @@
  */
 
 #include "blockstore.h"
+#include "nbtree_def.h"
 #include "log_iface.h"
 #include "util.h"
 #include "status_util.h"
 #include "crc32c.h"
 #include "akumuli_version.h"
+#include "instrumentation.h"
+#include "pool.h"
 
 #include <cassert>
+#include <future>
 
 #include <boost/filesystem.hpp>
 
 namespace Akumuli {
 namespace StorageEngine {
 
-static u64 hash32(u32 value, u32 bits, u64 seed) {
-    // hashes x strongly universally into N bits
-    // using the random seed.
-    static const u64 a = (1ul << 32) - 1;
-    return (a * value + seed) >> (64-bits);
+BlockCache::BlockCache(size_t capacity)
+    : capacity_(capacity)
+    , protected_capacity_(capacity - capacity / 5)
+    , mem_(AKU_MEM_BLOCK_CACHE)
+{
 }
 
-static u64 hash(u64 value, u32 bits) {
-    auto a = hash32(value & 0xFFFFFFFF, bits, 277);
-    auto b = hash32(value >> 32, bits, 337);
-    return a ^ b;
+void BlockCache::update_memory_use() {
+    const size_t list_node_size = sizeof(LogicAddr) + 2*sizeof(void*);
+    i64 bytes = hashtable_memory_use(table_)
+              + static_cast<i64>(table_.size() * (AKU_BLOCK_SIZE + sizeof(Block)))
+              + static_cast<i64>((probation_.size() + protected_.size()) * list_node_size);
+    mem_.set(bytes, static_cast<i64>(table_.size()));
 }
 
-BlockCache::BlockCache(u32 Nbits)
-    : block_cache_(1 << Nbits, PBlock())
-    , bits_(Nbits)
-    , gen_(dev_())
-    , dist_(0, 1 << Nbits)
-{
+void BlockCache::promote(Entry& entry, LogicAddr addr) {
+    if (entry.is_protected) {
+        protected_.splice(protected_.begin(), protected_, entry.pos);
+        return;
+    }
+    probation_.erase(entry.pos);
+    protected_.push_front(addr);
+    entry.pos = protected_.begin();
+    entry.is_protected = true;
+    // Protected segment overflow, demote LRU entry to the probationary segment
+    while (protected_.size() > protected_capacity_) {
+        auto lru = protected_.back();
+        protected_.pop_back();
+        auto& demoted = table_.at(lru);
+        probation_.push_front(lru);
+        demoted.pos = probation_.begin();
+        demoted.is_protected = false;
+    }
 }
 
-int BlockCache::probe(LogicAddr addr) {
-    auto h = hash(addr, bits_);
-    auto b = block_cache_.at(h);
-    if (b) {
-        return b->get_addr() == addr ? 2 : 1;
+void BlockCache::evict() {
+    while (table_.size() > capacity_ && !probation_.empty()) {
+        table_.erase(probation_.back());
+        probation_.pop_back();
     }
-    return 0;
 }
 
-void BlockCache::insert(PBlock block) {
-    auto addr = block->get_addr();
-    auto pr = probe(addr);
-    if (pr == 2) {
-        // No need to insert, addr already sits in the cache.
+void BlockCache::insert(LogicAddr addr, PBlock block, bool high_priority) {
+    if (capacity_ == 0) {
         return;
     }
-    if (pr == 0) {
-        // Eviction. Generate two random hashes. Evict least accessed.
-        auto h1 = dist_(gen_);
-        auto h2 = dist_(gen_);
-        auto p1 = block_cache_.at(h1);
-        auto p2 = block_cache_.at(h2);
-        if (p1 && p2) {
-            if (p1.use_count() > p2.use_count()) {
-                block_cache_.at(h2).reset();
-            } else if (p1.use_count() < p2.use_count()) {
-                block_cache_.at(h1).reset();
-            } else {
-                if (p1->get_addr() < p2->get_addr()) {
-                    block_cache_.at(h1).reset();
-                } else {
-                    block_cache_.at(h2).reset();
-                }
-            }
-        }
+    std::lock_guard<std::mutex> guard(lock_); AKU_UNUSED(guard);
+    auto it = table_.find(addr);
+    if (it == table_.end()) {
+        probation_.push_front(addr);
+        Entry entry = { block, false, probation_.begin() };
+        it = table_.insert(std::make_pair(addr, entry)).first;
+    } else {
+        it->second.block = block;
+    }
+    if (high_priority) {
+        promote(it->second, addr);
     }
-    auto h = hash(addr, bits_);
-    block_cache_.at(h) = block;
+    evict();
+    update_memory_use();
 }
 
-BlockCache::PBlock BlockCache::loockup(LogicAddr addr) {
-    auto it = hash(addr, bits_);
-    auto p = block_cache_.at(it);
-    if (p->get_addr() != addr) {
-        p.reset();
+BlockCache::PBlock BlockCache::lookup(LogicAddr addr) {
+    std::lock_guard<std::mutex> guard(lock_); AKU_UNUSED(guard);
+    auto it = table_.find(addr);
+    if (it == table_.end()) {
+        return PBlock();
     }
-    return p;
+    promote(it->second, addr);
+    return it->second.block;
 }
 
+size_t BlockCache::size() const {
+    std::lock_guard<std::mutex> guard(lock_); AKU_UNUSED(guard);
+    return table_.size();
+}
 
 Block::Block(LogicAddr addr, std::vector<u8>&& data)
     : data_(std::move(data))
@@ -113,11 +123,23 @@ Block::Block(LogicAddr addr, const u8* ptr)
 {
 }
 
+Block::Block(LogicAddr addr, std::shared_ptr<const Block> base)
+    : addr_(addr)
+    , zptr_(base->get_cdata())
+    , base_(base)
+{
+}
+
 Block::Block()
-    : data_(static_cast<size_t>(AKU_BLOCK_SIZE), 0)
-    , addr_(EMPTY_ADDR)
+    : addr_(EMPTY_ADDR)
     , zptr_(nullptr)
 {
+    BufferPool<u8>::acquire(&data_);
+    data_.resize(static_cast<size_t>(AKU_BLOCK_SIZE), 0);
+}
+
+Block::~Block() {
+    BufferPool<u8>::release(&data_);
 }
 
 const u8* Block::get_data() const {
@@ -150,12 +172,16 @@ void Block::set_addr(LogicAddr addr) {
 }
 
 
-FileStorage::FileStorage(std::shared_ptr<VolumeRegistry> meta)
+FileStorage::FileStorage(std::shared_ptr<VolumeRegistry> meta, FileStorageParams const& params)
     : meta_(MetaVolume::open_existing(meta))
     , current_volume_(0)
     , current_gen_(0)
     , total_size_(0)
+    , params_(params)
 {
+    if (params_.direct_io) {
+        cache_.reset(new BlockCache(params_.cache_size));
+    }
     typedef VolumeRegistry::VolumeDesc TVol;
     auto volumes = meta->get_volumes();
     std::sort(volumes.begin(), volumes.end(), [](TVol const& a, TVol const& b) {
@@ -175,7 +201,7 @@ FileStorage::FileStorage(std::shared_ptr<VolumeRegistry> meta)
                                                    StatusUtil::str(status)));
             AKU_PANIC("Can't open blockstore - " + StatusUtil::str(status));
         }
-        auto uptr = Volume::open_existing(volpath.c_str(), nblocks);
+        auto uptr = open_volume(volpath.c_str(), nblocks);
         volumes_.push_back(std::move(uptr));
         dirty_.push_back(0);
     }
@@ -217,6 +243,90 @@ void FileStorage::create(std::vector<std::tuple<u32, std::string>> vols)
     }
 }
 
+std::unique_ptr<Volume> FileStorage::open_volume(const char* path, u32 nblocks) const {
+    auto volume = Volume::open_existing(path, nblocks, params_.direct_io);
+    if (params_.lock_in_memory) {
+        volume->lock_in_memory();
+    }
+    return volume;
+}
+
+static bool is_superblock(Block const& block) {
+    auto ref = reinterpret_cast<SubtreeRef const*>(block.get_cdata());
+    return ref->type == NBTreeBlockType::INNER;
+}
+
+//! Add series id and time range of the block to the summary of the volume
+static aku_Status add_to_summary(MetaVolume* meta, u32 volume, u32 nblocks, Block const& block) {
+    auto ref = reinterpret_cast<SubtreeRef const*>(block.get_cdata());
+    return meta->add_to_summary(volume, nblocks, ref->id, ref->begin, ref->end);
+}
+
+std::tuple<aku_Status, std::shared_ptr<Block>> FileStorage::read_from_volume(Volume* volume, BlockAddr vol, LogicAddr addr) {
+    aku_Status status;
+    QueryCounters::inc(&QueryCounters::blocks_read);
+    if (cache_) {
+        auto cached = cache_->lookup(addr);
+        if (cached) {
+            QueryCounters::inc(&QueryCounters::blocks_cached);
+            return std::make_tuple(AKU_SUCCESS, std::move(cached));
+        }
+    }
+    // Try to use zero-copy if possible
+    const u8* mptr;
+    std::tie(status, mptr) = volume->read_block_zero_copy(vol);
+    if (status == AKU_SUCCESS) {
+        QueryCounters::inc(&QueryCounters::blocks_zero_copy);
+        std::shared_ptr<Block> zblock = make_pooled<Block>(addr, mptr);
+        return std::make_tuple(status, std::move(zblock));
+    } else if (status == AKU_EUNAVAILABLE) {
+        // Fallback to copying if not possible
+        std::vector<u8> dest;
+        BufferPool<u8>::acquire(&dest);
+        dest.resize(AKU_BLOCK_SIZE, 0);
+        status = volume->read_block(vol, dest.data());
+        if (status != AKU_SUCCESS) {
+            return std::make_tuple(status, std::unique_ptr<Block>());
+        }
+        std::shared_ptr<Block> block = make_pooled<Block>(addr, std::move(dest));
+        if (cache_) {
+            cache_->insert(addr, block, is_superblock(*block));
+        }
+        return std::make_tuple(status, std::move(block));
+    }
+    return std::make_tuple(status, std::unique_ptr<Block>());
+}
+
+std::tuple<aku_Status, std::shared_ptr<Block>> FileStorage::read_checked(std::unique_lock<std::mutex>* guard,
+                                                                         Volume* volume,
+                                                                         BlockAddr vol,
+                                                                         LogicAddr addr)
+{
+    if (!volume->is_direct_io()) {
+        // Memory mapped or buffered volume, buffered reads are not thread-safe
+        return read_from_volume(volume, vol, addr);
+    }
+    guard->unlock();
+    auto result = read_from_volume(volume, vol, addr);
+    if (!exists(addr)) {
+        // Volume was recycled during the read
+        return std::make_tuple(AKU_EUNAVAILABLE, std::shared_ptr<Block>());
+    }
+    return result;
+}
+
+void FileStorage::cache_written_block(std::shared_ptr<Block> const& data, LogicAddr addr) {
+    if (cache_) {
+        // Recently written blocks are likely to be read soon, copy is needed
+        // because the writer owns the original block.
+        std::vector<u8> copy;
+        BufferPool<u8>::acquire(&copy);
+        copy.assign(data->get_cdata(), data->get_cdata() + AKU_BLOCK_SIZE);
+        std::shared_ptr<Block> block = make_pooled<Block>(addr, std::move(copy));
+        cache_->insert(addr, block, is_superblock(*block));
+    }
+}
+
 void FileStorage::handle_volume_transition() {
     Logger::msg(AKU_LOG_INFO, "Advance volume called, current gen:" + std::to_string(current_gen_));
     adjust_current_volume();
@@ -264,7 +374,8 @@ static LogicAddr make_logic(u32 gen, BlockAddr addr) {
 }
 
 std::tuple<aku_Status, LogicAddr> FileStorage::append_block(std::shared_ptr<Block> data) {
-    std::lock_guard<std::mutex> guard(lock_); AKU_UNUSED(guard);
+    ProbeScope probe(AKU_PROBE_APPEND_BLOCK);
+    std::unique_lock<std::mutex> guard(lock_);
     BlockAddr block_addr;
     aku_Status status;
     std::tie(status, block_addr) = volumes_[current_volume_]->append_block(data->get_data());
@@ -277,15 +388,23 @@ std::tuple<aku_Status, LogicAddr> FileStorage::append_block(std::shared_ptr<Bloc
       }
     }
     data->set_addr(block_addr);
-    status = meta_->set_nblocks(current_volume_, block_addr + 1);
+    // Summary goes first, it should cover all blocks counted by `nblocks`
+    status = add_to_summary(meta_.get(), current_volume_, block_addr + 1, *data);
+    if (status == AKU_SUCCESS) {
+        status = meta_->set_nblocks(current_volume_, block_addr + 1);
+    }
     if (status != AKU_SUCCESS) {
       AKU_PANIC("Invalid BlockStore state, " + StatusUtil::str(status));
     }
     dirty_[current_volume_]++;
-    return std::make_tuple(status, make_logic(current_gen_, block_addr));
+    auto addr = make_logic(current_gen_, block_addr);
+    guard.unlock();
+    cache_written_block(data, addr);
+    return std::make_tuple(status, addr);
 }
 
 void FileStorage::flush() {
+    ProbeScope probe(AKU_PROBE_FLUSH);
     std::lock_guard<std::mutex> guard(lock_); AKU_UNUSED(guard);
     /*
     for (size_t ix = 0; ix < dirty_.size(); ix++) {
@@ -320,7 +439,15 @@ BlockStoreStats FileStorage::get_stats() const {
     return stats;
 }
 
+VolumeSummarySnapshot FileStorage::get_summary_snapshot() const {
+    std::lock_guard<std::mutex> guard(lock_); AKU_UNUSED(guard);
+    VolumeSummarySnapshot snapshot;
+    meta_->get_summary_snapshot(&snapshot);
+    return snapshot;
+}
+
 PerVolumeStats FileStorage::get_volume_stats() const {
+    std::lock_guard<std::mutex> guard(lock_); AKU_UNUSED(guard);
     PerVolumeStats result;
     size_t nvol = meta_->get_nvolumes();
     for (u32 ix = 0; ix < nvol; ix++) {
@@ -336,6 +463,7 @@ PerVolumeStats FileStorage::get_volume_stats() const {
         if (stat == AKU_SUCCESS) {
             stats.nblocks += res;
         }
+        stats.direct_io = volumes_.at(ix)->is_direct_io();
         auto name = volume_names_.at(ix);
         result[name] = stats;
     }
@@ -354,14 +482,16 @@ u32 FileStorage::checksum(u8 const* data, size_t size) const {
 
 // FixedSizeFileStorage
 
-FixedSizeFileStorage::FixedSizeFileStorage(std::shared_ptr<VolumeRegistry> meta)
-    : FileStorage::FileStorage(meta)
+FixedSizeFileStorage::FixedSizeFileStorage(std::shared_ptr<VolumeRegistry> meta, FileStorageParams const& params)
+    : FileStorage::FileStorage(meta, params)
 {
     // nothing specific needed except calling the parent constructor
 }
 
-std::shared_ptr<FixedSizeFileStorage> FixedSizeFileStorage::open(std::shared_ptr<VolumeRegistry> meta) {
-    auto bs = new FixedSizeFileStorage(meta);
+std::shared_ptr<FixedSizeFileStorage> FixedSizeFileStorage::open(std::shared_ptr<VolumeRegistry> meta,
+                                                                 FileStorageParams const& params)
+{
+    auto bs = new FixedSizeFileStorage(meta, params);
     return std::shared_ptr<FixedSizeFileStorage>(bs);
 }
 
@@ -385,7 +515,7 @@ bool FixedSizeFileStorage::exists(LogicAddr addr) const {
 }
 
 std::tuple<aku_Status, std::shared_ptr<Block>> FixedSizeFileStorage::read_block(LogicAddr addr) {
-    std::lock_guard<std::mutex> guard(lock_); AKU_UNUSED(guard);
+    std::unique_lock<std::mutex> guard(lock_);
     aku_Status status;
     auto gen = extract_gen(addr);
     auto vol = extract_vol(addr);
@@ -403,40 +533,148 @@ std::tuple<aku_Status, std::shared_ptr<Block>> FixedSizeFileStorage::read_block(
     if (actual_gen != gen || vol >= nblocks) {
         return std::make_tuple(AKU_EUNAVAILABLE, std::unique_ptr<Block>());
     }
-    // Try to use zero-copy if possible
-    const u8* mptr;
-    std::tie(status, mptr) = volumes_[volix]->read_block_zero_copy(vol);
-    if (status == AKU_SUCCESS) {
-        std::shared_ptr<Block> zblock = std::make_shared<Block>(addr, mptr);
-        return std::make_tuple(status, std::move(zblock));
-    } else if (status == AKU_EUNAVAILABLE) {
-        // Fallback to copying if not possible
-        std::vector<u8> dest(AKU_BLOCK_SIZE, 0);
-        status = volumes_[volix]->read_block(vol, dest.data());
+    return read_checked(&guard, volumes_[volix].get(), vol, addr);
+}
+
+void FixedSizeFileStorage::adjust_current_volume() {
+    current_volume_ = (current_volume_ + 1) % volumes_.size();
+}
+
+// StripedFileStorage
+
+StripedFileStorage::StripedFileStorage(std::shared_ptr<VolumeRegistry> meta, u32 stripe_width,
+                                       FileStorageParams const& params)
+    : FixedSizeFileStorage(meta, params)
+    , stripe_width_(stripe_width)
+{
+    if (stripe_width_ == 0 || volumes_.size() % stripe_width_ != 0) {
+        Logger::msg(AKU_LOG_ERROR, "Can't open striped blockstore, " + std::to_string(volumes_.size()) +
+                                   " volumes can't be split into " + std::to_string(stripe_width_) + " stripes");
+        AKU_PANIC("Can't open striped blockstore, invalid stripe width");
+    }
+    // Base c-tor chooses first volume with free space, resume round-robin
+    // from the least filled volume of its row.
+    u32 row = current_volume_ / stripe_width_;
+    u32 min_nblocks = std::numeric_limits<u32>::max();
+    for (u32 ix = row * stripe_width_; ix < (row + 1) * stripe_width_; ix++) {
+        aku_Status status;
+        u32 nblocks;
+        std::tie(status, nblocks) = meta_->get_nblocks(ix);
         if (status != AKU_SUCCESS) {
-            return std::make_tuple(status, std::unique_ptr<Block>());
+            Logger::msg(AKU_LOG_ERROR, "Can't find current volume, meta-volume corrupted, error: "
+                        + StatusUtil::str(status));
+            AKU_PANIC("Meta-volume corrupted, " + StatusUtil::str(status));
+        }
+        if (nblocks < min_nblocks) {
+            min_nblocks = nblocks;
+            current_volume_ = ix;
         }
-        auto block = std::make_shared<Block>(addr, std::move(dest));
-        return std::make_tuple(status, std::move(block));
     }
-    return std::make_tuple(status, std::unique_ptr<Block>());
 }
 
-void FixedSizeFileStorage::adjust_current_volume() {
-    current_volume_ = (current_volume_ + 1) % volumes_.size();
+std::shared_ptr<StripedFileStorage> StripedFileStorage::open(std::shared_ptr<VolumeRegistry> meta, u32 stripe_width,
+                                                             FileStorageParams const& params)
+{
+    auto bs = new StripedFileStorage(meta, stripe_width, params);
+    return std::shared_ptr<StripedFileStorage>(bs);
+}
+
+void StripedFileStorage::advance_row() {
+    u32 nrows = static_cast<u32>(volumes_.size()) / stripe_width_;
+    u32 row = (current_volume_ / stripe_width_ + 1) % nrows;
+    Logger::msg(AKU_LOG_INFO, "Advance row called, next row: " + std::to_string(row));
+    for (u32 ix = row * stripe_width_; ix < (row + 1) * stripe_width_; ix++) {
+        aku_Status status;
+        u32 gen, nblocks;
+        std::tie(status, gen) = meta_->get_generation(ix);
+        if (status == AKU_SUCCESS) {
+            std::tie(status, nblocks) = meta_->get_nblocks(ix);
+        }
+        if (status != AKU_SUCCESS) {
+            Logger::msg(AKU_LOG_ERROR, "Can't read next volume, " + StatusUtil::str(status));
+            AKU_PANIC("Can't read the next volume, " + StatusUtil::str(status));
+        }
+        if (nblocks != 0) {
+            // Volume is not empty, reset it and change generation
+            status = meta_->set_generation(ix, gen + static_cast<u32>(volumes_.size()));
+            if (status == AKU_SUCCESS) {
+                status = meta_->set_nblocks(ix, 0);
+            }
+            if (status != AKU_SUCCESS) {
+                Logger::msg(AKU_LOG_ERROR, "Can't reset volume, " + StatusUtil::str(status));
+                AKU_PANIC("Invalid BlockStore state, can't reset volume, " + StatusUtil::str(status));
+            }
+            volumes_[ix]->reset();
+            dirty_[ix]++;
+        }
+    }
+    current_volume_ = row * stripe_width_;
+}
+
+std::tuple<aku_Status, LogicAddr> StripedFileStorage::append_block(std::shared_ptr<Block> data) {
+    ProbeScope probe(AKU_PROBE_APPEND_BLOCK);
+    std::unique_lock<std::mutex> guard(lock_);
+    BlockAddr block_addr;
+    aku_Status status;
+    std::tie(status, block_addr) = volumes_[current_volume_]->append_block(data->get_data());
+    if (status == AKU_EOVERFLOW) {
+        advance_row();
+        std::tie(status, block_addr) = volumes_.at(current_volume_)->append_block(data->get_data());
+        if (status != AKU_SUCCESS) {
+            return std::make_tuple(status, 0ull);
+        }
+    }
+    std::tie(status, current_gen_) = meta_->get_generation(current_volume_);
+    if (status == AKU_SUCCESS) {
+        status = add_to_summary(meta_.get(), current_volume_, block_addr + 1, *data);
+    }
+    if (status == AKU_SUCCESS) {
+        status = meta_->set_nblocks(current_volume_, block_addr + 1);
+    }
+    if (status != AKU_SUCCESS) {
+        AKU_PANIC("Invalid BlockStore state, " + StatusUtil::str(status));
+    }
+    data->set_addr(block_addr);
+    dirty_[current_volume_]++;
+    auto addr = make_logic(current_gen_, block_addr);
+    // Next block goes to the next stripe of the same row
+    u32 row_begin = current_volume_ - current_volume_ % stripe_width_;
+    current_volume_ = row_begin + (current_volume_ + 1 - row_begin) % stripe_width_;
+    guard.unlock();
+    cache_written_block(data, addr);
+    return std::make_tuple(status, addr);
+}
+
+void StripedFileStorage::flush() {
+    ProbeScope probe(AKU_PROBE_FLUSH);
+    std::lock_guard<std::mutex> guard(lock_); AKU_UNUSED(guard);
+    std::vector<std::future<void>> stripes;
+    for (u32 stripe = 0; stripe < stripe_width_; stripe++) {
+        stripes.push_back(std::async(std::launch::async, [this, stripe]() {
+            for (size_t ix = stripe; ix < volumes_.size(); ix += stripe_width_) {
+                volumes_[ix]->flush();
+            }
+        }));
+    }
+    for (auto& f: stripes) {
+        // Rethrows flush error
+        f.get();
+    }
+    meta_->flush();
 }
 
 // ExpandableFileStorage
 
-ExpandableFileStorage::ExpandableFileStorage(std::shared_ptr<VolumeRegistry> meta)
-    : FileStorage::FileStorage(meta)
+ExpandableFileStorage::ExpandableFileStorage(std::shared_ptr<VolumeRegistry> meta, FileStorageParams const& params)
+    : FileStorage::FileStorage(meta, params)
     , db_name_(meta->get_dbname())
 {
 }
 
-std::shared_ptr<ExpandableFileStorage> ExpandableFileStorage::open(std::shared_ptr<VolumeRegistry> meta)
+std::shared_ptr<ExpandableFileStorage> ExpandableFileStorage::open(std::shared_ptr<VolumeRegistry> meta,
+                                                                   FileStorageParams const& params)
 {
-    auto bs = new ExpandableFileStorage(meta);
+    auto bs = new ExpandableFileStorage(meta, params);
     return std::shared_ptr<ExpandableFileStorage>(bs);
 }
 
@@ -459,7 +697,7 @@ bool ExpandableFileStorage::exists(LogicAddr addr) const {
 }
 
 std::tuple<aku_Status, std::shared_ptr<Block>> ExpandableFileStorage::read_block(LogicAddr addr) {
-    std::lock_guard<std::mutex> guard(lock_); AKU_UNUSED(guard);
+    std::unique_lock<std::mutex> guard(lock_);
     aku_Status status;
     auto gen = extract_gen(addr);
     auto vol = extract_vol(addr);
@@ -476,23 +714,7 @@ std::tuple<aku_Status, std::shared_ptr<Block>> ExpandableFileStorage::read_block
     if (actual_gen != gen || vol >= nblocks) {
       return std::make_tuple(AKU_EUNAVAILABLE, std::unique_ptr<Block>());
     }
-    // Try to use zero-copy if possible
-    const u8* mptr;
-    std::tie(status, mptr) = volumes_[gen]->read_block_zero_copy(vol);
-    if (status == AKU_SUCCESS) {
-        std::shared_ptr<Block> zblock = std::make_shared<Block>(addr, mptr);
-        return std::make_tuple(status, std::move(zblock));
-    } else if (status == AKU_EUNAVAILABLE) {
-        // Fallback to copying if not possible
-        std::vector<u8> dest(AKU_BLOCK_SIZE, 0);
-        status = volumes_[gen]->read_block(vol, dest.data());
-        if (status != AKU_SUCCESS) {
-            return std::make_tuple(status, std::unique_ptr<Block>());
-        }
-        auto block = std::make_shared<Block>(addr, std::move(dest));
-        return std::make_tuple(status, std::move(block));
-    }
-    return std::make_tuple(status, std::unique_ptr<Block>());
+    return read_checked(&guard, volumes_[gen].get(), vol, addr);
 }
 
 std::unique_ptr<Volume> ExpandableFileStorage::create_new_volume(u32 id) {
@@ -502,7 +724,7 @@ std::unique_ptr<Volume> ExpandableFileStorage::create_new_volume(u32 id) {
     std::string basename = std::string(db_name_) + "_" + std::to_string(id) + ".vol";
     boost::filesystem::path new_path = pp / basename;
     Volume::create_new(new_path.c_str(), volumes_[prev_id]->get_size());
-    return Volume::open_existing(new_path.c_str(), 0);
+    return open_volume(new_path.c_str(), 0);
 }
 
 void ExpandableFileStorage::adjust_current_volume() {
@@ -524,6 +746,138 @@ void ExpandableFileStorage::adjust_current_volume() {
     }
 }
 
+// VolumeRegistryView
+
+VolumeRegistryView::VolumeRegistryView(std::shared_ptr<VolumeRegistry> registry, u32 base, u32 range, std::string name_suffix)
+    : registry_(registry)
+    , base_(base)
+    , range_(range)
+    , suffix_(name_suffix)
+{
+}
+
+std::vector<VolumeRegistry::VolumeDesc> VolumeRegistryView::get_volumes() const {
+    std::vector<VolumeDesc> result;
+    for (auto vol: registry_->get_volumes()) {
+        if (vol.id >= base_ && vol.id - base_ < range_) {
+            vol.id -= base_;
+            result.push_back(vol);
+        }
+    }
+    return result;
+}
+
+void VolumeRegistryView::add_volume(const VolumeDesc& vol) {
+    auto desc = vol;
+    desc.id += base_;
+    registry_->add_volume(desc);
+}
+
+void VolumeRegistryView::update_volume(const VolumeDesc& vol) {
+    auto desc = vol;
+    desc.id += base_;
+    registry_->update_volume(desc);
+}
+
+std::vector<VolumeRegistry::VolumeSummary> VolumeRegistryView::get_volume_summaries() const {
+    std::vector<VolumeSummary> result;
+    for (auto summary: registry_->get_volume_summaries()) {
+        if (summary.id >= base_ && summary.id - base_ < range_) {
+            summary.id -= base_;
+            result.push_back(summary);
+        }
+    }
+    return result;
+}
+
+void VolumeRegistryView::update_volume_summary(const VolumeSummary& summary) {
+    auto copy = summary;
+    copy.id += base_;
+    registry_->update_volume_summary(copy);
+}
+
+std::string VolumeRegistryView::get_dbname() {
+    return registry_->get_dbname() + suffix_;
+}
+
+// SplitBlockStore
+
+SplitBlockStore::SplitBlockStore(std::shared_ptr<BlockStore> leaves, std::shared_ptr<BlockStore> superblocks)
+    : leaves_(leaves)
+    , superblocks_(superblocks)
+{
+}
+
+std::tuple<aku_Status, std::shared_ptr<Block>> SplitBlockStore::read_block(LogicAddr addr) {
+    if ((addr & SUPERBLOCK_ADDR_TAG) == 0) {
+        return leaves_->read_block(addr);
+    }
+    aku_Status status;
+    std::shared_ptr<Block> block;
+    std::tie(status, block) = superblocks_->read_block(addr & ~SUPERBLOCK_ADDR_TAG);
+    if (status == AKU_SUCCESS) {
+        // Block can be shared with the cache (and other readers), so the
+        // tagged address is set on the view instead of the block itself
+        block = std::make_shared<Block>(addr, block);
+    }
+    return std::make_tuple(status, std::move(block));
+}
+
+std::tuple<aku_Status, LogicAddr> SplitBlockStore::append_block(std::shared_ptr<Block> data) {
+    if (!is_superblock(*data)) {
+        return leaves_->append_block(data);
+    }
+    aku_Status status;
+    LogicAddr addr;
+    std::tie(status, addr) = superblocks_->append_block(data);
+    if (status == AKU_SUCCESS && (addr & SUPERBLOCK_ADDR_TAG) != 0) {
+        Logger::msg(AKU_LOG_ERROR, "Superblock address is out of range: " + std::to_string(addr));
+        return std::make_tuple(AKU_EOVERFLOW, EMPTY_ADDR);
+    }
+    return std::make_tuple(status, addr | SUPERBLOCK_ADDR_TAG);
+}
+
+void SplitBlockStore::flush() {
+    // Leaves should be flushed first, superblocks refer to them
+    leaves_->flush();
+    superblocks_->flush();
+}
+
+bool SplitBlockStore::exists(LogicAddr addr) const {
+    if ((addr & SUPERBLOCK_ADDR_TAG) == 0) {
+        return leaves_->exists(addr);
+    }
+    return superblocks_->exists(addr & ~SUPERBLOCK_ADDR_TAG);
+}
+
+u32 SplitBlockStore::checksum(u8 const* data, size_t size) const {
+    return leaves_->checksum(data, size);
+}
+
+BlockStoreStats SplitBlockStore::get_stats() const {
+    auto stats = leaves_->get_stats();
+    auto sbstats = superblocks_->get_stats();
+    stats.capacity += sbstats.capacity;
+    stats.nblocks += sbstats.nblocks;
+    return stats;
+}
+
+VolumeSummarySnapshot SplitBlockStore::get_summary_snapshot() const {
+    // Superblocks can serve aggregates when the leaves are already gone
+    auto snapshot = leaves_->get_summary_snapshot();
+    auto sblocks = superblocks_->get_summary_snapshot();
+    snapshot.volumes.insert(snapshot.volumes.end(), sblocks.volumes.begin(), sblocks.volumes.end());
+    return snapshot;
+}
+
+PerVolumeStats SplitBlockStore::get_volume_stats() const {
+    auto stats = leaves_->get_volume_stats();
+    for (auto const& kv: superblocks_->get_volume_stats()) {
+        stats[kv.first] = kv.second;
+    }
+    return stats;
+}
+
 //! Address space should be started from this address (otherwise some tests will pass no matter what).
 static const LogicAddr MEMSTORE_BASE = 619;
 
@@ -560,16 +914,18 @@ std::tuple<aku_Status, std::shared_ptr<Block>> MemStore::read_block(LogicAddr ad
     if (addr < removed_pos_) {
         return std::make_tuple(AKU_EUNAVAILABLE, block);
     }
+    QueryCounters::inc(&QueryCounters::blocks_read);
     std::vector<u8> data;
-    data.reserve(AKU_BLOCK_SIZE);
+    BufferPool<u8>::acquire(&data);
     auto begin = buffer_.begin() + offset;
     auto end = begin + AKU_BLOCK_SIZE;
-    std::copy(begin, end, std::back_inserter(data));
-    block.reset(new Block(addr + MEMSTORE_BASE, std::move(data)));
+    data.assign(begin, end);
+    block = make_pooled<Block>(addr + MEMSTORE_BASE, std::move(data));
     return std::make_tuple(AKU_SUCCESS, block);
 }
 
 std::tuple<aku_Status, LogicAddr> MemStore::append_block(std::shared_ptr<Block> data) {
+    ProbeScope probe(AKU_PROBE_APPEND_BLOCK);
     std::lock_guard<std::mutex> guard(lock_); AKU_UNUSED(guard);
     assert(data->get_size() == AKU_BLOCK_SIZE);
     std::copy(data->get_data(), data->get_data() + AKU_BLOCK_SIZE, std::back_inserter(buffer_));
@@ -587,7 +943,7 @@ void MemStore::flush() {
 }
 
 BlockStoreStats MemStore::get_stats() const {
-    BlockStoreStats s;
+    BlockStoreStats s = {};
     s.block_size = 4096;
     s.capacity = 1024*4096;
     s.nblocks = write_pos_;
@@ -596,7 +952,7 @@ BlockStoreStats MemStore::get_stats() const {
 
 PerVolumeStats MemStore::get_volume_stats() const {
     PerVolumeStats result;
-    BlockStoreStats s;
+    BlockStoreStats s = {};
     s.block_size = 4096;
     s.capacity = 1024*4096;
     s.nblocks = write_pos_;
@@ -604,6 +960,14 @@ PerVolumeStats MemStore::get_volume_stats() const {
     return result;
 }
 
+VolumeSummarySnapshot MemStore::get_summary_snapshot() const {
+    // Can contain anything
+    VolumeSummarySnapshot snapshot;
+    VolumeSummaryRef ref = { AKU_MIN_TIMESTAMP, AKU_MAX_TIMESTAMP, nullptr };
+    snapshot.volumes.push_back(ref);
+    return snapshot;
+}
+
 bool MemStore::exists(LogicAddr addr) const {
     addr -= MEMSTORE_BASE;
     std::lock_guard<std::mutex> guard(lock_); AKU_UNUSED(guard);
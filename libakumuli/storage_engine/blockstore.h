@@ -18,10 +18,12 @@
 #pragma once
 #include "volumeregistry.h"
 #include "volume.h"
-#include <random>
+#include "instrumentation.h"
+#include <list>
 #include <mutex>
 #include <map>
 #include <string>
+#include <unordered_map>
 
 namespace Akumuli {
 namespace StorageEngine {
@@ -32,29 +34,78 @@ typedef u64 LogicAddr;
 //! This value represents empty addr. It's too large to be used as a real block addr.
 static const LogicAddr EMPTY_ADDR = std::numeric_limits<LogicAddr>::max();
 
+//! Logic addresses of the blocks from the superblock volume set are tagged with this bit
+//! (not the highest one, addresses are stored in SQLite as signed integers)
+static const LogicAddr SUPERBLOCK_ADDR_TAG = 1ull << 62;
+
+//! Id of the first volume of the superblock volume set (in the volume registry)
+static const u32 SUPERBLOCK_VOLUME_BASE = 0x40000000;
+
 class Block;
 
-struct BlockCache {
+/** Scan-resistant block cache (segmented LRU).
+  * Blocks are admitted to the probationary segment and promoted to the protected
+  * segment on the second hit, so one-off scans of historical data can't evict
+  * the working set. Superblocks (inner nodes of the NB+tree) are admitted directly
+  * to the protected segment. Cache has its own lock, so it can be accessed without
+  * holding the blockstore lock.
+  */
+class BlockCache {
+public:
     typedef std::shared_ptr<Block> PBlock;
-    std::vector<PBlock> block_cache_;
-    const u32 bits_;
-    // RNG
-    std::random_device dev_;
-    std::mt19937 gen_;
-    std::uniform_int_distribution<u32> dist_;
-
-    /** Check status of the cache cell.
-      * Return 0 if there is no such addr in the cache and slot is free.
-      * Return 1 if addr is not present in the cache but slot is occupied by the other block.
-      * Return 2 if addr is already present in the cache.
+
+private:
+    struct Entry {
+        PBlock block;
+        bool is_protected;
+        std::list<LogicAddr>::iterator pos;
+    };
+    std::unordered_map<LogicAddr, Entry> table_;
+    //! Probationary segment, MRU first
+    std::list<LogicAddr> probation_;
+    //! Protected segment, MRU first
+    std::list<LogicAddr> protected_;
+    const size_t capacity_;
+    const size_t protected_capacity_;
+    //! Memory used by cached blocks
+    MemoryTracker mem_;
+    mutable std::mutex lock_;
+
+    //! Move entry to the MRU position of the protected segment
+    void promote(Entry& entry, LogicAddr addr);
+
+    //! Evict blocks from probationary segment until the size is less then capacity
+    void evict();
+
+    //! Report memory use of the cache
+    void update_memory_use();
+
+public:
+    //! Create cache that can hold `capacity` blocks
+    BlockCache(size_t capacity);
+
+    /** Add block to the cache.
+      * @param addr is a logic address of the block
+      * @param block is a block
+      * @param high_priority should be set to admit the block to the protected segment
       */
-    int probe(LogicAddr addr);
+    void insert(LogicAddr addr, PBlock block, bool high_priority);
 
-    BlockCache(u32 Nbits);
+    //! Find block in the cache (returns empty pointer if block is not cached)
+    PBlock lookup(LogicAddr addr);
 
-    void insert(PBlock block);
+    //! Number of cached blocks
+    size_t size() const;
+};
 
-    PBlock loockup(LogicAddr addr);
+//! File storage parameters
+struct FileStorageParams {
+    //! Open volumes in O_DIRECT mode (bypass page cache and use block cache instead)
+    bool direct_io = false;
+    //! Block cache size in blocks (only used in O_DIRECT mode)
+    size_t cache_size = 0;
+    //! Lock memory mapped volumes in memory
+    bool lock_in_memory = false;
 };
 
 
@@ -62,6 +113,7 @@ struct BlockStoreStats {
     size_t block_size;
     size_t capacity;
     size_t nblocks;
+    bool   direct_io;  //< Volume is opened in O_DIRECT mode
 };
 
 typedef std::map<std::string, BlockStoreStats> PerVolumeStats;
@@ -96,6 +148,11 @@ struct BlockStore {
     virtual BlockStoreStats get_stats() const = 0;
 
     virtual PerVolumeStats get_volume_stats() const = 0;
+
+    /** Get snapshot of the volume summaries. Snapshot can be checked without
+      * locking the blockstore and without reading any data.
+      */
+    virtual VolumeSummarySnapshot get_summary_snapshot() const = 0;
 };
 
 class FileStorage : public BlockStore {
@@ -116,13 +173,36 @@ protected:
     mutable std::mutex lock_;
     //! Volume names (for nice statistics)
     std::vector<std::string> volume_names_;
+    //! Blockstore parameters
+    FileStorageParams params_;
+    //! Block cache (only used in O_DIRECT mode)
+    std::unique_ptr<BlockCache> cache_;
 
     //! Secret c-tor.
-    FileStorage(std::shared_ptr<VolumeRegistry> meta);
+    FileStorage(std::shared_ptr<VolumeRegistry> meta, FileStorageParams const& params);
 
     virtual void adjust_current_volume() = 0;
     void handle_volume_transition();
 
+    //! Open volume according to blockstore parameters
+    std::unique_ptr<Volume> open_volume(const char* path, u32 nblocks) const;
+
+    //! Read block from the volume or from the block cache (address should be checked)
+    std::tuple<aku_Status, std::shared_ptr<Block>> read_from_volume(Volume* volume, BlockAddr vol, LogicAddr addr);
+
+    /** Read block from the volume, address should be checked under the lock.
+      * O_DIRECT volumes are read after the lock is released, so reads from all
+      * queries are not serialized. Address is checked again after the read,
+      * in case the volume was recycled while the block was being read.
+      */
+    std::tuple<aku_Status, std::shared_ptr<Block>> read_checked(std::unique_lock<std::mutex>* guard,
+                                                                Volume* volume,
+                                                                BlockAddr vol,
+                                                                LogicAddr addr);
+
+    //! Add recently written block to the block cache
+    void cache_written_block(std::shared_ptr<Block> const& data, LogicAddr addr);
+
 public:
     static void create(std::vector<std::tuple<u32, std::string>> vols);
 
@@ -139,20 +219,23 @@ public:
     virtual BlockStoreStats get_stats() const;
 
     virtual PerVolumeStats get_volume_stats() const;
+
+    virtual VolumeSummarySnapshot get_summary_snapshot() const;
 };
 
 class FixedSizeFileStorage : public FileStorage,
                              public std::enable_shared_from_this<FixedSizeFileStorage> {
+protected:
     //! Secret c-tor.
-    FixedSizeFileStorage(std::shared_ptr<VolumeRegistry> meta);
+    FixedSizeFileStorage(std::shared_ptr<VolumeRegistry> meta, FileStorageParams const& params);
 
-protected:
     virtual void adjust_current_volume();
 
 public:
     /** Create BlockStore instance (can be created only on heap).
       */
-    static std::shared_ptr<FixedSizeFileStorage> open(std::shared_ptr<VolumeRegistry> meta);
+    static std::shared_ptr<FixedSizeFileStorage> open(std::shared_ptr<VolumeRegistry> meta,
+                                                      FileStorageParams const& params = FileStorageParams());
 
     virtual bool exists(LogicAddr addr) const;
 
@@ -161,12 +244,44 @@ public:
     virtual std::tuple<aku_Status, std::shared_ptr<Block>> read_block(LogicAddr addr);
 };
 
+/** Striped blockstore. Volumes are placed on several devices (stripes) and grouped
+  * into rows, every row contains one volume from each stripe (volume `ix` belongs to
+  * stripe `ix % stripe_width` and to row `ix / stripe_width`). Blocks are appended to
+  * volumes of the current row in round-robin order, so writes and reads of recent data
+  * are spread across devices. Logic address encodes the volume (and the stripe) the
+  * same way as in FixedSizeFileStorage.
+  */
+class StripedFileStorage : public FixedSizeFileStorage {
+    //! Number of stripes (devices)
+    u32 stripe_width_;
+
+    //! Secret c-tor.
+    StripedFileStorage(std::shared_ptr<VolumeRegistry> meta, u32 stripe_width, FileStorageParams const& params);
+
+    //! Reset volumes of the next row and make it current
+    void advance_row();
+
+public:
+    /** Create BlockStore instance (can be created only on heap).
+      * @param meta is a volume registry
+      * @param stripe_width is a number of stripes, should divide number of volumes
+      * @param params is a blockstore parameters
+      */
+    static std::shared_ptr<StripedFileStorage> open(std::shared_ptr<VolumeRegistry> meta, u32 stripe_width,
+                                                    FileStorageParams const& params = FileStorageParams());
+
+    virtual std::tuple<aku_Status, LogicAddr> append_block(std::shared_ptr<Block> data);
+
+    //! Flush volumes of every stripe in parallel
+    virtual void flush();
+};
+
 class ExpandableFileStorage : public FileStorage,
                               public std::enable_shared_from_this<ExpandableFileStorage> {
      std::string db_name_;
 
      //! Secret c-tor.
-     ExpandableFileStorage(std::shared_ptr<VolumeRegistry> meta);
+     ExpandableFileStorage(std::shared_ptr<VolumeRegistry> meta, FileStorageParams const& params);
 
      std::unique_ptr<Volume> create_new_volume(u32 id);
 protected:
@@ -179,8 +294,10 @@ public:
       * @param metapath is a place where the meta-page is located
       * @param volpaths is a list of volume paths
       * @param on_volume_advance is function object that gets called when new volume is created
+      * @param params is a blockstore parameters
       */
-     static std::shared_ptr<ExpandableFileStorage> open(std::shared_ptr<VolumeRegistry> meta);
+     static std::shared_ptr<ExpandableFileStorage> open(std::shared_ptr<VolumeRegistry> meta,
+                                                        FileStorageParams const& params = FileStorageParams());
 
      virtual bool exists(LogicAddr addr) const;
 
@@ -190,6 +307,60 @@ public:
 };
 
 
+/** Subset of the volume registry (volumes with ids in [base, base + range) range).
+  * Volume ids are translated so the subset looks like a standalone registry.
+  */
+class VolumeRegistryView : public VolumeRegistry {
+    std::shared_ptr<VolumeRegistry> registry_;
+    const u32 base_;
+    const u32 range_;
+    const std::string suffix_;
+
+public:
+    /**
+     * @param registry is an underlying volume registry
+     * @param base is an id of the first volume of the subset
+     * @param range is a max number of volumes in the subset
+     * @param name_suffix is added to the database name (used to name new volumes)
+     */
+    VolumeRegistryView(std::shared_ptr<VolumeRegistry> registry, u32 base, u32 range, std::string name_suffix);
+
+    virtual std::vector<VolumeDesc> get_volumes() const;
+
+    virtual void add_volume(const VolumeDesc& vol);
+
+    virtual void update_volume(const VolumeDesc& vol);
+
+    virtual std::vector<VolumeSummary> get_volume_summaries() const;
+
+    virtual void update_volume_summary(const VolumeSummary& summary);
+
+    virtual std::string get_dbname();
+};
+
+/** Blockstore that writes superblocks (inner nodes of the NB+tree) to the dedicated
+  * blockstore. Superblock volume set is much smaller than the main one so it can be
+  * placed on faster media or locked in memory, and tree navigation doesn't touch
+  * cold storage. Logic addresses of superblocks are tagged with SUPERBLOCK_ADDR_TAG.
+  */
+class SplitBlockStore : public BlockStore {
+    std::shared_ptr<BlockStore> leaves_;
+    std::shared_ptr<BlockStore> superblocks_;
+
+public:
+    SplitBlockStore(std::shared_ptr<BlockStore> leaves, std::shared_ptr<BlockStore> superblocks);
+
+    virtual std::tuple<aku_Status, std::shared_ptr<Block>> read_block(LogicAddr addr);
+    virtual std::tuple<aku_Status, LogicAddr> append_block(std::shared_ptr<Block> data);
+    virtual void flush();
+    virtual bool exists(LogicAddr addr) const;
+    virtual u32 checksum(u8 const* data, size_t size) const;
+    virtual BlockStoreStats get_stats() const;
+    virtual PerVolumeStats get_volume_stats() const;
+    virtual VolumeSummarySnapshot get_summary_snapshot() const;
+};
+
+
 //! Memory resident blockstore for tests (and machines with infinite RAM)
 struct MemStore : BlockStore, std::enable_shared_from_this<MemStore> {
     std::vector<u8> buffer_;
@@ -210,6 +381,7 @@ struct MemStore : BlockStore, std::enable_shared_from_this<MemStore> {
     virtual u32 checksum(u8 const* data, size_t size) const;
     virtual BlockStoreStats get_stats() const;
     virtual PerVolumeStats get_volume_stats() const;
+    virtual VolumeSummarySnapshot get_summary_snapshot() const;
     void remove(size_t addr);
 };
 
@@ -219,6 +391,7 @@ class Block {
     std::vector<u8>           data_;
     LogicAddr                 addr_;
     const u8*                 zptr_;
+    std::shared_ptr<const Block> base_;  //< Owner of the data (if block is a view)
 
 public:
     Block(LogicAddr addr, std::vector<u8>&& data);
@@ -226,8 +399,17 @@ public:
     //! This c-tor is used in zero-copy mechanism, ptr should outlive the Block object
     Block(LogicAddr addr, const u8* ptr);
 
+    //! Read-only view of the other block with the different address (shared block is not modified)
+    Block(LogicAddr addr, std::shared_ptr<const Block> base);
+
     Block();
 
+    //! Returns data buffer to the thread-local pool
+    ~Block();
+
+    Block(Block const&) = delete;
+    Block& operator = (Block const&) = delete;
+
     bool is_readonly() const;
 
     const u8* get_data() const;
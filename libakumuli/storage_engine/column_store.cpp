@@ -7,6 +7,8 @@
 #include "operators/join.h"
 #include "operators/merge.h"
 
+#include <algorithm>
+
 #include <boost/property_tree/ptree.hpp>
 
 namespace Akumuli {
@@ -15,15 +17,84 @@ namespace StorageEngine {
 using namespace QP;
 
 
+// /////////////////////// //
+//  Series activity index  //
+// /////////////////////// //
+
+SeriesActivityIndex::SeriesActivityIndex(aku_Timestamp width)
+    : width_(width)
+{
+}
+
+void SeriesActivityIndex::restore(aku_ParamId id, Range range) {
+    std::lock_guard<std::mutex> guard(lock_);
+    index_[id] = range;
+}
+
+void SeriesActivityIndex::add_new(aku_ParamId id) {
+    std::lock_guard<std::mutex> guard(lock_);
+    // Range recorded by the concurrent writer shouldn't be overwritten
+    index_.emplace(id, std::make_pair(AKU_MAX_TIMESTAMP, AKU_MIN_TIMESTAMP));
+}
+
+SeriesActivityIndex::Range SeriesActivityIndex::update(aku_ParamId id, aku_Timestamp ts) {
+    aku_Timestamp lo = ts - ts % width_;
+    aku_Timestamp hi = lo > AKU_MAX_TIMESTAMP - width_ ? AKU_MAX_TIMESTAMP : lo + width_ - 1;
+    std::lock_guard<std::mutex> guard(lock_);
+    auto it = index_.find(id);
+    if (it == index_.end()) {
+        // Data written before the index was created can be anywhere before `ts`
+        it = index_.insert(std::make_pair(id, std::make_pair(AKU_MIN_TIMESTAMP, hi))).first;
+    } else if (lo < it->second.first || hi > it->second.second) {
+        it->second.first  = std::min(it->second.first, lo);
+        it->second.second = std::max(it->second.second, hi);
+    } else {
+        return it->second;
+    }
+    changes_[id] = it->second;
+    return it->second;
+}
+
+bool SeriesActivityIndex::is_active(aku_ParamId id, aku_Timestamp begin, aku_Timestamp end) const {
+    auto min = std::min(begin, end);
+    auto max = std::max(begin, end);
+    std::lock_guard<std::mutex> guard(lock_);
+    auto it = index_.find(id);
+    if (it == index_.end()) {
+        return true;
+    }
+    if (it->second.first > it->second.second) {
+        // Series doesn't have any data
+        return false;
+    }
+    return it->second.first <= max && min <= it->second.second;
+}
+
+std::unordered_map<aku_ParamId, SeriesActivityIndex::Range> SeriesActivityIndex::pull_changes() {
+    std::unordered_map<aku_ParamId, Range> result;
+    std::lock_guard<std::mutex> guard(lock_);
+    std::swap(result, changes_);
+    return result;
+}
+
+
 // ////////////// //
 //  Column-store  //
 // ////////////// //
 
-ColumnStore::ColumnStore(std::shared_ptr<BlockStore> bstore)
+ColumnStore::ColumnStore(std::shared_ptr<BlockStore> bstore, aku_Timestamp activity_partition)
     : blockstore_(bstore)
+    , columns_mem_(AKU_MEM_CSTORE_COLUMNS)
+    , activity_(activity_partition)
 {
 }
 
+//! Update memory tracker of the columns table, should be called under `table_lock_`
+static void update_columns_memory_use(MemoryTracker* mem, std::unordered_map<aku_ParamId, std::shared_ptr<NBTreeExtentsList>> const& columns) {
+    i64 bytes = hashtable_memory_use(columns) + static_cast<i64>(columns.size() * sizeof(NBTreeExtentsList));
+    mem->set(bytes, static_cast<i64>(columns.size()));
+}
+
 aku_Status ColumnStore::open_or_restore(std::unordered_map<aku_ParamId, std::vector<StorageEngine::LogicAddr>> const& mapping, bool force_init) {
     for (auto it: mapping) {
         aku_ParamId id = it.first;
@@ -43,6 +114,7 @@ aku_Status ColumnStore::open_or_restore(std::unordered_map<aku_ParamId, std::vec
             return AKU_EBAD_ARG;
         } else {
             columns_[id] = std::move(tree);
+            update_columns_memory_use(&columns_mem_, columns_);
         }
         if (force_init) {
             columns_[id]->force_init();
@@ -73,11 +145,54 @@ aku_Status ColumnStore::create_new_column(aku_ParamId id) {
         if (columns_.count(id)) {
             return AKU_EBAD_ARG;
         } else {
+            // Series should be in the activity index before it can be written
+            activity_.add_new(id);
             columns_[id] = std::move(tree);
             columns_[id]->force_init();
-            return AKU_SUCCESS;
+            update_columns_memory_use(&columns_mem_, columns_);
+        }
+    }
+    return AKU_SUCCESS;
+}
+
+void ColumnStore::restore_activity(std::unordered_map<aku_ParamId, SeriesActivityIndex::Range> const& ranges) {
+    for (auto const& kv: ranges) {
+        activity_.restore(kv.first, kv.second);
+    }
+}
+
+SeriesActivityIndex::Range ColumnStore::update_activity(aku_ParamId id, aku_Timestamp ts) {
+    return activity_.update(id, ts);
+}
+
+std::unordered_map<aku_ParamId, SeriesActivityIndex::Range> ColumnStore::pull_activity_changes() {
+    return activity_.pull_changes();
+}
+
+void ColumnStore::drop_inactive(std::vector<aku_ParamId>* ids, aku_Timestamp begin, aku_Timestamp end) const {
+    // All data of the series that wasn't written since restart is stored in the
+    // blockstore, volume summaries can tell that it was overwritten by the retention
+    auto summaries = blockstore_->get_summary_snapshot();
+    std::vector<bool> on_disk(ids->size(), false);
+    {
+        std::lock_guard<std::mutex> guard(table_lock_); AKU_UNUSED(guard);
+        for (size_t i = 0; i < ids->size(); i++) {
+            auto col = columns_.find(ids->at(i));
+            on_disk[i] = col != columns_.end() && !col->second->is_initialized();
+        }
+    }
+    size_t out = 0;
+    for (size_t i = 0; i < ids->size(); i++) {
+        aku_ParamId id = ids->at(i);
+        if (!activity_.is_active(id, begin, end)) {
+            continue;
+        }
+        if (on_disk[i] && !summaries.may_contain(id, begin, end)) {
+            continue;
         }
+        ids->at(out++) = id;
     }
+    ids->resize(out);
 }
 
 size_t ColumnStore::_get_uncommitted_memory() const {
@@ -124,6 +239,7 @@ NBTreeAppendResult ColumnStore::write(aku_Sample const& sample, std::vector<Logi
 
 CStoreSession::CStoreSession(std::shared_ptr<ColumnStore> registry)
     : cstore_(registry)
+    , cache_mem_(AKU_MEM_CSTORE_SESSIONS)
 {
 }
 
@@ -131,18 +247,29 @@ NBTreeAppendResult CStoreSession::write(aku_Sample const& sample, std::vector<Lo
     if (AKU_UNLIKELY(sample.payload.type != AKU_PAYLOAD_FLOAT)) {
         return NBTreeAppendResult::FAIL_BAD_VALUE;
     }
+    NBTreeAppendResult res;
     // Cache lookup
     auto it = cache_.find(sample.paramid);
     if (it != cache_.end()) {
-        auto res = it->second->append(sample.timestamp, sample.payload.float64);
+        res = it->second->append(sample.timestamp, sample.payload.float64);
         if (res == NBTreeAppendResult::OK_FLUSH_NEEDED) {
             auto tmp = it->second->get_roots();
             rescue_points->swap(tmp);
         }
-        return res;
+    } else {
+        // Cache miss - access global registry
+        res = cstore_->write(sample, rescue_points, &cache_);
+        cache_mem_.set(hashtable_memory_use(cache_) + hashtable_memory_use(activity_),
+                       static_cast<i64>(cache_.size()));
+    }
+    if (res == NBTreeAppendResult::OK || res == NBTreeAppendResult::OK_FLUSH_NEEDED) {
+        // Global index is updated only if the timestamp is out of the known range
+        auto range = activity_.find(sample.paramid);
+        if (range == activity_.end() || sample.timestamp < range->second.first || sample.timestamp > range->second.second) {
+            activity_[sample.paramid] = cstore_->update_activity(sample.paramid, sample.timestamp);
+        }
     }
-    // Cache miss - access global registry
-    return cstore_->write(sample, rescue_points, &cache_);
+    return res;
 }
 
 void CStoreSession::close() {
@@ -45,6 +45,53 @@ namespace Akumuli {
 namespace StorageEngine {
 
 
+/** Series activity index.
+  * Stores time range of every series with partition granularity (bounds of the
+  * range are aligned to partitions). Query planner uses it to drop series that
+  * don't have data in the query range without touching their trees.
+  * Series without record (e.g. series created by the older version) are always
+  * considered active.
+  * Instances of this class is thread-safe.
+  */
+class SeriesActivityIndex {
+public:
+    //! Time range of the series (inclusive, empty if first > second)
+    typedef std::pair<aku_Timestamp, aku_Timestamp> Range;
+
+    //! Default partition width is one hour
+    static const aku_Timestamp DEFAULT_PARTITION_WIDTH = 3600000000000ull;
+
+private:
+    aku_Timestamp width_;
+    std::unordered_map<aku_ParamId, Range> index_;
+    //! Ranges updated since the last `pull_changes` call
+    std::unordered_map<aku_ParamId, Range> changes_;
+    mutable std::mutex lock_;
+
+public:
+    SeriesActivityIndex(aku_Timestamp width = DEFAULT_PARTITION_WIDTH);
+
+    //! Add range loaded from the metadata storage
+    void restore(aku_ParamId id, Range range);
+
+    //! Add new series (series doesn't have any data), existing range is not changed
+    void add_new(aku_ParamId id);
+
+    /** Update range of the series using timestamp of the written value.
+      * If series doesn't have a record its previous data range is unknown, so the
+      * range is extended to the beginning of time.
+      * @return updated range
+      */
+    Range update(aku_ParamId id, aku_Timestamp ts);
+
+    //! Return true if series can have data in [min(begin, end), max(begin, end)] range
+    bool is_active(aku_ParamId id, aku_Timestamp begin, aku_Timestamp end) const;
+
+    //! Return ranges updated since the last call
+    std::unordered_map<aku_ParamId, Range> pull_changes();
+};
+
+
 /** Columns store.
   * Serve as a central data repository for series metadata and all individual columns.
   * Each column is addressed by the series name. Data can be written in through WriteSession
@@ -56,9 +103,13 @@ namespace StorageEngine {
 class ColumnStore : public std::enable_shared_from_this<ColumnStore> {
     std::shared_ptr<StorageEngine::BlockStore> blockstore_;
     std::unordered_map<aku_ParamId, std::shared_ptr<NBTreeExtentsList>> columns_;
+    //! Memory used by `columns_` table and column descriptors (tree nodes are tracked separately)
+    MemoryTracker columns_mem_;
     PlainSeriesMatcher global_matcher_;
     //! List of metadata to update
     std::unordered_map<aku_ParamId, std::vector<StorageEngine::LogicAddr>> rescue_points_;
+    //! Time ranges of the series
+    SeriesActivityIndex activity_;
     //! Mutex for metadata storage and rescue points list
     mutable std::mutex metadata_lock_;
     //! Mutex for table_ hashmap (shrink and resize)
@@ -67,7 +118,8 @@ class ColumnStore : public std::enable_shared_from_this<ColumnStore> {
     std::condition_variable cvar_;
 
 public:
-    ColumnStore(std::shared_ptr<StorageEngine::BlockStore> bstore);
+    ColumnStore(std::shared_ptr<StorageEngine::BlockStore> bstore,
+                aku_Timestamp activity_partition = SeriesActivityIndex::DEFAULT_PARTITION_WIDTH);
 
     // No value semantics allowed.
     ColumnStore(ColumnStore const&) = delete;
@@ -93,6 +145,20 @@ public:
 
     size_t _get_uncommitted_memory() const;
 
+    //! Load activity index from the metadata storage (should be called after `open_or_restore`)
+    void restore_activity(std::unordered_map<aku_ParamId, SeriesActivityIndex::Range> const& ranges);
+
+    //! Update activity index after write, returns updated range of the series
+    SeriesActivityIndex::Range update_activity(aku_ParamId id, aku_Timestamp ts);
+
+    //! Return activity ranges that should be saved to the metadata storage
+    std::unordered_map<aku_ParamId, SeriesActivityIndex::Range> pull_activity_changes();
+
+    /** Remove series that don't have data in [begin, end] range from the list.
+      * Series activity index and volume summaries of the blockstore are used, no I/O is performed.
+      */
+    void drop_inactive(std::vector<aku_ParamId>* ids, aku_Timestamp begin, aku_Timestamp end) const;
+
     //! For debug reports
     std::unordered_map<aku_ParamId, std::shared_ptr<NBTreeExtentsList>> _get_columns() {
         return columns_;
@@ -136,10 +202,11 @@ public:
     aku_Status aggregate(std::vector<aku_ParamId> const& ids,
                          aku_Timestamp begin,
                          aku_Timestamp end,
-                         std::vector<std::unique_ptr<AggregateOperator>>* dest) const
+                         std::vector<std::unique_ptr<AggregateOperator>>* dest,
+                         bool need_m2 = false) const
     {
-        return iterate(ids, dest, [begin, end](const NBTreeExtentsList& elist) {
-            return elist.aggregate(begin, end);
+        return iterate(ids, dest, [begin, end, need_m2](const NBTreeExtentsList& elist) {
+            return elist.aggregate(begin, end, need_m2);
         });
     }
 
@@ -147,12 +214,30 @@ public:
                                aku_Timestamp begin,
                                aku_Timestamp end,
                                aku_Timestamp step,
-                               std::vector<std::unique_ptr<AggregateOperator>>* dest) const
+                               std::vector<std::unique_ptr<AggregateOperator>>* dest,
+                               u16 level = 0,
+                               bool need_m2 = false) const
     {
-        return iterate(ids, dest, [begin, end, step](const NBTreeExtentsList& elist) {
-            return elist.group_aggregate(begin, end, step);
+        return iterate(ids, dest, [begin, end, step, level, need_m2](const NBTreeExtentsList& elist) {
+            return elist.group_aggregate(begin, end, step, level, need_m2);
         });
     }
+
+    //! Return height of the tallest tree (0 if none of the series exists)
+    u16 get_height(std::vector<aku_ParamId> const& ids) const {
+        u16 height = 0;
+        for (auto id: ids) {
+            std::lock_guard<std::mutex> lg(table_lock_); AKU_UNUSED(lg);
+            auto it = columns_.find(id);
+            if (it != columns_.end()) {
+                if (!it->second->is_initialized()) {
+                    it->second->force_init();
+                }
+                height = std::max(height, it->second->get_height());
+            }
+        }
+        return height;
+    }
 };
 
 
@@ -166,6 +251,10 @@ class CStoreSession : public std::enable_shared_from_this<CStoreSession>
     std::shared_ptr<ColumnStore> cstore_;
     //! Tree cache
     std::unordered_map<aku_ParamId, std::shared_ptr<NBTreeExtentsList>> cache_;
+    //! Activity ranges known to the column store (index is updated only when the range grows)
+    std::unordered_map<aku_ParamId, SeriesActivityIndex::Range> activity_;
+    //! Memory used by tree cache
+    MemoryTracker cache_mem_;
 public:
     //! C-tor. Shouldn't be called directly.
     CStoreSession(std::shared_ptr<ColumnStore> registry);
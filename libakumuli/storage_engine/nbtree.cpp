@@ -18,15 +18,19 @@
 // C++
 #include <iostream>  // For debug print fn.
 #include <algorithm>
+#include <cmath>
+#include <cstddef>
 #include <vector>
 #include <sstream>
 #include <stack>
 
 // App
 #include "nbtree.h"
-#include "akumuli_version.h"
 #include "status_util.h"
 #include "log_iface.h"
+#include "instrumentation.h"
+#include "cancellation.h"
+#include "pool.h"
 #include "operators/scan.h"
 #include "operators/aggregate.h"
 
@@ -74,14 +78,43 @@ static const SubtreeRef INIT_SUBTREE_REF = {
     //! Payload size (real)
     0,
     //! Node version
-    AKUMULI_VERSION,
+    AKU_NBTREE_VERSION,
     //! Fan out index of the element (current)
     0,
     //! Checksum of the block (not used for links to child nodes)
-    0
+    0,
+    //! Sum of squared differences from the mean
+    .0
 };
 
 
+/** Subtree reference used by AKU_NBTREE_V1 nodes.
+  * Same as SubtreeRef but without `m2` field.
+  */
+struct SubtreeRefV1 {
+    u64 count;
+    aku_ParamId id;
+    aku_Timestamp begin;
+    aku_Timestamp end;
+    LogicAddr addr;
+    double min;
+    aku_Timestamp min_time;
+    double max;
+    aku_Timestamp max_time;
+    double sum;
+    double first;
+    double last;
+    NBTreeBlockType type;
+    u16 level;
+    u16 payload_size;
+    u16 version;
+    u16 fanout_index;
+    u32 checksum;
+} __attribute__((packed));
+
+static_assert(offsetof(SubtreeRefV1, version) == offsetof(SubtreeRef, version), "Node version can't be detected");
+
+
 static SubtreeRef* subtree_cast(u8* p) {
     return reinterpret_cast<SubtreeRef*>(p);
 }
@@ -90,6 +123,260 @@ static SubtreeRef const* subtree_cast(u8 const* p) {
     return reinterpret_cast<SubtreeRef const*>(p);
 }
 
+//! Size of the node header (node can be created by the older version)
+static size_t header_size(u8 const* p) {
+    return subtree_cast(p)->version < AKU_NBTREE_V2 ? sizeof(SubtreeRefV1) : sizeof(SubtreeRef);
+}
+
+/** Convert node created by the older version to the current format.
+  * Nodes are converted in memory when loaded, `m2` is set to NaN in converted
+  * nodes, so queries that need it have to read the data.
+  */
+static std::shared_ptr<Block> upgrade_node(std::shared_ptr<Block> block) {
+    u8 const* src = block->get_cdata();
+    SubtreeRef const* ref = subtree_cast(src);
+    if (ref->version >= AKU_NBTREE_V2) {
+        return block;
+    }
+    auto convert = [](u8 const* from, u8* to) {
+        memcpy(to, from, sizeof(SubtreeRefV1));
+        subtree_cast(to)->m2 = std::numeric_limits<double>::quiet_NaN();
+    };
+    std::vector<u8> data;
+    if (ref->type == NBTreeBlockType::LEAF) {
+        // Payload is shifted, converted leaf can be a bit larger than the block
+        size_t payload = block->get_size() - sizeof(SubtreeRefV1);
+        data.resize(sizeof(SubtreeRef) + payload);
+        convert(src, data.data());
+        memcpy(data.data() + sizeof(SubtreeRef), src + sizeof(SubtreeRefV1), payload);
+    } else {
+        data.resize(AKU_BLOCK_SIZE);
+        // Node header and child refs
+        for (u32 ix = 0; ix < 1u + ref->payload_size; ix++) {
+            convert(src + ix*sizeof(SubtreeRefV1), data.data() + ix*sizeof(SubtreeRef));
+        }
+    }
+    return std::make_shared<Block>(block->get_addr(), std::move(data));
+}
+
+
+// Compressed superblock format (AKU_NBTREE_VERSION).
+// Child refs are stored column-wise after the node header. Payload starts with the
+// number of refs (u16) and offsets of the column ends (u16 each). Every column is
+// delta-encoded using the previous ref so the column can be decoded independently
+// (e.g. query can check timestamps without decoding the rest of the node).
+
+enum SBlockColumn {
+    SBLOCK_TIMESTAMPS,   //< begin (delta from prev end), end (delta from begin)
+    SBLOCK_ADDRESSES,    //< addr (delta from prev addr)
+    SBLOCK_COUNTS,       //< count
+    SBLOCK_VALUE_TIMES,  //< min_time and max_time (delta from begin)
+    SBLOCK_VALUES,       //< min, max, sum, first, last, m2 (xor with prev values)
+    SBLOCK_METADATA,     //< id (delta from node id), type and level, version, payload_size,
+                         //  fanout_index, checksum
+    SBLOCK_NCOLUMNS,
+};
+
+static const size_t SBLOCK_HEADER_SIZE = sizeof(u16) * (1 + SBLOCK_NCOLUMNS);
+
+//! Space available for the payload
+static const size_t SBLOCK_CAPACITY = AKU_BLOCK_SIZE - sizeof(SubtreeRef);
+
+//! Max size of the encoded ref (10 bytes per 64-bit integer, 9 bytes per double,
+//! 5 bytes per small field)
+static const size_t SBLOCK_MAX_REF_SIZE = 10*7 + 9*6 + 5*5;
+
+static_assert((SBLOCK_CAPACITY - SBLOCK_HEADER_SIZE) / SBLOCK_MAX_REF_SIZE > AKU_NBTREE_MIN_FANOUT,
+              "AKU_NBTREE_MIN_FANOUT is too large");
+
+static u64 zigzag_encode(u64 value) {
+    auto sval = static_cast<i64>(value);
+    return static_cast<u64>((sval << 1) ^ (sval >> 63));
+}
+
+static u64 zigzag_decode(u64 value) {
+    return (value >> 1) ^ (~(value & 1) + 1);
+}
+
+static void put_varint(ByteVector& stream, u64 value) {
+    u8 buffer[10];
+    Base128Int<u64> val(value);
+    auto end = val.put(buffer, buffer + sizeof(buffer));
+    stream.insert(stream.end(), buffer, end);
+}
+
+//! Write bits of `value ^ prev` omitting leading and trailing zero bytes
+static void put_xored(ByteVector& stream, double value, double prev) {
+    u64 bits, prevbits;
+    memcpy(&bits, &value, sizeof(bits));
+    memcpy(&prevbits, &prev, sizeof(prevbits));
+    u64 diff = bits ^ prevbits;
+    if (diff == 0) {
+        stream.push_back(0x80);
+        return;
+    }
+    int lz = __builtin_clzll(diff) / 8;
+    int tz = __builtin_ctzll(diff) / 8;
+    stream.push_back(static_cast<u8>(lz << 4 | tz));
+    for (int i = tz; i < 8 - lz; i++) {
+        stream.push_back(static_cast<u8>(diff >> (8*i)));
+    }
+}
+
+static double read_xored(Base128StreamReader& stream, double prev) {
+    u8 flags = stream.read_raw<u8>();
+    int lz = flags >> 4;
+    int tz = flags & 0xF;
+    u64 diff = 0;
+    for (int i = tz; i < 8 - lz; i++) {
+        diff |= static_cast<u64>(stream.read_raw<u8>()) << (8*i);
+    }
+    u64 bits;
+    memcpy(&bits, &prev, sizeof(bits));
+    bits ^= diff;
+    double result;
+    memcpy(&result, &bits, sizeof(result));
+    return result;
+}
+
+//! Encode child ref, `prev` is a previous child ref (or zeroed ref)
+static void encode_subtree_ref(ByteVector* columns, SubtreeRef const& ref, SubtreeRef const& prev, aku_ParamId id) {
+    auto& ts = columns[SBLOCK_TIMESTAMPS];
+    put_varint(ts, zigzag_encode(ref.begin - prev.end));
+    put_varint(ts, ref.end - ref.begin);
+    put_varint(columns[SBLOCK_ADDRESSES], zigzag_encode(ref.addr - prev.addr));
+    put_varint(columns[SBLOCK_COUNTS], ref.count);
+    auto& vt = columns[SBLOCK_VALUE_TIMES];
+    put_varint(vt, ref.min_time - ref.begin);
+    put_varint(vt, ref.max_time - ref.begin);
+    auto& xs = columns[SBLOCK_VALUES];
+    put_xored(xs, ref.min,   prev.min);
+    put_xored(xs, ref.max,   prev.max);
+    put_xored(xs, ref.sum,   prev.sum);
+    put_xored(xs, ref.first, prev.first);
+    put_xored(xs, ref.last,  prev.last);
+    put_xored(xs, ref.m2,    prev.m2);
+    auto& meta = columns[SBLOCK_METADATA];
+    put_varint(meta, zigzag_encode(ref.id - id));
+    put_varint(meta, static_cast<u64>(ref.level) << 1 | static_cast<u64>(ref.type));
+    put_varint(meta, ref.version);
+    put_varint(meta, ref.payload_size);
+    put_varint(meta, ref.fanout_index);
+    put_varint(meta, ref.checksum);
+}
+
+//! Return number of child refs in compressed superblock
+static u32 get_encoded_nrefs(u8 const* payload) {
+    return *reinterpret_cast<u16 const*>(payload);
+}
+
+//! Decode one column of all child refs
+static void decode_column(u8 const* payload, SBlockColumn column, aku_ParamId id, SubtreeRef* refs) {
+    u32 nrefs = get_encoded_nrefs(payload);
+    u16 const* offsets = reinterpret_cast<u16 const*>(payload) + 1;
+    u8 const* data = payload + SBLOCK_HEADER_SIZE;
+    Base128StreamReader stream(data + (column == 0 ? 0 : offsets[column - 1]), data + offsets[column]);
+    SubtreeRef prev = {};
+    for (u32 ix = 0; ix < nrefs; ix++) {
+        SubtreeRef& ref = refs[ix];
+        switch (column) {
+        case SBLOCK_TIMESTAMPS:
+            ref.begin = prev.end + zigzag_decode(stream.next<u64>());
+            ref.end = ref.begin + stream.next<u64>();
+            break;
+        case SBLOCK_ADDRESSES:
+            ref.addr = prev.addr + zigzag_decode(stream.next<u64>());
+            break;
+        case SBLOCK_COUNTS:
+            ref.count = stream.next<u64>();
+            break;
+        case SBLOCK_VALUE_TIMES:
+            // Depends on SBLOCK_TIMESTAMPS column
+            ref.min_time = ref.begin + stream.next<u64>();
+            ref.max_time = ref.begin + stream.next<u64>();
+            break;
+        case SBLOCK_VALUES:
+            ref.min   = read_xored(stream, prev.min);
+            ref.max   = read_xored(stream, prev.max);
+            ref.sum   = read_xored(stream, prev.sum);
+            ref.first = read_xored(stream, prev.first);
+            ref.last  = read_xored(stream, prev.last);
+            ref.m2    = read_xored(stream, prev.m2);
+            break;
+        case SBLOCK_METADATA: {
+            ref.id = id + zigzag_decode(stream.next<u64>());
+            auto typelevel = stream.next<u32>();
+            ref.type = static_cast<NBTreeBlockType>(typelevel & 1);
+            ref.level = static_cast<u16>(typelevel >> 1);
+            ref.version = static_cast<u16>(stream.next<u32>());
+            ref.payload_size = static_cast<u16>(stream.next<u32>());
+            ref.fanout_index = static_cast<u16>(stream.next<u32>());
+            ref.checksum = stream.next<u32>();
+        }
+        break;
+        case SBLOCK_NCOLUMNS:
+            break;
+        };
+        prev = ref;
+    }
+}
+
+//! Return size of the encoded child ref
+static size_t get_encoded_size(SubtreeRef const& ref, SubtreeRef const& prev, aku_ParamId id) {
+    ByteVector columns[SBLOCK_NCOLUMNS];
+    encode_subtree_ref(columns, ref, prev, id);
+    size_t result = 0;
+    for (auto const& col: columns) {
+        result += col.size();
+    }
+    return result;
+}
+
+/** Encode child refs into the payload.
+  * @return size of the payload or 0 if refs doesn't fit
+  */
+static size_t encode_subtree_refs(u8* payload, size_t capacity, std::vector<SubtreeRef> const& refs, aku_ParamId id) {
+    ByteVector columns[SBLOCK_NCOLUMNS];
+    SubtreeRef prev = {};
+    for (auto const& ref: refs) {
+        encode_subtree_ref(columns, ref, prev, id);
+        prev = ref;
+    }
+    size_t size = SBLOCK_HEADER_SIZE;
+    for (auto const& col: columns) {
+        size += col.size();
+    }
+    if (size > capacity) {
+        return 0;
+    }
+    u16* header = reinterpret_cast<u16*>(payload);
+    header[0] = static_cast<u16>(refs.size());
+    u8* pos = payload + SBLOCK_HEADER_SIZE;
+    for (int col = 0; col < SBLOCK_NCOLUMNS; col++) {
+        memcpy(pos, columns[col].data(), columns[col].size());
+        pos += columns[col].size();
+        header[1 + col] = static_cast<u16>(pos - payload - SBLOCK_HEADER_SIZE);
+    }
+    return size;
+}
+
+
+/** Check that `nextra` child refs can be added to the node that contains `refs`.
+  * Neighbouring ref can change its encoded size as well, so the estimate is conservative.
+  */
+static bool sblock_has_room(std::vector<SubtreeRef> const& refs, aku_ParamId id, size_t nextra) {
+    if (refs.size() + nextra > AKU_NBTREE_FANOUT) {
+        return false;
+    }
+    size_t size = SBLOCK_HEADER_SIZE;
+    SubtreeRef prev = {};
+    for (auto const& ref: refs) {
+        size += get_encoded_size(ref, prev, id);
+        prev = ref;
+    }
+    return size + (nextra + 1)*SBLOCK_MAX_REF_SIZE <= SBLOCK_CAPACITY;
+}
+
 
 static std::tuple<aku_Status, std::shared_ptr<Block>> read_and_check(std::shared_ptr<BlockStore> bstore, LogicAddr curr) {
     aku_Status status;
@@ -101,7 +388,7 @@ static std::tuple<aku_Status, std::shared_ptr<Block>> read_and_check(std::shared
     // Check consistency (works with both inner and leaf nodes).
     u8 const* data = block->get_cdata();
     SubtreeRef const* subtree = subtree_cast(data);
-    u32 crc = bstore->checksum(data + sizeof(SubtreeRef), subtree->payload_size);
+    u32 crc = bstore->checksum(data + header_size(data), subtree->payload_size);
     if (crc != subtree->checksum) {
         std::stringstream fmt;
         fmt << "Invalid checksum (addr: " << curr << ", level: " << subtree->level << ")";
@@ -123,7 +410,7 @@ static std::shared_ptr<Block> read_block_from_bstore(std::shared_ptr<BlockStore>
     // Check consistency (works with both inner and leaf nodes).
     u8 const* data = block->get_cdata();
     SubtreeRef const* subtree = subtree_cast(data);
-    u32 crc = bstore->checksum(data + sizeof(SubtreeRef), subtree->payload_size);
+    u32 crc = bstore->checksum(data + header_size(data), subtree->payload_size);
     if (crc != subtree->checksum) {
         std::stringstream fmt;
         fmt << "Invalid checksum (addr: " << curr << ", level: " << subtree->level << ")";
@@ -159,12 +446,14 @@ aku_Status init_subtree_from_subtree(const NBTreeSuperblock& node, SubtreeRef& b
     backref.last = refs.back().last;
     backref.count = 0;
     backref.sum = 0;
+    backref.m2 = 0;
 
     double min = std::numeric_limits<double>::max();
     double max = std::numeric_limits<double>::min();
     aku_Timestamp mints = 0;
     aku_Timestamp maxts = 0;
     for (const SubtreeRef& sref: refs) {
+        backref.m2     = merge_m2(backref.count, backref.sum, backref.m2, sref.count, sref.sum, sref.m2);
         backref.count += sref.count;
         backref.sum   += sref.sum;
         if (min > sref.min) {
@@ -185,7 +474,7 @@ aku_Status init_subtree_from_subtree(const NBTreeSuperblock& node, SubtreeRef& b
     backref.id = node.get_id();
     backref.level = node.get_level();
     backref.type = NBTreeBlockType::INNER;
-    backref.version = AKUMULI_VERSION;
+    backref.version = node.get_sblockmeta()->version;
     backref.fanout_index = node.get_fanout();
     backref.payload_size = 0;
     return AKU_SUCCESS;
@@ -193,8 +482,11 @@ aku_Status init_subtree_from_subtree(const NBTreeSuperblock& node, SubtreeRef& b
 
 
 /** QueryOperator implementation for leaf node.
-  * This is very basic. All node's data is copied to
-  * the internal buffer by c-tor.
+  * This is very basic. Node's data is decoded to the internal buffer by c-tor.
+  * Decoding stops at the end of the search range, this helps only forward scans
+  * that end in the middle of the leaf. Backward scans start from the newest
+  * element so the whole leaf is decoded. Backward iterator reads this buffer
+  * from the end (no copy and reversal).
   */
 struct NBTreeLeafIterator : RealValuedOperator {
 
@@ -206,9 +498,9 @@ struct NBTreeLeafIterator : RealValuedOperator {
     std::vector<aku_Timestamp> tsbuf_;
     //! Values
     std::vector<double>        xsbuf_;
-    //! Range begin
+    //! Range begin (offset from the end of the buffer in BWD direction)
     ssize_t                    from_;
-    //! Range end
+    //! Range end (offset from the end of the buffer in BWD direction)
     ssize_t                    to_;
     //! Status of the iterator initialization process
     aku_Status                 status_;
@@ -236,6 +528,11 @@ struct NBTreeLeafIterator : RealValuedOperator {
         }
     }
 
+    ~NBTreeLeafIterator() {
+        BufferPool<aku_Timestamp>::release(&tsbuf_);
+        BufferPool<double>::release(&xsbuf_);
+    }
+
     void init(NBTreeLeaf const& node) {
         aku_Timestamp min = std::min(begin_, end_);
         aku_Timestamp max = std::max(begin_, end_);
@@ -245,17 +542,14 @@ struct NBTreeLeafIterator : RealValuedOperator {
             status_ = AKU_ENO_DATA;
             return;
         }
-        status_ = node.read_all(&tsbuf_, &xsbuf_);
+        BufferPool<aku_Timestamp>::acquire(&tsbuf_);
+        BufferPool<double>::acquire(&xsbuf_);
+        status_ = node.read_all(&tsbuf_, &xsbuf_, max);
         if (status_ == AKU_SUCCESS) {
             if (begin_ < end_) {
                 // FWD direction
                 auto it_begin = std::lower_bound(tsbuf_.begin(), tsbuf_.end(), begin_);
-                if (it_begin != tsbuf_.end()) {
-                    from_ = std::distance(tsbuf_.begin(), it_begin);
-                } else {
-                    from_ = 0;
-                    assert(tsbuf_.front() > begin_);
-                }
+                from_ = std::distance(tsbuf_.begin(), it_begin);
                 auto it_end = std::lower_bound(tsbuf_.begin(), tsbuf_.end(), end_);
                 to_ = std::distance(tsbuf_.begin(), it_end);
             } else {
@@ -265,8 +559,6 @@ struct NBTreeLeafIterator : RealValuedOperator {
 
                 auto it_end = std::upper_bound(tsbuf_.begin(), tsbuf_.end(), end_);
                 to_ = std::distance(it_end, tsbuf_.end());
-                std::reverse(tsbuf_.begin(), tsbuf_.end());
-                std::reverse(xsbuf_.begin(), xsbuf_.end());
             }
         }
     }
@@ -295,8 +587,13 @@ std::tuple<aku_Status, size_t> NBTreeLeafIterator::read(aku_Timestamp *destts, d
     }
     auto begin = from_;
     ssize_t end = from_ + toread;
-    std::copy(tsbuf_.begin() + begin, tsbuf_.begin() + end, destts);
-    std::copy(xsbuf_.begin() + begin, xsbuf_.begin() + end, destval);
+    if (begin_ < end_) {
+        std::copy(tsbuf_.begin() + begin, tsbuf_.begin() + end, destts);
+        std::copy(xsbuf_.begin() + begin, xsbuf_.begin() + end, destval);
+    } else {
+        std::copy(tsbuf_.rbegin() + begin, tsbuf_.rbegin() + end, destts);
+        std::copy(xsbuf_.rbegin() + begin, xsbuf_.rbegin() + end, destval);
+    }
     from_ += toread;
     return std::make_tuple(AKU_SUCCESS, toread);
 }
@@ -361,7 +658,7 @@ struct NBTreeSBlockIteratorBase : SeriesOperator<TVal> {
         , fsm_pos_(1)  // FSM will bypass `init` step.
         , refs_pos_(0)
     {
-        aku_Status status = sblock.read_all(&refs_);
+        aku_Status status = sblock.read_range(begin_, end_, &refs_);
         if (status != AKU_SUCCESS) {
             // `read` call should fail with AKU_ENO_DATA error.
             refs_pos_ = begin_ < end_ ? static_cast<i32>(refs_.size()) : -1;
@@ -378,7 +675,7 @@ struct NBTreeSBlockIteratorBase : SeriesOperator<TVal> {
             return status;
         }
         NBTreeSuperblock current(block);
-        status = current.read_all(&refs_);
+        status = current.read_range(begin_, end_, &refs_);
         refs_pos_ = begin_ < end_ ? 0 : static_cast<i32>(refs_.size()) - 1;
         return status;
     }
@@ -396,6 +693,11 @@ struct NBTreeSBlockIteratorBase : SeriesOperator<TVal> {
         auto max = std::max(begin_, end_);
 
         TIter empty;
+        // Long traversal should stop if the query was cancelled
+        auto reason = QueryCancellation::check_current();
+        if (reason != AKU_SUCCESS) {
+            return std::make_tuple(reason, std::move(empty));
+        }
         SubtreeRef ref = INIT_SUBTREE_REF;
         if (get_direction() == Direction::FORWARD) {
             if (refs_pos_ == static_cast<i32>(refs_.size())) {
@@ -525,7 +827,7 @@ class NBTreeLeafAggregator : public AggregateOperator {
     bool enable_cached_metadata_;
     SubtreeRef metacache_;
 public:
-    NBTreeLeafAggregator(aku_Timestamp begin, aku_Timestamp end, NBTreeLeaf const& node)
+    NBTreeLeafAggregator(aku_Timestamp begin, aku_Timestamp end, NBTreeLeaf const& node, bool need_m2)
         : iter_(begin, end, node, true)
         , enable_cached_metadata_(false)
         , metacache_(INIT_SUBTREE_REF)
@@ -534,10 +836,12 @@ public:
         std::tie(nodemin, nodemax) = node.get_timestamps();
         min = std::min(begin, end);
         max = std::max(begin, end);
-        if (min <= nodemin && nodemax < max) {
+        bool has_m2 = !need_m2 || !std::isnan(node.get_leafmeta()->m2);
+        if (min <= nodemin && nodemax < max && has_m2) {
             // Leaf totally inside the search range, we can use metadata.
             metacache_ = *node.get_leafmeta();
             enable_cached_metadata_ = true;
+            QueryCounters::inc(&QueryCounters::subtrees_reused);
         } else {
             // Otherwise we need to compute aggregate from subset of leaf's values.
             iter_.init(node);
@@ -640,25 +944,104 @@ ValueAggregator::Direction ValueAggregator::get_direction() {
     return dir_;
 }
 
+/** Approximate group-aggregate iterator.
+  * Spreads summary of the subtree across all buckets that overlap with
+  * the subtree. Count and sum are divided proportionally to the overlap,
+  * min and max are copied so they bound the real values from below/above.
+  */
+class SubtreeSpreadAggregator : public AggregateOperator {
+    SubtreeRef ref_;
+    aku_Timestamp begin_;
+    u64 step_;
+    bool forward_;
+    u64 lo_;    //< Offset of the first covered point from `begin_`
+    u64 hi_;    //< Offset of the last covered point from `begin_`
+    u64 pos_;   //< Offset of the next bucket
+    bool done_;
+public:
+    SubtreeSpreadAggregator(SubtreeRef const& ref, aku_Timestamp begin, aku_Timestamp end, u64 step)
+        : ref_(ref)
+        , begin_(begin)
+        , step_(step)
+        , forward_(begin < end)
+        , lo_(0)
+        , hi_(0)
+        , pos_(0)
+        , done_(false)
+    {
+        // Convert timestamps to offsets from the beginning of the query range
+        // so both directions can be handled the same way.
+        if (forward_) {
+            auto first = std::max(ref.begin, begin);
+            auto last  = std::min(ref.end, end - 1);
+            done_ = first > last;
+            lo_ = first - begin;
+            hi_ = last - begin;
+        } else {
+            auto first = std::min(ref.end, begin);
+            auto last  = std::max(ref.begin, end + 1);
+            done_ = first < last;
+            lo_ = begin - first;
+            hi_ = begin - last;
+        }
+        pos_ = lo_;
+    }
+
+    virtual std::tuple<aku_Status, size_t> read(aku_Timestamp *destts, AggregationResult *destval, size_t size) override {
+        if (size == 0) {
+            return std::make_tuple(AKU_EBAD_ARG, 0ul);
+        }
+        double span = static_cast<double>(ref_.end - ref_.begin) + 1.0;
+        size_t n = 0;
+        while (!done_ && n < size) {
+            u64 bucket_end = (pos_ / step_ + 1) * step_ - 1;
+            u64 last = std::min(bucket_end, hi_);
+            double fraction = (static_cast<double>(last - pos_) + 1.0) / span;
+            AggregationResult res = INIT_AGGRES;
+            res.copy_from(ref_);
+            res.cnt = ref_.count * fraction;
+            res.sum = ref_.sum * fraction;
+            res.m2  = ref_.m2 * fraction;
+            res._begin = forward_ ? begin_ + pos_ : begin_ - last;
+            res._end   = forward_ ? begin_ + last : begin_ - pos_;
+            destts[n] = res._begin;
+            destval[n] = res;
+            n++;
+            done_ = last == hi_;
+            pos_ = last + 1;
+        }
+        return std::make_tuple(done_ ? AKU_ENO_DATA : AKU_SUCCESS, n);
+    }
+
+    virtual Direction get_direction() override {
+        return forward_ ? Direction::FORWARD : Direction::BACKWARD;
+    }
+};
+
 /** Superblock aggregator (iterator that computes different aggregates e.g. min/max/avg/sum).
   * Uses metadata stored in superblocks in some cases.
   */
 class NBTreeSBlockAggregator : public NBTreeSBlockIteratorBase<AggregationResult> {
+    bool need_m2_;  //< Subtrees without `m2` can't be used
 
 public:
     NBTreeSBlockAggregator(std::shared_ptr<BlockStore> bstore,
                            NBTreeSuperblock const& sblock,
                            aku_Timestamp begin,
-                           aku_Timestamp end)
+                           aku_Timestamp end,
+                           bool need_m2)
         : NBTreeSBlockIteratorBase<AggregationResult>(bstore, sblock, begin, end)
+        , need_m2_(need_m2)
     {
     }
 
     NBTreeSBlockAggregator(std::shared_ptr<BlockStore> bstore,
                            LogicAddr addr,
                            aku_Timestamp begin,
-                           aku_Timestamp end)
+                           aku_Timestamp end,
+                           bool need_m2)
         : NBTreeSBlockIteratorBase<AggregationResult>(bstore, addr, begin, end)
+        , need_m2_(need_m2)
     {
     }
     virtual std::tuple<aku_Status, std::unique_ptr<AggregateOperator>> make_leaf_iterator(const SubtreeRef &ref) override;
@@ -723,7 +1106,7 @@ std::tuple<aku_Status, std::unique_ptr<AggregateOperator> > NBTreeSBlockAggregat
     }
     NBTreeLeaf leaf(block);
     std::unique_ptr<AggregateOperator> result;
-    result.reset(new NBTreeLeafAggregator(begin_, end_, leaf));
+    result.reset(new NBTreeLeafAggregator(begin_, end_, leaf, need_m2_));
     return std::make_tuple(AKU_SUCCESS, std::move(result));
 }
 
@@ -731,13 +1114,15 @@ std::tuple<aku_Status, std::unique_ptr<AggregateOperator> > NBTreeSBlockAggregat
     aku_Timestamp min = std::min(begin_, end_);
     aku_Timestamp max = std::max(begin_, end_);
     std::unique_ptr<AggregateOperator> result;
-    if (min <= ref.begin && ref.end < max) {
+    bool has_m2 = !need_m2_ || !std::isnan(ref.m2);
+    if (min <= ref.begin && ref.end < max && has_m2) {
         // We don't need to go to lower level, value from subtree ref can be used instead.
         auto agg = INIT_AGGRES;
         agg.copy_from(ref);
+        QueryCounters::inc(&QueryCounters::subtrees_reused);
         result.reset(new ValueAggregator(ref.end, agg, get_direction()));
     } else {
-        result.reset(new NBTreeSBlockAggregator(bstore_, ref.addr, begin_, end_));
+        result.reset(new NBTreeSBlockAggregator(bstore_, ref.addr, begin_, end_, need_m2_));
     }
     return std::make_tuple(AKU_SUCCESS, std::move(result));
 }
@@ -755,7 +1140,7 @@ class NBTreeLeafGroupAggregator : public AggregateOperator {
     aku_Timestamp end_;
     aku_Timestamp step_;
 public:
-    NBTreeLeafGroupAggregator(aku_Timestamp begin, aku_Timestamp end, u64 step, NBTreeLeaf const& node)
+    NBTreeLeafGroupAggregator(aku_Timestamp begin, aku_Timestamp end, u64 step, NBTreeLeaf const& node, bool need_m2)
         : iter_(begin, end, node, true)
         , enable_cached_metadata_(false)
         , metacache_(INIT_SUBTREE_REF)
@@ -765,13 +1150,15 @@ public:
     {
         aku_Timestamp nodemin, nodemax;
         std::tie(nodemin, nodemax) = node.get_timestamps();
+        bool has_m2 = !need_m2 || !std::isnan(node.get_leafmeta()->m2);
         if (begin < end) {
             auto a = (nodemin - begin) / step;
             auto b = (nodemax - begin) / step;
-            if (a == b && nodemin >= begin && nodemax < end) {
+            if (a == b && nodemin >= begin && nodemax < end && has_m2) {
                 // Leaf totally inside one step range, we can use metadata.
                 metacache_ = *node.get_leafmeta();
                 enable_cached_metadata_ = true;
+                QueryCounters::inc(&QueryCounters::subtrees_reused);
             } else {
                 // Otherwise we need to compute aggregate from subset of leaf's values.
                 iter_.init(node);
@@ -779,10 +1166,11 @@ public:
         } else {
             auto a = (begin - nodemin) / step;
             auto b = (begin - nodemax) / step;
-            if (a == b && nodemax <= begin && nodemin > end) {
+            if (a == b && nodemax <= begin && nodemin > end && has_m2) {
                 // Leaf totally inside one step range, we can use metadata.
                 metacache_ = *node.get_leafmeta();
                 enable_cached_metadata_ = true;
+                QueryCounters::inc(&QueryCounters::subtrees_reused);
             } else {
                 // Otherwise we need to compute aggregate from subset of leaf's values.
                 iter_.init(node);
@@ -877,6 +1265,8 @@ std::tuple<aku_Status, size_t> NBTreeLeafGroupAggregator::read(aku_Timestamp *de
 class NBTreeSBlockGroupAggregator : public NBTreeSBlockIteratorBase<AggregationResult> {
     typedef std::vector<AggregationResult> ReadBuffer;
     u64 step_;
+    u16 level_;  //< Approximation level
+    bool need_m2_;  //< Subtrees without `m2` can't be used
     ReadBuffer rdbuf_;
     u32 rdpos_;
     bool done_;
@@ -888,9 +1278,13 @@ public:
                                 NBTreeSuperblock const& sblock,
                                 aku_Timestamp begin,
                                 aku_Timestamp end,
-                                u64 step)
+                                u64 step,
+                                u16 level,
+                                bool need_m2)
         : NBTreeSBlockIteratorBase<AggregationResult>(bstore, sblock, begin, end)
         , step_(step)
+        , level_(level)
+        , need_m2_(need_m2)
         , rdpos_(0)
         , done_(false)
     {
@@ -900,9 +1294,13 @@ public:
                                 LogicAddr addr,
                                 aku_Timestamp begin,
                                 aku_Timestamp end,
-                                u64 step)
+                                u64 step,
+                                u16 level,
+                                bool need_m2)
         : NBTreeSBlockIteratorBase<AggregationResult>(bstore, addr, begin, end)
         , step_(step)
+        , level_(level)
+        , need_m2_(need_m2)
         , rdpos_(0)
         , done_(false)
     {
@@ -1068,6 +1466,11 @@ std::tuple<aku_Status, size_t> NBTreeSBlockGroupAggregator::read(aku_Timestamp *
 }
 
 std::tuple<aku_Status, std::unique_ptr<AggregateOperator>> NBTreeSBlockGroupAggregator::make_leaf_iterator(SubtreeRef const& ref) {
+    if (level_ > 0) {
+        std::unique_ptr<AggregateOperator> result;
+        result.reset(new SubtreeSpreadAggregator(ref, begin_, end_, step_));
+        return std::make_tuple(AKU_SUCCESS, std::move(result));
+    }
     aku_Status status;
     std::shared_ptr<Block> block;
     std::tie(status, block) = read_and_check(bstore_, ref.addr);
@@ -1076,7 +1479,7 @@ std::tuple<aku_Status, std::unique_ptr<AggregateOperator>> NBTreeSBlockGroupAggr
     }
     NBTreeLeaf leaf(block);
     std::unique_ptr<AggregateOperator> result;
-    result.reset(new NBTreeLeafGroupAggregator(begin_, end_, step_, leaf));
+    result.reset(new NBTreeLeafGroupAggregator(begin_, end_, step_, leaf, need_m2_));
     return std::make_tuple(AKU_SUCCESS, std::move(result));
 }
 
@@ -1098,13 +1501,21 @@ std::tuple<aku_Status, std::unique_ptr<AggregateOperator>> NBTreeSBlockGroupAggr
             inner = true;
         }
     }
+    if (need_m2_ && std::isnan(ref.m2)) {
+        // Subtree was created by the older version
+        inner = false;
+    }
     if (inner) {
         // We don't need to go to lower level, value from subtree ref can be used instead.
         auto agg = INIT_AGGRES;
         agg.copy_from(ref);
+        QueryCounters::inc(&QueryCounters::subtrees_reused);
         result.reset(new ValueAggregator(ref.end, agg, get_direction()));
+    } else if (ref.level < level_) {
+        // Approximation, subtree is not read
+        result.reset(new SubtreeSpreadAggregator(ref, begin_, end_, step_));
     } else {
-        result.reset(new NBTreeSBlockGroupAggregator(bstore_, ref.addr, begin_, end_, step_));
+        result.reset(new NBTreeSBlockGroupAggregator(bstore_, ref.addr, begin_, end_, step_, level_, need_m2_));
     }
     return std::make_tuple(AKU_SUCCESS, std::move(result));
 }
@@ -1159,6 +1570,7 @@ std::tuple<aku_Status, std::unique_ptr<AggregateOperator>> NBTreeSBlockCandlesti
         // We don't need to go to lower level, value from subtree ref can be used instead.
         auto agg = INIT_AGGRES;
         agg.copy_from(ref);
+        QueryCounters::inc(&QueryCounters::subtrees_reused);
         result.reset(new ValueAggregator(ref.end, agg, get_direction()));
     } else {
         result.reset(new NBTreeSBlockCandlesticsIter(bstore_, ref.addr, begin_, end_, hint_));
@@ -1196,7 +1608,7 @@ NBTreeLeaf::NBTreeLeaf(aku_ParamId id, LogicAddr prev, u16 fanout_index)
     subtree->level = 0;  // Leaf node
     subtree->type = NBTreeBlockType::LEAF;
     subtree->id = id;
-    subtree->version = AKUMULI_VERSION;
+    subtree->version = AKU_NBTREE_VERSION;
     subtree->payload_size = 0;
     subtree->fanout_index = fanout_index;
     // values that should be updated by insert
@@ -1210,6 +1622,7 @@ NBTreeLeaf::NBTreeLeaf(aku_ParamId id, LogicAddr prev, u16 fanout_index)
     subtree->max_time = std::numeric_limits<aku_Timestamp>::min();
     subtree->first = .0;
     subtree->last = .0;
+    subtree->m2 = .0;
 }
 
 
@@ -1221,18 +1634,40 @@ NBTreeLeaf::NBTreeLeaf(std::shared_ptr<BlockStore> bstore, LogicAddr curr)
 NBTreeLeaf::NBTreeLeaf(std::shared_ptr<Block> block)
     : prev_(EMPTY_ADDR)
 {
-    block_ = block;
+    block_ = upgrade_node(block);
     const SubtreeRef* subtree = subtree_cast(block_->get_cdata());
     prev_ = subtree->addr;
     fanout_index_ = subtree->fanout_index;
 }
 
+//! Make writable copy of the block (converted V1 leaf can be larger than AKU_BLOCK_SIZE)
 static std::shared_ptr<Block> clone(std::shared_ptr<Block> block) {
-    auto res = std::make_shared<Block>();
+    if (block->get_size() != AKU_BLOCK_SIZE) {
+        std::vector<u8> data(block->get_cdata(), block->get_cdata() + block->get_size());
+        return std::make_shared<Block>(EMPTY_ADDR, std::move(data));
+    }
+    auto res = make_pooled<Block>();
     memcpy(res->get_data(), block->get_cdata(), AKU_BLOCK_SIZE);
     return res;
 }
 
+/** Copy leaf cloned from the converted V1 leaf to the block of normal size.
+  * Leaf that doesn't fit the block in the current format is stored in V1 format
+  * (payload is the same, only `m2` is dropped from the header).
+  */
+static std::shared_ptr<Block> fit_leaf(std::shared_ptr<Block> block) {
+    auto res = make_pooled<Block>();
+    SubtreeRef const* subtree = subtree_cast(block->get_cdata());
+    if (sizeof(SubtreeRef) + subtree->payload_size > AKU_BLOCK_SIZE) {
+        memcpy(res->get_data(), block->get_cdata(), sizeof(SubtreeRefV1));
+        memcpy(res->get_data() + sizeof(SubtreeRefV1), block->get_cdata() + sizeof(SubtreeRef), subtree->payload_size);
+        subtree_cast(res->get_data())->version = AKU_NBTREE_V1;
+    } else {
+        memcpy(res->get_data(), block->get_cdata(), AKU_BLOCK_SIZE);
+    }
+    return res;
+}
+
 static aku_ParamId getid(std::shared_ptr<Block> const& block) {
     auto ptr = reinterpret_cast<SubtreeRef const*>(block->get_cdata());
     return ptr->id;
@@ -1240,12 +1675,15 @@ static aku_ParamId getid(std::shared_ptr<Block> const& block) {
 
 NBTreeLeaf::NBTreeLeaf(std::shared_ptr<Block> block, NBTreeLeaf::CloneTag)
     : prev_(EMPTY_ADDR)
-    , block_(clone(block))
-    , writer_(getid(block_), block_->get_data() + sizeof(SubtreeRef), AKU_BLOCK_SIZE - sizeof(SubtreeRef))
+    , block_(clone(upgrade_node(block)))
+    , writer_(getid(block_), block_->get_data() + sizeof(SubtreeRef), static_cast<int>(block_->get_size() - sizeof(SubtreeRef)))
 {
     // Re-insert the data
+    block = upgrade_node(block);
     DataBlockReader reader(block->get_cdata() + sizeof(SubtreeRef), block->get_size());
     size_t sz = reader.nelements();
+    // Node can be created by the older version without `m2`, it's recalculated
+    AggregationResult agg = INIT_AGGRES;
     for (size_t ix = 0; ix < sz; ix++) {
         aku_Status status;
         aku_Timestamp ts;
@@ -1262,9 +1700,11 @@ NBTreeLeaf::NBTreeLeaf(std::shared_ptr<Block> block, NBTreeLeaf::CloneTag)
             assert(false);
             return;
         }
+        agg.add(ts, value, true);
     }
 
-    const SubtreeRef* subtree = subtree_cast(block_->get_cdata());
+    SubtreeRef* subtree = subtree_cast(block_->get_data());
+    subtree->m2 = agg.m2;
     prev_ = subtree->addr;
     fanout_index_ = subtree->fanout_index;
 }
@@ -1320,8 +1760,10 @@ LogicAddr NBTreeLeaf::get_prev_addr() const {
 
 
 aku_Status NBTreeLeaf::read_all(std::vector<aku_Timestamp>* timestamps,
-                                std::vector<double>* values) const
+                                std::vector<double>* values,
+                                aku_Timestamp max) const
 {
+    QueryCounters::inc(&QueryCounters::leaves_decoded);
     int windex = writer_.get_write_index();
     DataBlockReader reader(block_->get_cdata() + sizeof(SubtreeRef), block_->get_size());
     size_t sz = reader.nelements();
@@ -1335,6 +1777,11 @@ aku_Status NBTreeLeaf::read_all(std::vector<aku_Timestamp>* timestamps,
         if (status != AKU_SUCCESS) {
             return status;
         }
+        if (ts > max) {
+            // Tail elements are out of the search range (only possible if the
+            // range ends inside the leaf, newest-first reads always decode all)
+            return AKU_SUCCESS;
+        }
         timestamps->push_back(ts);
         values->push_back(value);
     }
@@ -1355,8 +1802,11 @@ aku_Status NBTreeLeaf::append(aku_Timestamp ts, double value) {
             subtree->begin = ts;
             subtree->first = value;
         }
+        // Welford's algorithm
+        double delta = value - (subtree->count ? subtree->sum / subtree->count : .0);
         subtree->count++;
         subtree->sum += value;
+        subtree->m2 += delta * (value - subtree->sum / subtree->count);
         if (subtree->max < value) {
             subtree->max = value;
             subtree->max_time = ts;
@@ -1370,6 +1820,7 @@ aku_Status NBTreeLeaf::append(aku_Timestamp ts, double value) {
 }
 
 std::tuple<aku_Status, LogicAddr> NBTreeLeaf::commit(std::shared_ptr<BlockStore> bstore) {
+    ProbeScope probe(AKU_PROBE_LEAF_COMMIT);
     assert(nelements() != 0);
     u16 size = static_cast<u16>(writer_.commit());
     assert(size);
@@ -1383,12 +1834,22 @@ std::tuple<aku_Status, LogicAddr> NBTreeLeaf::commit(std::shared_ptr<BlockStore>
         subtree->addr  = EMPTY_ADDR;
         // Invariant: fanout index should be 0 in this case.
     }
-    subtree->version = AKUMULI_VERSION;
+    subtree->version = AKU_NBTREE_VERSION;
     subtree->level = 0;
     subtree->type  = NBTreeBlockType::LEAF;
     subtree->fanout_index = fanout_index_;
     // Compute checksum
     subtree->checksum = bstore->checksum(block_->get_cdata() + sizeof(SubtreeRef), size);
+    if (block_->get_size() != AKU_BLOCK_SIZE) {
+        // Leaf was cloned from the converted V1 leaf
+        aku_Status status;
+        LogicAddr addr;
+        std::tie(status, addr) = bstore->append_block(fit_leaf(block_));
+        if (status == AKU_SUCCESS) {
+            block_->set_addr(addr);
+        }
+        return std::make_tuple(status, addr);
+    }
     return bstore->append_block(block_);
 }
 
@@ -1399,9 +1860,9 @@ std::unique_ptr<RealValuedOperator> NBTreeLeaf::range(aku_Timestamp begin, aku_T
     return std::move(it);
 }
 
-std::unique_ptr<AggregateOperator> NBTreeLeaf::aggregate(aku_Timestamp begin, aku_Timestamp end) const {
+std::unique_ptr<AggregateOperator> NBTreeLeaf::aggregate(aku_Timestamp begin, aku_Timestamp end, bool need_m2) const {
     std::unique_ptr<AggregateOperator> it;
-    it.reset(new NBTreeLeafAggregator(begin, end, *this));
+    it.reset(new NBTreeLeafAggregator(begin, end, *this, need_m2));
     return std::move(it);
 }
 
@@ -1416,9 +1877,9 @@ std::unique_ptr<AggregateOperator> NBTreeLeaf::candlesticks(aku_Timestamp begin,
     return std::move(result);
 }
 
-std::unique_ptr<AggregateOperator> NBTreeLeaf::group_aggregate(aku_Timestamp begin, aku_Timestamp end, u64 step) const {
+std::unique_ptr<AggregateOperator> NBTreeLeaf::group_aggregate(aku_Timestamp begin, aku_Timestamp end, u64 step, bool need_m2) const {
     std::unique_ptr<AggregateOperator> it;
-    it.reset(new NBTreeLeafGroupAggregator(begin, end, step, *this));
+    it.reset(new NBTreeLeafGroupAggregator(begin, end, step, *this, need_m2));
     return std::move(it);
 }
 
@@ -1584,6 +2045,11 @@ std::tuple<aku_Status, LogicAddr> NBTreeLeaf::split(std::shared_ptr<BlockStore>
 //     NBTreeSuperblock     //
 // //////////////////////// //
 
+//! Return true if superblock stores child refs in compressed format
+static bool is_compressed(SubtreeRef const* header) {
+    return header->version >= AKU_NBTREE_VERSION;
+}
+
 NBTreeSuperblock::NBTreeSuperblock(aku_ParamId id, LogicAddr prev, u16 fanout, u16 lvl)
     : block_(std::make_shared<Block>())
     , id_(id)
@@ -1592,6 +2058,7 @@ NBTreeSuperblock::NBTreeSuperblock(aku_ParamId id, LogicAddr prev, u16 fanout, u
     , level_(lvl)
     , prev_(prev)
     , immutable_(false)
+    , encoded_size_(SBLOCK_HEADER_SIZE)
 {
     SubtreeRef* pref = subtree_cast(block_->get_data());
     pref->type = NBTreeBlockType::INNER;
@@ -1599,16 +2066,22 @@ NBTreeSuperblock::NBTreeSuperblock(aku_ParamId id, LogicAddr prev, u16 fanout, u
 }
 
 NBTreeSuperblock::NBTreeSuperblock(std::shared_ptr<Block> block)
-    : block_(block)
+    : block_(upgrade_node(block))
     , immutable_(true)
+    , encoded_size_(0)
 {
     // Use zero-copy here.
-    SubtreeRef const* ref = subtree_cast(block->get_cdata());
+    SubtreeRef const* ref = subtree_cast(block_->get_cdata());
     assert(ref->type == NBTreeBlockType::INNER);
     id_ = ref->id;
     fanout_index_ = ref->fanout_index;
     prev_ = ref->addr;
-    write_pos_ = ref->payload_size;
+    if (is_compressed(ref)) {
+        write_pos_ = get_encoded_nrefs(block_->get_cdata() + sizeof(SubtreeRef));
+        encoded_size_ = ref->payload_size;
+    } else {
+        write_pos_ = ref->payload_size;
+    }
     level_ = ref->level;
     assert(prev_ != 0);
 }
@@ -1621,21 +2094,27 @@ NBTreeSuperblock::NBTreeSuperblock(LogicAddr addr, std::shared_ptr<BlockStore> b
 NBTreeSuperblock::NBTreeSuperblock(LogicAddr addr, std::shared_ptr<BlockStore> bstore, bool remove_last)
     : block_(std::make_shared<Block>())
     , immutable_(false)
+    , encoded_size_(SBLOCK_HEADER_SIZE)
 {
-    std::shared_ptr<Block> block = read_block_from_bstore(bstore, addr);
-    SubtreeRef const* ref = subtree_cast(block->get_cdata());
-    assert(ref->type == NBTreeBlockType::INNER);
+    NBTreeSuperblock origin(read_block_from_bstore(bstore, addr));
+    SubtreeRef const* ref = origin.get_sblockmeta();
     id_ = ref->id;
     fanout_index_ = ref->fanout_index;
     prev_ = ref->addr;
     level_ = ref->level;
-    write_pos_ = ref->payload_size;
-    if (remove_last && write_pos_ != 0) {
-        write_pos_--;
+    origin.read_all(&refs_);
+    if (remove_last && !refs_.empty()) {
+        refs_.pop_back();
+    }
+    write_pos_ = static_cast<u32>(refs_.size());
+    SubtreeRef prev = {};
+    for (auto const& child: refs_) {
+        encoded_size_ += get_encoded_size(child, prev, id_);
+        prev = child;
     }
     assert(prev_ != 0);
     // We can't use zero-copy here because `block` belongs to other node.
-    memcpy(block_->get_data(), block->get_cdata(), AKU_BLOCK_SIZE);
+    memcpy(block_->get_data(), ref, sizeof(SubtreeRef));
 }
 
 SubtreeRef const* NBTreeSuperblock::get_sblockmeta() const {
@@ -1680,17 +2159,24 @@ LogicAddr NBTreeSuperblock::get_addr() const {
 }
 
 aku_Status NBTreeSuperblock::append(const SubtreeRef &p) {
-    if (is_full()) {
-        return AKU_EOVERFLOW;
-    }
     if (immutable_) {
         return AKU_EBAD_DATA;
     }
+    if (write_pos_ >= AKU_NBTREE_FANOUT) {
+        return AKU_EOVERFLOW;
+    }
     assert(p.count != 0);
-    // Write data into buffer
+    SubtreeRef prev = {};
+    if (!refs_.empty()) {
+        prev = refs_.back();
+    }
+    auto size = get_encoded_size(p, prev, id_);
+    if (encoded_size_ + size > SBLOCK_CAPACITY) {
+        return AKU_EOVERFLOW;
+    }
+    encoded_size_ += size;
+    refs_.push_back(p);
     SubtreeRef* pref = subtree_cast(block_->get_data());
-    auto it = pref + 1 + write_pos_;
-    *it = p;
     if (write_pos_ == 0) {
         pref->begin = p.begin;
     }
@@ -1709,25 +2195,65 @@ std::tuple<aku_Status, LogicAddr> NBTreeSuperblock::commit(std::shared_ptr<Block
     if (status != AKU_SUCCESS) {
         return std::make_tuple(status, EMPTY_ADDR);
     }
+    u8* payload = block_->get_data() + sizeof(SubtreeRef);
+    auto size = encode_subtree_refs(payload, SBLOCK_CAPACITY, refs_, id_);
+    if (size != 0) {
+        backref->payload_size = static_cast<u16>(size);
+        backref->version = AKU_NBTREE_VERSION;
+    } else if (refs_.size()*sizeof(SubtreeRef) <= SBLOCK_CAPACITY) {
+        // Node copied from the older version can have refs that doesn't
+        // compress well, old format should be used in this case.
+        memcpy(payload, refs_.data(), refs_.size()*sizeof(SubtreeRef));
+        backref->payload_size = static_cast<u16>(refs_.size());
+        backref->version = AKU_NBTREE_V2;
+    } else {
+        return std::make_tuple(AKU_EOVERFLOW, EMPTY_ADDR);
+    }
     backref->addr = prev_;
-    backref->payload_size = static_cast<u16>(write_pos_);
-    assert(backref->payload_size + sizeof(SubtreeRef) < AKU_BLOCK_SIZE);
     backref->fanout_index = fanout_index_;
     backref->id = id_;
     backref->level = level_;
     backref->type  = NBTreeBlockType::INNER;
-    backref->version = AKUMULI_VERSION;
     // add checksum
     backref->checksum = bstore->checksum(block_->get_cdata() + sizeof(SubtreeRef), backref->payload_size);
     return bstore->append_block(block_);
 }
 
 bool NBTreeSuperblock::is_full() const {
-    return write_pos_ >= AKU_NBTREE_FANOUT;
+    if (write_pos_ >= AKU_NBTREE_FANOUT) {
+        return true;
+    }
+    size_t size = encoded_size_;
+    if (immutable_ && !is_compressed(get_sblockmeta())) {
+        // Node was created by the older version
+        std::vector<SubtreeRef> refs;
+        read_all(&refs);
+        SubtreeRef prev = {};
+        size = SBLOCK_HEADER_SIZE;
+        for (auto const& child: refs) {
+            size += get_encoded_size(child, prev, id_);
+            prev = child;
+        }
+    }
+    return size + SBLOCK_MAX_REF_SIZE > SBLOCK_CAPACITY;
 }
 
 aku_Status NBTreeSuperblock::read_all(std::vector<SubtreeRef>* refs) const {
+    QueryCounters::inc(&QueryCounters::superblocks_decoded);
+    if (!immutable_) {
+        refs->insert(refs->end(), refs_.begin(), refs_.end());
+        return AKU_SUCCESS;
+    }
     SubtreeRef const* ref = subtree_cast(block_->get_cdata());
+    if (is_compressed(ref)) {
+        auto payload = block_->get_cdata() + sizeof(SubtreeRef);
+        auto offset = refs->size();
+        refs->resize(offset + write_pos_, INIT_SUBTREE_REF);
+        for (int col = 0; col < SBLOCK_NCOLUMNS; col++) {
+            decode_column(payload, static_cast<SBlockColumn>(col), id_, refs->data() + offset);
+        }
+        return AKU_SUCCESS;
+    }
     for(u32 ix = 0u; ix < write_pos_; ix++) {
         auto p = ref + 1 + ix;
         refs->push_back(*p);
@@ -1735,17 +2261,56 @@ aku_Status NBTreeSuperblock::read_all(std::vector<SubtreeRef>* refs) const {
     return AKU_SUCCESS;
 }
 
+aku_Status NBTreeSuperblock::read_range(aku_Timestamp begin, aku_Timestamp end, std::vector<SubtreeRef>* refs) const {
+    auto min = std::min(begin, end);
+    auto max = std::max(begin, end);
+    auto in_range = [min, max](SubtreeRef const& ref) {
+        return subtree_in_range(ref, min, max);
+    };
+    SubtreeRef const* header = subtree_cast(block_->get_cdata());
+    if (!immutable_ || !is_compressed(header)) {
+        std::vector<SubtreeRef> all;
+        auto status = read_all(&all);
+        std::copy_if(all.begin(), all.end(), std::back_inserter(*refs), in_range);
+        return status;
+    }
+    QueryCounters::inc(&QueryCounters::superblocks_decoded);
+    // Decode timestamps first, the rest is decoded only if needed
+    auto payload = block_->get_cdata() + sizeof(SubtreeRef);
+    std::vector<SubtreeRef> all(write_pos_, INIT_SUBTREE_REF);
+    decode_column(payload, SBLOCK_TIMESTAMPS, id_, all.data());
+    if (std::none_of(all.begin(), all.end(), in_range)) {
+        return AKU_SUCCESS;
+    }
+    for (int col = SBLOCK_TIMESTAMPS + 1; col < SBLOCK_NCOLUMNS; col++) {
+        decode_column(payload, static_cast<SBlockColumn>(col), id_, all.data());
+    }
+    std::copy_if(all.begin(), all.end(), std::back_inserter(*refs), in_range);
+    return AKU_SUCCESS;
+}
+
 bool NBTreeSuperblock::top(SubtreeRef* outref) const {
     if (write_pos_ == 0) {
         return false;
     }
-    SubtreeRef const* ref = subtree_cast(block_->get_cdata());
-    auto p = ref + write_pos_;
-    *outref = *p;
+    std::vector<SubtreeRef> refs;
+    read_all(&refs);
+    *outref = refs.back();
     return true;
 }
 
 bool NBTreeSuperblock::top(LogicAddr* outaddr) const {
+    if (write_pos_ == 0) {
+        return false;
+    }
+    SubtreeRef const* header = subtree_cast(block_->get_cdata());
+    if (immutable_ && is_compressed(header)) {
+        // Only addresses are needed
+        std::vector<SubtreeRef> refs(write_pos_, INIT_SUBTREE_REF);
+        decode_column(block_->get_cdata() + sizeof(SubtreeRef), SBLOCK_ADDRESSES, id_, refs.data());
+        *outaddr = refs.back().addr;
+        return true;
+    }
     SubtreeRef child;
     if (top(&child)) {
         *outaddr = child.addr;
@@ -1770,10 +2335,11 @@ std::unique_ptr<RealValuedOperator> NBTreeSuperblock::search(aku_Timestamp begin
 
 std::unique_ptr<AggregateOperator> NBTreeSuperblock::aggregate(aku_Timestamp begin,
                                                             aku_Timestamp end,
-                                                            std::shared_ptr<BlockStore> bstore) const
+                                                            std::shared_ptr<BlockStore> bstore,
+                                                            bool need_m2) const
 {
     std::unique_ptr<AggregateOperator> result;
-    result.reset(new NBTreeSBlockAggregator(bstore, *this, begin, end));
+    result.reset(new NBTreeSBlockAggregator(bstore, *this, begin, end, need_m2));
     return std::move(result);
 }
 
@@ -1789,10 +2355,12 @@ std::unique_ptr<AggregateOperator> NBTreeSuperblock::candlesticks(aku_Timestamp
 std::unique_ptr<AggregateOperator> NBTreeSuperblock::group_aggregate(aku_Timestamp begin,
                                                                     aku_Timestamp end,
                                                                     u64 step,
-                                                                    std::shared_ptr<BlockStore> bstore) const
+                                                                    std::shared_ptr<BlockStore> bstore,
+                                                                    u16 level,
+                                                                    bool need_m2) const
 {
     std::unique_ptr<AggregateOperator> result;
-    result.reset(new NBTreeSBlockGroupAggregator(bstore, *this, begin, end, step));
+    result.reset(new NBTreeSBlockGroupAggregator(bstore, *this, begin, end, step, level, need_m2));
     return std::move(result);
 }
 
@@ -1818,7 +2386,10 @@ std::tuple<aku_Status, LogicAddr> NBTreeSuperblock::split_into(std::shared_ptr<B
             u16 current_fanout = 0;
             // Clone current node
             for (u32 j = 0; j < i; j++) {
-                root->append(refs[j]);
+                status = root->append(refs[j]);
+                if (status != AKU_SUCCESS) {
+                    return std::make_tuple(status, EMPTY_ADDR);
+                }
                 current_fanout++;
             }
             std::shared_ptr<Block> block;
@@ -1840,7 +2411,7 @@ std::tuple<aku_Status, LogicAddr> NBTreeSuperblock::split_into(std::shared_ptr<B
                 }
             } else {
                 NBTreeLeaf oldleaf(block);
-                if ((refs.size() - AKU_NBTREE_FANOUT) > 1) {
+                if (sblock_has_room(refs, id_, 1)) {
                     // Split in-place
                     std::tie(status, new_ith_child_addr) = oldleaf.split_into(bstore, pivot, preserve_horizontal_links, &current_fanout, root);
                     if (status != AKU_SUCCESS) {
@@ -1863,7 +2434,10 @@ std::tuple<aku_Status, LogicAddr> NBTreeSuperblock::split_into(std::shared_ptr<B
                     return std::make_tuple(status, EMPTY_ADDR);
                 }
                 newref.addr = new_ith_child_addr;
-                root->append(newref);
+                status = root->append(newref);
+                if (status != AKU_SUCCESS) {
+                    return std::make_tuple(status, EMPTY_ADDR);
+                }
                 current_fanout++;
             }
             LogicAddr last_child_addr;
@@ -1919,7 +2493,10 @@ std::tuple<aku_Status, LogicAddr> NBTreeSuperblock::split_into(std::shared_ptr<B
                 }
             } else {
                 for (u32 j = i+1; j < refs.size(); j++) {
-                    root->append(refs[j]);
+                    status = root->append(refs[j]);
+                    if (status != AKU_SUCCESS) {
+                        return std::make_tuple(status, EMPTY_ADDR);
+                    }
                 }
             }
             return std::tie(status, last_child_addr);
@@ -1963,6 +2540,8 @@ struct NBTreeLeafExtent : NBTreeExtent {
     // padding
     u16 pad0_;
     u32 pad1_;
+    //! Open leaf node holds one block in memory
+    MemoryTracker mem_;
 
     NBTreeLeafExtent(std::shared_ptr<BlockStore> bstore,
                      std::shared_ptr<NBTreeExtentsList> roots,
@@ -1975,6 +2554,7 @@ struct NBTreeLeafExtent : NBTreeExtent {
         , fanout_index_(0)
         , pad0_{}
         , pad1_{}
+        , mem_(AKU_MEM_NBTREE_LEAVES, AKU_BLOCK_SIZE, 1)
     {
         if (last_ != EMPTY_ADDR) {
             // Load previous node and calculate fanout.
@@ -2051,9 +2631,9 @@ struct NBTreeLeafExtent : NBTreeExtent {
     virtual std::tuple<bool, LogicAddr> append(const SubtreeRef &pl);
     virtual std::tuple<bool, LogicAddr> commit(bool final);
     virtual std::unique_ptr<RealValuedOperator> search(aku_Timestamp begin, aku_Timestamp end) const;
-    virtual std::unique_ptr<AggregateOperator> aggregate(aku_Timestamp begin, aku_Timestamp end) const;
+    virtual std::unique_ptr<AggregateOperator> aggregate(aku_Timestamp begin, aku_Timestamp end, bool need_m2) const;
     virtual std::unique_ptr<AggregateOperator> candlesticks(aku_Timestamp begin, aku_Timestamp end, NBTreeCandlestickHint hint) const;
-    virtual std::unique_ptr<AggregateOperator> group_aggregate(aku_Timestamp begin, aku_Timestamp end, u64 step) const;
+    virtual std::unique_ptr<AggregateOperator> group_aggregate(aku_Timestamp begin, aku_Timestamp end, u64 step, u16 level, bool need_m2) const;
     virtual bool is_dirty() const;
     virtual void debug_dump(std::ostream& stream, int base_indent, std::function<std::string(aku_Timestamp)> tsformat, u32 mask) const override;
     virtual std::tuple<bool, LogicAddr> split(aku_Timestamp pivot);
@@ -2201,11 +2781,12 @@ std::tuple<bool, LogicAddr> NBTreeLeafExtent::commit(bool final) {
     }
     payload.addr = addr;
     bool parent_saved = false;
+    bool carried = false;
     auto roots_collection = roots_.lock();
     size_t next_level = payload.level + 1;
     if (roots_collection) {
         if (!final || roots_collection->_get_roots().size() > next_level) {
-            parent_saved = roots_collection->append(payload);
+            parent_saved = roots_collection->append(payload, &carried);
         }
     } else {
         // Invariant broken.
@@ -2215,7 +2796,12 @@ std::tuple<bool, LogicAddr> NBTreeLeafExtent::commit(bool final) {
     }
     fanout_index_++;
     last_ = addr;
-    if (fanout_index_ == AKU_NBTREE_FANOUT) {
+    if (carried) {
+        // Parent node was full and was committed before this node was added,
+        // this node is the first child of the new parent
+        fanout_index_ = 1;
+    } else if (parent_saved || fanout_index_ == AKU_NBTREE_FANOUT) {
+        // Parent node is full and was committed, next node will be the first child of the new parent
         fanout_index_ = 0;
         last_ = EMPTY_ADDR;
     }
@@ -2231,16 +2817,17 @@ std::unique_ptr<RealValuedOperator> NBTreeLeafExtent::search(aku_Timestamp begin
     return std::move(leaf_->range(begin, end));
 }
 
-std::unique_ptr<AggregateOperator> NBTreeLeafExtent::aggregate(aku_Timestamp begin, aku_Timestamp end) const {
-    return std::move(leaf_->aggregate(begin, end));
+std::unique_ptr<AggregateOperator> NBTreeLeafExtent::aggregate(aku_Timestamp begin, aku_Timestamp end, bool need_m2) const {
+    return std::move(leaf_->aggregate(begin, end, need_m2));
 }
 
 std::unique_ptr<AggregateOperator> NBTreeLeafExtent::candlesticks(aku_Timestamp begin, aku_Timestamp end, NBTreeCandlestickHint hint) const {
     return std::move(leaf_->candlesticks(begin, end, hint));
 }
 
-std::unique_ptr<AggregateOperator> NBTreeLeafExtent::group_aggregate(aku_Timestamp begin, aku_Timestamp end, u64 step) const {
-    return std::move(leaf_->group_aggregate(begin, end, step));
+std::unique_ptr<AggregateOperator> NBTreeLeafExtent::group_aggregate(aku_Timestamp begin, aku_Timestamp end, u64 step, u16, bool need_m2) const {
+    // Leaf is stored in memory, approximation is not needed
+    return std::move(leaf_->group_aggregate(begin, end, step, need_m2));
 }
 
 bool NBTreeLeafExtent::is_dirty() const {
@@ -2269,9 +2856,10 @@ std::tuple<bool, LogicAddr> NBTreeLeafExtent::split(aku_Timestamp pivot) {
     }
     payload.addr = addr;
     bool parent_saved = false;
+    bool carried = false;
     auto roots_collection = roots_.lock();
     if (roots_collection) {
-        parent_saved = roots_collection->append(payload);
+        parent_saved = roots_collection->append(payload, &carried);
     } else {
         // Invariant broken.
         // Roots collection was destroyed before write process
@@ -2280,7 +2868,12 @@ std::tuple<bool, LogicAddr> NBTreeLeafExtent::split(aku_Timestamp pivot) {
     }
     fanout_index_++;
     last_ = addr;
-    if (fanout_index_ == AKU_NBTREE_FANOUT) {
+    if (carried) {
+        // Parent node was full and was committed before this node was added,
+        // this node is the first child of the new parent
+        fanout_index_ = 1;
+    } else if (parent_saved || fanout_index_ == AKU_NBTREE_FANOUT) {
+        // Parent node is full and was committed, next node will be the first child of the new parent
         fanout_index_ = 0;
         last_ = EMPTY_ADDR;
     }
@@ -2302,6 +2895,8 @@ struct NBTreeSBlockExtent : NBTreeExtent {
     u16 level_;
     // padding
     u32 killed_;
+    //! Open superblock holds one block and decoded child refs in memory
+    MemoryTracker mem_;
 
     NBTreeSBlockExtent(std::shared_ptr<BlockStore> bstore,
                        std::shared_ptr<NBTreeExtentsList> roots,
@@ -2315,6 +2910,7 @@ struct NBTreeSBlockExtent : NBTreeExtent {
         , fanout_index_(0)
         , level_(level)
         , killed_(0)
+        , mem_(AKU_MEM_NBTREE_SUPERBLOCKS, AKU_BLOCK_SIZE + AKU_NBTREE_FANOUT*sizeof(SubtreeRef), 1)
     {
         if (addr != EMPTY_ADDR) {
             // `addr` is not empty. Node should be restored from
@@ -2394,9 +2990,9 @@ struct NBTreeSBlockExtent : NBTreeExtent {
     virtual std::tuple<bool, LogicAddr> append(const SubtreeRef &pl);
     virtual std::tuple<bool, LogicAddr> commit(bool final);
     virtual std::unique_ptr<RealValuedOperator> search(aku_Timestamp begin, aku_Timestamp end) const;
-    virtual std::unique_ptr<AggregateOperator> aggregate(aku_Timestamp begin, aku_Timestamp end) const;
+    virtual std::unique_ptr<AggregateOperator> aggregate(aku_Timestamp begin, aku_Timestamp end, bool need_m2) const;
     virtual std::unique_ptr<AggregateOperator> candlesticks(aku_Timestamp begin, aku_Timestamp end, NBTreeCandlestickHint hint) const;
-    virtual std::unique_ptr<AggregateOperator> group_aggregate(aku_Timestamp begin, aku_Timestamp end, u64 step) const;
+    virtual std::unique_ptr<AggregateOperator> group_aggregate(aku_Timestamp begin, aku_Timestamp end, u64 step, u16 level, bool need_m2) const;
     virtual bool is_dirty() const;
     virtual void debug_dump(std::ostream& stream, int base_indent, std::function<std::string(aku_Timestamp)> tsformat, u32 mask) const override;
     virtual std::tuple<bool, LogicAddr> split(aku_Timestamp pivot);
@@ -2511,15 +3107,30 @@ std::tuple<bool, LogicAddr> NBTreeSBlockExtent::append(aku_Timestamp, double) {
 }
 
 std::tuple<bool, LogicAddr> NBTreeSBlockExtent::append(SubtreeRef const& pl) {
+    LogicAddr addr = EMPTY_ADDR;
+    if (curr_->is_full()) {
+        // Node restored from the block-store can be full. It is committed without
+        // the new ref and the ref becomes the first child of the new node.
+        std::tie(std::ignore, addr) = commit(false);
+        SubtreeRef first = pl;
+        first.fanout_index = 0;
+        auto status = curr_->append(first);
+        if (status != AKU_SUCCESS) {
+            AKU_PANIC("Can't append subtree ref to the new node, " + StatusUtil::str(status));
+        }
+        return std::make_tuple(true, addr);
+    }
     auto status = curr_->append(pl);
-    if (status == AKU_EOVERFLOW) {
-        LogicAddr addr;
-        bool parent_saved;
-        std::tie(parent_saved, addr) = commit(false);
-        append(pl);
-        return std::make_tuple(parent_saved, addr);
+    if (status != AKU_SUCCESS) {
+        AKU_PANIC("Can't append subtree ref, " + StatusUtil::str(status));
     }
-    return std::make_tuple(false, EMPTY_ADDR);
+    if (curr_->is_full()) {
+        // Fanout depends on the compressed size of the child refs so the node
+        // should be committed as soon as it's full. This way the child extent
+        // knows that it should start the new fanout sequence.
+        std::tie(std::ignore, addr) = commit(false);
+    }
+    return std::make_tuple(false, addr);
 }
 
 std::tuple<bool, LogicAddr> NBTreeSBlockExtent::commit(bool final) {
@@ -2542,12 +3153,13 @@ std::tuple<bool, LogicAddr> NBTreeSBlockExtent::commit(bool final) {
     }
     payload.addr = addr;
     bool parent_saved = false;
+    bool carried = false;
     auto roots_collection = roots_.lock();
     size_t next_level = payload.level + 1;
     if (roots_collection) {
         if (!final || roots_collection->_get_roots().size() > next_level) {
             // We shouldn't create new root if `commit` called from `close` method.
-            parent_saved = roots_collection->append(payload);
+            parent_saved = roots_collection->append(payload, &carried);
         }
     } else {
         // Invariant broken.
@@ -2557,7 +3169,12 @@ std::tuple<bool, LogicAddr> NBTreeSBlockExtent::commit(bool final) {
     }
     fanout_index_++;
     last_ = addr;
-    if (fanout_index_ == AKU_NBTREE_FANOUT) {
+    if (carried) {
+        // Parent node was full and was committed before this node was added,
+        // this node is the first child of the new parent
+        fanout_index_ = 1;
+    } else if (parent_saved || fanout_index_ == AKU_NBTREE_FANOUT) {
+        // Parent node is full and was committed, next node will be the first child of the new parent
         fanout_index_ = 0;
         last_ = EMPTY_ADDR;
     }
@@ -2571,16 +3188,16 @@ std::unique_ptr<RealValuedOperator> NBTreeSBlockExtent::search(aku_Timestamp beg
     return curr_->search(begin, end, bstore_);
 }
 
-std::unique_ptr<AggregateOperator> NBTreeSBlockExtent::aggregate(aku_Timestamp begin, aku_Timestamp end) const {
-    return curr_->aggregate(begin, end, bstore_);
+std::unique_ptr<AggregateOperator> NBTreeSBlockExtent::aggregate(aku_Timestamp begin, aku_Timestamp end, bool need_m2) const {
+    return curr_->aggregate(begin, end, bstore_, need_m2);
 }
 
 std::unique_ptr<AggregateOperator> NBTreeSBlockExtent::candlesticks(aku_Timestamp begin, aku_Timestamp end, NBTreeCandlestickHint hint) const {
     return curr_->candlesticks(begin, end, bstore_, hint);
 }
 
-std::unique_ptr<AggregateOperator> NBTreeSBlockExtent::group_aggregate(aku_Timestamp begin, aku_Timestamp end, u64 step) const {
-    return curr_->group_aggregate(begin, end, step, bstore_);
+std::unique_ptr<AggregateOperator> NBTreeSBlockExtent::group_aggregate(aku_Timestamp begin, aku_Timestamp end, u64 step, u16 level, bool need_m2) const {
+    return curr_->group_aggregate(begin, end, step, bstore_, level, need_m2);
 }
 
 bool NBTreeSBlockExtent::is_dirty() const {
@@ -2765,7 +3382,7 @@ NBTreeExtentsList::NBTreeExtentsList(aku_ParamId id, std::vector<LogicAddr> addr
 }
 
 void NBTreeExtentsList::force_init() {
-    UniqueLock lock(lock_);
+    ScalableUniqueLock lock(lock_);
     if (!initialized_) {
         init();
     }
@@ -2784,7 +3401,7 @@ size_t NBTreeExtentsList::_get_uncommitted_size() const {
 }
 
 bool NBTreeExtentsList::is_initialized() const {
-    SharedLock lock(lock_);
+    ScalableSharedLock lock(lock_);
     return initialized_;
 }
 
@@ -2806,7 +3423,7 @@ u32 NBTreeExtentsList::chose_random_node() {
 }
 
 std::tuple<aku_Status, AggregationResult> NBTreeExtentsList::get_aggregates(u32 ixnode) const {
-    auto it = extents_.at(ixnode)->aggregate(0, AKU_MAX_TIMESTAMP);
+    auto it = extents_.at(ixnode)->aggregate(0, AKU_MAX_TIMESTAMP, false);
     aku_Timestamp ts;
     AggregationResult dest;
     size_t outsz;
@@ -2851,7 +3468,7 @@ void NBTreeExtentsList::check_rescue_points(u32 i) const {
     // we can use i-1 value to restore the i'th
     LogicAddr addr = rescue_points_.at(i-1);
 
-    auto aggit = extents_.at(i)->aggregate(AKU_MIN_TIMESTAMP, AKU_MAX_TIMESTAMP);
+    auto aggit = extents_.at(i)->aggregate(AKU_MIN_TIMESTAMP, AKU_MAX_TIMESTAMP, false);
     aku_Timestamp ts;
     AggregationResult res;
     size_t sz;
@@ -2905,7 +3522,7 @@ std::tuple<aku_Status, LogicAddr> NBTreeExtentsList::_split(aku_Timestamp pivot)
     size_t extent_index = extents_.size();
     // Find the extent that contains the pivot
     for (size_t i = 0; i < extents_.size(); i++) {
-        auto it = extents_.at(i)->aggregate(AKU_MIN_TIMESTAMP, AKU_MAX_TIMESTAMP);
+        auto it = extents_.at(i)->aggregate(AKU_MIN_TIMESTAMP, AKU_MAX_TIMESTAMP, false);
         AggregationResult res;
         size_t outsz;
         aku_Timestamp ts;
@@ -2960,7 +3577,8 @@ std::tuple<aku_Status, LogicAddr> NBTreeExtentsList::_split(aku_Timestamp pivot)
 }
 
 NBTreeAppendResult NBTreeExtentsList::append(aku_Timestamp ts, double value) {
-    UniqueLock lock(lock_);  // NOTE: NBTreeExtentsList::append(subtree) can be called from here
+    ProbeScope probe(AKU_PROBE_NBTREE_APPEND);
+    ScalableUniqueLock lock(lock_);  // NOTE: NBTreeExtentsList::append(subtree) can be called from here
                              //       recursively (maybe even many times).
     if (!initialized_) {
         AKU_PANIC("NB+tree not imitialized");
@@ -2992,7 +3610,7 @@ NBTreeAppendResult NBTreeExtentsList::append(aku_Timestamp ts, double value) {
     return result;
 }
 
-bool NBTreeExtentsList::append(const SubtreeRef &pl) {
+bool NBTreeExtentsList::append(const SubtreeRef &pl, bool* carried) {
     // NOTE: this method should be called by extents which
     //       is called by another `append` overload recursively
     //       and lock will be held already so no lock here!
@@ -3012,9 +3630,8 @@ bool NBTreeExtentsList::append(const SubtreeRef &pl) {
         Logger::msg(AKU_LOG_ERROR, std::to_string(id_) + " Invalid node level - " + std::to_string(lvl));
         AKU_PANIC("Invalid node level");
     }
-    bool parent_saved = false;
     LogicAddr addr = EMPTY_ADDR;
-    std::tie(parent_saved, addr) = root->append(pl);
+    std::tie(*carried, addr) = root->append(pl);
     if (addr != EMPTY_ADDR) {
         // NOTE: `addr != EMPTY_ADDR` means that something was saved to disk (current node or parent node).
         if (rescue_points_.size() > lvl) {
@@ -3221,8 +3838,9 @@ void NBTreeExtentsList::repair() {
                 }
             }
             // Insert all nodes in direct order
+            bool carried = false;
             for(auto it = refs.rbegin(); it < refs.rend(); it++) {
-                append(*it);  // There is no need to check return value.
+                append(*it, &carried);  // There is no need to check return value.
             }
         }
     }
@@ -3244,7 +3862,7 @@ void NBTreeExtentsList::init() {
 }
 
 std::unique_ptr<RealValuedOperator> NBTreeExtentsList::search(aku_Timestamp begin, aku_Timestamp end) const {
-    SharedLock lock(lock_);
+    ScalableSharedLock lock(lock_);
     if (!initialized_) {
         AKU_PANIC("NB+tree not imitialized");
     }
@@ -3266,19 +3884,19 @@ std::unique_ptr<RealValuedOperator> NBTreeExtentsList::search(aku_Timestamp begi
     return concat;
 }
 
-std::unique_ptr<AggregateOperator> NBTreeExtentsList::aggregate(aku_Timestamp begin, aku_Timestamp end) const {
-    SharedLock lock(lock_);
+std::unique_ptr<AggregateOperator> NBTreeExtentsList::aggregate(aku_Timestamp begin, aku_Timestamp end, bool need_m2) const {
+    ScalableSharedLock lock(lock_);
     if (!initialized_) {
         AKU_PANIC("NB+tree not imitialized");
     }
     std::vector<std::unique_ptr<AggregateOperator>> iterators;
     if (begin < end) {
         for (auto it = extents_.rbegin(); it != extents_.rend(); it++) {
-            iterators.push_back((*it)->aggregate(begin, end));
+            iterators.push_back((*it)->aggregate(begin, end, need_m2));
         }
     } else {
         for (auto const& root: extents_) {
-            iterators.push_back(root->aggregate(begin, end));
+            iterators.push_back(root->aggregate(begin, end, need_m2));
         }
     }
     if (iterators.size() == 1) {
@@ -3290,19 +3908,19 @@ std::unique_ptr<AggregateOperator> NBTreeExtentsList::aggregate(aku_Timestamp be
 
 }
 
-std::unique_ptr<AggregateOperator> NBTreeExtentsList::group_aggregate(aku_Timestamp begin, aku_Timestamp end, aku_Timestamp step) const {
-    SharedLock lock(lock_);
+std::unique_ptr<AggregateOperator> NBTreeExtentsList::group_aggregate(aku_Timestamp begin, aku_Timestamp end, aku_Timestamp step, u16 level, bool need_m2) const {
+    ScalableSharedLock lock(lock_);
     if (!initialized_) {
         AKU_PANIC("NB+tree not imitialized");
     }
     std::vector<std::unique_ptr<AggregateOperator>> iterators;
     if (begin < end) {
         for (auto it = extents_.rbegin(); it != extents_.rend(); it++) {
-            iterators.push_back((*it)->group_aggregate(begin, end, step));
+            iterators.push_back((*it)->group_aggregate(begin, end, step, level, need_m2));
         }
     } else {
         for (auto const& root: extents_) {
-            iterators.push_back(root->group_aggregate(begin, end, step));
+            iterators.push_back(root->group_aggregate(begin, end, step, level, need_m2));
         }
     }
     std::unique_ptr<AggregateOperator> concat;
@@ -3310,9 +3928,14 @@ std::unique_ptr<AggregateOperator> NBTreeExtentsList::group_aggregate(aku_Timest
     return concat;
 }
 
+u16 NBTreeExtentsList::get_height() const {
+    ScalableSharedLock lock(lock_);
+    return static_cast<u16>(extents_.size());
+}
+
 
 std::unique_ptr<AggregateOperator> NBTreeExtentsList::candlesticks(aku_Timestamp begin, aku_Timestamp end, NBTreeCandlestickHint hint) const {
-    SharedLock lock(lock_);
+    ScalableSharedLock lock(lock_);
     if (!initialized_) {
         AKU_PANIC("NB+tree not imitialized");
     }
@@ -3337,7 +3960,7 @@ std::unique_ptr<AggregateOperator> NBTreeExtentsList::candlesticks(aku_Timestamp
 
 
 std::vector<LogicAddr> NBTreeExtentsList::close() {
-    UniqueLock lock(lock_);
+    ScalableUniqueLock lock(lock_);
     if (initialized_) {
         if (write_count_) {
             Logger::msg(AKU_LOG_TRACE, std::to_string(id_) + " Going to close the tree.");
@@ -3375,7 +3998,7 @@ std::vector<LogicAddr> NBTreeExtentsList::close() {
 }
 
 std::vector<LogicAddr> NBTreeExtentsList::get_roots() const {
-    SharedLock lock(lock_);
+    ScalableSharedLock lock(lock_);
     return rescue_points_;
 }
 
@@ -75,6 +75,7 @@
 
 // C++ headers
 #include <deque>
+#include <random>
 
 // App headers
 #include "nbtree_def.h"
@@ -140,6 +141,8 @@ public:
     /**
      * @brief Clone leaf node
      * @param block is a pointer to block that contains leaf's data
+     * @note Clone of the V1 leaf that doesn't fit the block in the current format
+     *       is committed in V1 format.
      */
     NBTreeLeaf(std::shared_ptr<Block> block, CloneTag tag);
 
@@ -174,9 +177,13 @@ public:
     /** Read all elements from the leaf node.
       * @param timestamps Destination for timestamps.
       * @param values Destination for values.
+      * @param max Decoding stops at the first element with timestamp greater than `max`
+      *        (values are encoded sequentially so the prefix of the leaf should be decoded anyway,
+      *        reads that start from the newest element decode the whole leaf).
       * @return status.
       */
-    aku_Status read_all(std::vector<aku_Timestamp>* timestamps, std::vector<double>* values) const;
+    aku_Status read_all(std::vector<aku_Timestamp>* timestamps, std::vector<double>* values,
+                        aku_Timestamp max = AKU_MAX_TIMESTAMP) const;
 
     //! Append values to NBTree
     aku_Status append(aku_Timestamp ts, double value);
@@ -195,7 +202,10 @@ public:
     //! Return iterator that outputs all values in time range that is stored in this leaf.
     std::unique_ptr<RealValuedOperator> range(aku_Timestamp begin, aku_Timestamp end) const;
 
-    std::unique_ptr<AggregateOperator> aggregate(aku_Timestamp begin, aku_Timestamp end) const;
+    /** Return iterator that returns single aggregate
+      * @param need_m2 if set, leaf metadata is not used if it doesn't have `m2` (node created by the older version)
+      */
+    std::unique_ptr<AggregateOperator> aggregate(aku_Timestamp begin, aku_Timestamp end, bool need_m2 = false) const;
 
     //! Search for values in a range (in this and connected leaf nodes). DEPRICATED
     std::unique_ptr<RealValuedOperator> search(aku_Timestamp begin, aku_Timestamp end, std::shared_ptr<BlockStore> bstore) const;
@@ -203,8 +213,8 @@ public:
     //! Return iterator that returns candlesticks
     std::unique_ptr<AggregateOperator> candlesticks(aku_Timestamp begin, aku_Timestamp end, NBTreeCandlestickHint hint) const;
 
-    //! Group-aggregate query results iterator
-    std::unique_ptr<AggregateOperator> group_aggregate(aku_Timestamp begin, aku_Timestamp end, u64 step) const;
+    //! Group-aggregate query results iterator (see `aggregate` for `need_m2` description)
+    std::unique_ptr<AggregateOperator> group_aggregate(aku_Timestamp begin, aku_Timestamp end, u64 step, bool need_m2 = false) const;
 
     // Node split experiment //
 
@@ -237,15 +247,21 @@ public:
 
 
 /** NBTree superblock. Stores refs to subtrees.
+  * Refs are stored column-wise and delta-encoded (see AKU_NBTREE_VERSION), writable
+  * node keeps them decoded and encodes on commit.
  */
 class NBTreeSuperblock {
-    std::shared_ptr<Block> block_;
-    aku_ParamId            id_;
-    u32                    write_pos_;
-    u16                    fanout_index_;
-    u16                    level_;
-    LogicAddr              prev_;
-    bool                   immutable_;
+    std::shared_ptr<Block>  block_;
+    aku_ParamId             id_;
+    u32                     write_pos_;
+    u16                     fanout_index_;
+    u16                     level_;
+    LogicAddr               prev_;
+    bool                    immutable_;
+    //! Child refs of the writable node
+    std::vector<SubtreeRef> refs_;
+    //! Size of the encoded child refs of the writable node
+    u32                     encoded_size_;
 
 public:
     //! Create new writable node.
@@ -266,11 +282,16 @@ public:
     //! Commit changes (even if node is not full)
     std::tuple<aku_Status, LogicAddr> commit(std::shared_ptr<BlockStore> bstore);
 
-    //! Check if node is full (always true if node is immutable - c-tor #2)
+    //! Check if node is full (next child ref may not fit into the block)
     bool is_full() const;
 
     aku_Status read_all(std::vector<SubtreeRef>* refs) const;
 
+    /** Read refs to subtrees that overlap with [min(begin, end), max(begin, end)] range.
+      * Only timestamps are decoded if the node doesn't overlap with the range.
+      */
+    aku_Status read_range(aku_Timestamp begin, aku_Timestamp end, std::vector<SubtreeRef>* refs) const;
+
     bool top(SubtreeRef* outref) const;
 
     bool top(LogicAddr* outaddr) const;
@@ -305,18 +326,29 @@ public:
 
     std::unique_ptr<RealValuedOperator> search(aku_Timestamp begin, aku_Timestamp end, std::shared_ptr<BlockStore> bstore) const;
 
+    /** Aggregate query results iterator
+      * @param need_m2 if set, subtree refs without `m2` (created by the older version) are
+      *        not used, the subtrees are read instead
+      */
     std::unique_ptr<AggregateOperator> aggregate(aku_Timestamp begin,
                                                 aku_Timestamp end,
-                                                std::shared_ptr<BlockStore> bstore) const;
+                                                std::shared_ptr<BlockStore> bstore,
+                                                bool need_m2 = false) const;
 
     std::unique_ptr<AggregateOperator> candlesticks(aku_Timestamp begin, aku_Timestamp end,
                                                    std::shared_ptr<BlockStore> bstore,
                                                    NBTreeCandlestickHint hint) const;
 
-    //! Group-aggregate query results iterator
+    /** Group-aggregate query results iterator
+      * @param level is an approximation level, child nodes below this level are not
+      *        read, summaries from their subtree refs are used instead (0 - exact result)
+      * @param need_m2 see `aggregate`
+      */
     std::unique_ptr<AggregateOperator> group_aggregate(aku_Timestamp begin,
                                                       aku_Timestamp end,
-                                                      u64 step, std::shared_ptr<BlockStore> bstore) const;
+                                                      u64 step, std::shared_ptr<BlockStore> bstore,
+                                                      u16 level,
+                                                      bool need_m2 = false) const;
 
     // Node split experiment //
     /**
@@ -370,7 +402,8 @@ struct NBTreeExtent {
     virtual std::tuple<bool, LogicAddr> append(aku_Timestamp ts, double value) = 0;
 
     /** Append subtree metadata to the root (doesn't work with leaf nodes)
-      * If new root created - return address of the previous root, otherwise return EMPTY
+      * If root was committed - return its address, otherwise return EMPTY. Boolean value
+      * is set to true if the root was full and `pl` was added to the new root after commit.
       */
     virtual std::tuple<bool, LogicAddr> append(SubtreeRef const& pl) = 0;
 
@@ -388,12 +421,12 @@ struct NBTreeExtent {
     virtual bool is_dirty() const = 0;
 
     //! Return iterator that will return single aggregated value.
-    virtual std::unique_ptr<AggregateOperator> aggregate(aku_Timestamp begin, aku_Timestamp end) const = 0;
+    virtual std::unique_ptr<AggregateOperator> aggregate(aku_Timestamp begin, aku_Timestamp end, bool need_m2) const = 0;
 
     virtual std::unique_ptr<AggregateOperator> candlesticks(aku_Timestamp begin, aku_Timestamp end, NBTreeCandlestickHint hint) const = 0;
 
-    //! Return group-aggregate query results iterator
-    virtual std::unique_ptr<AggregateOperator> group_aggregate(aku_Timestamp begin, aku_Timestamp end, u64 step) const = 0;
+    //! Return group-aggregate query results iterator (see NBTreeSuperblock::group_aggregate)
+    virtual std::unique_ptr<AggregateOperator> group_aggregate(aku_Timestamp begin, aku_Timestamp end, u64 step, u16 level, bool need_m2) const = 0;
 
     // Service functions //
 
@@ -454,7 +487,7 @@ class NBTreeExtentsList : public std::enable_shared_from_this<NBTreeExtentsList>
     void open();
     void repair();
     void init();
-    mutable RWLock lock_;
+    mutable ScalableRWLock lock_;
 
     // Testing
     std::random_device              rd_;
@@ -482,9 +515,10 @@ public:
     /** Append new subtree reference to extents list.
       * This operation can't fail and should be used only by NB-tree itself (from node-commit functions).
       * This property is not enforced by the typesystem.
-      * Result is OK or OK_FLUSH_NEEDED (if rescue points list was changed).
+      * Returns true if the parent node was committed. `carried` is set to true if the parent
+      * node was full before the call and `pl` became the first child of the new parent.
       */
-    bool append(SubtreeRef const& pl);
+    bool append(SubtreeRef const& pl, bool* carried);
 
     /** Append new value to extents list.
       * This operation can fail if value is out of order.
@@ -506,7 +540,7 @@ public:
      * @param end is a next after the last element of the search interval
      * @return iterator that produces single value
      */
-    std::unique_ptr<AggregateOperator> aggregate(aku_Timestamp begin, aku_Timestamp end) const;
+    std::unique_ptr<AggregateOperator> aggregate(aku_Timestamp begin, aku_Timestamp end, bool need_m2 = false) const;
 
     std::unique_ptr<AggregateOperator> candlesticks(aku_Timestamp begin, aku_Timestamp end, NBTreeCandlestickHint hint) const;
 
@@ -515,9 +549,17 @@ public:
      * @param begin start of the search interval
      * @param end end of the search interval
      * @param step bucket size
+     * @param level approximation level, subtrees below this level are not read, values
+     *        from their summaries are spread across buckets proportionally (0 - exact result)
+     * @param need_m2 should be set if variance is needed, subtrees created by the older
+     *        version don't have it in their summaries and have to be read
      * @return iterator
      */
-    std::unique_ptr<AggregateOperator> group_aggregate(aku_Timestamp begin, aku_Timestamp end, aku_Timestamp step) const;
+    std::unique_ptr<AggregateOperator> group_aggregate(aku_Timestamp begin, aku_Timestamp end, aku_Timestamp step,
+                                                      u16 level = 0, bool need_m2 = false) const;
+
+    //! Get number of levels in the tree
+    u16 get_height() const;
 
     //! Commit changes to btree and close (do not call blockstore.flush), return list of addresses.
     std::vector<LogicAddr> close();
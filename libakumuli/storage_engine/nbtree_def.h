@@ -18,9 +18,23 @@ enum class NBTreeBlockType : u16 {
 };
 
 
+/** Max fanout of the superblock. Superblocks are compressed so the actual
+  * fanout depends on data, the node is full when the next child ref
+  * may not fit into the block. Full node has at least AKU_NBTREE_MIN_FANOUT
+  * children (every child ref has max encoded size).
+  */
+enum {
+    AKU_NBTREE_FANOUT = 128,
+    AKU_NBTREE_MAX_FANOUT_INDEX = 127,
+    AKU_NBTREE_MIN_FANOUT = 24,
+};
+
+
+//! Node versions (stored in SubtreeRef::version)
 enum {
-    AKU_NBTREE_FANOUT = 32,
-    AKU_NBTREE_MAX_FANOUT_INDEX = 31,
+    AKU_NBTREE_V1 = 30,       //< SubtreeRef doesn't have `m2` field
+    AKU_NBTREE_V2 = 31,       //< Superblock stores array of uncompressed SubtreeRef structs
+    AKU_NBTREE_VERSION = 32,  //< Current version, superblock stores child refs column-wise
 };
 
 
@@ -33,6 +47,8 @@ enum {
   * leafa node and all this fields describes this leaf node. If level is 2 or more
   * then all this aggregates comes from entire subtree (e.g. min is a minimal value
   * in leaf nodes in pointee subtree).
+  * Nodes created by older versions (AKU_NBTREE_V1) don't have the `m2` field,
+  * it's added when the node is loaded and set to NaN.
   */
 struct SubtreeRef {
     //! Number of elements in the subtree
@@ -71,6 +87,25 @@ struct SubtreeRef {
     u16 fanout_index;
     //! Checksum of the block (not used for links to child nodes)
     u32 checksum;
+    //! Sum of squared differences from the mean (NaN if unknown)
+    double m2;
 } __attribute__((packed));
 
+
+/** Merge sums of squared differences from the mean of two sets of
+  * values (parallel variant of the Welford's algorithm).
+  */
+inline double merge_m2(double cnt_a, double sum_a, double m2_a,
+                       double cnt_b, double sum_b, double m2_b)
+{
+    if (cnt_a == 0) {
+        return m2_b;
+    }
+    if (cnt_b == 0) {
+        return m2_a;
+    }
+    double delta = sum_b / cnt_b - sum_a / cnt_a;
+    return m2_a + m2_b + delta * delta * cnt_a * cnt_b / (cnt_a + cnt_b);
+}
+
 }} // namespace
@@ -258,6 +258,22 @@ std::tuple<aku_Status, size_t> AggregateMaterializer::read(u8* dest, size_t size
             sample.timestamp = destval._end;
             sample.payload.float64 = destval.sum/destval.cnt;
         break;
+        case AggregationFunction::RATE:
+            sample.timestamp = destval._end;
+            sample.payload.float64 = CounterDelta::make(destval, nullptr).rate();
+        break;
+        case AggregationFunction::INCREASE:
+            sample.timestamp = destval._end;
+            sample.payload.float64 = CounterDelta::make(destval, nullptr).increase;
+        break;
+        case AggregationFunction::VARIANCE:
+            sample.timestamp = destval._end;
+            sample.payload.float64 = destval.m2/destval.cnt;
+        break;
+        case AggregationFunction::STDDEV:
+            sample.timestamp = destval._end;
+            sample.payload.float64 = std::sqrt(destval.m2/destval.cnt);
+        break;
         }
         memcpy(dest, &sample, sizeof(sample));
         // move to next
@@ -287,11 +303,25 @@ std::tuple<aku_Status, size_t> SeriesOrderAggregateMaterializer::read(u8 *dest,
     size_t accsz = 0;  // accumulated size
     size_t sample_size = get_tuple_size(tuple_);
     size_t size = dest_size / sample_size;
+    const size_t maxout = size;
+    if (counters_ && !forward_ && size != 0) {
+        // One more bucket is read to find the previous bucket of the last one
+        size++;
+    }
     std::vector<aku_Timestamp> destts_vec(size, 0);
     std::vector<AggregationResult> destval_vec(size, INIT_AGGRES);
     std::vector<aku_ParamId> outids(size, 0);
-    aku_Timestamp* destts = destts_vec.data();
-    AggregationResult* destval = destval_vec.data();
+    if (counters_ && !forward_ && has_carry_ && size != 0) {
+        // Bucket that was held back by the previous call
+        destts_vec[0]  = carry_ts_;
+        destval_vec[0] = carry_;
+        outids[0]      = carry_id_;
+        has_carry_     = false;
+        accsz = 1;
+        size -= 1;
+    }
+    aku_Timestamp* destts = destts_vec.data() + accsz;
+    AggregationResult* destval = destval_vec.data() + accsz;
     while(pos_ < iters_.size()) {
         aku_ParamId curr = ids_[pos_];
         std::tie(status, ressz) = iters_[pos_]->read(destts, destval, size);
@@ -315,8 +345,34 @@ std::tuple<aku_Status, size_t> SeriesOrderAggregateMaterializer::read(u8 *dest,
             break;
         }
     }
+    size_t outsz = accsz;
+    if (counters_ && !forward_ && accsz > maxout) {
+        // The previous bucket of the last one wasn't read yet
+        outsz--;
+        has_carry_ = true;
+        carry_id_  = outids[outsz];
+        carry_ts_  = destts_vec[outsz];
+        carry_     = destval_vec[outsz];
+        if (status == AKU_ENO_DATA) {
+            status = AKU_SUCCESS;
+        }
+    }
     // Convert vectors to series of samples
-    for (size_t i = 0; i < accsz; i++) {
+    CounterDelta delta = {};
+    for (size_t i = 0; i < outsz; i++) {
+        if (counters_) {
+            const AggregationResult* prev = nullptr;
+            if (forward_) {
+                if (i > 0 && outids[i - 1] == outids[i]) {
+                    prev = &destval_vec[i - 1];
+                } else if (i == 0 && has_carry_ && carry_id_ == outids[i]) {
+                    prev = &carry_;
+                }
+            } else if (i + 1 < accsz && outids[i + 1] == outids[i]) {
+                prev = &destval_vec[i + 1];
+            }
+            delta = CounterDelta::make(destval_vec[i], prev);
+        }
         double* tup;
         aku_Sample* sample;
         std::tie(sample, tup)   = cast(dest);
@@ -326,9 +382,15 @@ std::tuple<aku_Status, size_t> SeriesOrderAggregateMaterializer::read(u8 *dest,
         sample->paramid         = outids[i];
         sample->timestamp       = destts_vec[i];
         sample->payload.float64 = get_flags(tuple_);
-        set_tuple(tup, tuple_, destval_vec[i]);
+        set_tuple(tup, tuple_, destval_vec[i], delta);
+    }
+    if (counters_ && forward_ && outsz != 0) {
+        has_carry_ = true;
+        carry_id_  = outids[outsz - 1];
+        carry_ts_  = destts_vec[outsz - 1];
+        carry_     = destval_vec[outsz - 1];
     }
-    return std::make_tuple(status, accsz*sample_size);
+    return std::make_tuple(status, outsz*sample_size);
 
 }
 
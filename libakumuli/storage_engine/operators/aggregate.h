@@ -134,6 +134,16 @@ struct SeriesOrderAggregateMaterializer : TupleOutputUtils, ColumnMaterializer {
     std::vector<aku_ParamId> ids_;
     std::vector<AggregationFunction> tuple_;
     u32 pos_;
+    // Counter functions (rate, increase) need the previous bucket of the series.
+    // In forward direction it's the last bucket returned by the previous `read` call,
+    // in backward direction it's the bucket that will be read next, so one extra bucket
+    // is read and held back until the next call.
+    bool counters_;
+    bool forward_;
+    bool has_carry_;
+    aku_ParamId carry_id_;
+    aku_Timestamp carry_ts_;
+    AggregationResult carry_;
 
     SeriesOrderAggregateMaterializer(std::vector<aku_ParamId>&& ids,
                         std::vector<std::unique_ptr<AggregateOperator>>&& it,
@@ -142,6 +152,12 @@ struct SeriesOrderAggregateMaterializer : TupleOutputUtils, ColumnMaterializer {
         , ids_(std::move(ids))
         , tuple_(std::move(components))
         , pos_(0)
+        , counters_(has_counters(tuple_))
+        , forward_(iters_.empty() || iters_.front()->get_direction() == AggregateOperator::Direction::FORWARD)
+        , has_carry_(false)
+        , carry_id_(0)
+        , carry_ts_(0)
+        , carry_(INIT_AGGRES)
     {
     }
 
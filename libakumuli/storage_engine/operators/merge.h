@@ -66,6 +66,15 @@ struct SeriesOrder {
 };
 
 
+/**
+ * Merges several series.
+ * Series are read lazily in small batches. Batch size of the series grows
+ * every time its range is refilled, so the first output doesn't require
+ * reading a lot of data from every series (query with limit can be stopped
+ * early) and long scans are still read in large batches. The saving is in the
+ * number of leaves read per series, every leaf that is read is still decoded
+ * as a whole in backward direction.
+ */
 template<template <int dir> class CmpPred, bool IsStable=false>
 struct MergeMaterializer : ColumnMaterializer {
     std::vector<std::unique_ptr<RealValuedOperator>> iters_;
@@ -73,7 +82,8 @@ struct MergeMaterializer : ColumnMaterializer {
     bool forward_;
 
     enum {
-        RANGE_SIZE=1024
+        RANGE_SIZE=1024,
+        INIT_RANGE_SIZE=16,
     };
 
     struct Range {
@@ -88,8 +98,20 @@ struct MergeMaterializer : ColumnMaterializer {
             , size(0)
             , pos(0)
         {
-            ts.resize(RANGE_SIZE);
-            xs.resize(RANGE_SIZE);
+        }
+
+        //! Read next batch from the iterator
+        aku_Status refill(RealValuedOperator& iter) {
+            size_t batch = std::min(std::max(ts.size()*2, static_cast<size_t>(INIT_RANGE_SIZE)),
+                                    static_cast<size_t>(RANGE_SIZE));
+            ts.resize(batch);
+            xs.resize(batch);
+            aku_Status status;
+            size_t outsize;
+            std::tie(status, outsize) = iter.read(ts.data(), xs.data(), batch);
+            size = outsize;
+            pos  = 0;
+            return status;
         }
 
         void advance() {
@@ -145,15 +167,10 @@ struct MergeMaterializer : ColumnMaterializer {
         if (ranges_.empty()) {
             // `ranges_` array should be initialized on first call
             for (size_t i = 0; i < iters_.size(); i++) {
+                // Empty ranges are added too, `ranges_` and `iters_` should have the same indexes
                 Range range(ids_[i]);
-                aku_Status status;
-                size_t outsize;
-                std::tie(status, outsize) = iters_[i]->read(range.ts.data(), range.xs.data(), RANGE_SIZE);
-                if (status == AKU_SUCCESS || (status == AKU_ENO_DATA && outsize != 0)) {
-                    range.size = outsize;
-                    range.pos  = 0;
-                    ranges_.push_back(std::move(range));
-                }
+                aku_Status status = range.refill(*iters_[i]);
+                ranges_.push_back(std::move(range));
                 if (status != AKU_SUCCESS && status != AKU_ENO_DATA) {
                     return std::make_tuple(status, 0);
                 }
@@ -204,14 +221,10 @@ struct MergeMaterializer : ColumnMaterializer {
             ranges_[index].advance();
             if (ranges_[index].empty()) {
                 // Refill range if possible
-                aku_Status status;
-                size_t outsize;
-                std::tie(status, outsize) = iters_[index]->read(ranges_[index].ts.data(), ranges_[index].xs.data(), RANGE_SIZE);
+                aku_Status status = ranges_[index].refill(*iters_[index]);
                 if (status != AKU_SUCCESS && status != AKU_ENO_DATA) {
                     return std::make_tuple(status, 0);
                 }
-                ranges_[index].size = outsize;
-                ranges_[index].pos  = 0;
             }
             if (!ranges_[index].empty()) {
                 KeyType point = ranges_[index].top_key();
@@ -8,6 +8,7 @@ namespace StorageEngine {
 void AggregationResult::copy_from(SubtreeRef const& r) {
     cnt = r.count;
     sum = r.sum;
+    m2 = r.m2;
     min = r.min;
     max = r.max;
     mints = r.min_time;
@@ -20,6 +21,15 @@ void AggregationResult::copy_from(SubtreeRef const& r) {
 
 void AggregationResult::do_the_math(aku_Timestamp* tss, double const* xss, size_t size, bool inverted) {
     assert(size);
+    // Welford's algorithm is used to compute m2 of the batch
+    double bsum = 0;
+    double bm2 = 0;
+    for (size_t i = 0; i < size; i++) {
+        double delta = xss[i] - (i ? bsum / i : 0);
+        bsum += xss[i];
+        bm2 += delta * (xss[i] - bsum / (i + 1));
+    }
+    m2 = merge_m2(cnt, sum, m2, size, bsum, bm2);
     cnt += size;
     for (size_t i = 0; i < size; i++) {
         sum += xss[i];
@@ -46,7 +56,9 @@ void AggregationResult::do_the_math(aku_Timestamp* tss, double const* xss, size_
 }
 
 void AggregationResult::add(aku_Timestamp ts, double xs, bool forward) {
+    double delta = xs - (cnt ? sum / cnt : 0);
     sum += xs;
+    m2 += delta * (xs - sum / (cnt + 1));
     if (min > xs) {
         min = xs;
         mints = ts;
@@ -55,24 +67,24 @@ void AggregationResult::add(aku_Timestamp ts, double xs, bool forward) {
         max = xs;
         maxts = ts;
     }
+    // first and last are ordered by time regardless of the iteration order
     if (cnt == 0) {
         first = xs;
-        if (forward) {
-            _begin = ts;
-        } else {
-            _end = ts;
-        }
-    }
-    last = xs;
-    if (forward) {
+        last = xs;
+        _begin = ts;
+        _end = ts;
+    } else if (forward) {
+        last = xs;
         _end = ts;
     } else {
+        first = xs;
         _begin = ts;
     }
     cnt += 1;
 }
 
 void AggregationResult::combine(const AggregationResult& other) {
+    m2 = merge_m2(cnt, sum, m2, other.cnt, other.sum, other.m2);
     sum += other.sum;
     cnt += other.cnt;
     if (min > other.min) {
@@ -95,4 +107,38 @@ void AggregationResult::combine(const AggregationResult& other) {
     }
 }
 
+CounterDelta CounterDelta::make(AggregationResult const& curr, AggregationResult const* prev) {
+    CounterDelta res = {};
+    if (curr.min < curr.first) {
+        // Counter was reset inside the bucket. The counter starts from zero after reset
+        // and values after reset can't be larger than the last one, so if the maximum is
+        // larger than the last value it was reached before the reset. Otherwise the value
+        // before the reset is unknown and only the part after the reset is counted.
+        res.increase = curr.last;
+        if (curr.max > curr.last) {
+            res.increase += curr.max - curr.first;
+        }
+    } else {
+        res.increase = curr.last - curr.first;
+    }
+    if (prev) {
+        // Counter was reset between the buckets if the first value is smaller than the
+        // last value of the previous bucket
+        res.increase += curr.first >= prev->last ? curr.first - prev->last : curr.first;
+        res.interval  = curr._end - prev->_end;
+    } else {
+        res.interval  = curr._end - curr._begin;
+    }
+    return res;
+}
+
+double CounterDelta::rate() const {
+    if (interval == 0) {
+        // Single sample, rate is unknown
+        return 0;
+    }
+    const double nsec = 1000000000;
+    return increase / static_cast<double>(interval) * nsec;
+}
+
 }}
@@ -12,6 +12,7 @@
 
 #include "akumuli_def.h"
 #include "../nbtree_def.h"
+#include "pool.h"
 
 
 namespace Akumuli {
@@ -24,13 +25,18 @@ enum class AggregationFunction {
     CNT,
     MIN_TIMESTAMP,
     MAX_TIMESTAMP,
-    MEAN
+    MEAN,
+    RATE,
+    INCREASE,
+    VARIANCE,
+    STDDEV
 };
 
 //! Result of the aggregation operation that has several components.
 struct AggregationResult {
     double cnt;
     double sum;
+    double m2;  //< Sum of squared differences from the mean (NaN if unknown)
     double min;
     double max;
     double first;
@@ -55,8 +61,29 @@ struct AggregationResult {
     void combine(const AggregationResult& other);
 };
 
+/** Counter increase within the group-aggregate bucket.
+  * Used by `rate` and `increase` functions. Only first, last, min and max values of the
+  * bucket and the last value of the previous bucket are used, so the raw data doesn't
+  * have to be decompressed if the bucket is covered by the subtree.
+  */
+struct CounterDelta {
+    double        increase;
+    aku_Timestamp interval;  //< Time between the last sample of the previous bucket and the last sample of this one
+
+    /**
+     * Calculate counter increase.
+     * @param curr is a bucket
+     * @param prev is a previous bucket of the same series (or nullptr)
+     */
+    static CounterDelta make(AggregationResult const& curr, AggregationResult const* prev);
+
+    //! Per second rate
+    double rate() const;
+};
+
 
 static const AggregationResult INIT_AGGRES = {
+    .0,
     .0,
     .0,
     std::numeric_limits<double>::max(),
@@ -71,6 +98,7 @@ static const AggregationResult INIT_AGGRES = {
 
 
 /** Single series operator.
+  * Operators are created per series per query so they're allocated from the thread-local pool.
   * @note all ranges is semi-open. This means that if we're
   *       reading data from A to B, operator should return
   *       data in range [A, B), and B timestamp should be
@@ -78,7 +106,7 @@ static const AggregationResult INIT_AGGRES = {
   *       direction) then all timestamps that we've read before.
   */
 template <class TValue>
-struct SeriesOperator {
+struct SeriesOperator : PooledObject {
 
     //! Iteration direction
     enum class Direction {
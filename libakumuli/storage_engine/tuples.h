@@ -5,6 +5,7 @@
 #include <tuple>
 #include <vector>
 #include <cassert>
+#include <cmath>
 
 namespace Akumuli {
 
@@ -42,7 +43,10 @@ struct TupleOutputUtils {
         return std::make_tuple(size, bitmap);
     }
 
-    static double get(StorageEngine::AggregationResult const& res, StorageEngine::AggregationFunction afunc) {
+    static double get(StorageEngine::AggregationResult const& res,
+                      StorageEngine::CounterDelta const& delta,
+                      StorageEngine::AggregationFunction afunc)
+    {
         double out = 0;
         switch (afunc) {
         case StorageEngine::AggregationFunction::CNT:
@@ -66,18 +70,45 @@ struct TupleOutputUtils {
         case StorageEngine::AggregationFunction::MEAN:
             out = res.sum / res.cnt;
             break;
+        case StorageEngine::AggregationFunction::RATE:
+            out = delta.rate();
+            break;
+        case StorageEngine::AggregationFunction::INCREASE:
+            out = delta.increase;
+            break;
+        case StorageEngine::AggregationFunction::VARIANCE:
+            out = res.m2 / res.cnt;
+            break;
+        case StorageEngine::AggregationFunction::STDDEV:
+            out = std::sqrt(res.m2 / res.cnt);
+            break;
         }
         return out;
     }
 
-    static void set_tuple(double* tuple, std::vector<StorageEngine::AggregationFunction> const& comp, StorageEngine::AggregationResult const& res) {
+    static void set_tuple(double* tuple,
+                          std::vector<StorageEngine::AggregationFunction> const& comp,
+                          StorageEngine::AggregationResult const& res,
+                          StorageEngine::CounterDelta const& delta)
+    {
         for (size_t i = 0; i < comp.size(); i++) {
             auto elem = comp[i];
-            *tuple = get(res, elem);
+            *tuple = get(res, delta, elem);
             tuple++;
         }
     }
 
+    //! Check if tuple contains counter functions (rate or increase)
+    static bool has_counters(std::vector<StorageEngine::AggregationFunction> const& comp) {
+        for (auto fn: comp) {
+            if (fn == StorageEngine::AggregationFunction::RATE ||
+                fn == StorageEngine::AggregationFunction::INCREASE) {
+                return true;
+            }
+        }
+        return false;
+    }
+
     static size_t get_tuple_size(const std::vector<StorageEngine::AggregationFunction>& tup) {
         size_t payload = 0;
         assert(!tup.empty());
@@ -20,8 +20,16 @@
 #include <apr_general.h>
 #include <apr_file_io.h>
 #include <set>
+#include <algorithm>
+#include <tuple>
+#include <cstdlib>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 #include <boost/exception/all.hpp>
+#include <boost/system/error_code.hpp>
 
 #include "log_iface.h"
 #include "akumuli_version.h"
@@ -101,13 +109,101 @@ static void volcpy(u8* block, const VolumeRegistry::VolumeDesc* desc) {
     pvolume->path[desc->path.size()] = '\0';
 }
 
+//                      //
+//     VolumeFilter     //
+//                      //
+
+//! Hash of the series id (splitmix64 finalizer, series ids are sequential)
+static u64 hash_series_id(aku_ParamId id) {
+    u64 hash = id + 0x9E3779B97F4A7C15ull;
+    hash = (hash ^ (hash >> 30)) * 0xBF58476D1CE4E5B9ull;
+    hash = (hash ^ (hash >> 27)) * 0x94D049BB133111EBull;
+    return hash ^ (hash >> 31);
+}
+
+VolumeFilter::VolumeFilter(size_t nwords)
+    : bits_(nwords)
+{
+}
+
+VolumeFilter::VolumeFilter(std::vector<u64> const& words)
+    : bits_(words.size())
+{
+    for (size_t i = 0; i < words.size(); i++) {
+        bits_[i].store(words[i], std::memory_order_relaxed);
+    }
+}
+
+bool VolumeFilter::add(aku_ParamId id) {
+    auto hash = hash_series_id(id);
+    const u64 nbits = bits_.size() * 64;
+    bool changed = false;
+    for (u64 bit: { hash % nbits, (hash >> 32) % nbits }) {
+        u64 mask = 1ull << (bit % 64);
+        if ((bits_[bit / 64].load(std::memory_order_relaxed) & mask) == 0) {
+            bits_[bit / 64].fetch_or(mask, std::memory_order_relaxed);
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+bool VolumeFilter::may_contain(aku_ParamId id) const {
+    auto hash = hash_series_id(id);
+    const u64 nbits = bits_.size() * 64;
+    for (u64 bit: { hash % nbits, (hash >> 32) % nbits }) {
+        if ((bits_[bit / 64].load(std::memory_order_relaxed) & (1ull << (bit % 64))) == 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::vector<u64> VolumeFilter::get_words() const {
+    std::vector<u64> result;
+    result.reserve(bits_.size());
+    for (auto const& word: bits_) {
+        result.push_back(word.load(std::memory_order_relaxed));
+    }
+    return result;
+}
+
+bool VolumeSummarySnapshot::may_contain(aku_ParamId id, aku_Timestamp begin, aku_Timestamp end) const {
+    auto lo = std::min(begin, end);
+    auto hi = std::max(begin, end);
+    for (auto const& vol: volumes) {
+        if (vol.end < lo || hi < vol.begin) {
+            continue;
+        }
+        if (!vol.filter || vol.filter->may_contain(id)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+//                    //
+//     MetaVolume     //
+//                    //
+
+//! Size of the volume filter in words, 4 bits per block of the volume (at least 4096 bits)
+static size_t get_filter_size(u32 capacity) {
+    size_t nbits = 4096;
+    while (nbits < static_cast<size_t>(capacity) * 4) {
+        nbits *= 2;
+    }
+    return nbits / 64;
+}
+
 MetaVolume::MetaVolume(std::shared_ptr<VolumeRegistry> meta)
     : meta_(meta)
 {
     auto volumes = meta_->get_volumes();
     file_size_ = volumes.size() * AKU_BLOCK_SIZE;
     double_write_buffer_.resize(file_size_);
+    summaries_.resize(volumes.size());
     std::set<u32> init_list;
+    std::vector<u32> nblocks(volumes.size());
     for (const auto& vol: volumes) {
         if (init_list.count(vol.id) != 0) {
             AKU_PANIC("Duplicate volume record");
@@ -115,6 +211,34 @@ MetaVolume::MetaVolume(std::shared_ptr<VolumeRegistry> meta)
         init_list.insert(vol.id);
         auto block = double_write_buffer_.data() + vol.id * AKU_BLOCK_SIZE;
         volcpy(block, &vol);
+        nblocks.at(vol.id) = vol.nblocks;
+        if (vol.nblocks == 0) {
+            reset_summary(vol.id, vol.generation, vol.capacity);
+        } else {
+            // Volume can contain anything (e.g. it was written by the older version)
+            SummaryState& state = summaries_.at(vol.id);
+            state.generation     = vol.generation;
+            state.begin          = AKU_MIN_TIMESTAMP;
+            state.end            = AKU_MAX_TIMESTAMP;
+            state.filter_nblocks = 0;
+            state.filter_dirty   = false;
+        }
+    }
+    // Time range is saved before `nblocks` so it always covers all blocks of the volume,
+    // filter is saved less often and can be used only if it covers all blocks.
+    for (const auto& summary: meta_->get_volume_summaries()) {
+        if (summary.id >= summaries_.size() || summaries_.at(summary.id).generation != summary.generation) {
+            continue;
+        }
+        SummaryState& state = summaries_.at(summary.id);
+        state.begin = summary.begin;
+        state.end   = summary.end;
+        if (!summary.filter.empty() && summary.filter_nblocks >= nblocks.at(summary.id)) {
+            state.filter = std::make_shared<VolumeFilter>(summary.filter);
+            state.filter_nblocks = summary.filter_nblocks;
+        } else {
+            state.filter.reset();
+        }
     }
 }
 
@@ -135,6 +259,81 @@ static VolumeRef* get_volref(u8* p, u32 id) {
     return vol;
 }
 
+void MetaVolume::reset_summary(u32 id, u32 generation, u32 capacity) {
+    if (summaries_.size() <= id) {
+        summaries_.resize(id + 1);
+    }
+    SummaryState& state = summaries_.at(id);
+    state.generation     = generation;
+    state.begin          = AKU_MAX_TIMESTAMP;
+    state.end            = AKU_MIN_TIMESTAMP;
+    state.filter         = std::make_shared<VolumeFilter>(get_filter_size(capacity));
+    state.filter_nblocks = 0;
+    state.filter_dirty   = true;
+}
+
+void MetaVolume::save_summary(u32 id, bool with_filter) {
+    SummaryState& state = summaries_.at(id);
+    VolumeSummary summary;
+    summary.id             = id;
+    summary.generation     = state.generation;
+    summary.begin          = state.begin;
+    summary.end            = state.end;
+    summary.filter_nblocks = state.filter_nblocks;
+    if (with_filter && state.filter) {
+        summary.filter = state.filter->get_words();
+        state.filter_dirty = false;
+    }
+    meta_->update_volume_summary(summary);
+}
+
+void MetaVolume::get_summary_snapshot(VolumeSummarySnapshot* snapshot) const {
+    for (auto const& state: summaries_) {
+        if (state.begin <= state.end) {
+            VolumeSummaryRef ref = { state.begin, state.end, state.filter };
+            snapshot->volumes.push_back(ref);
+        }
+    }
+}
+
+aku_Status MetaVolume::add_to_summary(u32 volid, u32 nblocks, aku_ParamId id, aku_Timestamp begin, aku_Timestamp end) {
+    if (volid >= summaries_.size()) {
+        return AKU_EBAD_ARG;
+    }
+    SummaryState& state = summaries_.at(volid);
+    if (begin > end) {
+        std::swap(begin, end);
+    }
+    bool changed = begin < state.begin || end > state.end;
+    state.begin = std::min(state.begin, begin);
+    state.end   = std::max(state.end, end);
+    if (!state.filter) {
+        // Content of the volume is unknown, only the time range can be maintained
+        if (changed) {
+            save_summary(volid, false);
+        }
+        return AKU_SUCCESS;
+    }
+    if (state.filter->add(id)) {
+        state.filter_dirty = true;
+    }
+    if (!state.filter_dirty) {
+        // Saved filter covers the new block
+        state.filter_nblocks = nblocks;
+        changed = true;
+    }
+    u32 capacity = get_volref(double_write_buffer_.data(), volid)->capacity;
+    if (state.filter_dirty && ((nblocks & (nblocks - 1)) == 0 || nblocks >= capacity)) {
+        // Large filter is saved only when the number of blocks is doubled or the volume
+        // is full, after crash the filter that doesn't cover all blocks is not used.
+        state.filter_nblocks = nblocks;
+        save_summary(volid, true);
+    } else if (changed) {
+        save_summary(volid, false);
+    }
+    return AKU_SUCCESS;
+}
+
 std::tuple<aku_Status, u32> MetaVolume::get_nblocks(u32 id) const {
     if (id < file_size_/AKU_BLOCK_SIZE) {
         auto pvol = get_volref(double_write_buffer_.data(), id);
@@ -190,6 +389,7 @@ aku_Status MetaVolume::add_volume(u32 id, u32 capacity, const std::string& path)
     vol.path            = path;
 
     meta_->add_volume(vol);
+    reset_summary(id, pvolume->generation, capacity);
 
     return AKU_SUCCESS;
 }
@@ -197,6 +397,10 @@ aku_Status MetaVolume::add_volume(u32 id, u32 capacity, const std::string& path)
 aku_Status MetaVolume::update(u32 id, u32 nblocks, u32 capacity, u32 gen) {
     if (id < file_size_/AKU_BLOCK_SIZE) {
         auto pvol        = get_volref(double_write_buffer_.data(), id);
+        if (pvol->generation != gen) {
+            reset_summary(id, gen, capacity);
+            save_summary(id, true);
+        }
         pvol->nblocks    = nblocks;
         pvol->capacity   = capacity;
         pvol->generation = gen;
@@ -261,6 +465,10 @@ aku_Status MetaVolume::set_generation(u32 id, u32 gen) {
         auto pvol = get_volref(double_write_buffer_.data(), id);
         pvol->generation = gen;
 
+        // Volume content is discarded
+        reset_summary(id, gen, pvol->capacity);
+        save_summary(id, true);
+
         VolumeRegistry::VolumeDesc vol;
         vol.nblocks      = pvol->nblocks;
         vol.generation   = pvol->generation;
@@ -284,14 +492,24 @@ aku_Status MetaVolume::flush(u32 id) {
 
 //--------------------------- Volume -----------------------------------//
 
-Volume::Volume(const char* path, size_t write_pos)
+Volume::Volume(const char* path, size_t write_pos, bool direct_io)
     : apr_pool_(_make_apr_pool())
     , apr_file_handle_(_open_file(path, apr_pool_.get()))
     , file_size_(static_cast<u32>(_get_file_size(apr_file_handle_.get())/AKU_BLOCK_SIZE))
     , write_pos_(static_cast<u32>(write_pos))
     , path_(path)
     , mmap_ptr_(nullptr)
+    , direct_fd_(-1)
 {
+    if (direct_io) {
+        direct_fd_ = ::open(path, O_RDWR|O_DIRECT);
+        if (direct_fd_ >= 0) {
+            return;
+        }
+        // Fallback on error (e.g. file system doesn't support O_DIRECT)
+        boost::system::error_code error(errno, boost::system::system_category());
+        Logger::msg(AKU_LOG_ERROR, path_ + " can't be opened in O_DIRECT mode: '" + error.message() + "', fallback to page cache");
+    }
 #if UINTPTR_MAX == 0xFFFFFFFFFFFFFFFF
     // 64-bit architecture, we can use mmap for speed
     mmap_.reset(new MemoryMappedFile(path, false));
@@ -312,6 +530,41 @@ Volume::Volume(const char* path, size_t write_pos)
 #endif
 }
 
+Volume::~Volume() {
+    if (direct_fd_ >= 0) {
+        ::close(direct_fd_);
+    }
+}
+
+/** Thread-local buffer aligned to the block size.
+  * O_DIRECT requires buffers aligned to the logical block size of the device,
+  * pooled Block buffers don't have this guarantee.
+  */
+static u8* _aligned_buffer() {
+    struct AlignedBuffer {
+        void* ptr;
+        AlignedBuffer() : ptr(nullptr) {
+            if (posix_memalign(&ptr, AKU_BLOCK_SIZE, AKU_BLOCK_SIZE) != 0) {
+                AKU_PANIC("Can't allocate aligned buffer");
+            }
+        }
+        ~AlignedBuffer() {
+            free(ptr);
+        }
+    };
+    static thread_local AlignedBuffer buffer;
+    return static_cast<u8*>(buffer.ptr);
+}
+
+static void panic_on_errno(ssize_t res, const char* msg) {
+    if (res != static_cast<ssize_t>(AKU_BLOCK_SIZE)) {
+        auto code = res < 0 ? errno : EIO;
+        boost::system::error_code error(code, boost::system::system_category());
+        Logger::msg(AKU_LOG_ERROR, std::string(msg) + " " + error.message());
+        AKU_PANIC(msg);
+    }
+}
+
 void Volume::reset() {
     write_pos_ = 0;
 }
@@ -321,9 +574,9 @@ void Volume::create_new(const char* path, size_t capacity) {
     _create_file(path, size);
 }
 
-std::unique_ptr<Volume> Volume::open_existing(const char* path, size_t pos) {
+std::unique_ptr<Volume> Volume::open_existing(const char* path, size_t pos, bool direct_io) {
     std::unique_ptr<Volume> result;
-    result.reset(new Volume(path, pos));
+    result.reset(new Volume(path, pos, direct_io));
     return std::move(result);
 }
 
@@ -332,6 +585,14 @@ std::tuple<aku_Status, BlockAddr> Volume::append_block(const u8* source) {
     if (write_pos_ >= file_size_) {
         return std::make_tuple(AKU_EOVERFLOW, 0u);
     }
+    if (direct_fd_ >= 0) {
+        auto buffer = _aligned_buffer();
+        memcpy(buffer, source, AKU_BLOCK_SIZE);
+        off_t offset = static_cast<off_t>(write_pos_) * AKU_BLOCK_SIZE;
+        panic_on_errno(::pwrite(direct_fd_, buffer, AKU_BLOCK_SIZE, offset), "Volume write error");
+        auto result = write_pos_++;
+        return std::make_tuple(AKU_SUCCESS, result);
+    }
     apr_off_t seek_off = write_pos_ * AKU_BLOCK_SIZE;
     apr_status_t status = apr_file_seek(apr_file_handle_.get(), APR_SET, &seek_off);
     panic_on_error(status, "Volume seek error");
@@ -353,6 +614,13 @@ aku_Status Volume::read_block(u32 ix, u8* dest) const {
         memcpy(dest, mmap_ptr_ + offset, AKU_BLOCK_SIZE);
         return AKU_SUCCESS;
     }
+    if (direct_fd_ >= 0) {
+        auto buffer = _aligned_buffer();
+        off_t offset = static_cast<off_t>(ix) * AKU_BLOCK_SIZE;
+        panic_on_errno(::pread(direct_fd_, buffer, AKU_BLOCK_SIZE, offset), "Volume read error");
+        memcpy(dest, buffer, AKU_BLOCK_SIZE);
+        return AKU_SUCCESS;
+    }
     apr_off_t offset = ix * AKU_BLOCK_SIZE;
     apr_status_t status = apr_file_seek(apr_file_handle_.get(), APR_SET, &offset);
     panic_on_error(status, "Volume seek error");
@@ -380,6 +648,19 @@ void Volume::flush() {
     panic_on_error(status, "Volume flush error");
 }
 
+void Volume::lock_in_memory() {
+    if (mmap_ptr_ == nullptr) {
+        Logger::msg(AKU_LOG_INFO, path_ + " is not memory mapped and can't be locked in memory");
+        return;
+    }
+    if (mlock(mmap_ptr_, static_cast<size_t>(file_size_) * AKU_BLOCK_SIZE) != 0) {
+        boost::system::error_code error(errno, boost::system::system_category());
+        Logger::msg(AKU_LOG_ERROR, path_ + " can't be locked in memory: '" + error.message() + "'");
+        return;
+    }
+    Logger::msg(AKU_LOG_INFO, path_ + " locked in memory");
+}
+
 u32 Volume::get_size() const {
     return file_size_;
 }
@@ -388,4 +669,8 @@ std::string Volume::get_path() const {
   return path_;
 }
 
+bool Volume::is_direct_io() const {
+    return direct_fd_ >= 0;
+}
+
 }}  // namespace
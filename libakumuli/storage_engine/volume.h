@@ -17,6 +17,7 @@
 
 #pragma once
 // stdlib
+#include <atomic>
 #include <cstdint>
 #include <future>
 #include <memory>
@@ -42,6 +43,50 @@ typedef std::unique_ptr<apr_pool_t, void (*)(apr_pool_t*)> AprPoolPtr;
 typedef std::unique_ptr<apr_file_t, void (*)(apr_file_t*)> AprFilePtr;
 
 
+/** Bloom filter of series ids of the volume. Bits are never cleared (new
+  * filter is created when the volume is recycled) so the filter can be
+  * checked without locks while the writer updates it.
+  */
+class VolumeFilter {
+    std::vector<std::atomic<u64>> bits_;
+
+public:
+    //! Create empty filter, size is a power of two
+    VolumeFilter(size_t nwords);
+
+    //! Create filter with the given content
+    VolumeFilter(std::vector<u64> const& words);
+
+    //! Add series id, return true if the filter was changed
+    bool add(aku_ParamId id);
+
+    //! Check filter (false positives are possible)
+    bool may_contain(aku_ParamId id) const;
+
+    //! Get copy of the filter content
+    std::vector<u64> get_words() const;
+};
+
+
+//! Volume content summary that can be checked without locks
+struct VolumeSummaryRef {
+    aku_Timestamp begin;
+    aku_Timestamp end;
+    std::shared_ptr<const VolumeFilter> filter;  //< Empty pointer - any series
+};
+
+
+//! Snapshot of the volume summaries of the blockstore
+struct VolumeSummarySnapshot {
+    std::vector<VolumeSummaryRef> volumes;
+
+    /** Check if any volume may contain data of the series `id` from [begin, end] range.
+      * Summaries are conservative, false positives are possible but not false negatives.
+      */
+    bool may_contain(aku_ParamId id, aku_Timestamp begin, aku_Timestamp end) const;
+};
+
+
 /** Class that represents metadata volume.
   * MetaVolume is a file that contains some information
   * about each regullar volume - write position, generation, etc.
@@ -52,13 +97,33 @@ typedef std::unique_ptr<apr_file_t, void (*)(apr_file_t*)> AprFilePtr;
   * a result of the partial sector write).
   */
 class MetaVolume {
+    typedef VolumeRegistry::VolumeSummary VolumeSummary;
+
+    //! Volume content summary
+    struct SummaryState {
+        u32 generation;
+        aku_Timestamp begin;
+        aku_Timestamp end;
+        std::shared_ptr<VolumeFilter> filter;  //< Empty pointer - unknown content
+        u32 filter_nblocks;                    //< Number of blocks covered by the saved filter
+        bool filter_dirty;                     //< Filter was changed since it was saved
+    };
+
     std::shared_ptr<VolumeRegistry>  meta_;
     size_t                           file_size_;
     mutable std::vector<u8>          double_write_buffer_;
     const std::string                path_;
+    //! Content summaries of the volumes
+    std::vector<SummaryState>        summaries_;
 
     MetaVolume(std::shared_ptr<VolumeRegistry> meta);
 
+    //! Clear summary of the volume (when volume is created or recycled)
+    void reset_summary(u32 id, u32 generation, u32 capacity);
+
+    //! Save summary to the volume registry (filter is saved only if `with_filter` is set)
+    void save_summary(u32 id, bool with_filter);
+
 public:
 
     /** Open existing meta-volume.
@@ -81,6 +146,9 @@ public:
 
     size_t get_nvolumes() const;
 
+    //! Add summaries of all non-empty volumes to the snapshot
+    void get_summary_snapshot(VolumeSummarySnapshot* snapshot) const;
+
     // Mutators
 
     /**
@@ -99,9 +167,15 @@ public:
     //! Set volume capacity
     aku_Status set_capacity(u32 id, u32 nblocks);
 
-    //! Set generation
+    //! Set generation (summary of the volume is cleared)
     aku_Status set_generation(u32 id, u32 nblocks);
 
+    /** Add block of the series `id` with [begin, end] time range to the volume summary.
+      * Should be called before `set_nblocks`.
+      * @param nblocks is a number of blocks in the volume including the new one
+      */
+    aku_Status add_to_summary(u32 volid, u32 nblocks, aku_ParamId id, aku_Timestamp begin, aku_Timestamp end);
+
     //! Flush entire file
     void flush();
 
@@ -114,15 +188,23 @@ class Volume {
     AprPoolPtr  apr_pool_;
     AprFilePtr  apr_file_handle_;
     u32         file_size_;
-    u32         write_pos_;
+    //! Number of written blocks (O_DIRECT reads are done without the blockstore lock)
+    std::atomic<u32> write_pos_;
     std::string path_;
     // Optional mmap
     std::unique_ptr<MemoryMappedFile> mmap_;
     const u8* mmap_ptr_;
+    // File descriptor opened with O_DIRECT (-1 if direct I/O is not used)
+    int direct_fd_;
 
-    Volume(const char* path, size_t write_pos);
+    Volume(const char* path, size_t write_pos, bool direct_io);
     
 public:
+    ~Volume();
+
+    Volume(Volume const&) = delete;
+    Volume& operator = (Volume const&) = delete;
+
     /** Create new volume.
       * @param path Path to volume.
       * @param capacity Size of the volume in blocks.
@@ -134,9 +216,10 @@ public:
       * @throw std::runtime_error on error.
       * @param path Path to volume file.
       * @param pos Write position inside volume (in blocks).
+      * @param direct_io Bypass page cache (use O_DIRECT instead of mmap).
       * @return New instance of V2::Volume.
       */
-    static std::unique_ptr<Volume> open_existing(const char* path, size_t pos);
+    static std::unique_ptr<Volume> open_existing(const char* path, size_t pos, bool direct_io = false);
 
     // Mutators
 
@@ -148,6 +231,9 @@ public:
     //! Flush volume
     void flush();
 
+    //! Lock memory mapped volume in memory (no-op if mmap is not used)
+    void lock_in_memory();
+
     // Accessors
 
     //! Read filxed size block from file
@@ -165,6 +251,9 @@ public:
 
     //! Return path of volume
     std::string get_path() const;
+
+    //! Return true if the volume is opened in O_DIRECT mode
+    bool is_direct_io() const;
 };
 
 }  // namespace V2
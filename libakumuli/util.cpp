@@ -408,6 +408,106 @@ void RWLock::unlock() {
     }
 }
 
+// ScalableRWLock //
+
+//! Size of the visible readers table (should be a power of two)
+static const int VISIBLE_READERS_TABLE_SIZE = 4096;
+//! Read bias is disabled for N*revocation-time after each revocation
+static const u64 INHIBIT_MULTIPLIER = 9;
+
+static std::atomic<const void*> g_visible_readers[VISIBLE_READERS_TABLE_SIZE];
+static std::atomic<u64> g_rd_contended;
+static std::atomic<u64> g_wr_contended;
+static std::atomic<u64> g_revocations;
+
+static u64 steady_clock_ns() {
+    return static_cast<u64>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+static int visible_readers_slot(const void* lock) {
+    static thread_local char thread_tag;
+    u64 h = reinterpret_cast<u64>(lock) ^ (reinterpret_cast<u64>(&thread_tag) >> 4);
+    h *= 0x9E3779B97F4A7C15ull;
+    return static_cast<int>(h >> 52) & (VISIBLE_READERS_TABLE_SIZE - 1);
+}
+
+ScalableRWLock::ScalableRWLock()
+    : rbias_(1)
+    , inhibit_until_(0)
+{
+}
+
+int ScalableRWLock::rdlock() {
+    if (rbias_.load(std::memory_order_acquire)) {
+        int slot = visible_readers_slot(this);
+        const void* expected = nullptr;
+        if (g_visible_readers[slot].compare_exchange_strong(expected, this)) {
+            // Writer could revoke the bias after the first check, it will wait for this slot
+            // to become empty if it didn't see the bias
+            if (rbias_.load()) {
+                return slot;
+            }
+            g_visible_readers[slot].store(nullptr, std::memory_order_release);
+        }
+    }
+    if (!lock_.try_rdlock()) {
+        g_rd_contended.fetch_add(1, std::memory_order_relaxed);
+        lock_.rdlock();
+    }
+    if (!rbias_.load(std::memory_order_relaxed) &&
+        steady_clock_ns() >= inhibit_until_.load(std::memory_order_relaxed))
+    {
+        // Writers can't revoke bias concurrently because we're holding the read lock
+        rbias_.store(1);
+    }
+    return -1;
+}
+
+void ScalableRWLock::rdunlock(int slot) {
+    if (slot >= 0) {
+        g_visible_readers[slot].store(nullptr, std::memory_order_release);
+    } else {
+        lock_.unlock();
+    }
+}
+
+void ScalableRWLock::wrlock() {
+    if (!lock_.try_wrlock()) {
+        g_wr_contended.fetch_add(1, std::memory_order_relaxed);
+        lock_.wrlock();
+    }
+    if (rbias_.load(std::memory_order_relaxed)) {
+        rbias_.store(0);
+        auto start = steady_clock_ns();
+        bool contended = false;
+        for (int i = 0; i < VISIBLE_READERS_TABLE_SIZE; i++) {
+            while (g_visible_readers[i].load() == this) {
+                contended = true;
+                std::this_thread::yield();
+            }
+        }
+        auto stop = steady_clock_ns();
+        inhibit_until_.store(stop + (stop - start) * INHIBIT_MULTIPLIER, std::memory_order_relaxed);
+        g_revocations.fetch_add(1, std::memory_order_relaxed);
+        if (contended) {
+            g_wr_contended.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+}
+
+void ScalableRWLock::wrunlock() {
+    lock_.unlock();
+}
+
+ScalableRWLockStats ScalableRWLock::get_stats() {
+    ScalableRWLockStats stats = {};
+    stats.rd_contended = g_rd_contended.load(std::memory_order_relaxed);
+    stats.wr_contended = g_wr_contended.load(std::memory_order_relaxed);
+    stats.revocations  = g_revocations.load(std::memory_order_relaxed);
+    return stats;
+}
+
 bool same_value(double a, double b) {
     union Bits {
         double d;
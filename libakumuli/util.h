@@ -151,7 +151,89 @@ struct LockGuard {
 };
 
 using UniqueLock = LockGuard<RWLock, &RWLock::wrlock>;
-using SharedLock = LockGuard<RWLock, &RWLock::wrlock>;
+using SharedLock = LockGuard<RWLock, &RWLock::rdlock>;
+
+//! Contention counters of all `ScalableRWLock` instances
+struct ScalableRWLockStats {
+    //! Number of times reader had to wait for the writer
+    u64 rd_contended;
+    //! Number of times writer had to wait for another writer or reader
+    u64 wr_contended;
+    //! Number of times writer had to revoke read bias
+    u64 revocations;
+};
+
+/** Read-scalable reader writer lock.
+  * Readers don't write to the lock itself while the lock is read-biased. Instead,
+  * they publish themselves in the process-wide table of visible readers, so
+  * concurrent readers of the same object don't bounce the same cache line
+  * between cores. Writer revokes the bias and waits until all published readers
+  * are gone. Read bias is restored only after some time proportional to revocation
+  * cost, frequently written locks behave like the plain `RWLock` (BRAVO scheme).
+  */
+class ScalableRWLock {
+    RWLock           lock_;
+    std::atomic<int> rbias_;
+    std::atomic<u64> inhibit_until_;
+
+public:
+    ScalableRWLock();
+
+    ScalableRWLock(ScalableRWLock const&) = delete;
+    ScalableRWLock(ScalableRWLock &&) = delete;
+    ScalableRWLock& operator = (ScalableRWLock const&) = delete;
+
+    /** Acquire read lock.
+      * @return slot in the visible readers table that should be passed to `rdunlock`
+      */
+    int rdlock();
+
+    void rdunlock(int slot);
+
+    void wrlock();
+
+    void wrunlock();
+
+    //! Read contention counters (aggregated over all instances)
+    static ScalableRWLockStats get_stats();
+};
+
+struct ScalableSharedLock {
+    ScalableRWLock& lock;
+    const int slot;
+
+    ScalableSharedLock(ScalableRWLock& lock)
+        : lock(lock)
+        , slot(lock.rdlock())
+    {
+    }
+
+    ScalableSharedLock(ScalableSharedLock const&) = delete;
+    ScalableSharedLock(ScalableSharedLock &&) = delete;
+    ScalableSharedLock& operator = (ScalableSharedLock const&) = delete;
+
+    ~ScalableSharedLock() {
+        lock.rdunlock(slot);
+    }
+};
+
+struct ScalableUniqueLock {
+    ScalableRWLock& lock;
+
+    ScalableUniqueLock(ScalableRWLock& lock)
+        : lock(lock)
+    {
+        lock.wrlock();
+    }
+
+    ScalableUniqueLock(ScalableUniqueLock const&) = delete;
+    ScalableUniqueLock(ScalableUniqueLock &&) = delete;
+    ScalableUniqueLock& operator = (ScalableUniqueLock const&) = delete;
+
+    ~ScalableUniqueLock() {
+        lock.wrunlock();
+    }
+};
 
 //! Compare two double values and return true if they are equal at bit-level (needed to supress CLang analyzer warnings).
 bool same_value(double a, double b);
@@ -19,6 +19,18 @@ struct VolumeRegistry {
         u32 generation;
     } VolumeDesc;
 
+    /** Summary of the volume content, time range and bloom filter of series
+      * ids of all blocks stored in the volume.
+      */
+    typedef struct {
+        u32 id;
+        u32 generation;        //< Summary is valid only for this generation of the volume
+        aku_Timestamp begin;
+        aku_Timestamp end;
+        u32 filter_nblocks;    //< Number of blocks of the volume covered by the filter
+        std::vector<u64> filter;
+    } VolumeSummary;
+
     /** Read list of volumes and their sequence numbers.
       * @throw std::runtime_error in a case of error
       */
@@ -37,6 +49,19 @@ struct VolumeRegistry {
      */
     virtual void update_volume(const VolumeDesc& vol) = 0;
 
+    /** Read volume summaries. Volume without summary (or with summary of
+      * the other generation) can contain any data.
+      * @throw std::runtime_error in a case of error
+      */
+    virtual std::vector<VolumeSummary> get_volume_summaries() const = 0;
+
+    /**
+     * @brief Update volume summary asynchronously
+     * @param summary is a volume summary, if `filter` is empty only the time range
+     *        and `filter_nblocks` are updated
+     */
+    virtual void update_volume_summary(const VolumeSummary& summary) = 0;
+
     /**
      * @brief Get name of the database
      * @return database name
@@ -0,0 +1,143 @@
+#include "e2e_tools.h"
+#include "perftest_tools.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+#include <boost/asio.hpp>
+
+#include <dirent.h>
+#include <unistd.h>
+
+namespace Akumuli {
+namespace E2E {
+
+using boost::asio::ip::tcp;
+
+uint64_t now_ns() {
+    auto ts = std::chrono::system_clock::now().time_since_epoch();
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(ts).count());
+}
+
+uint64_t steady_ns() {
+    auto ts = std::chrono::steady_clock::now().time_since_epoch();
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(ts).count());
+}
+
+static std::string http_request(std::string const& host, int port, std::string const& request) {
+    boost::asio::io_service io;
+    tcp::socket sock(io);
+    auto addr = boost::asio::ip::address::from_string(host);
+    sock.connect(tcp::endpoint(addr, static_cast<unsigned short>(port)));
+    boost::asio::write(sock, boost::asio::buffer(request));
+    boost::asio::streambuf resp;
+    boost::system::error_code error;
+    boost::asio::read(sock, resp, boost::asio::transfer_all(), error);
+    if (error && error != boost::asio::error::eof) {
+        throw boost::system::system_error(error);
+    }
+    return std::string(boost::asio::buffers_begin(resp.data()), boost::asio::buffers_end(resp.data()));
+}
+
+std::string http_post(std::string const& host, int port, std::string const& path, std::string const& body) {
+    std::stringstream req;
+    req << "POST " << path << " HTTP/1.1\r\n"
+        << "Host: " << host << "\r\n"
+        << "Content-Length: " << body.size() << "\r\n"
+        << "Connection: close\r\n\r\n"
+        << body;
+    return http_request(host, port, req.str());
+}
+
+std::string http_get(std::string const& host, int port, std::string const& path) {
+    std::stringstream req;
+    req << "GET " << path << " HTTP/1.1\r\n"
+        << "Host: " << host << "\r\n"
+        << "Connection: close\r\n\r\n";
+    auto resp = http_request(host, port, req.str());
+    auto pos = resp.find("\r\n\r\n");
+    return pos == std::string::npos ? std::string() : resp.substr(pos + 4);
+}
+
+bool wait_visible(std::string const& host, int http_port, std::string const& metric, uint64_t id, uint64_t ts, double timeout) {
+    std::stringstream query;
+    query << "{ \"select\": \"" << metric << "\", "
+          << "\"range\": { \"from\": \"" << ts << "\", \"to\": \"" << (ts + 1) << "\" }, "
+          << "\"where\": { \"id\": \"" << id << "\" } }";
+    std::string marker = metric + " id=" + std::to_string(id);
+    PerfTimer tm;
+    while (tm.elapsed() < timeout) {
+        auto resp = http_post(host, http_port, "/api/query", query.str());
+        if (resp.find(marker) != std::string::npos) {
+            return true;
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+    return false;
+}
+
+int find_server_pid() {
+    DIR* dir = opendir("/proc");
+    if (dir == nullptr) {
+        return 0;
+    }
+    int result = 0;
+    while (auto entry = readdir(dir)) {
+        int pid = std::atoi(entry->d_name);
+        if (pid <= 0) {
+            continue;
+        }
+        std::ifstream comm("/proc/" + std::string(entry->d_name) + "/comm");
+        std::string name;
+        if (comm >> name && name == "akumulid") {
+            result = pid;
+            break;
+        }
+    }
+    closedir(dir);
+    return result;
+}
+
+ProcStats read_proc_stats(int pid) {
+    ProcStats result = {};
+    std::ifstream stat("/proc/" + std::to_string(pid) + "/stat");
+    std::string content((std::istreambuf_iterator<char>(stat)), std::istreambuf_iterator<char>());
+    // Skip pid and (comm), comm can contain spaces
+    auto pos = content.rfind(')');
+    if (pos != std::string::npos) {
+        std::stringstream fields(content.substr(pos + 2));
+        std::string field;
+        uint64_t utime = 0, stime = 0;
+        // Fields 3..13 are skipped, utime and stime are fields 14 and 15
+        for (int i = 3; i <= 15 && fields >> field; i++) {
+            if (i == 14) {
+                utime = std::stoull(field);
+            } else if (i == 15) {
+                stime = std::stoull(field);
+            }
+        }
+        result.cpu_time = static_cast<double>(utime + stime) / static_cast<double>(sysconf(_SC_CLK_TCK));
+    }
+    std::ifstream status("/proc/" + std::to_string(pid) + "/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.compare(0, 6, "VmRSS:") == 0) {
+            result.rss = std::stoull(line.substr(6)) * 1024;
+        }
+    }
+    return result;
+}
+
+uint64_t percentile(std::vector<uint64_t> const& sorted, double q) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    size_t ix = static_cast<size_t>(q * static_cast<double>(sorted.size() - 1) + 0.5);
+    return sorted.at(std::min(ix, sorted.size() - 1));
+}
+
+}  // namespace E2E
+}  // namespace Akumuli
@@ -0,0 +1,44 @@
+/**
+ * Helpers for the benchmarks that drive running akumulid instance
+ * (perf_e2e_ingestion, perf_replay).
+ */
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace Akumuli {
+namespace E2E {
+
+//! Wall clock time in nanoseconds
+uint64_t now_ns();
+
+//! Monotonic time in nanoseconds
+uint64_t steady_ns();
+
+//! Send HTTP POST request and return response (including headers)
+std::string http_post(std::string const& host, int port, std::string const& path, std::string const& body);
+
+//! Send HTTP GET request and return response body
+std::string http_get(std::string const& host, int port, std::string const& path);
+
+/** Wait until the probe point `<metric> id=<id>` with timestamp `ts` becomes
+  * visible through the query API. Return false on timeout.
+  */
+bool wait_visible(std::string const& host, int http_port, std::string const& metric, uint64_t id, uint64_t ts, double timeout);
+
+//! Find akumulid process by name, return 0 if not found
+int find_server_pid();
+
+struct ProcStats {
+    double   cpu_time;    //< User + system time in seconds
+    uint64_t rss;         //< Resident set size in bytes
+};
+
+ProcStats read_proc_stats(int pid);
+
+//! Get percentile of the sorted sample
+uint64_t percentile(std::vector<uint64_t> const& sorted, double q);
+
+}  // namespace E2E
+}  // namespace Akumuli
@@ -0,0 +1,529 @@
+/**
+ * Copyright (c) 2017 Eugene Lazin <4lazin@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/** Microbenchmark harness.
+  * Runs every registered benchmark (or the ones that match `--filter`) with warmup
+  * and several repetitions and reports per-iteration time statistics, throughput,
+  * number of allocations and hardware counters. Results can be saved in JSON format
+  * and compared using `scripts/compare_benchmarks.py`.
+  */
+
+#include "microbench.h"
+#include "perftest_tools.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <regex>
+#include <thread>
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <boost/program_options.hpp>
+#include <boost/property_tree/json_parser.hpp>
+#include <boost/property_tree/ptree.hpp>
+
+namespace Akumuli {
+namespace MicroBench {
+
+// --------------------- //
+// Hardware counters     //
+// --------------------- //
+
+/** Group of hardware counters of the current thread.
+  * Counters are optional, perf_event_open can be unavailable (not Linux, no
+  * permissions, virtualized environment), in this case all values are zeroes.
+  */
+class PerfEventGroup {
+    enum {
+        NCOUNTERS = 4,
+    };
+    int fds_[NCOUNTERS];
+    bool enabled_;
+
+    static int open_counter(uint64_t config, int group_fd) {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size           = sizeof(attr);
+        attr.type           = PERF_TYPE_HARDWARE;
+        attr.config         = config;
+        attr.disabled       = group_fd == -1 ? 1 : 0;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv     = 1;
+        attr.read_format    = PERF_FORMAT_GROUP;
+        return static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, group_fd, 0));
+    }
+
+public:
+    PerfEventGroup()
+        : enabled_(false)
+    {
+        std::fill(fds_, fds_ + NCOUNTERS, -1);
+    }
+
+    ~PerfEventGroup() {
+        for (auto fd: fds_) {
+            if (fd >= 0) {
+                close(fd);
+            }
+        }
+    }
+
+    bool open() {
+        const uint64_t configs[NCOUNTERS] = {
+            PERF_COUNT_HW_CPU_CYCLES,
+            PERF_COUNT_HW_INSTRUCTIONS,
+            PERF_COUNT_HW_CACHE_MISSES,
+            PERF_COUNT_HW_BRANCH_MISSES,
+        };
+        for (int i = 0; i < NCOUNTERS; i++) {
+            fds_[i] = open_counter(configs[i], i == 0 ? -1 : fds_[0]);
+            if (fds_[i] < 0) {
+                return false;
+            }
+        }
+        ioctl(fds_[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(fds_[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        enabled_ = true;
+        return true;
+    }
+
+    bool is_enabled() const {
+        return enabled_;
+    }
+
+    PerfCounters read_counters() const {
+        PerfCounters result = {};
+        if (!enabled_) {
+            return result;
+        }
+        struct {
+            uint64_t nr;
+            uint64_t values[NCOUNTERS];
+        } data;
+        if (::read(fds_[0], &data, sizeof(data)) != sizeof(data) || data.nr != NCOUNTERS) {
+            return result;
+        }
+        result.cycles        = data.values[0];
+        result.instructions  = data.values[1];
+        result.cache_misses  = data.values[2];
+        result.branch_misses = data.values[3];
+        return result;
+    }
+};
+
+static PerfEventGroup& perf_events() {
+    static PerfEventGroup group;
+    return group;
+}
+
+static uint64_t now_ns() {
+    auto ts = std::chrono::steady_clock::now().time_since_epoch();
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(ts).count());
+}
+
+static PerfCounters operator - (PerfCounters const& lhs, PerfCounters const& rhs) {
+    PerfCounters res;
+    res.cycles        = lhs.cycles - rhs.cycles;
+    res.instructions  = lhs.instructions - rhs.instructions;
+    res.cache_misses  = lhs.cache_misses - rhs.cache_misses;
+    res.branch_misses = lhs.branch_misses - rhs.branch_misses;
+    return res;
+}
+
+static PerfCounters& operator += (PerfCounters& lhs, PerfCounters const& rhs) {
+    lhs.cycles        += rhs.cycles;
+    lhs.instructions  += rhs.instructions;
+    lhs.cache_misses  += rhs.cache_misses;
+    lhs.branch_misses += rhs.branch_misses;
+    return lhs;
+}
+
+// ----- //
+// State //
+// ----- //
+
+State::State(uint64_t iterations)
+    : iterations_(iterations)
+    , items_(0)
+    , bytes_(0)
+    , start_ns_(0)
+    , elapsed_ns_(0)
+    , start_counters_{}
+    , counters_{}
+    , start_allocs_(0)
+    , allocs_(0)
+    , running_(false)
+{
+}
+
+uint64_t State::iterations() const {
+    return iterations_;
+}
+
+void State::set_items_processed(uint64_t items) {
+    items_ = items;
+}
+
+void State::set_bytes_processed(uint64_t bytes) {
+    bytes_ = bytes;
+}
+
+void State::pause() {
+    if (!running_) {
+        return;
+    }
+    auto end = now_ns();
+    counters_ += perf_events().read_counters() - start_counters_;
+    allocs_ += get_allocation_stats().count - start_allocs_;
+    elapsed_ns_ += end - start_ns_;
+    running_ = false;
+}
+
+void State::resume() {
+    if (running_) {
+        return;
+    }
+    running_ = true;
+    start_allocs_ = get_allocation_stats().count;
+    start_counters_ = perf_events().read_counters();
+    start_ns_ = now_ns();
+}
+
+void State::set_error(std::string msg) {
+    error_ = msg;
+}
+
+void State::start() {
+    resume();
+}
+
+void State::stop() {
+    pause();
+}
+
+uint64_t State::elapsed_ns() const {
+    return elapsed_ns_;
+}
+
+uint64_t State::items() const {
+    return items_ ? items_ : iterations_;
+}
+
+uint64_t State::bytes() const {
+    return bytes_;
+}
+
+uint64_t State::allocations() const {
+    return allocs_;
+}
+
+PerfCounters const& State::counters() const {
+    return counters_;
+}
+
+std::string const& State::error() const {
+    return error_;
+}
+
+// -------- //
+// Registry //
+// -------- //
+
+static std::map<std::string, BenchmarkFn>& registry() {
+    static std::map<std::string, BenchmarkFn> reg;
+    return reg;
+}
+
+bool register_benchmark(std::string name, BenchmarkFn fn) {
+    registry()[name] = fn;
+    return true;
+}
+
+// ------ //
+// Runner //
+// ------ //
+
+struct Options {
+    std::string filter;
+    int         repetitions;
+    int         warmup;
+    double      min_time;
+    std::string json;
+    std::string label;
+    bool        counters;
+};
+
+//! Results of the single run normalized per item
+struct RunResult {
+    double ns_per_item;
+    double bytes_per_item;
+    double allocs_per_item;
+    double cycles;
+    double instructions;
+    double cache_misses;
+    double branch_misses;
+};
+
+struct Summary {
+    double mean;
+    double median;
+    double stddev;
+    double min;
+    double max;
+};
+
+static Summary summarize(std::vector<double> values) {
+    Summary res = {};
+    if (values.empty()) {
+        return res;
+    }
+    std::sort(values.begin(), values.end());
+    size_t n = values.size();
+    double sum = 0;
+    for (auto x: values) {
+        sum += x;
+    }
+    res.mean = sum / n;
+    res.median = n % 2 ? values[n/2] : (values[n/2 - 1] + values[n/2]) / 2;
+    double var = 0;
+    for (auto x: values) {
+        var += (x - res.mean)*(x - res.mean);
+    }
+    res.stddev = n > 1 ? std::sqrt(var / (n - 1)) : 0;
+    res.min = values.front();
+    res.max = values.back();
+    return res;
+}
+
+//! Run benchmark with specified number of iterations
+static State execute(BenchmarkFn const& fn, uint64_t iterations) {
+    State state(iterations);
+    state.start();
+    fn(state);
+    state.stop();
+    return state;
+}
+
+//! Find number of iterations that takes at least `min_time` seconds
+static uint64_t calibrate(BenchmarkFn const& fn, double min_time, std::string* error) {
+    const uint64_t MAX_ITERATIONS = 1000000000ull;
+    const double min_ns = min_time * 1e9;
+    uint64_t iterations = 1;
+    while (true) {
+        auto state = execute(fn, iterations);
+        if (!state.error().empty()) {
+            *error = state.error();
+            return 0;
+        }
+        double elapsed = static_cast<double>(state.elapsed_ns());
+        if (elapsed >= min_ns || iterations >= MAX_ITERATIONS) {
+            return iterations;
+        }
+        double multiplier = elapsed > 0 ? min_ns * 1.4 / elapsed : 10;
+        multiplier = std::min(std::max(multiplier, 2.0), 10.0);
+        iterations = std::min(MAX_ITERATIONS, static_cast<uint64_t>(iterations * multiplier));
+    }
+}
+
+static void add_summary(boost::property_tree::ptree* tree, std::string name, Summary const& s) {
+    boost::property_tree::ptree item;
+    item.add("mean", s.mean);
+    item.add("median", s.median);
+    item.add("stddev", s.stddev);
+    item.add("min", s.min);
+    item.add("max", s.max);
+    tree->add_child(name, item);
+}
+
+static bool run_benchmark(std::string const& name, BenchmarkFn const& fn, Options const& opt,
+                          boost::property_tree::ptree* out)
+{
+    std::string error;
+    auto iterations = calibrate(fn, opt.min_time, &error);
+    if (iterations == 0) {
+        std::cerr << name << ": " << error << std::endl;
+        return false;
+    }
+    for (int i = 0; i < opt.warmup; i++) {
+        execute(fn, iterations);
+    }
+    std::vector<RunResult> runs;
+    uint64_t items = 0;
+    for (int i = 0; i < opt.repetitions; i++) {
+        auto state = execute(fn, iterations);
+        if (!state.error().empty()) {
+            std::cerr << name << ": " << state.error() << std::endl;
+            return false;
+        }
+        double nitems = static_cast<double>(state.items());
+        items = state.items();
+        RunResult r;
+        r.ns_per_item     = state.elapsed_ns() / nitems;
+        r.bytes_per_item  = state.bytes() / nitems;
+        r.allocs_per_item = state.allocations() / nitems;
+        r.cycles          = state.counters().cycles / nitems;
+        r.instructions    = state.counters().instructions / nitems;
+        r.cache_misses    = state.counters().cache_misses / nitems;
+        r.branch_misses   = state.counters().branch_misses / nitems;
+        runs.push_back(r);
+    }
+
+    auto collect = [&runs](double RunResult::*field) {
+        std::vector<double> res;
+        for (auto const& r: runs) {
+            res.push_back(r.*field);
+        }
+        return summarize(res);
+    };
+    auto time = collect(&RunResult::ns_per_item);
+    auto allocs = collect(&RunResult::allocs_per_item);
+    auto bytes = collect(&RunResult::bytes_per_item);
+    double items_per_sec = time.median > 0 ? 1e9 / time.median : 0;
+
+    boost::property_tree::ptree item;
+    item.add("name", name);
+    item.add("iterations", iterations);
+    item.add("items", items);
+    item.add("repetitions", opt.repetitions);
+    add_summary(&item, "ns_per_item", time);
+    item.add("items_per_second", items_per_sec);
+    if (bytes.median > 0) {
+        item.add("bytes_per_second", bytes.median * items_per_sec);
+    }
+    item.add("allocations_per_item", allocs.median);
+
+    char ipc[32] = "-";
+    if (perf_events().is_enabled()) {
+        auto cycles = collect(&RunResult::cycles);
+        auto instr  = collect(&RunResult::instructions);
+        boost::property_tree::ptree counters;
+        counters.add("cycles", cycles.median);
+        counters.add("instructions", instr.median);
+        counters.add("cache_misses", collect(&RunResult::cache_misses).median);
+        counters.add("branch_misses", collect(&RunResult::branch_misses).median);
+        item.add_child("counters", counters);
+        if (cycles.median > 0) {
+            snprintf(ipc, sizeof(ipc), "%.2f", instr.median / cycles.median);
+        }
+    }
+    out->push_back(std::make_pair("", item));
+
+    char line[256];
+    snprintf(line, sizeof(line), "%-40s %12.2f ns %7.2f%% %14.0f items/s %8s IPC %8.2f allocs",
+             name.c_str(), time.median, time.mean > 0 ? 100.0 * time.stddev / time.mean : 0.0,
+             items_per_sec, ipc, allocs.median);
+    std::cout << line << std::endl;
+    return true;
+}
+
+static std::string get_hostname() {
+    char buf[256] = {};
+    if (gethostname(buf, sizeof(buf) - 1) != 0) {
+        return "unknown";
+    }
+    return buf;
+}
+
+static int run_all(Options const& opt) {
+    std::regex filter(opt.filter);
+    if (opt.counters && !perf_events().open()) {
+        std::cerr << "Hardware counters are not available" << std::endl;
+    }
+    boost::property_tree::ptree benchmarks;
+    int nfailed = 0;
+    char header[256];
+    snprintf(header, sizeof(header), "%-40s %15s %8s %23s %12s %15s",
+             "benchmark", "time/item", "cv", "throughput", "IPC", "allocs/item");
+    std::cout << header << std::endl;
+    for (auto const& kv: registry()) {
+        if (!std::regex_search(kv.first, filter)) {
+            continue;
+        }
+        if (!run_benchmark(kv.first, kv.second, opt, &benchmarks)) {
+            nfailed++;
+        }
+    }
+    if (!opt.json.empty()) {
+        boost::property_tree::ptree report;
+        report.add("context.label", opt.label);
+        report.add("context.host", get_hostname());
+        report.add("context.ncpu", std::thread::hardware_concurrency());
+        report.add("context.date", std::time(nullptr));
+        report.add("context.min_time", opt.min_time);
+        report.add("context.counters", perf_events().is_enabled());
+        report.add_child("benchmarks", benchmarks);
+        if (opt.json == "-") {
+            boost::property_tree::json_parser::write_json(std::cout, report, true);
+        } else {
+            std::ofstream out(opt.json);
+            boost::property_tree::json_parser::write_json(out, report, true);
+        }
+    }
+    return nfailed ? -1 : 0;
+}
+
+}  // namespace MicroBench
+}  // namespace Akumuli
+
+namespace po = boost::program_options;
+
+int main(int argc, char** argv) {
+    using namespace Akumuli::MicroBench;
+    Options opt;
+    po::options_description desc("Akumuli microbenchmarks");
+    desc.add_options()
+        ("help", "Produce help message")
+        ("list", "List benchmarks")
+        ("filter", po::value<std::string>(&opt.filter)->default_value("."), "Run benchmarks that match regex")
+        ("repetitions", po::value<int>(&opt.repetitions)->default_value(10), "Number of measured runs")
+        ("warmup", po::value<int>(&opt.warmup)->default_value(1), "Number of warmup runs")
+        ("min-time", po::value<double>(&opt.min_time)->default_value(0.1), "Minimal duration of the run (seconds)")
+        ("json", po::value<std::string>(&opt.json)->default_value(""), "Save results to file in JSON format ('-' for stdout)")
+        ("label", po::value<std::string>(&opt.label)->default_value(""), "Label of the results (commit hash, build type)")
+        ("no-counters", "Don't collect hardware counters")
+        ;
+    po::variables_map vm;
+    try {
+        po::store(po::parse_command_line(argc, argv, desc), vm);
+        po::notify(vm);
+    } catch (po::error const& e) {
+        std::cerr << e.what() << std::endl;
+        std::cerr << desc << std::endl;
+        return -1;
+    }
+    if (vm.count("help")) {
+        std::cout << desc << std::endl;
+        return 0;
+    }
+    if (vm.count("list")) {
+        for (auto const& kv: registry()) {
+            std::cout << kv.first << std::endl;
+        }
+        return 0;
+    }
+    opt.counters = vm.count("no-counters") == 0;
+    opt.repetitions = std::max(opt.repetitions, 1);
+    opt.warmup = std::max(opt.warmup, 0);
+    return run_all(opt);
+}
@@ -0,0 +1,116 @@
+/**
+ * Copyright (c) 2017 Eugene Lazin <4lazin@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace Akumuli {
+namespace MicroBench {
+
+/** Hardware counters (read using perf_event_open if available).
+  */
+struct PerfCounters {
+    uint64_t cycles;
+    uint64_t instructions;
+    uint64_t cache_misses;
+    uint64_t branch_misses;
+};
+
+/** Benchmark state, passed to every benchmark function.
+  * Benchmark should perform `iterations()` operations, the harness chooses number
+  * of iterations so each run takes at least `--min-time` seconds. Code that shouldn't
+  * be measured (per-run setup) should be surrounded by `pause()` and `resume()` calls.
+  */
+class State {
+    uint64_t     iterations_;
+    uint64_t     items_;
+    uint64_t     bytes_;
+    uint64_t     start_ns_;
+    uint64_t     elapsed_ns_;
+    PerfCounters start_counters_;
+    PerfCounters counters_;
+    uint64_t     start_allocs_;
+    uint64_t     allocs_;
+    bool         running_;
+    std::string  error_;
+
+public:
+    State(uint64_t iterations);
+
+    uint64_t iterations() const;
+
+    //! Set number of items processed by the whole run (default is `iterations()`)
+    void set_items_processed(uint64_t items);
+
+    //! Set number of bytes processed by the whole run
+    void set_bytes_processed(uint64_t bytes);
+
+    //! Stop the clock and hardware counters
+    void pause();
+
+    //! Restart the clock and hardware counters
+    void resume();
+
+    //! Mark run as failed, results will be discarded
+    void set_error(std::string msg);
+
+    // Used by the harness
+    void start();
+    void stop();
+    uint64_t elapsed_ns() const;
+    uint64_t items() const;
+    uint64_t bytes() const;
+    uint64_t allocations() const;
+    PerfCounters const& counters() const;
+    std::string const& error() const;
+};
+
+typedef std::function<void(State&)> BenchmarkFn;
+
+//! Register benchmark (normally via MICROBENCH macro)
+bool register_benchmark(std::string name, BenchmarkFn fn);
+
+//! Prevent compiler from optimizing out the value
+template<class T>
+inline void do_not_optimize(T const& value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+//! Prevent compiler from reordering memory accesses around this point
+inline void clobber_memory() {
+    asm volatile("" : : : "memory");
+}
+
+}  // namespace MicroBench
+}  // namespace Akumuli
+
+#define AKU_MB_CONCAT_(a, b) a##b
+#define AKU_MB_CONCAT(a, b) AKU_MB_CONCAT_(a, b)
+
+/** Define and register benchmark.
+  * Usage:
+  *     MICROBENCH(datablock_write) {
+  *         for (uint64_t i = 0; i < state.iterations(); i++) { ... }
+  *     }
+  */
+#define MICROBENCH(name)                                                                           \
+    static void AKU_MB_CONCAT(microbench_, name)(Akumuli::MicroBench::State& state);               \
+    static bool AKU_MB_CONCAT(microbench_reg_, name) __attribute__((unused)) =                     \
+        Akumuli::MicroBench::register_benchmark(#name, &AKU_MB_CONCAT(microbench_, name));         \
+    static void AKU_MB_CONCAT(microbench_, name)(Akumuli::MicroBench::State& state)
@@ -0,0 +1,144 @@
+/**
+ * Concurrent readers of the single hot series while ingesting.
+ * Usage: perf_concurrent_reads [nreaders] [duration-seconds]
+ */
+// C++ headers
+#include <atomic>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+// Lib headers
+#include <apr.h>
+
+// App headers
+#include "storage_engine/blockstore.h"
+#include "storage_engine/nbtree.h"
+#include "log_iface.h"
+#include "util.h"
+#include "perftest_tools.h"
+
+using namespace Akumuli;
+using namespace Akumuli::StorageEngine;
+
+static void console_logger(aku_LogLevel lvl, const char* msg) {
+    if (lvl == AKU_LOG_ERROR) {
+        std::cerr << "ERROR: " << msg << std::endl;
+    }
+}
+
+int main(int argc, char** argv) {
+    apr_initialize();
+    Logger::set_logger(console_logger);
+
+    int nreaders = 16;
+    double duration = 10.0;
+    if (argc > 1) {
+        nreaders = std::atoi(argv[1]);
+    }
+    if (argc > 2) {
+        duration = std::atof(argv[2]);
+    }
+
+    auto bstore = BlockStoreBuilder::create_memstore();
+    std::vector<LogicAddr> empty;
+    auto tree = std::make_shared<NBTreeExtentsList>(42, empty, bstore);
+    tree->force_init();
+
+    // Prefill the tree so readers have something to traverse
+    const aku_Timestamp PREFILL = 1000000;
+    for (aku_Timestamp ts = 0; ts < PREFILL; ts++) {
+        tree->append(ts, static_cast<double>(ts));
+    }
+
+    std::atomic<bool> done = {false};
+    std::atomic<aku_Timestamp> last = {PREFILL};
+    std::atomic<u64> nwrites = {0};
+
+    auto writer = [&]() {
+        aku_Timestamp ts = PREFILL;
+        while (!done) {
+            for (int i = 0; i < 1000; i++) {
+                tree->append(ts, static_cast<double>(ts));
+                ts++;
+            }
+            last = ts;
+            nwrites += 1000;
+        }
+    };
+
+    std::vector<u64> nqueries(static_cast<size_t>(nreaders), 0);
+    std::vector<u64> nsamples(static_cast<size_t>(nreaders), 0);
+    auto reader = [&](int ix) {
+        const size_t BUFSZ = 1024;
+        std::vector<aku_Timestamp> ts(BUFSZ);
+        std::vector<double> xs(BUFSZ);
+        std::vector<AggregationResult> agg(BUFSZ);
+        u64 iter = 0;
+        while (!done) {
+            aku_Timestamp end = last;
+            aku_Timestamp begin = end - 10000;
+            aku_Status status = AKU_SUCCESS;
+            size_t sz = 0;
+            switch (iter++ % 3) {
+            case 0: {
+                // Dashboard tail query
+                auto it = tree->search(begin, end);
+                do {
+                    std::tie(status, sz) = it->read(ts.data(), xs.data(), BUFSZ);
+                    nsamples[ix] += sz;
+                } while (status == AKU_SUCCESS && sz != 0);
+                break;
+            }
+            case 1: {
+                auto it = tree->aggregate(0, end);
+                std::tie(status, sz) = it->read(ts.data(), agg.data(), BUFSZ);
+                nsamples[ix] += sz;
+                break;
+            }
+            case 2: {
+                auto it = tree->group_aggregate(begin, end, 1000);
+                do {
+                    std::tie(status, sz) = it->read(ts.data(), agg.data(), BUFSZ);
+                    nsamples[ix] += sz;
+                } while (status == AKU_SUCCESS && sz != 0);
+                break;
+            }
+            };
+            nqueries[ix]++;
+        }
+    };
+
+    auto allocs = get_allocation_stats();
+    PerfTimer tm;
+    std::thread wth(writer);
+    std::vector<std::thread> rth;
+    for (int i = 0; i < nreaders; i++) {
+        rth.emplace_back(reader, i);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(static_cast<int>(duration*1000)));
+    done = true;
+    wth.join();
+    for (auto& th: rth) {
+        th.join();
+    }
+    double elapsed = tm.elapsed();
+
+    u64 total_queries = 0;
+    u64 total_samples = 0;
+    for (int i = 0; i < nreaders; i++) {
+        total_queries += nqueries[i];
+        total_samples += nsamples[i];
+    }
+    auto stats = ScalableRWLock::get_stats();
+    std::cout << "Readers: " << nreaders << std::endl;
+    std::cout << "Elapsed: " << elapsed << "s" << std::endl;
+    std::cout << "Queries: " << total_queries << " (" << (total_queries / elapsed) << " q/s)" << std::endl;
+    std::cout << "Samples read: " << total_samples << " (" << (total_samples / elapsed) << " samples/s)" << std::endl;
+    std::cout << "Writes: " << nwrites << " (" << (nwrites / elapsed) << " samples/s)" << std::endl;
+    std::cout << "Read contention: " << stats.rd_contended << std::endl;
+    std::cout << "Write contention: " << stats.wr_contended << std::endl;
+    std::cout << "Bias revocations: " << stats.revocations << std::endl;
+    print_allocations(allocs, total_queries);
+    return 0;
+}
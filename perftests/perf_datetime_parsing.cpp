@@ -1,11 +1,37 @@
+#include <cstring>
+#include <iostream>
+
 #include "datetime.h"
 #include "perftest_tools.h"
 
 using namespace Akumuli;
 
+static const int N_ITERS = 100000;
+
+//! Parse all strings N_ITERS times and print timings
+template<class Fn>
+static void run_test(const char* name, const char** test_strings, int n, Fn const& parse) {
+    std::vector<size_t> lengths;
+    for (int i = 0; i < n; i++) {
+        lengths.push_back(std::strlen(test_strings[i]));
+    }
+    u64 acc = 0;
+    PerfTimer timer;
+    for(int k = N_ITERS; k --> 0;) {
+        for(int i = n; i --> 0;) {
+            acc += parse(test_strings[i], lengths[i]);
+        }
+    }
+    double elapsed = timer.elapsed();
+    double nstrings = static_cast<double>(N_ITERS)*n;
+    std::cout << name << std::endl;
+    std::cout << "Summ: " << acc << std::endl;
+    std::cout << "Elapsed: " << elapsed << "s, " << (elapsed / nstrings * 1000000000.0) << " ns per string" << std::endl;
+}
+
 int main() {
 
-    const char* test_strings[] = {
+    const char* basic_strings[] = {
         "20060102T100405.999999999",
         "20060202T110406.888888888",
         "20060302T120407.777777777",
@@ -17,15 +43,68 @@ int main() {
         "20060902T180403.111111111",
         "20061002T190404.000000000"
     };
-    aku_Timestamp tsacc = 0;
-    PerfTimer timer;
-    for(int k = 100000; k --> 0;) {
-        for(int i = 10; i --> 0;) {
-            tsacc += DateTimeUtil::from_iso_string(test_strings[i]);
-        }
-    }
-    double elapsed = timer.elapsed();
-    std::cout << "Summ: " << tsacc << std::endl;
-    std::cout << "Elapsed: " << elapsed << std::endl;
+
+    const char* rfc3339_strings[] = {
+        "2006-01-02T10:04:05.999999999Z",
+        "2006-02-02T11:04:06.888888888+01:00",
+        "2006-03-02T12:04:07.777777777-02:00",
+        "2006-04-02T13:04:08.666666Z",
+        "2006-05-02T14:04:09.555+05:30",
+        "2006-06-02T15:04:00Z",
+        "2006-07-02T16:04:01.333333333+00:00",
+        "2006-08-02T17:04:02.222222222Z",
+        "2006-09-02T18:04:03.111-08:00",
+        "2006-10-02T19:04:04+03:00"
+    };
+
+    const char* raw_strings[] = {
+        "1136196245999999999",
+        "1138878246888888888",
+        "1141300447777777777",
+        "1143982448666666666",
+        "1146578649555555555",
+        "1149260640444444444",
+        "1151852641333333333",
+        "1154538242222222222",
+        "1157220243111111111",
+        "1159815844000000000"
+    };
+
+    const char* durations[] = {
+        "10s",
+        "111n",
+        "111",
+        "111us",
+        "111ms",
+        "111m",
+        "3min",
+        "24h",
+        "1000ms",
+        "15s"
+    };
+
+    run_test("Basic format (throwing API)", basic_strings, 10, [](const char* str, size_t) {
+        return DateTimeUtil::from_iso_string(str);
+    });
+    run_test("Basic format", basic_strings, 10, [](const char* str, size_t len) {
+        aku_Timestamp ts = 0;
+        DateTimeUtil::parse_iso_string(str, len, &ts);
+        return ts;
+    });
+    run_test("RFC 3339 format", rfc3339_strings, 10, [](const char* str, size_t len) {
+        aku_Timestamp ts = 0;
+        DateTimeUtil::parse_iso_string(str, len, &ts);
+        return ts;
+    });
+    run_test("Raw timestamps", raw_strings, 10, [](const char* str, size_t len) {
+        aku_Timestamp ts = 0;
+        DateTimeUtil::parse_iso_string(str, len, &ts);
+        return ts;
+    });
+    run_test("Durations", durations, 10, [](const char* str, size_t len) {
+        aku_Duration d = 0;
+        DateTimeUtil::parse_duration(str, len, &d);
+        return d;
+    });
     return 0;
 }
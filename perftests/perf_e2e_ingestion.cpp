@@ -0,0 +1,424 @@
+/**
+ * End-to-end ingestion benchmark.
+ * Drives running akumulid instance over TCP (RESP or OpenTSDB) or UDP and reports
+ * sustained throughput, server CPU time per point, server memory growth and
+ * write-to-visible latency (measured by polling HTTP query API) as JSON.
+ *
+ * Usage: perf_e2e_ingestion --protocol resp --cardinality 100000 --tags 4 --duration 60
+ *        perf_e2e_ingestion --help
+ */
+// C++ headers
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+// Lib headers
+#include <boost/asio.hpp>
+#include <boost/program_options.hpp>
+#include <boost/property_tree/json_parser.hpp>
+#include <boost/property_tree/ptree.hpp>
+
+// App headers
+#include "e2e_tools.h"
+#include "perftest_tools.h"
+
+using namespace Akumuli;
+using namespace Akumuli::E2E;
+namespace po = boost::program_options;
+using boost::asio::ip::tcp;
+using boost::asio::ip::udp;
+
+typedef uint64_t u64;
+
+enum class Protocol {
+    RESP,
+    OPENTSDB,
+    UDP,
+};
+
+struct Options {
+    std::string host;
+    int         resp_port;
+    int         opentsdb_port;
+    int         udp_port;
+    int         http_port;
+    Protocol    protocol;
+    u64         cardinality;
+    int         ntags;
+    int         ncolumns;       //< Number of metrics per message (bulk format if > 1)
+    int         batch;          //< Number of messages per write
+    double      late_ratio;     //< Fraction of points written in the past
+    u64         late_window;    //< Max delay of the late write (ns)
+    double      churn;          //< Fraction of points that creates new series
+    double      duration;       //< Duration in seconds
+    double      rate;           //< Max points/s (0 - unlimited)
+    int         connections;
+    int         probe_interval; //< Latency probe interval (ms)
+    int         pid;            //< Server pid (0 - autodetect)
+    u64         seed;
+    std::string output;
+};
+
+// ------------------ //
+// Workload generator //
+// ------------------ //
+
+/** Generates messages in the wire format.
+  * Series with index `ix` has tags `id=<ix> tag1=<ix % 10> tag2=<ix % 100> ...`
+  * so cardinality of the individual tags is bounded.
+  */
+class Generator {
+    Options const&              opt_;
+    std::vector<std::string>    metrics_;
+    std::vector<std::string>    tags_;      //< Precomputed tags of the initial series
+    std::atomic<u64>&           new_series_;
+    std::mt19937_64             rand_;
+    std::uniform_real_distribution<double> uniform_;
+
+    std::string make_tags(u64 ix) const {
+        std::stringstream str;
+        str << "id=" << ix;
+        u64 fanout = 10;
+        for (int i = 1; i < opt_.ntags; i++) {
+            str << " tag" << i << "=" << (ix % fanout);
+            fanout *= 10;
+        }
+        return str.str();
+    }
+
+    void format(std::string* out, std::string const& tags, u64 ts, double value) {
+        char buf[64];
+        switch (opt_.protocol) {
+        case Protocol::RESP:
+        case Protocol::UDP:
+            if (opt_.ncolumns > 1) {
+                out->append("+");
+                for (size_t i = 0; i < metrics_.size(); i++) {
+                    if (i != 0) {
+                        out->append("|");
+                    }
+                    out->append(metrics_[i]);
+                }
+                out->append(" ").append(tags);
+                snprintf(buf, sizeof(buf), "\r\n:%lu\r\n*%d\r\n", ts, opt_.ncolumns);
+                out->append(buf);
+                for (int i = 0; i < opt_.ncolumns; i++) {
+                    snprintf(buf, sizeof(buf), "+%.3f\r\n", value + i);
+                    out->append(buf);
+                }
+            } else {
+                out->append("+").append(metrics_[0]).append(" ").append(tags);
+                snprintf(buf, sizeof(buf), "\r\n:%lu\r\n+%.3f\r\n", ts, value);
+                out->append(buf);
+            }
+            break;
+        case Protocol::OPENTSDB:
+            // OpenTSDB protocol doesn't have bulk format
+            for (int i = 0; i < opt_.ncolumns; i++) {
+                out->append("put ").append(metrics_[static_cast<size_t>(i)]);
+                snprintf(buf, sizeof(buf), " %lu %.3f ", ts, value + i);
+                out->append(buf).append(tags).append("\n");
+            }
+            break;
+        };
+    }
+
+public:
+    Generator(Options const& opt, std::atomic<u64>& new_series, u64 seed)
+        : opt_(opt)
+        , new_series_(new_series)
+        , rand_(seed)
+        , uniform_(0.0, 1.0)
+    {
+        for (int i = 0; i < opt.ncolumns; i++) {
+            metrics_.push_back("e2e.m" + std::to_string(i));
+        }
+        for (u64 ix = 0; ix < opt.cardinality; ix++) {
+            tags_.push_back(make_tags(ix));
+        }
+    }
+
+    //! Generate single message, return number of points
+    int next(std::string* out) {
+        u64 ts = now_ns();
+        if (opt_.late_ratio > 0 && uniform_(rand_) < opt_.late_ratio) {
+            ts -= static_cast<u64>(uniform_(rand_) * static_cast<double>(opt_.late_window));
+        }
+        double value = uniform_(rand_) * 1000.0;
+        if (opt_.churn > 0 && uniform_(rand_) < opt_.churn) {
+            format(out, make_tags(new_series_++), ts, value);
+        } else {
+            format(out, tags_[rand_() % tags_.size()], ts, value);
+        }
+        return opt_.ncolumns;
+    }
+
+    //! Generate latency probe message
+    void probe(std::string* out, u64 id, u64 ts) {
+        switch (opt_.protocol) {
+        case Protocol::RESP:
+        case Protocol::UDP:
+            out->append("+e2e.probe id=" + std::to_string(id) + "\r\n:" + std::to_string(ts) + "\r\n+1\r\n");
+            break;
+        case Protocol::OPENTSDB:
+            out->append("put e2e.probe " + std::to_string(ts) + " 1 id=" + std::to_string(id) + "\n");
+            break;
+        };
+    }
+};
+
+// --------- //
+// Transport //
+// --------- //
+
+class Channel {
+    boost::asio::io_service io_;
+    tcp::socket             tcp_;
+    udp::socket             udp_;
+    udp::endpoint           peer_;
+    bool                    is_udp_;
+public:
+    Channel(Options const& opt)
+        : tcp_(io_)
+        , udp_(io_)
+        , is_udp_(opt.protocol == Protocol::UDP)
+    {
+        auto addr = boost::asio::ip::address::from_string(opt.host);
+        if (is_udp_) {
+            peer_ = udp::endpoint(addr, static_cast<unsigned short>(opt.udp_port));
+            udp_.open(udp::v4());
+        } else {
+            int port = opt.protocol == Protocol::RESP ? opt.resp_port : opt.opentsdb_port;
+            tcp_.connect(tcp::endpoint(addr, static_cast<unsigned short>(port)));
+            tcp_.set_option(tcp::no_delay(true));
+        }
+    }
+
+    /** Send buffer. UDP datagrams should contain only complete messages so `bounds`
+      * contains end offsets of the individual messages.
+      */
+    void send(std::string const& buf, std::vector<size_t> const& bounds) {
+        if (!is_udp_) {
+            boost::asio::write(tcp_, boost::asio::buffer(buf));
+            return;
+        }
+        static const size_t MAX_DATAGRAM = 1400;
+        size_t begin = 0;
+        size_t prev  = 0;
+        for (auto end: bounds) {
+            if (end - begin > MAX_DATAGRAM && prev != begin) {
+                udp_.send_to(boost::asio::buffer(buf.data() + begin, prev - begin), peer_);
+                begin = prev;
+            }
+            prev = end;
+        }
+        if (prev != begin) {
+            udp_.send_to(boost::asio::buffer(buf.data() + begin, prev - begin), peer_);
+        }
+    }
+};
+
+static bool parse_args(int argc, char** argv, Options* opt) {
+    std::string protocol;
+    po::options_description desc("End-to-end ingestion benchmark, run against local akumulid instance");
+    desc.add_options()
+        ("help", "Produce help message")
+        ("host",            po::value<std::string>(&opt->host)->default_value("127.0.0.1"), "Server address")
+        ("resp-port",       po::value<int>(&opt->resp_port)->default_value(8282), "RESP (TCP) port")
+        ("opentsdb-port",   po::value<int>(&opt->opentsdb_port)->default_value(4242), "OpenTSDB port")
+        ("udp-port",        po::value<int>(&opt->udp_port)->default_value(8383), "UDP port")
+        ("http-port",       po::value<int>(&opt->http_port)->default_value(8181), "HTTP API port")
+        ("protocol",        po::value<std::string>(&protocol)->default_value("resp"), "resp, opentsdb or udp")
+        ("cardinality",     po::value<u64>(&opt->cardinality)->default_value(10000), "Number of series")
+        ("tags",            po::value<int>(&opt->ntags)->default_value(3), "Number of tags per series")
+        ("columns",         po::value<int>(&opt->ncolumns)->default_value(1), "Metrics per message (RESP bulk format if > 1)")
+        ("batch",           po::value<int>(&opt->batch)->default_value(100), "Messages per write")
+        ("late-ratio",      po::value<double>(&opt->late_ratio)->default_value(0.0), "Fraction of late writes")
+        ("late-window",     po::value<u64>(&opt->late_window)->default_value(60000000000ull), "Max delay of the late write (ns)")
+        ("churn",           po::value<double>(&opt->churn)->default_value(0.0), "Fraction of points that creates new series")
+        ("duration",        po::value<double>(&opt->duration)->default_value(30.0), "Test duration (seconds)")
+        ("rate",            po::value<double>(&opt->rate)->default_value(0.0), "Max points per second (0 - unlimited)")
+        ("connections",     po::value<int>(&opt->connections)->default_value(4), "Number of connections")
+        ("probe-interval",  po::value<int>(&opt->probe_interval)->default_value(100), "Latency probe interval (ms)")
+        ("pid",             po::value<int>(&opt->pid)->default_value(0), "Server pid (0 - find akumulid process)")
+        ("seed",            po::value<u64>(&opt->seed)->default_value(42), "Random seed")
+        ("output",          po::value<std::string>(&opt->output), "Write JSON report to file instead of stdout")
+    ;
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+    po::notify(vm);
+    if (vm.count("help")) {
+        std::cout << desc << std::endl;
+        return false;
+    }
+    if (protocol == "resp") {
+        opt->protocol = Protocol::RESP;
+    } else if (protocol == "opentsdb") {
+        opt->protocol = Protocol::OPENTSDB;
+    } else if (protocol == "udp") {
+        opt->protocol = Protocol::UDP;
+    } else {
+        std::cerr << "Unknown protocol " << protocol << std::endl;
+        return false;
+    }
+    if (opt->cardinality == 0 || opt->ncolumns < 1 || opt->ntags < 1 || opt->connections < 1 || opt->batch < 1) {
+        std::cerr << "Invalid arguments" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    Options opt;
+    if (!parse_args(argc, argv, &opt)) {
+        return 1;
+    }
+    int pid = opt.pid ? opt.pid : find_server_pid();
+    if (pid == 0) {
+        std::cerr << "akumulid process not found, CPU and memory usage will not be reported" << std::endl;
+    }
+
+    std::atomic<bool> done = {false};
+    std::atomic<u64> new_series = {opt.cardinality};
+    std::atomic<u64> npoints = {0};
+
+    auto writer = [&](int ix) {
+        Generator gen(opt, new_series, opt.seed + static_cast<u64>(ix));
+        Channel chan(opt);
+        std::string buf;
+        std::vector<size_t> bounds;
+        double rate = opt.rate / opt.connections;
+        u64 sent = 0;
+        PerfTimer tm;
+        while (!done) {
+            buf.clear();
+            bounds.clear();
+            int n = 0;
+            for (int i = 0; i < opt.batch; i++) {
+                n += gen.next(&buf);
+                bounds.push_back(buf.size());
+            }
+            chan.send(buf, bounds);
+            sent += static_cast<u64>(n);
+            npoints += static_cast<u64>(n);
+            if (rate > 0) {
+                double ahead = static_cast<double>(sent) / rate - tm.elapsed();
+                if (ahead > 0) {
+                    std::this_thread::sleep_for(std::chrono::microseconds(static_cast<int64_t>(ahead*1000000)));
+                }
+            }
+        }
+    };
+
+    // Latency probes
+    std::vector<u64> latencies;
+    u64 probes_lost = 0;
+    std::atomic<u64> probe_id = {0};
+    std::atomic<u64> new_probes = {0};
+    Generator probe_gen(opt, new_probes, opt.seed);
+    Channel probe_chan(opt);
+    auto send_probe = [&](double timeout) {
+        u64 id = probe_id++;
+        u64 ts = now_ns();
+        std::string buf;
+        probe_gen.probe(&buf, id, ts);
+        u64 start = steady_ns();
+        probe_chan.send(buf, { buf.size() });
+        if (wait_visible(opt.host, opt.http_port, "e2e.probe", id, ts, timeout)) {
+            latencies.push_back(steady_ns() - start);
+        } else {
+            probes_lost++;
+        }
+    };
+    auto prober = [&]() {
+        while (!done) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(opt.probe_interval));
+            send_probe(10.0);
+        }
+    };
+
+    ProcStats before = {};
+    if (pid) {
+        before = read_proc_stats(pid);
+    }
+    PerfTimer tm;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < opt.connections; i++) {
+        threads.emplace_back(writer, i);
+    }
+    std::thread pth(prober);
+
+    // Record throughput every second
+    std::vector<u64> timeline;
+    u64 prev = 0;
+    while (tm.elapsed() < opt.duration) {
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+        u64 curr = npoints;
+        timeline.push_back(curr - prev);
+        prev = curr;
+    }
+    done = true;
+    for (auto& th: threads) {
+        th.join();
+    }
+    pth.join();
+    // Wait until the server will catch up, drain time is included into the elapsed time
+    send_probe(60.0);
+    double elapsed = tm.elapsed();
+    ProcStats after = {};
+    if (pid) {
+        after = read_proc_stats(pid);
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+    boost::property_tree::ptree report;
+    report.put("workload.protocol", opt.protocol == Protocol::RESP ? "resp" : opt.protocol == Protocol::UDP ? "udp" : "opentsdb");
+    report.put("workload.cardinality", opt.cardinality);
+    report.put("workload.tags", opt.ntags);
+    report.put("workload.columns", opt.ncolumns);
+    report.put("workload.batch", opt.batch);
+    report.put("workload.late_ratio", opt.late_ratio);
+    report.put("workload.churn", opt.churn);
+    report.put("workload.connections", opt.connections);
+    report.put("workload.rate_limit", opt.rate);
+    report.put("elapsed_s", elapsed);
+    report.put("points", npoints.load());
+    report.put("new_series", new_series.load() - opt.cardinality);
+    report.put("points_per_sec", static_cast<double>(npoints) / elapsed);
+    boost::property_tree::ptree tl;
+    for (auto n: timeline) {
+        boost::property_tree::ptree item;
+        item.put("", n);
+        tl.push_back(std::make_pair("", item));
+    }
+    report.add_child("points_per_sec_timeline", tl);
+    if (pid) {
+        double cpu = after.cpu_time - before.cpu_time;
+        report.put("server.cpu_s", cpu);
+        report.put("server.cpu_ns_per_point", npoints ? cpu * 1000000000.0 / static_cast<double>(npoints) : 0.0);
+        report.put("server.rss_before", before.rss);
+        report.put("server.rss_after", after.rss);
+        report.put("server.rss_growth", static_cast<int64_t>(after.rss) - static_cast<int64_t>(before.rss));
+    }
+    report.put("latency.probes", latencies.size());
+    report.put("latency.lost", probes_lost);
+    report.put("latency.p50_ns", percentile(latencies, 0.5));
+    report.put("latency.p99_ns", percentile(latencies, 0.99));
+    report.put("latency.p999_ns", percentile(latencies, 0.999));
+    report.put("latency.max_ns", latencies.empty() ? 0 : latencies.back());
+
+    if (opt.output.empty()) {
+        boost::property_tree::json_parser::write_json(std::cout, report, true);
+    } else {
+        std::ofstream out(opt.output);
+        boost::property_tree::json_parser::write_json(out, report, true);
+    }
+    return 0;
+}
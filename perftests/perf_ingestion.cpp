@@ -234,10 +234,15 @@ void logger_(aku_LogLevel level, const char * msg) {
     }
 }
 
-int main(int, const char**) {
+int main(int argc, const char** argv) {
 
     aku_initialize(nullptr, logger_);
 
+    // Run with --no-probes to measure instrumentation overhead
+    if (argc > 1 && std::string(argv[1]) == "--no-probes") {
+        aku_probe_enable(0);
+    }
+
     // Delete database
     //
 
@@ -247,7 +252,7 @@ int main(int, const char**) {
     // Create database
     //
 
-    status = aku_create_database("testdb", "/tmp", "/tmp", 2);
+    status = aku_create_database("testdb", "/tmp", "/tmp", 2, false);
     if (status != AKU_SUCCESS) {
         std::cerr << "Can't create database" << std::endl;
     }
@@ -301,6 +306,7 @@ int main(int, const char**) {
         aku_destroy_session(session);
     };
 
+    Timer total;
     std::thread th0(std::bind(worker, 0, 1000));
     std::thread th1(std::bind(worker, 1000, 2000));
     //std::thread th2(std::bind(worker, 3000, 4000));
@@ -309,6 +315,7 @@ int main(int, const char**) {
     th1.join();
     //th2.join();
     //th3.join();
+    std::cout << "Ingestion time: " << total.elapsed() << "s" << std::endl;
 
     //aku_SearchStats search_stats = {};
     //aku_StorageStats storage_stats = {};
@@ -0,0 +1,658 @@
+/**
+ * Copyright (c) 2017 Eugene Lazin <4lazin@gmail.com>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/** Microbenchmarks of the hot code paths.
+  * All results are reported per item (sample, series name, postings list element, etc).
+  * Usage:
+  *     perf_microbench --filter datablock --json before.json
+  *     perf_microbench --filter datablock --json after.json
+  *     scripts/compare_benchmarks.py before.json after.json
+  */
+
+#include "microbench.h"
+
+#include "akumuli.h"
+#include "storage_engine/compression.h"
+#include "storage_engine/operators/merge.h"
+#include "storage_engine/operators/operator.h"
+#include "index/invertedindex.h"
+#include "index/seriesparser.h"
+#include "ingestion_pipeline.h"
+#include "protocolparser.h"
+#include "query_results_pooler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <map>
+#include <random>
+
+using namespace Akumuli;
+using namespace Akumuli::StorageEngine;
+using namespace Akumuli::MicroBench;
+
+namespace {
+
+// ---------- //
+// Test data  //
+// ---------- //
+
+enum {
+    NSAMPLES = 0x10000,
+    BLOCK_SIZE = 4096,
+    NSERIES = 10000,
+};
+
+//! Timestamps with small jitter (typical for the real-world data)
+static std::vector<aku_Timestamp> const& get_timestamps() {
+    static std::vector<aku_Timestamp> result;
+    if (result.empty()) {
+        std::mt19937 gen(42);
+        std::uniform_int_distribution<aku_Timestamp> jitter(0, 1000);
+        aku_Timestamp ts = 1500000000000000000ull;
+        for (int i = 0; i < NSAMPLES; i++) {
+            ts += 1000000000ull + jitter(gen);
+            result.push_back(ts);
+        }
+    }
+    return result;
+}
+
+//! Random walk rounded to two decimal places
+static std::vector<double> const& get_values() {
+    static std::vector<double> result;
+    if (result.empty()) {
+        std::mt19937 gen(42);
+        std::normal_distribution<double> step(0, 1);
+        double x = 100;
+        for (int i = 0; i < NSAMPLES; i++) {
+            x += step(gen);
+            result.push_back(std::round(x * 100) / 100);
+        }
+    }
+    return result;
+}
+
+//! Series names with tags in random order
+static std::vector<std::string> const& get_series_names() {
+    static std::vector<std::string> result;
+    if (result.empty()) {
+        std::mt19937 gen(42);
+        const char* metrics[] = { "cpu.user", "cpu.sys", "mem.free", "net.rx", "net.tx", "disk.io" };
+        for (int i = 0; i < NSERIES; i++) {
+            std::vector<std::string> tags = {
+                "host=host_" + std::to_string(i / 6),
+                "region=region_" + std::to_string(i % 7),
+                "rack=rack_" + std::to_string(i % 31),
+                "os=ubuntu_16.04",
+                "team=team_" + std::to_string(i % 13),
+            };
+            std::shuffle(tags.begin(), tags.end(), gen);
+            std::string name = metrics[i % 6];
+            for (auto const& tag: tags) {
+                name += " " + tag;
+            }
+            result.push_back(name);
+        }
+    }
+    return result;
+}
+
+static std::string to_canonical_form(std::string const& name) {
+    std::vector<char> out(name.size() + 1);
+    const char* kbegin = nullptr;
+    const char* kend = nullptr;
+    SeriesParser::to_canonical_form(name.data(), name.data() + name.size(),
+                                    out.data(), out.data() + out.size(), &kbegin, &kend);
+    return std::string(static_cast<const char*>(out.data()), kend);
+}
+
+}  // namespace
+
+// ---------------------------- //
+// DataBlockWriter/Reader       //
+// ---------------------------- //
+
+MICROBENCH(datablock_write) {
+    auto const& tss = get_timestamps();
+    auto const& xss = get_values();
+    std::vector<u8> block(BLOCK_SIZE);
+    u64 bytes = 0;
+    u64 i = 0;
+    while (i < state.iterations()) {
+        DataBlockWriter writer(42, block.data(), BLOCK_SIZE);
+        for (; i < state.iterations(); i++) {
+            auto ix = i % NSAMPLES;
+            if (writer.put(tss[ix], xss[ix]) != AKU_SUCCESS) {
+                break;
+            }
+        }
+        bytes += writer.commit();
+    }
+    do_not_optimize(block);
+    state.set_bytes_processed(bytes);
+}
+
+MICROBENCH(datablock_read) {
+    state.pause();
+    auto const& tss = get_timestamps();
+    auto const& xss = get_values();
+    std::vector<std::vector<u8>> blocks;
+    size_t ix = 0;
+    while (ix < NSAMPLES) {
+        std::vector<u8> block(BLOCK_SIZE);
+        DataBlockWriter writer(42, block.data(), BLOCK_SIZE);
+        while (ix < NSAMPLES && writer.put(tss[ix], xss[ix]) == AKU_SUCCESS) {
+            ix++;
+        }
+        block.resize(writer.commit());
+        blocks.push_back(std::move(block));
+    }
+    state.resume();
+    u64 nread = 0;
+    u64 bytes = 0;
+    double sum = 0;
+    while (nread < state.iterations()) {
+        for (auto const& block: blocks) {
+            DataBlockReader reader(block.data(), block.size());
+            size_t nelem = reader.nelements();
+            for (size_t i = 0; i < nelem; i++) {
+                aku_Status status;
+                aku_Timestamp ts;
+                double value;
+                std::tie(status, ts, value) = reader.next();
+                sum += value;
+            }
+            nread += nelem;
+            bytes += block.size();
+            if (nread >= state.iterations()) {
+                break;
+            }
+        }
+    }
+    do_not_optimize(sum);
+    state.set_items_processed(nread);
+    state.set_bytes_processed(bytes);
+}
+
+// --------------- //
+// CompressedPList //
+// --------------- //
+
+static CompressedPList make_plist(u64 start, u64 step, size_t size) {
+    CompressedPList list;
+    for (size_t i = 0; i < size; i++) {
+        list.add(start + i*step);
+    }
+    return list;
+}
+
+MICROBENCH(cplist_add) {
+    CompressedPList list;
+    for (u64 i = 0; i < state.iterations(); i++) {
+        list.add(1024 + i*3);
+    }
+    do_not_optimize(list.getSizeInBytes());
+}
+
+MICROBENCH(cplist_iterate) {
+    state.pause();
+    const size_t N = 10000;
+    auto list = make_plist(1024, 3, N);
+    state.resume();
+    u64 sum = 0;
+    u64 n = 0;
+    while (n < state.iterations()) {
+        for (auto x: list) {
+            sum += x;
+        }
+        n += N;
+    }
+    do_not_optimize(sum);
+    state.set_items_processed(n);
+}
+
+MICROBENCH(cplist_intersect) {
+    state.pause();
+    const size_t N = 10000;
+    auto lhs = make_plist(1024, 2, N);
+    auto rhs = make_plist(1024, 3, N);
+    state.resume();
+    for (u64 i = 0; i < state.iterations(); i++) {
+        auto res = lhs & rhs;
+        do_not_optimize(res.cardinality());
+    }
+    state.set_items_processed(state.iterations() * 2 * N);
+}
+
+MICROBENCH(cplist_union) {
+    state.pause();
+    const size_t N = 10000;
+    auto lhs = make_plist(1024, 2, N);
+    auto rhs = make_plist(1024, 3, N);
+    state.resume();
+    for (u64 i = 0; i < state.iterations(); i++) {
+        auto res = lhs | rhs;
+        do_not_optimize(res.cardinality());
+    }
+    state.set_items_processed(state.iterations() * 2 * N);
+}
+
+// ------------- //
+// Series names  //
+// ------------- //
+
+MICROBENCH(series_to_canonical_form) {
+    auto const& names = get_series_names();
+    char out[AKU_LIMITS_MAX_SNAME];
+    for (u64 i = 0; i < state.iterations(); i++) {
+        auto const& name = names[i % NSERIES];
+        const char* kbegin = nullptr;
+        const char* kend = nullptr;
+        auto status = SeriesParser::to_canonical_form(name.data(), name.data() + name.size(),
+                                                      out, out + AKU_LIMITS_MAX_SNAME, &kbegin, &kend);
+        if (status != AKU_SUCCESS) {
+            state.set_error("to_canonical_form failed");
+            return;
+        }
+        do_not_optimize(kend);
+    }
+}
+
+MICROBENCH(seriesmatcher_add) {
+    state.pause();
+    auto const& names = get_series_names();
+    std::vector<std::string> unique;
+    unique.reserve(state.iterations());
+    for (u64 i = 0; i < state.iterations(); i++) {
+        // Make every name unique by adding generation tag
+        unique.push_back(to_canonical_form(names[i % NSERIES] + " gen=" + std::to_string(i / NSERIES)));
+    }
+    SeriesMatcher matcher;
+    state.resume();
+    for (auto const& name: unique) {
+        do_not_optimize(matcher.add(name.data(), name.data() + name.size()));
+    }
+}
+
+MICROBENCH(seriesmatcher_match) {
+    state.pause();
+    std::vector<std::string> canonical;
+    SeriesMatcher matcher;
+    for (auto const& name: get_series_names()) {
+        canonical.push_back(to_canonical_form(name));
+        matcher.add(canonical.back().data(), canonical.back().data() + canonical.back().size());
+    }
+    state.resume();
+    for (u64 i = 0; i < state.iterations(); i++) {
+        auto const& name = canonical[(i * 7919) % NSERIES];
+        auto id = matcher.match(name.data(), name.data() + name.size());
+        if (id == 0) {
+            state.set_error("series not found");
+            return;
+        }
+        do_not_optimize(id);
+    }
+}
+
+// ----------------- //
+// MergeMaterializer //
+// ----------------- //
+
+namespace {
+
+//! Operator that reads pre-generated data from memory
+struct MemOperator : RealValuedOperator {
+    std::vector<aku_Timestamp> const& tss_;
+    std::vector<double> const& xss_;
+    size_t pos_;
+    size_t end_;
+
+    MemOperator(std::vector<aku_Timestamp> const& tss, std::vector<double> const& xss, size_t size)
+        : tss_(tss)
+        , xss_(xss)
+        , pos_(0)
+        , end_(std::min(size, tss.size()))
+    {
+    }
+
+    virtual std::tuple<aku_Status, size_t> read(aku_Timestamp* destts, double* destval, size_t size) override {
+        size_t n = std::min(size, end_ - pos_);
+        std::copy(tss_.begin() + pos_, tss_.begin() + pos_ + n, destts);
+        std::copy(xss_.begin() + pos_, xss_.begin() + pos_ + n, destval);
+        pos_ += n;
+        return std::make_tuple(pos_ == end_ ? AKU_ENO_DATA : AKU_SUCCESS, n);
+    }
+
+    virtual Direction get_direction() override {
+        return Direction::FORWARD;
+    }
+};
+
+template<template <int dir> class CmpPred>
+void bench_merge(State& state, size_t nseries) {
+    state.pause();
+    size_t per_series = std::min(static_cast<size_t>(state.iterations() / nseries + 1),
+                                 static_cast<size_t>(NSAMPLES));
+    std::vector<u8> outbuf(sizeof(aku_Sample) * 1024);
+    u64 total = 0;
+    state.resume();
+    while (total < state.iterations()) {
+        state.pause();
+        std::vector<aku_ParamId> ids;
+        std::vector<std::unique_ptr<RealValuedOperator>> iters;
+        for (size_t i = 0; i < nseries; i++) {
+            ids.push_back(1024 + i);
+            iters.emplace_back(new MemOperator(get_timestamps(), get_values(), per_series));
+        }
+        state.resume();
+        MergeMaterializer<CmpPred> mat(std::move(ids), std::move(iters));
+        while (true) {
+            aku_Status status;
+            size_t size;
+            std::tie(status, size) = mat.read(outbuf.data(), outbuf.size());
+            total += size / sizeof(aku_Sample);
+            if (status != AKU_SUCCESS || size == 0) {
+                break;
+            }
+        }
+    }
+    do_not_optimize(outbuf);
+    state.set_items_processed(total);
+}
+
+}  // namespace
+
+MICROBENCH(merge_time_order_16) {
+    bench_merge<TimeOrder>(state, 16);
+}
+
+MICROBENCH(merge_time_order_256) {
+    bench_merge<TimeOrder>(state, 256);
+}
+
+MICROBENCH(merge_series_order_16) {
+    bench_merge<SeriesOrder>(state, 16);
+}
+
+// ----------------- //
+// AggregationResult //
+// ----------------- //
+
+MICROBENCH(aggregation_add) {
+    auto const& tss = get_timestamps();
+    auto const& xss = get_values();
+    AggregationResult agg = INIT_AGGRES;
+    for (u64 i = 0; i < state.iterations(); i++) {
+        auto ix = i % NSAMPLES;
+        agg.add(tss[ix], xss[ix], true);
+    }
+    do_not_optimize(agg);
+}
+
+MICROBENCH(aggregation_do_the_math) {
+    state.pause();
+    std::vector<aku_Timestamp> tss = get_timestamps();
+    auto const& xss = get_values();
+    state.resume();
+    const size_t BATCH = 1024;
+    AggregationResult agg = INIT_AGGRES;
+    u64 n = 0;
+    while (n < state.iterations()) {
+        auto offset = n % (NSAMPLES - BATCH);
+        agg.do_the_math(tss.data() + offset, xss.data() + offset, BATCH, false);
+        n += BATCH;
+    }
+    do_not_optimize(agg);
+    state.set_items_processed(n);
+}
+
+MICROBENCH(aggregation_combine) {
+    state.pause();
+    auto const& tss = get_timestamps();
+    auto const& xss = get_values();
+    std::vector<AggregationResult> parts;
+    for (size_t i = 0; i < 1024; i++) {
+        AggregationResult part = INIT_AGGRES;
+        part.add(tss[i], xss[i], true);
+        parts.push_back(part);
+    }
+    state.resume();
+    AggregationResult agg = INIT_AGGRES;
+    for (u64 i = 0; i < state.iterations(); i++) {
+        agg.combine(parts[i & 1023]);
+    }
+    do_not_optimize(agg);
+}
+
+// ----------- //
+// RESP parser //
+// ----------- //
+
+namespace {
+
+//! Session that accepts everything and maps series names to dummy ids
+struct NullSession : DbSession {
+    u64 nwritten = 0;
+    std::shared_ptr<DbCursor> cursor;
+
+    virtual aku_Status write(const aku_Sample&) override {
+        nwritten++;
+        return AKU_SUCCESS;
+    }
+
+    virtual std::shared_ptr<DbCursor> query(std::string) override {
+        return cursor;
+    }
+
+    virtual std::shared_ptr<DbCursor> suggest(std::string) override {
+        return cursor;
+    }
+
+    virtual std::shared_ptr<DbCursor> search(std::string) override {
+        return cursor;
+    }
+
+    virtual std::shared_ptr<DbCursor> prepare(std::string) override {
+        return cursor;
+    }
+
+    virtual int param_id_to_series(aku_ParamId id, char* buffer, size_t buffer_size) override {
+        auto const& names = get_series_names();
+        auto const& name = names[id % NSERIES];
+        if (name.size() + 1 > buffer_size) {
+            return -1*static_cast<int>(name.size() + 1);
+        }
+        memcpy(buffer, name.data(), name.size());
+        buffer[name.size()] = '\0';
+        return static_cast<int>(name.size() + 1);
+    }
+
+    virtual aku_Status series_to_param_id(const char*, size_t, aku_Sample* sample) override {
+        sample->paramid = 1024;
+        return AKU_SUCCESS;
+    }
+
+    virtual int name_to_param_id_list(const char* begin, const char* end, aku_ParamId* ids, u32 cap) override {
+        auto nelem = std::count(begin, end, '|') + 1;
+        if (nelem > cap) {
+            return -1*static_cast<int>(nelem);
+        }
+        for (int i = 0; i < nelem; i++) {
+            ids[i] = 1024 + static_cast<u64>(i);
+        }
+        return static_cast<int>(nelem);
+    }
+};
+
+//! Generate `n` RESP messages with `ncolumns` values each
+std::string make_resp_input(size_t n, int ncolumns) {
+    auto const& names = get_series_names();
+    auto const& xss = get_values();
+    std::string result;
+    for (size_t i = 0; i < n; i++) {
+        auto const& name = names[i % NSERIES];
+        auto sp = name.find(' ');
+        std::string metric = name.substr(0, sp);
+        for (int c = 1; c < ncolumns; c++) {
+            metric += "|" + name.substr(0, sp) + std::to_string(c);
+        }
+        result += "+" + metric + name.substr(sp) + "\r\n";
+        result += ":" + std::to_string(get_timestamps()[i % NSAMPLES]) + "\r\n";
+        if (ncolumns > 1) {
+            result += "*" + std::to_string(ncolumns) + "\r\n";
+        }
+        for (int c = 0; c < ncolumns; c++) {
+            char buf[64];
+            snprintf(buf, sizeof(buf), "+%.2f\r\n", xss[(i + c) % NSAMPLES]);
+            result += buf;
+        }
+    }
+    return result;
+}
+
+void bench_resp_parser(State& state, int ncolumns) {
+    state.pause();
+    const size_t NMESSAGES = 10000;
+    const size_t CHUNK_SIZE = 1024;
+    static std::map<int, std::string> inputs;
+    auto& input = inputs[ncolumns];
+    if (input.empty()) {
+        input = make_resp_input(NMESSAGES, ncolumns);
+    }
+    auto session = std::make_shared<NullSession>();
+    RESPProtocolParser parser(session);
+    parser.start();
+    state.resume();
+    u64 nmessages = 0;
+    u64 bytes = 0;
+    while (nmessages < state.iterations()) {
+        for (size_t pos = 0; pos < input.size(); pos += CHUNK_SIZE) {
+            auto size = std::min(CHUNK_SIZE, input.size() - pos);
+            auto buf = parser.get_next_buffer();
+            memcpy(buf, input.data() + pos, size);
+            parser.parse_next(buf, static_cast<u32>(size));
+        }
+        nmessages += NMESSAGES;
+        bytes += input.size();
+    }
+    parser.close();
+    if (session->nwritten != nmessages * ncolumns) {
+        state.set_error("RESP parser lost some samples");
+    }
+    state.set_items_processed(nmessages);
+    state.set_bytes_processed(bytes);
+}
+
+}  // namespace
+
+MICROBENCH(resp_parser) {
+    bench_resp_parser(state, 1);
+}
+
+MICROBENCH(resp_parser_bulk_8) {
+    bench_resp_parser(state, 8);
+}
+
+// ----------------- //
+// Output formatters //
+// ----------------- //
+
+namespace {
+
+//! Cursor that returns `n` pre-generated float samples
+struct MemCursor : DbCursor {
+    u64 n;
+    u64 pos;
+
+    MemCursor(u64 n)
+        : n(n)
+        , pos(0)
+    {
+    }
+
+    virtual size_t read(void* dest, size_t dest_size) override {
+        auto out = static_cast<aku_Sample*>(dest);
+        size_t cap = dest_size / sizeof(aku_Sample);
+        size_t i = 0;
+        for (; i < cap && pos < n; i++, pos++) {
+            auto ix = pos % NSAMPLES;
+            out[i].paramid = 1024 + pos % NSERIES;
+            out[i].timestamp = get_timestamps()[ix];
+            out[i].payload.type = AKU_PAYLOAD_FLOAT;
+            out[i].payload.size = sizeof(aku_Sample);
+            out[i].payload.float64 = get_values()[ix];
+        }
+        return i * sizeof(aku_Sample);
+    }
+
+    virtual int is_done() override {
+        return pos == n;
+    }
+
+    virtual bool is_error(aku_Status* out_error_code_or_null) override {
+        if (out_error_code_or_null) {
+            *out_error_code_or_null = AKU_SUCCESS;
+        }
+        return false;
+    }
+
+    virtual void close() override {
+    }
+};
+
+void bench_formatter(State& state, const char* output) {
+    state.pause();
+    auto session = std::make_shared<NullSession>();
+    session->cursor = std::make_shared<MemCursor>(state.iterations());
+    QueryResultsPooler pooler(session, 1000, ApiEndpoint::QUERY);
+    std::string query = std::string("{\"output\": ") + output + "}";
+    pooler.append(query.data(), query.size());
+    pooler.start();
+    std::vector<char> buffer(0x10000);
+    state.resume();
+    u64 bytes = 0;
+    while (true) {
+        size_t len;
+        bool done;
+        std::tie(len, done) = pooler.read_some(buffer.data(), buffer.size());
+        bytes += len;
+        if (done) {
+            break;
+        }
+    }
+    pooler.close();
+    do_not_optimize(buffer);
+    state.set_bytes_processed(bytes);
+}
+
+}  // namespace
+
+MICROBENCH(format_csv) {
+    bench_formatter(state, "{\"format\": \"csv\"}");
+}
+
+MICROBENCH(format_csv_iso) {
+    bench_formatter(state, "{\"format\": \"csv\", \"timestamp\": \"iso\"}");
+}
+
+MICROBENCH(format_resp) {
+    bench_formatter(state, "{\"format\": \"resp\"}");
+}
+
+MICROBENCH(format_resp_iso) {
+    bench_formatter(state, "{\"format\": \"resp\", \"timestamp\": \"iso\"}");
+}
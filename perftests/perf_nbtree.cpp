@@ -12,6 +12,7 @@
 #include "storage_engine/nbtree.h"
 #include "log_iface.h"
 #include "util.h"
+#include "perftest_tools.h"
 
 
 using namespace Akumuli::StorageEngine;
@@ -130,6 +131,7 @@ int main() {
         return fn;
     };
 
+    auto allocs = Akumuli::get_allocation_stats();
     std::thread th1(writer(0, numids/4));
     std::thread th2(writer(numids/4, numids/4*2));
     std::thread th3(writer(numids/4*2, numids/4*3));
@@ -138,6 +140,7 @@ int main() {
     th2.join();
     th3.join();
     th4.join();
+    Akumuli::print_allocations(allocs, static_cast<uint64_t>(N)*4);
 
     {   // stop flush thread
         done = true;
@@ -51,6 +51,9 @@ namespace detail {
         std::shared_ptr<DbCursor> search(std::string query) {
             throw "not implemented";
         }
+        std::shared_ptr<DbCursor> prepare(std::string query) {
+            throw "not implemented";
+        }
         int param_id_to_series(aku_ParamId id, char *buffer, size_t buffer_size) {
             throw "not implemented";
         }
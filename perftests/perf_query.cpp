@@ -0,0 +1,361 @@
+/**
+ * Query benchmark.
+ * Builds fixed dataset and runs representative queries of every plan type (cold and warm).
+ * Reports latency distribution, rows/s and number of bytes read from the block store as JSON.
+ *
+ * Usage: perf_query create [options]   - create database and fill it with data
+ *        perf_query run [options]      - run all queries
+ *        perf_query delete [options]   - delete database
+ */
+// C++ headers
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+// Lib headers
+#include <boost/filesystem.hpp>
+#include <boost/program_options.hpp>
+#include <boost/property_tree/json_parser.hpp>
+#include <boost/property_tree/ptree.hpp>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+// App headers
+#include "akumuli.h"
+#include "perftest_tools.h"
+
+using namespace Akumuli;
+namespace po = boost::program_options;
+
+static const aku_Timestamp BASE_TS = 1483228800000000000ull;  // 2017-01-01
+static const u64 NS_PER_SEC  = 1000000000ull;
+static const u64 NS_PER_HOUR = 3600*NS_PER_SEC;
+static const u64 NS_PER_DAY  = 24*NS_PER_HOUR;
+static const u64 BLOCK_SIZE  = 4096;
+
+struct Options {
+    std::string path;
+    std::string name;
+    int         nvolumes;
+    u64         nhosts;     //< Each host has two series (cpu.user and cpu.sys)
+    u64         days;
+    u64         step;       //< Step in seconds
+    int         threads;
+    int         iterations;
+    std::string filter;     //< Run only queries with names containing this string
+    std::string output;
+
+    std::string meta_file() const {
+        return (boost::filesystem::path(path) / (name + ".akumuli")).string();
+    }
+
+    aku_Timestamp end() const {
+        return BASE_TS + days*NS_PER_DAY;
+    }
+};
+
+static void logger(aku_LogLevel level, const char * msg) {
+    if (level == AKU_LOG_ERROR) {
+        aku_console_logger(level, msg);
+    }
+}
+
+// ------- //
+// Dataset //
+// ------- //
+
+static std::string series_name(const char* metric, u64 host) {
+    std::stringstream str;
+    str << metric << " host=h" << host << " region=r" << (host % 10) << " rack=k" << (host % 100);
+    return str.str();
+}
+
+static int create_dataset(Options const& opt) {
+    aku_Status status = aku_create_database(opt.name.c_str(), opt.path.c_str(), opt.path.c_str(), opt.nvolumes, false);
+    if (status != AKU_SUCCESS) {
+        std::cerr << "Can't create database: " << aku_error_message(status) << std::endl;
+        return 1;
+    }
+    aku_FineTuneParams params = {};
+    auto db = aku_open_database(opt.meta_file().c_str(), params);
+
+    auto worker = [&](u64 begin, u64 end) {
+        auto session = aku_create_session(db);
+        std::vector<aku_ParamId> ids;
+        for (u64 host = begin; host < end; host++) {
+            for (auto metric: { "cpu.user", "cpu.sys" }) {
+                auto name = series_name(metric, host);
+                aku_Sample sample;
+                if (aku_series_to_param_id(session, name.data(), name.data() + name.size(), &sample) != AKU_SUCCESS) {
+                    std::cerr << "Can't create series " << name << std::endl;
+                    std::terminate();
+                }
+                ids.push_back(sample.paramid);
+            }
+        }
+        std::mt19937 gen(static_cast<u32>(begin));
+        std::normal_distribution<double> dist(0.0, 1.0);
+        std::vector<double> values(ids.size(), 50.0);
+        for (aku_Timestamp ts = BASE_TS; ts < opt.end(); ts += opt.step*NS_PER_SEC) {
+            for (size_t i = 0; i < ids.size(); i++) {
+                values[i] += dist(gen);
+                aku_Sample sample;
+                sample.paramid = ids[i];
+                sample.timestamp = ts;
+                sample.payload.type = AKU_PAYLOAD_FLOAT;
+                sample.payload.float64 = values[i];
+                if (aku_write(session, &sample) != AKU_SUCCESS) {
+                    std::cerr << "Write error" << std::endl;
+                    std::terminate();
+                }
+            }
+        }
+        aku_destroy_session(session);
+    };
+
+    PerfTimer tm;
+    std::vector<std::thread> threads;
+    u64 per_thread = (opt.nhosts + static_cast<u64>(opt.threads) - 1) / static_cast<u64>(opt.threads);
+    for (u64 begin = 0; begin < opt.nhosts; begin += per_thread) {
+        threads.emplace_back(worker, begin, std::min(begin + per_thread, opt.nhosts));
+    }
+    for (auto& th: threads) {
+        th.join();
+    }
+    u64 npoints = opt.nhosts * 2 * ((opt.end() - BASE_TS) / (opt.step*NS_PER_SEC));
+    std::cout << "Dataset created: " << opt.nhosts*2 << " series, " << npoints << " points, "
+              << tm.elapsed() << "s" << std::endl;
+    aku_close_database(db);
+    return 0;
+}
+
+//! Evict volumes from the page cache
+static void drop_caches(Options const& opt) {
+    boost::filesystem::directory_iterator it(opt.path), end;
+    for (; it != end; it++) {
+        auto fname = it->path().filename().string();
+        if (fname.compare(0, opt.name.size() + 1, opt.name + "_") == 0 && it->path().extension() == ".vol") {
+            int fd = open(it->path().c_str(), O_RDONLY);
+            if (fd >= 0) {
+                fdatasync(fd);
+                posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+                close(fd);
+            }
+        }
+    }
+}
+
+// ------- //
+// Queries //
+// ------- //
+
+struct BenchQuery {
+    std::string name;
+    std::string query;
+};
+
+static std::string range(aku_Timestamp begin, aku_Timestamp end) {
+    return "\"range\": { \"from\": \"" + std::to_string(begin) + "\", \"to\": \"" + std::to_string(end) + "\" }";
+}
+
+static std::vector<BenchQuery> make_queries(Options const& opt) {
+    aku_Timestamp mid  = BASE_TS + (opt.end() - BASE_TS) / 2;
+    auto full = range(BASE_TS, opt.end());
+    auto hour = range(mid, mid + NS_PER_HOUR);
+    auto day  = range(mid, mid + NS_PER_DAY);
+    return {
+        { "select-single-series",
+          "{ \"select\": \"cpu.user\", \"where\": { \"host\": \"h42\" }, " + full + " }" },
+        { "select-region-1h",
+          "{ \"select\": \"cpu.user\", \"where\": { \"region\": \"r3\" }, " + hour + " }" },
+        { "select-region-1h-order-by-time",
+          "{ \"select\": \"cpu.user\", \"where\": { \"region\": \"r3\" }, \"order-by\": \"time\", " + hour + " }" },
+        { "select-group-by-region-1h",
+          "{ \"select\": \"cpu.user\", \"group-by\": [ \"region\" ], \"order-by\": \"time\", " + hour + " }" },
+        { "aggregate-all-series",
+          "{ \"aggregate\": { \"cpu.user\": \"max\" }, " + full + " }" },
+        { "aggregate-group-by-region",
+          "{ \"aggregate\": { \"cpu.user\": \"sum\" }, \"group-by\": [ \"region\" ], " + full + " }" },
+        { "group-aggregate-rack-1h-step",
+          "{ \"group-aggregate\": { \"metric\": \"cpu.user\", \"func\": [ \"avg\", \"max\" ], \"step\": \"1h\" }, "
+          "\"where\": { \"rack\": \"k7\" }, " + full + " }" },
+        { "join-region-1h",
+          "{ \"join\": [ \"cpu.user\", \"cpu.sys\" ], \"where\": { \"region\": \"r3\" }, " + hour + " }" },
+        { "pipeline-rate-abs-1d",
+          "{ \"select\": \"cpu.user\", \"where\": { \"rack\": \"k7\" }, "
+          "\"apply\": [ { \"name\": \"rate\" }, { \"name\": \"abs\" } ], " + day + " }" },
+    };
+}
+
+struct QueryResult {
+    bool        success;
+    u64         rows;
+    u64         bytes;      //< Size of the result
+    std::string text;       //< Text output (query profile)
+};
+
+static QueryResult execute(aku_Database* db, std::string const& query) {
+    QueryResult result = { true, 0, 0, {} };
+    auto session = aku_create_session(db);
+    auto cursor = aku_query(session, query.c_str());
+    std::vector<char> buffer(0x10000);
+    while (!aku_cursor_is_done(cursor)) {
+        aku_Status err = AKU_SUCCESS;
+        if (aku_cursor_is_error(cursor, &err)) {
+            std::cerr << "Query error: " << aku_error_message(err) << std::endl;
+            result.success = false;
+            break;
+        }
+        size_t size = aku_cursor_read(cursor, buffer.data(), buffer.size());
+        size_t pos = 0;
+        while (pos < size) {
+            auto sample = reinterpret_cast<aku_Sample const*>(buffer.data() + pos);
+            size_t sample_size = std::max(sizeof(aku_Sample), static_cast<size_t>(sample->payload.size));
+            if (sample->payload.type & aku_PData::TEXT) {
+                result.text.append(sample->payload.data, sample_size - sizeof(aku_Sample));
+            } else {
+                result.rows++;
+            }
+            result.bytes += sample_size;
+            pos += sample_size;
+        }
+    }
+    aku_cursor_close(cursor);
+    aku_destroy_session(session);
+    return result;
+}
+
+static u64 percentile(std::vector<u64> const& sorted, double q) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    size_t ix = static_cast<size_t>(q * static_cast<double>(sorted.size() - 1) + 0.5);
+    return sorted.at(std::min(ix, sorted.size() - 1));
+}
+
+static boost::property_tree::ptree run_query(aku_Database** db, Options const& opt, BenchQuery const& q) {
+    boost::property_tree::ptree report;
+    report.put("query", q.query);
+
+    // Cold run
+    aku_close_database(*db);
+    drop_caches(opt);
+    aku_FineTuneParams params = {};
+    *db = aku_open_database(opt.meta_file().c_str(), params);
+    PerfTimer tm;
+    auto cold = execute(*db, q.query);
+    report.put("cold_ns", static_cast<u64>(tm.elapsed()*NS_PER_SEC));
+    if (!cold.success) {
+        report.put("error", true);
+        return report;
+    }
+
+    // Warm runs
+    std::vector<u64> latencies;
+    for (int i = 0; i < opt.iterations; i++) {
+        tm.restart();
+        execute(*db, q.query);
+        latencies.push_back(static_cast<u64>(tm.elapsed()*NS_PER_SEC));
+    }
+    std::sort(latencies.begin(), latencies.end());
+    u64 total = 0;
+    for (auto l: latencies) {
+        total += l;
+    }
+    double mean = latencies.empty() ? 0.0 : static_cast<double>(total) / static_cast<double>(latencies.size());
+    report.put("rows", cold.rows);
+    report.put("result_bytes", cold.bytes);
+    report.put("warm.min_ns", latencies.empty() ? 0 : latencies.front());
+    report.put("warm.p50_ns", percentile(latencies, 0.5));
+    report.put("warm.p90_ns", percentile(latencies, 0.9));
+    report.put("warm.p99_ns", percentile(latencies, 0.99));
+    report.put("warm.max_ns", latencies.empty() ? 0 : latencies.back());
+    report.put("warm.rows_per_sec", mean > 0 ? static_cast<double>(cold.rows) * NS_PER_SEC / mean : 0.0);
+
+    // Storage level counters are collected by the profiled run
+    auto query = q.query;
+    query.insert(query.rfind('}'), ", \"profile\": true ");
+    auto prof = execute(*db, query);
+    if (prof.success && !prof.text.empty()) {
+        boost::property_tree::ptree profile;
+        std::stringstream str(prof.text);
+        boost::property_tree::json_parser::read_json(str, profile);
+        u64 blocks = profile.get<u64>("blocks.read", 0);
+        report.put("blocks_read", blocks);
+        report.put("bytes_read", blocks*BLOCK_SIZE);
+        report.add_child("profile", profile);
+    }
+    return report;
+}
+
+static int run_queries(Options const& opt) {
+    aku_FineTuneParams params = {};
+    auto db = aku_open_database(opt.meta_file().c_str(), params);
+    boost::property_tree::ptree report;
+    report.put("dataset.series", opt.nhosts*2);
+    report.put("dataset.days", opt.days);
+    report.put("dataset.step_s", opt.step);
+    for (auto const& q: make_queries(opt)) {
+        if (!opt.filter.empty() && q.name.find(opt.filter) == std::string::npos) {
+            continue;
+        }
+        std::cerr << "Running " << q.name << std::endl;
+        report.add_child(boost::property_tree::ptree::path_type("queries/" + q.name, '/'), run_query(&db, opt, q));
+    }
+    aku_close_database(db);
+    if (opt.output.empty()) {
+        boost::property_tree::json_parser::write_json(std::cout, report, true);
+    } else {
+        std::ofstream out(opt.output);
+        boost::property_tree::json_parser::write_json(out, report, true);
+    }
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    Options opt;
+    std::string cmd;
+    po::options_description desc("Query benchmark\nUsage: perf_query create|run|delete [options]");
+    desc.add_options()
+        ("help", "Produce help message")
+        ("command",     po::value<std::string>(&cmd), "create, run or delete")
+        ("path",        po::value<std::string>(&opt.path)->default_value("/tmp"), "Database location")
+        ("name",        po::value<std::string>(&opt.name)->default_value("perfquerydb"), "Database name")
+        ("volumes",     po::value<int>(&opt.nvolumes)->default_value(8), "Number of volumes")
+        ("hosts",       po::value<u64>(&opt.nhosts)->default_value(50000), "Number of hosts (two series per host)")
+        ("days",        po::value<u64>(&opt.days)->default_value(7), "Dataset time span in days")
+        ("step",        po::value<u64>(&opt.step)->default_value(600), "Interval between points in seconds")
+        ("threads",     po::value<int>(&opt.threads)->default_value(4), "Number of writer threads")
+        ("iterations",  po::value<int>(&opt.iterations)->default_value(10), "Number of warm runs per query")
+        ("filter",      po::value<std::string>(&opt.filter), "Run only queries which names contain this string")
+        ("output",      po::value<std::string>(&opt.output), "Write JSON report to file instead of stdout")
+    ;
+    po::positional_options_description pos;
+    pos.add("command", 1);
+    po::variables_map vm;
+    po::store(po::command_line_parser(argc, argv).options(desc).positional(pos).run(), vm);
+    po::notify(vm);
+    if (vm.count("help") || cmd.empty() || opt.threads < 1 || opt.step == 0) {
+        std::cout << desc << std::endl;
+        return 1;
+    }
+
+    aku_initialize(nullptr, logger);
+
+    if (cmd == "create") {
+        return create_dataset(opt);
+    } else if (cmd == "run") {
+        return run_queries(opt);
+    } else if (cmd == "delete") {
+        aku_Status status = aku_remove_database(opt.meta_file().c_str(), true);
+        std::cout << "Remove database, status: " << aku_error_message(status) << std::endl;
+        return status == AKU_SUCCESS ? 0 : 1;
+    }
+    std::cout << desc << std::endl;
+    return 1;
+}
@@ -0,0 +1,358 @@
+/**
+ * Ingestion capture replay.
+ * Reads capture produced by akumulid (see `[Capture]` section of the config) and
+ * feeds it to the running akumulid instance with the original timing (or faster).
+ * Every captured connection is replayed using its own connection, data is sent in
+ * the same chunks as it was received by the server. Reports throughput, schedule
+ * lag (how far behind the original timing the writes are, it grows if the server
+ * can't keep up) and write-to-visible latency as JSON.
+ *
+ * Usage: perf_replay --input /tmp/akumuli.capture --speed 10
+ *        perf_replay --help
+ */
+// C++ headers
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+// Lib headers
+#include <boost/asio.hpp>
+#include <boost/program_options.hpp>
+#include <boost/property_tree/json_parser.hpp>
+#include <boost/property_tree/ptree.hpp>
+
+// App headers
+#include "capture.h"
+#include "e2e_tools.h"
+#include "perftest_tools.h"
+
+using namespace Akumuli;
+using namespace Akumuli::E2E;
+namespace po = boost::program_options;
+using boost::asio::ip::tcp;
+using boost::asio::ip::udp;
+
+struct Options {
+    std::string input;
+    std::string host;
+    int         resp_port;
+    int         opentsdb_port;
+    int         udp_port;
+    int         http_port;
+    double      speed;          //< Speedup factor (0 - as fast as possible)
+    int         probe_interval; //< Latency probe interval (ms, 0 - disabled)
+    int         pid;            //< Server pid (0 - autodetect)
+    std::string output;
+};
+
+//! Captured data of the single connection
+struct Stream {
+    u32             id;
+    CaptureProtocol protocol;
+    u64             open_ts;
+    u64             close_ts;
+    struct Chunk {
+        u64    timestamp;
+        size_t offset;
+        size_t size;
+    };
+    std::vector<Chunk> chunks;
+    std::vector<char>  data;
+};
+
+static std::vector<Stream> load_capture(std::string const& path, u64* duration) {
+    CaptureReader reader(path);
+    std::map<u32, Stream> streams;
+    CaptureRecordHeader hdr;
+    std::vector<char> payload;
+    *duration = 0;
+    while (reader.next(&hdr, &payload)) {
+        auto it = streams.find(hdr.stream_id);
+        if (it == streams.end()) {
+            Stream stream = {};
+            stream.id       = hdr.stream_id;
+            stream.protocol = static_cast<CaptureProtocol>(hdr.protocol);
+            stream.open_ts  = hdr.timestamp;
+            it = streams.insert(std::make_pair(hdr.stream_id, std::move(stream))).first;
+        }
+        Stream& stream = it->second;
+        stream.close_ts = hdr.timestamp;
+        if (hdr.type == static_cast<u8>(CaptureRecordType::DATA)) {
+            stream.chunks.push_back({ hdr.timestamp, stream.data.size(), payload.size() });
+            stream.data.insert(stream.data.end(), payload.begin(), payload.end());
+        }
+        *duration = std::max(*duration, hdr.timestamp);
+    }
+    std::vector<Stream> result;
+    for (auto& kv: streams) {
+        if (!kv.second.chunks.empty()) {
+            result.push_back(std::move(kv.second));
+        }
+    }
+    return result;
+}
+
+static const char* protocol_name(CaptureProtocol protocol) {
+    switch (protocol) {
+    case CaptureProtocol::RESP:
+        return "resp";
+    case CaptureProtocol::OPENTSDB:
+        return "opentsdb";
+    case CaptureProtocol::UDP:
+        return "udp";
+    };
+    return "unknown";
+}
+
+//! Read total number of points written by the server
+static u64 get_server_points(Options const& opt) {
+    std::stringstream json(http_get(opt.host, opt.http_port, "/api/stats/probes"));
+    boost::property_tree::ptree stats;
+    boost::property_tree::json_parser::read_json(json, stats);
+    return stats.get<u64>("nbtree_append.count", 0);
+}
+
+struct ReplayStats {
+    u64              bytes;
+    u64              chunks;
+    std::vector<u64> lag;     //< Difference between actual and scheduled send time
+};
+
+/** Replay single stream.
+  * Chunk with timestamp `ts` should be sent at `start + ts / speed`, so the relative
+  * order of the streams is preserved.
+  */
+static void replay_stream(Options const& opt, Stream const& stream, u64 start, ReplayStats* stats) {
+    boost::asio::io_service io;
+    tcp::socket tsock(io);
+    udp::socket usock(io);
+    udp::endpoint peer;
+    auto addr = boost::asio::ip::address::from_string(opt.host);
+    auto schedule = [&](u64 ts) -> u64 {
+        return opt.speed > 0 ? start + static_cast<u64>(static_cast<double>(ts) / opt.speed) : 0;
+    };
+    auto wait_until = [](u64 deadline) {
+        u64 now = steady_ns();
+        if (deadline > now) {
+            std::this_thread::sleep_for(std::chrono::nanoseconds(deadline - now));
+        }
+    };
+    wait_until(schedule(stream.open_ts));
+    if (stream.protocol == CaptureProtocol::UDP) {
+        peer = udp::endpoint(addr, static_cast<unsigned short>(opt.udp_port));
+        usock.open(udp::v4());
+    } else {
+        int port = stream.protocol == CaptureProtocol::RESP ? opt.resp_port : opt.opentsdb_port;
+        tsock.connect(tcp::endpoint(addr, static_cast<unsigned short>(port)));
+        tsock.set_option(tcp::no_delay(true));
+    }
+    for (auto const& chunk: stream.chunks) {
+        u64 deadline = schedule(chunk.timestamp);
+        wait_until(deadline);
+        auto buf = boost::asio::buffer(stream.data.data() + chunk.offset, chunk.size);
+        if (stream.protocol == CaptureProtocol::UDP) {
+            usock.send_to(buf, peer);
+        } else {
+            boost::asio::write(tsock, buf);
+        }
+        if (deadline) {
+            u64 now = steady_ns();
+            stats->lag.push_back(now > deadline ? now - deadline : 0);
+        }
+        stats->bytes += chunk.size;
+        stats->chunks++;
+    }
+    if (stream.protocol != CaptureProtocol::UDP) {
+        wait_until(schedule(stream.close_ts));
+        boost::system::error_code err;
+        tsock.shutdown(tcp::socket::shutdown_send, err);
+    }
+}
+
+static bool parse_args(int argc, char** argv, Options* opt) {
+    po::options_description desc("Replay ingestion capture against local akumulid instance");
+    desc.add_options()
+        ("help", "Produce help message")
+        ("input",           po::value<std::string>(&opt->input), "Capture file")
+        ("host",            po::value<std::string>(&opt->host)->default_value("127.0.0.1"), "Server address")
+        ("resp-port",       po::value<int>(&opt->resp_port)->default_value(8282), "RESP (TCP) port")
+        ("opentsdb-port",   po::value<int>(&opt->opentsdb_port)->default_value(4242), "OpenTSDB port")
+        ("udp-port",        po::value<int>(&opt->udp_port)->default_value(8383), "UDP port")
+        ("http-port",       po::value<int>(&opt->http_port)->default_value(8181), "HTTP API port")
+        ("speed",           po::value<double>(&opt->speed)->default_value(1.0), "Speedup factor (1 - original timing, 0 - as fast as possible)")
+        ("probe-interval",  po::value<int>(&opt->probe_interval)->default_value(100), "Latency probe interval (ms, 0 to disable)")
+        ("pid",             po::value<int>(&opt->pid)->default_value(0), "Server pid (0 - find akumulid process)")
+        ("output",          po::value<std::string>(&opt->output), "Write JSON report to file instead of stdout")
+    ;
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc, argv, desc), vm);
+    po::notify(vm);
+    if (vm.count("help")) {
+        std::cout << desc << std::endl;
+        return false;
+    }
+    if (opt->input.empty() || opt->speed < 0) {
+        std::cerr << "Invalid arguments" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    Options opt;
+    if (!parse_args(argc, argv, &opt)) {
+        return 1;
+    }
+    u64 duration = 0;
+    std::vector<Stream> streams;
+    try {
+        streams = load_capture(opt.input, &duration);
+    } catch (std::exception const& err) {
+        std::cerr << err.what() << std::endl;
+        return 1;
+    }
+    if (streams.empty()) {
+        std::cerr << "Capture is empty" << std::endl;
+        return 1;
+    }
+    int pid = opt.pid ? opt.pid : find_server_pid();
+    if (pid == 0) {
+        std::cerr << "akumulid process not found, CPU and memory usage will not be reported" << std::endl;
+    }
+
+    // Latency probes
+    std::atomic<bool> done = {false};
+    std::vector<u64> latencies;
+    u64 probes_lost = 0;
+    u64 probe_id = 0;
+    boost::asio::io_service io;
+    tcp::socket probe_sock(io);
+    if (opt.probe_interval > 0) {
+        auto addr = boost::asio::ip::address::from_string(opt.host);
+        probe_sock.connect(tcp::endpoint(addr, static_cast<unsigned short>(opt.resp_port)));
+        probe_sock.set_option(tcp::no_delay(true));
+    }
+    auto send_probe = [&](double timeout) {
+        u64 id = probe_id++;
+        u64 ts = now_ns();
+        std::string buf = "+replay.probe id=" + std::to_string(id) + "\r\n:" + std::to_string(ts) + "\r\n+1\r\n";
+        u64 start = steady_ns();
+        boost::asio::write(probe_sock, boost::asio::buffer(buf));
+        if (wait_visible(opt.host, opt.http_port, "replay.probe", id, ts, timeout)) {
+            latencies.push_back(steady_ns() - start);
+        } else {
+            probes_lost++;
+        }
+    };
+    auto prober = [&]() {
+        while (!done) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(opt.probe_interval));
+            send_probe(10.0);
+        }
+    };
+
+    ProcStats before = {};
+    if (pid) {
+        before = read_proc_stats(pid);
+    }
+    u64 points_before = get_server_points(opt);
+    std::vector<ReplayStats> stats(streams.size());
+    std::vector<std::thread> threads;
+    PerfTimer tm;
+    u64 start = steady_ns();
+    for (size_t i = 0; i < streams.size(); i++) {
+        threads.emplace_back([&, i]() {
+            try {
+                replay_stream(opt, streams[i], start, &stats[i]);
+            } catch (std::exception const& err) {
+                std::cerr << "Stream " << streams[i].id << " failed: " << err.what() << std::endl;
+            }
+        });
+    }
+    std::thread pth;
+    if (opt.probe_interval > 0) {
+        pth = std::thread(prober);
+    }
+    for (auto& th: threads) {
+        th.join();
+    }
+    double send_time = tm.elapsed();
+    done = true;
+    if (pth.joinable()) {
+        pth.join();
+    }
+    // Wait until the server will catch up, drain time is included into the elapsed time
+    if (opt.probe_interval > 0) {
+        send_probe(60.0);
+    }
+    double elapsed = tm.elapsed();
+    ProcStats after = {};
+    if (pid) {
+        after = read_proc_stats(pid);
+    }
+    u64 points = get_server_points(opt) - points_before;
+    // Probes are counted by the server too
+    points -= std::min(points, probe_id);
+
+    u64 bytes = 0, chunks = 0;
+    std::vector<u64> lag;
+    std::map<std::string, int> protocols;
+    for (size_t i = 0; i < streams.size(); i++) {
+        bytes  += stats[i].bytes;
+        chunks += stats[i].chunks;
+        lag.insert(lag.end(), stats[i].lag.begin(), stats[i].lag.end());
+        protocols[protocol_name(streams[i].protocol)]++;
+    }
+    std::sort(lag.begin(), lag.end());
+    std::sort(latencies.begin(), latencies.end());
+
+    boost::property_tree::ptree report;
+    report.put("capture.path", opt.input);
+    report.put("capture.duration_s", static_cast<double>(duration) / 1000000000.0);
+    report.put("capture.streams", streams.size());
+    for (auto const& kv: protocols) {
+        report.put("capture.protocols." + kv.first, kv.second);
+    }
+    report.put("speed", opt.speed);
+    report.put("send_time_s", send_time);
+    report.put("elapsed_s", elapsed);
+    report.put("bytes", bytes);
+    report.put("chunks", chunks);
+    report.put("points", points);
+    report.put("bytes_per_sec", static_cast<double>(bytes) / elapsed);
+    report.put("points_per_sec", static_cast<double>(points) / elapsed);
+    if (!lag.empty()) {
+        report.put("schedule_lag.p50_ns", percentile(lag, 0.5));
+        report.put("schedule_lag.p99_ns", percentile(lag, 0.99));
+        report.put("schedule_lag.max_ns", lag.back());
+    }
+    if (pid) {
+        double cpu = after.cpu_time - before.cpu_time;
+        report.put("server.cpu_s", cpu);
+        report.put("server.cpu_ns_per_point", points ? cpu * 1000000000.0 / static_cast<double>(points) : 0.0);
+        report.put("server.rss_before", before.rss);
+        report.put("server.rss_after", after.rss);
+        report.put("server.rss_growth", static_cast<int64_t>(after.rss) - static_cast<int64_t>(before.rss));
+    }
+    report.put("latency.probes", latencies.size());
+    report.put("latency.lost", probes_lost);
+    report.put("latency.p50_ns", percentile(latencies, 0.5));
+    report.put("latency.p99_ns", percentile(latencies, 0.99));
+    report.put("latency.p999_ns", percentile(latencies, 0.999));
+    report.put("latency.max_ns", latencies.empty() ? 0 : latencies.back());
+
+    if (opt.output.empty()) {
+        boost::property_tree::json_parser::write_json(std::cout, report, true);
+    } else {
+        std::ofstream out(opt.output);
+        boost::property_tree::json_parser::write_json(out, report, true);
+    }
+    return 0;
+}
@@ -28,6 +28,10 @@ struct DbMock : DbConnection {
         throw "not implemented";
     }
 
+    virtual std::shared_ptr<DbCursor> prepare(std::string query) {
+        throw "not implemented";
+    }
+
     int param_id_to_series(aku_ParamId id, char *buffer, size_t buffer_size) {
         throw "not implemented";
     }
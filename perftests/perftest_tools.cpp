@@ -1,10 +1,66 @@
 #include <boost/asio.hpp>
+#include <atomic>
+#include <iostream>
+#include <new>
 #include <string>
 #include <chrono>
 #include <cstdlib>
 #include <time.h>
 #include "perftest_tools.h"
 
+static std::atomic<uint64_t> g_alloc_count = {0};
+static std::atomic<uint64_t> g_alloc_bytes = {0};
+
+static void* counting_alloc(size_t size) {
+    g_alloc_count.fetch_add(1, std::memory_order_relaxed);
+    g_alloc_bytes.fetch_add(size, std::memory_order_relaxed);
+    void* ptr = std::malloc(size ? size : 1);
+    if (ptr == nullptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void* operator new(size_t size) {
+    return counting_alloc(size);
+}
+
+void* operator new[](size_t size) {
+    return counting_alloc(size);
+}
+
+void* operator new(size_t size, std::nothrow_t const&) noexcept {
+    try {
+        return counting_alloc(size);
+    } catch (std::bad_alloc const&) {
+        return nullptr;
+    }
+}
+
+void* operator new[](size_t size, std::nothrow_t const&) noexcept {
+    try {
+        return counting_alloc(size);
+    } catch (std::bad_alloc const&) {
+        return nullptr;
+    }
+}
+
+void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr, size_t) noexcept {
+    std::free(ptr);
+}
+
 namespace Akumuli {
 
 PerfTimer::PerfTimer() {
@@ -22,6 +78,26 @@ double PerfTimer::elapsed() const {
            double(curr.tv_nsec - _start_time.tv_nsec)/1000000000.0;
 }
 
+AllocationStats get_allocation_stats() {
+    AllocationStats stats = {
+        g_alloc_count.load(std::memory_order_relaxed),
+        g_alloc_bytes.load(std::memory_order_relaxed),
+    };
+    return stats;
+}
+
+void print_allocations(AllocationStats const& start, uint64_t nops) {
+    auto curr = get_allocation_stats();
+    uint64_t count = curr.count - start.count;
+    uint64_t bytes = curr.bytes - start.bytes;
+    std::cout << "Allocations: " << count << " (" << bytes << " bytes)";
+    if (nops) {
+        std::cout << ", " << static_cast<double>(count) / nops << " per op, "
+                  << static_cast<double>(bytes) / nops << " bytes per op";
+    }
+    std::cout << std::endl;
+}
+
 void push_metric_to_graphite(std::string metric, double value) {
 #ifdef DEBUG
     return;
@@ -15,6 +15,8 @@
  */
 
 #pragma once
+#include <cstdint>
+#include <string>
 #include <time.h>
 
 namespace Akumuli {
@@ -33,4 +35,18 @@ private:
  * `GRAPHITE_HOST` environment variable.
  */
 void push_metric_to_graphite(std::string metric, double value);
+
+/** Allocation counter.
+  * Global `operator new` is replaced in every perftest that links perftest_tools.cpp,
+  * all allocations made by all threads are counted.
+  */
+struct AllocationStats {
+    uint64_t count;     //< Number of allocations
+    uint64_t bytes;     //< Total number of bytes allocated
+};
+
+AllocationStats get_allocation_stats();
+
+//! Print number of allocations since `start` (per operation if `nops` is not zero)
+void print_allocations(AllocationStats const& start, uint64_t nops = 0);
 }
@@ -0,0 +1,112 @@
+#!/usr/bin/env python
+"""Compare two result files produced by `perf_microbench --json`.
+
+Usage:
+    compare_benchmarks.py baseline.json contender.json [--threshold 5]
+
+Benchmarks are matched by name. The change is considered significant if it's
+larger than the threshold and larger than the noise (two standard deviations of
+both runs). Exit code is 1 if any benchmark regressed.
+"""
+from __future__ import print_function
+import argparse
+import json
+import math
+import sys
+
+
+def load(path):
+    with open(path) as f:
+        report = json.load(f)
+    result = {}
+    for item in report.get("benchmarks", []):
+        result[item["name"]] = item
+    return report.get("context", {}), result
+
+
+def median_and_noise(item):
+    ns = item["ns_per_item"]
+    median = float(ns["median"])
+    stddev = float(ns["stddev"])
+    return median, stddev
+
+
+def counter(item, name):
+    counters = item.get("counters")
+    if counters is None or name not in counters:
+        return None
+    return float(counters[name])
+
+
+def fmt_ns(value):
+    if value >= 1e6:
+        return "%.2f ms" % (value / 1e6)
+    if value >= 1e3:
+        return "%.2f us" % (value / 1e3)
+    return "%.2f ns" % value
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Compare microbenchmark results")
+    parser.add_argument("baseline", help="Baseline JSON report")
+    parser.add_argument("contender", help="New JSON report")
+    parser.add_argument("--threshold", type=float, default=5.0,
+                        help="Minimal change in percents that is reported as regression/improvement")
+    parser.add_argument("--filter", default="", help="Compare only benchmarks with this substring in the name")
+    args = parser.parse_args()
+
+    base_ctx, base = load(args.baseline)
+    new_ctx, new = load(args.contender)
+    print("baseline:  %s (%s)" % (args.baseline, base_ctx.get("label", "")))
+    print("contender: %s (%s)" % (args.contender, new_ctx.get("label", "")))
+    print()
+
+    header = "%-40s %12s %12s %9s %9s %9s  %s" % ("benchmark", "baseline", "contender", "time", "instr", "allocs", "")
+    print(header)
+    print("-" * len(header))
+
+    regressions = 0
+    for name in sorted(set(base) | set(new)):
+        if args.filter and args.filter not in name:
+            continue
+        if name not in base:
+            print("%-40s %12s %12s" % (name, "-", fmt_ns(median_and_noise(new[name])[0])))
+            continue
+        if name not in new:
+            print("%-40s %12s %12s" % (name, fmt_ns(median_and_noise(base[name])[0]), "-"))
+            continue
+        b, bnoise = median_and_noise(base[name])
+        n, nnoise = median_and_noise(new[name])
+        delta = 100.0 * (n - b) / b if b > 0 else 0.0
+        noise = 100.0 * 2 * math.sqrt(bnoise**2 + nnoise**2) / b if b > 0 else 0.0
+
+        binstr = counter(base[name], "instructions")
+        ninstr = counter(new[name], "instructions")
+        instr = "-"
+        if binstr and ninstr is not None:
+            instr = "%+.1f%%" % (100.0 * (ninstr - binstr) / binstr)
+
+        ballocs = float(base[name].get("allocations_per_item", 0))
+        nallocs = float(new[name].get("allocations_per_item", 0))
+        allocs = "%+.2f" % (nallocs - ballocs) if abs(nallocs - ballocs) >= 0.005 else "="
+
+        verdict = ""
+        if abs(delta) >= args.threshold and abs(delta) > noise:
+            if delta > 0:
+                verdict = "REGRESSION"
+                regressions += 1
+            else:
+                verdict = "improvement"
+        elif abs(delta) >= args.threshold:
+            verdict = "(noise)"
+        print("%-40s %12s %12s %+8.1f%% %9s %9s  %s" % (name, fmt_ns(b), fmt_ns(n), delta, instr, allocs, verdict))
+
+    if regressions:
+        print()
+        print("%d benchmark(s) regressed" % regressions)
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
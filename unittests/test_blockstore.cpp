@@ -1,4 +1,7 @@
+#include <atomic>
 #include <iostream>
+#include <map>
+#include <thread>
 
 #define BOOST_TEST_DYN_LINK
 #define BOOST_TEST_MODULE Main
@@ -9,6 +12,7 @@
 #include "akumuli.h"
 #include "storage_engine/blockstore.h"
 #include "storage_engine/volume.h"
+#include "storage_engine/nbtree_def.h"
 #include "log_iface.h"
 
 using namespace Akumuli;
@@ -16,6 +20,7 @@ using namespace Akumuli;
 struct VolumeRegistryMock : VolumeRegistry {
 
     std::vector<VolumeDesc> volumes;
+    std::map<u32, VolumeSummary> summaries;
     std::string dbname;
 
     std::vector<VolumeDesc> get_volumes() const {
@@ -34,6 +39,25 @@ struct VolumeRegistryMock : VolumeRegistry {
         volume.generation = vol.generation;
     }
 
+    std::vector<VolumeSummary> get_volume_summaries() const {
+        std::vector<VolumeSummary> result;
+        for (auto const& kv: summaries) {
+            result.push_back(kv.second);
+        }
+        return result;
+    }
+
+    void update_volume_summary(const VolumeSummary& summary) {
+        auto it = summaries.find(summary.id);
+        if (!summary.filter.empty()) {
+            summaries[summary.id] = summary;
+        } else if (it != summaries.end() && it->second.generation == summary.generation) {
+            it->second.begin = summary.begin;
+            it->second.end = summary.end;
+            it->second.filter_nblocks = summary.filter_nblocks;
+        }
+    }
+
     std::string get_dbname() {
         return dbname;
     }
@@ -181,6 +205,111 @@ BOOST_AUTO_TEST_CASE(Test_blockstore_1) {
     delete_blockstore();
 }
 
+static std::shared_ptr<Block> make_block(aku_ParamId id, aku_Timestamp begin, aku_Timestamp end) {
+    auto block = std::make_shared<Block>();
+    auto ref = reinterpret_cast<SubtreeRef*>(block->get_data());
+    ref->id    = id;
+    ref->begin = begin;
+    ref->end   = end;
+    ref->type  = NBTreeBlockType::LEAF;
+    return block;
+}
+
+BOOST_AUTO_TEST_CASE(Test_blockstore_volume_summary) {
+    delete_blockstore();
+    create_blockstore();
+    std::shared_ptr<VolumeRegistryMock> vrmock(new VolumeRegistryMock());
+    vrmock->volumes = {
+        { 0, VOLPATH[0], 0, 0, CAPACITIES[0], 0 },
+        { 1, VOLPATH[1], 0, 0, CAPACITIES[1], 1 },
+    };
+    vrmock->dbname = "test";
+    auto bstore = FixedSizeFileStorage::open(vrmock);
+    BOOST_REQUIRE(!bstore->get_summary_snapshot().may_contain(42, AKU_MIN_TIMESTAMP, AKU_MAX_TIMESTAMP));
+
+    aku_Status status;
+    LogicAddr addr;
+    for (int i = 0; i < 4; i++) {
+        std::tie(status, addr) = bstore->append_block(make_block(42, 1000 + i*100, 1099 + i*100));
+        BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+    }
+    BOOST_REQUIRE(bstore->get_summary_snapshot().may_contain(42, 1050, 1060));
+    BOOST_REQUIRE(bstore->get_summary_snapshot().may_contain(42, 1399, 2000));
+    BOOST_REQUIRE(bstore->get_summary_snapshot().may_contain(42, 2000, 0));
+    BOOST_REQUIRE(!bstore->get_summary_snapshot().may_contain(42, 1400, 2000));
+    BOOST_REQUIRE(!bstore->get_summary_snapshot().may_contain(42, 0, 999));
+    BOOST_REQUIRE(!bstore->get_summary_snapshot().may_contain(43, 1000, 2000));
+
+    // Summary should be restored on reopen
+    bstore->flush();
+    bstore.reset();
+    BOOST_REQUIRE_EQUAL(vrmock->summaries.size(), 1);
+    BOOST_REQUIRE_EQUAL(vrmock->summaries.at(0).filter_nblocks, 4);
+    vrmock->volumes.at(0).nblocks = 4;  // mock doesn't save volume updates
+    bstore = FixedSizeFileStorage::open(vrmock);
+    BOOST_REQUIRE(bstore->get_summary_snapshot().may_contain(42, 1050, 1060));
+    BOOST_REQUIRE(!bstore->get_summary_snapshot().may_contain(43, 1000, 2000));
+
+    // Fill the rest of the first volume and the second volume
+    for (int i = 0; i < 12; i++) {
+        std::tie(status, addr) = bstore->append_block(make_block(43, 5000 + i*100, 5099 + i*100));
+        BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+    }
+    BOOST_REQUIRE(bstore->get_summary_snapshot().may_contain(42, 1000, 2000));
+    BOOST_REQUIRE(bstore->get_summary_snapshot().may_contain(43, 5000, 5100));
+
+    // First volume is recycled, blocks of the series 42 are gone
+    std::tie(status, addr) = bstore->append_block(make_block(44, 9000, 9099));
+    BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+    BOOST_REQUIRE_EQUAL(addr, 2ull << 32);
+    BOOST_REQUIRE(!bstore->get_summary_snapshot().may_contain(42, 1000, 2000));
+    BOOST_REQUIRE(!bstore->get_summary_snapshot().may_contain(43, 5000, 5399));
+    BOOST_REQUIRE(bstore->get_summary_snapshot().may_contain(43, 5400, 5500));
+    BOOST_REQUIRE(bstore->get_summary_snapshot().may_contain(44, 9000, 9000));
+    BOOST_REQUIRE_EQUAL(vrmock->summaries.at(0).generation, 2);
+
+    delete_blockstore();
+}
+
+BOOST_AUTO_TEST_CASE(Test_blockstore_volume_summary_partial_filter) {
+    delete_blockstore();
+    create_blockstore();
+    std::shared_ptr<VolumeRegistryMock> vrmock(new VolumeRegistryMock());
+    vrmock->volumes = {
+        { 0, VOLPATH[0], 0, 0, CAPACITIES[0], 0 },
+        { 1, VOLPATH[1], 0, 0, CAPACITIES[1], 1 },
+    };
+    vrmock->dbname = "test";
+    auto bstore = FixedSizeFileStorage::open(vrmock);
+
+    aku_Status status;
+    LogicAddr addr;
+    for (int i = 0; i < 4; i++) {
+        std::tie(status, addr) = bstore->append_block(make_block(42, 1000 + i*100, 1099 + i*100));
+        BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+    }
+    // Filter is not saved for the fifth block, only the time range
+    std::tie(status, addr) = bstore->append_block(make_block(43, 1400, 1499));
+    BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+    std::tie(status, addr) = bstore->append_block(make_block(42, 1500, 1599));
+    BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+    BOOST_REQUIRE(bstore->get_summary_snapshot().may_contain(43, 1400, 1499));
+    BOOST_REQUIRE(!bstore->get_summary_snapshot().may_contain(44, 1000, 2000));
+    BOOST_REQUIRE_EQUAL(vrmock->summaries.at(0).filter_nblocks, 4);
+    BOOST_REQUIRE_EQUAL(vrmock->summaries.at(0).end, 1599);
+
+    // Filter doesn't cover all blocks after reopen, only the time range can be used
+    bstore->flush();
+    bstore.reset();
+    vrmock->volumes.at(0).nblocks = 6;  // mock doesn't save volume updates
+    bstore = FixedSizeFileStorage::open(vrmock);
+    BOOST_REQUIRE(bstore->get_summary_snapshot().may_contain(43, 1400, 1499));
+    BOOST_REQUIRE(bstore->get_summary_snapshot().may_contain(44, 1000, 2000));
+    BOOST_REQUIRE(!bstore->get_summary_snapshot().may_contain(44, 1600, 2000));
+
+    delete_blockstore();
+}
+
 BOOST_AUTO_TEST_CASE(Test_blockstore_3) {
     delete_expandable_storage();
     create_expandable_storage();
@@ -261,3 +390,324 @@ BOOST_AUTO_TEST_CASE(Test_blockstore_4) {
     boost::filesystem::remove(expected_path);
     delete_expandable_storage();
 }
+
+static const std::vector<std::string> STRIPED_VOLPATH = { "stripe0_0.vol", "stripe1_1.vol",
+                                                          "stripe0_2.vol", "stripe1_3.vol" };
+
+static void create_striped_storage() {
+    for (auto const& path: STRIPED_VOLPATH) {
+        Volume::create_new(path.c_str(), CAPACITIES[0]);
+    }
+}
+
+static std::shared_ptr<StripedFileStorage> open_striped_storage() {
+    std::shared_ptr<VolumeRegistryMock> vrmock(new VolumeRegistryMock());
+    for (u32 ix = 0; ix < STRIPED_VOLPATH.size(); ix++) {
+        vrmock->volumes.push_back({ ix, STRIPED_VOLPATH[ix], 0, 0, CAPACITIES[0], ix });
+    }
+    vrmock->dbname = "test";
+    return StripedFileStorage::open(vrmock, 2);
+}
+
+static void delete_striped_storage() {
+    for (auto const& path: STRIPED_VOLPATH) {
+        boost::filesystem::remove(path);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(Test_striped_blockstore) {
+    delete_striped_storage();
+    create_striped_storage();
+    auto bstore = open_striped_storage();
+    aku_Status status;
+    LogicAddr addr;
+    std::vector<LogicAddr> addrlist;
+
+    // First row (volumes 0 and 1) is filled in round-robin order
+    const u32 rowsize = CAPACITIES[0] * 2;
+    for (u32 i = 0; i < rowsize; i++) {
+        auto buffer = std::make_shared<Block>();
+        buffer->get_data()[0] = static_cast<u8>(i);
+        std::tie(status, addr) = bstore->append_block(buffer);
+        BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+        BOOST_REQUIRE_EQUAL(addr, (static_cast<u64>(i % 2) << 32) | (i / 2));
+        addrlist.push_back(addr);
+    }
+    // Second row (volumes 2 and 3)
+    for (u32 i = 0; i < rowsize; i++) {
+        auto buffer = std::make_shared<Block>();
+        std::tie(status, addr) = bstore->append_block(buffer);
+        BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+        BOOST_REQUIRE_EQUAL(addr, (static_cast<u64>(2 + i % 2) << 32) | (i / 2));
+    }
+    bstore->flush();
+    for (u32 i = 0; i < rowsize; i++) {
+        std::shared_ptr<Block> block;
+        std::tie(status, block) = bstore->read_block(addrlist.at(i));
+        BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+        BOOST_REQUIRE_EQUAL(block->get_cdata()[0], i);
+    }
+
+    // Overflow, the whole first row should be reused
+    auto buffer = std::make_shared<Block>();
+    buffer->get_data()[0] = 42;
+    std::tie(status, addr) = bstore->append_block(buffer);
+    BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+    BOOST_REQUIRE_EQUAL(addr, 4ull << 32);
+    for (auto old: addrlist) {
+        BOOST_REQUIRE(!bstore->exists(old));
+    }
+    std::shared_ptr<Block> block;
+    std::tie(status, block) = bstore->read_block(addr);
+    BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+    BOOST_REQUIRE_EQUAL(block->get_cdata()[0], 42);
+
+    std::tie(status, addr) = bstore->append_block(std::make_shared<Block>());
+    BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+    BOOST_REQUIRE_EQUAL(addr, 5ull << 32);
+
+    delete_striped_storage();
+}
+
+static std::shared_ptr<Block> make_cached_block(LogicAddr addr) {
+    std::vector<u8> data(AKU_BLOCK_SIZE, 0);
+    return std::make_shared<Block>(addr, std::move(data));
+}
+
+BOOST_AUTO_TEST_CASE(Test_block_cache_scan_resistance) {
+    BlockCache cache(10);
+    // Working set, accessed twice and promoted to the protected segment
+    for (LogicAddr addr = 0; addr < 5; addr++) {
+        cache.insert(addr, make_cached_block(addr), false);
+        BOOST_REQUIRE(cache.lookup(addr));
+    }
+    // Superblock goes directly to the protected segment
+    cache.insert(100, make_cached_block(100), true);
+    // One-off scan shouldn't evict the working set
+    for (LogicAddr addr = 1000; addr < 1100; addr++) {
+        cache.insert(addr, make_cached_block(addr), false);
+    }
+    BOOST_REQUIRE_EQUAL(cache.size(), 10);
+    for (LogicAddr addr = 0; addr < 5; addr++) {
+        auto block = cache.lookup(addr);
+        BOOST_REQUIRE(block);
+        BOOST_REQUIRE_EQUAL(block->get_addr(), addr);
+    }
+    BOOST_REQUIRE(cache.lookup(100));
+    BOOST_REQUIRE(cache.lookup(1099));
+    BOOST_REQUIRE(!cache.lookup(1000));
+    BOOST_REQUIRE_EQUAL(MemoryAccounting::get_objects(AKU_MEM_BLOCK_CACHE), 10);
+    BOOST_REQUIRE_GE(MemoryAccounting::get_bytes(AKU_MEM_BLOCK_CACHE), 10*AKU_BLOCK_SIZE);
+}
+
+static std::shared_ptr<FixedSizeFileStorage> open_blockstore_direct() {
+    std::shared_ptr<VolumeRegistryMock> vrmock(new VolumeRegistryMock());
+    vrmock->volumes = {
+        { 0, VOLPATH[0], 0, 0, CAPACITIES[0], 0 },
+        { 1, VOLPATH[1], 0, 0, CAPACITIES[1], 1 },
+    };
+    vrmock->dbname = "test";
+    FileStorageParams params;
+    params.direct_io  = true;
+    params.cache_size = 4;
+    return FixedSizeFileStorage::open(vrmock, params);
+}
+
+BOOST_AUTO_TEST_CASE(Test_blockstore_direct_io) {
+    delete_blockstore();
+    create_blockstore();
+    auto bstore = open_blockstore_direct();
+    aku_Status status;
+    LogicAddr addr;
+    std::vector<LogicAddr> addrlist;
+    for (u32 i = 0; i < 12; i++) {
+        auto buffer = std::make_shared<Block>();
+        buffer->get_data()[0] = static_cast<u8>(i);
+        buffer->get_data()[AKU_BLOCK_SIZE - 1] = static_cast<u8>(i + 1);
+        std::tie(status, addr) = bstore->append_block(buffer);
+        BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+        addrlist.push_back(addr);
+    }
+    bstore->flush();
+    // Read everything twice, first pass reads evicted blocks from volumes
+    for (int pass = 0; pass < 2; pass++) {
+        for (u32 i = 0; i < addrlist.size(); i++) {
+            std::shared_ptr<Block> block;
+            std::tie(status, block) = bstore->read_block(addrlist.at(i));
+            BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+            BOOST_REQUIRE_EQUAL(block->get_addr(), addrlist.at(i));
+            BOOST_REQUIRE_EQUAL(block->get_size(), AKU_BLOCK_SIZE);
+            BOOST_REQUIRE_EQUAL(block->get_cdata()[0], i);
+            BOOST_REQUIRE_EQUAL(block->get_cdata()[AKU_BLOCK_SIZE - 1], i + 1);
+        }
+    }
+    delete_blockstore();
+}
+
+BOOST_AUTO_TEST_CASE(Test_blockstore_direct_io_concurrent_reads) {
+    delete_blockstore();
+    create_blockstore();
+    auto bstore = open_blockstore_direct();
+    aku_Status status;
+    LogicAddr addr;
+    std::vector<LogicAddr> addrlist;
+    for (u32 i = 0; i < 12; i++) {
+        auto buffer = std::make_shared<Block>();
+        buffer->get_data()[0] = static_cast<u8>(i);
+        std::tie(status, addr) = bstore->append_block(buffer);
+        BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+        addrlist.push_back(addr);
+    }
+    bstore->flush();
+    // Cache is smaller than the working set, so readers hit the volumes concurrently
+    std::atomic<int> nerrors{0};
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 4; t++) {
+        readers.emplace_back([&]() {
+            for (int pass = 0; pass < 100; pass++) {
+                for (u32 i = 0; i < addrlist.size(); i++) {
+                    aku_Status rstatus;
+                    std::shared_ptr<Block> block;
+                    std::tie(rstatus, block) = bstore->read_block(addrlist.at(i));
+                    if (rstatus != AKU_SUCCESS || block->get_cdata()[0] != i) {
+                        nerrors++;
+                    }
+                }
+            }
+        });
+    }
+    for (auto& th: readers) {
+        th.join();
+    }
+    BOOST_REQUIRE_EQUAL(nerrors.load(), 0);
+    delete_blockstore();
+}
+
+static std::shared_ptr<Block> make_typed_block(NBTreeBlockType type, u8 value) {
+    auto block = std::make_shared<Block>();
+    auto ref = reinterpret_cast<SubtreeRef*>(block->get_data());
+    ref->type = type;
+    block->get_data()[AKU_BLOCK_SIZE - 1] = value;
+    return block;
+}
+
+BOOST_AUTO_TEST_CASE(Test_split_blockstore) {
+    auto leaves = BlockStoreBuilder::create_memstore();
+    auto sblocks = BlockStoreBuilder::create_memstore();
+    SplitBlockStore bstore(leaves, sblocks);
+    aku_Status status;
+    LogicAddr addr;
+    std::vector<LogicAddr> addrlist;
+    for (u8 i = 0; i < 10; i++) {
+        auto type = i % 3 == 2 ? NBTreeBlockType::INNER : NBTreeBlockType::LEAF;
+        std::tie(status, addr) = bstore.append_block(make_typed_block(type, i));
+        BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+        BOOST_REQUIRE_EQUAL((addr & SUPERBLOCK_ADDR_TAG) != 0, type == NBTreeBlockType::INNER);
+        addrlist.push_back(addr);
+    }
+    bstore.flush();
+    BOOST_REQUIRE_EQUAL(leaves->get_stats().nblocks, 7);
+    BOOST_REQUIRE_EQUAL(sblocks->get_stats().nblocks, 3);
+    BOOST_REQUIRE_EQUAL(bstore.get_stats().nblocks, 10);
+    for (u8 i = 0; i < 10; i++) {
+        std::shared_ptr<Block> block;
+        BOOST_REQUIRE(bstore.exists(addrlist.at(i)));
+        std::tie(status, block) = bstore.read_block(addrlist.at(i));
+        BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+        BOOST_REQUIRE_EQUAL(block->get_addr(), addrlist.at(i));
+        BOOST_REQUIRE_EQUAL(block->get_cdata()[AKU_BLOCK_SIZE - 1], i);
+    }
+}
+
+/** Blockstore that returns the same block instance on every read (like the block cache)
+  */
+struct SharedBlocksMock : BlockStore {
+    std::shared_ptr<BlockStore> base_;
+    std::map<LogicAddr, std::shared_ptr<Block>> blocks_;
+
+    SharedBlocksMock(std::shared_ptr<BlockStore> base)
+        : base_(base)
+    {
+    }
+
+    virtual std::tuple<aku_Status, std::shared_ptr<Block>> read_block(LogicAddr addr) {
+        auto it = blocks_.find(addr);
+        if (it != blocks_.end()) {
+            return std::make_tuple(AKU_SUCCESS, it->second);
+        }
+        aku_Status status;
+        std::shared_ptr<Block> block;
+        std::tie(status, block) = base_->read_block(addr);
+        if (status == AKU_SUCCESS) {
+            blocks_[addr] = block;
+        }
+        return std::make_tuple(status, block);
+    }
+    virtual std::tuple<aku_Status, LogicAddr> append_block(std::shared_ptr<Block> data) {
+        return base_->append_block(data);
+    }
+    virtual void flush() {
+        base_->flush();
+    }
+    virtual bool exists(LogicAddr addr) const {
+        return base_->exists(addr);
+    }
+    virtual u32 checksum(u8 const* data, size_t size) const {
+        return base_->checksum(data, size);
+    }
+    virtual BlockStoreStats get_stats() const {
+        return base_->get_stats();
+    }
+    virtual PerVolumeStats get_volume_stats() const {
+        return base_->get_volume_stats();
+    }
+    virtual VolumeSummarySnapshot get_summary_snapshot() const {
+        return base_->get_summary_snapshot();
+    }
+};
+
+BOOST_AUTO_TEST_CASE(Test_split_blockstore_shared_blocks) {
+    auto leaves = BlockStoreBuilder::create_memstore();
+    auto sblocks = std::make_shared<SharedBlocksMock>(BlockStoreBuilder::create_memstore());
+    SplitBlockStore bstore(leaves, sblocks);
+    aku_Status status;
+    LogicAddr addr;
+    std::tie(status, addr) = bstore.append_block(make_typed_block(NBTreeBlockType::INNER, 42));
+    BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+    BOOST_REQUIRE((addr & SUPERBLOCK_ADDR_TAG) != 0);
+    for (int i = 0; i < 2; i++) {
+        std::shared_ptr<Block> block;
+        std::tie(status, block) = bstore.read_block(addr);
+        BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+        BOOST_REQUIRE_EQUAL(block->get_addr(), addr);
+        BOOST_REQUIRE_EQUAL(block->get_cdata()[AKU_BLOCK_SIZE - 1], 42);
+    }
+    // Shared block shouldn't be modified
+    std::shared_ptr<Block> shared;
+    std::tie(status, shared) = sblocks->read_block(addr & ~SUPERBLOCK_ADDR_TAG);
+    BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+    BOOST_REQUIRE_EQUAL(shared->get_addr(), addr & ~SUPERBLOCK_ADDR_TAG);
+}
+
+BOOST_AUTO_TEST_CASE(Test_volume_registry_view) {
+    std::shared_ptr<VolumeRegistryMock> vrmock(new VolumeRegistryMock());
+    vrmock->volumes = {
+        { 0, "vol0", 0, 0, 100, 0 },
+        { 1, "vol1", 0, 0, 100, 1 },
+        { SUPERBLOCK_VOLUME_BASE, "sb0", 0, 0, 10, 0 },
+    };
+    vrmock->dbname = "test";
+    VolumeRegistryView leaves(vrmock, 0, SUPERBLOCK_VOLUME_BASE, "");
+    VolumeRegistryView sblocks(vrmock, SUPERBLOCK_VOLUME_BASE, SUPERBLOCK_VOLUME_BASE, "_sb");
+    BOOST_REQUIRE_EQUAL(leaves.get_volumes().size(), 2);
+    auto sbvols = sblocks.get_volumes();
+    BOOST_REQUIRE_EQUAL(sbvols.size(), 1);
+    BOOST_REQUIRE_EQUAL(sbvols.at(0).id, 0);
+    BOOST_REQUIRE_EQUAL(sbvols.at(0).path, "sb0");
+    BOOST_REQUIRE_EQUAL(sblocks.get_dbname(), "test_sb");
+    VolumeRegistry::VolumeDesc desc = { 1, "sb1", 0, 0, 10, 1 };
+    sblocks.add_volume(desc);
+    BOOST_REQUIRE_EQUAL(vrmock->volumes.back().id, SUPERBLOCK_VOLUME_BASE + 1);
+    BOOST_REQUIRE_EQUAL(sblocks.get_volumes().size(), 2);
+    BOOST_REQUIRE_EQUAL(leaves.get_volumes().size(), 2);
+}
@@ -0,0 +1,161 @@
+#include <iostream>
+#include <thread>
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE Main
+#include <boost/test/unit_test.hpp>
+#include <boost/filesystem.hpp>
+
+#include "capture.h"
+
+using namespace Akumuli;
+
+static std::string temp_capture_path() {
+    auto path = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("capture-%%%%%%%%");
+    return path.string();
+}
+
+static CaptureSettings make_settings(std::string path, double sample_rate=1.0, u64 max_size=1024*1024) {
+    CaptureSettings settings;
+    settings.path        = path;
+    settings.sample_rate = sample_rate;
+    settings.max_size    = max_size;
+    settings.buffer_size = 64*1024;
+    return settings;
+}
+
+struct Record {
+    CaptureRecordHeader header;
+    std::string         payload;
+};
+
+static std::vector<Record> read_all(std::string path) {
+    std::vector<Record> result;
+    CaptureReader reader(path);
+    CaptureRecordHeader hdr;
+    std::vector<char> payload;
+    while (reader.next(&hdr, &payload)) {
+        result.push_back({ hdr, std::string(payload.begin(), payload.end()) });
+    }
+    return result;
+}
+
+BOOST_AUTO_TEST_CASE(Test_capture_roundtrip) {
+    auto path = temp_capture_path();
+    IngestionCapture::start(make_settings(path));
+    {
+        auto resp = IngestionCapture::open_stream(CaptureProtocol::RESP);
+        auto tsdb = IngestionCapture::open_stream(CaptureProtocol::OPENTSDB);
+        BOOST_REQUIRE(resp);
+        BOOST_REQUIRE(tsdb);
+        std::string msg1 = "+cpu host=A\r\n:1\r\n";
+        std::string msg2 = "+1.0\r\n";
+        std::string msg3 = "put cpu 1 1.0 host=A\n";
+        resp->write(msg1.data(), msg1.size());
+        tsdb->write(msg3.data(), msg3.size());
+        resp->write(msg2.data(), msg2.size());
+    }
+    IngestionCapture::stop();
+
+    auto records = read_all(path);
+    BOOST_REQUIRE_EQUAL(records.size(), 7);
+    u32 resp_id = records.at(0).header.stream_id;
+    std::string resp_data;
+    int nopen = 0, nclose = 0;
+    u64 prev_ts = 0;
+    for (auto const& rec: records) {
+        BOOST_REQUIRE(rec.header.timestamp >= prev_ts);
+        prev_ts = rec.header.timestamp;
+        switch (static_cast<CaptureRecordType>(rec.header.type)) {
+        case CaptureRecordType::OPEN:
+            nopen++;
+            break;
+        case CaptureRecordType::CLOSE:
+            nclose++;
+            break;
+        case CaptureRecordType::DATA:
+            if (rec.header.stream_id == resp_id) {
+                BOOST_REQUIRE(rec.header.protocol == static_cast<u8>(CaptureProtocol::RESP));
+                resp_data += rec.payload;
+            } else {
+                BOOST_REQUIRE(rec.header.protocol == static_cast<u8>(CaptureProtocol::OPENTSDB));
+                BOOST_REQUIRE_EQUAL(rec.payload, "put cpu 1 1.0 host=A\n");
+            }
+            break;
+        };
+    }
+    BOOST_REQUIRE_EQUAL(nopen, 2);
+    BOOST_REQUIRE_EQUAL(nclose, 2);
+    BOOST_REQUIRE_EQUAL(resp_data, "+cpu host=A\r\n:1\r\n+1.0\r\n");
+    boost::filesystem::remove(path);
+}
+
+BOOST_AUTO_TEST_CASE(Test_capture_disabled) {
+    BOOST_REQUIRE(!IngestionCapture::open_stream(CaptureProtocol::RESP));
+    BOOST_REQUIRE(!IngestionCapture::open_stream(CaptureProtocol::UDP));
+}
+
+BOOST_AUTO_TEST_CASE(Test_capture_sampling) {
+    auto path = temp_capture_path();
+    IngestionCapture::start(make_settings(path, 0.25));
+    int nstreams = 0;
+    for (int i = 0; i < 100; i++) {
+        if (IngestionCapture::open_stream(CaptureProtocol::RESP)) {
+            nstreams++;
+        }
+    }
+    BOOST_REQUIRE_EQUAL(nstreams, 25);
+    {
+        // UDP is sampled by datagram
+        auto udp = IngestionCapture::open_stream(CaptureProtocol::UDP);
+        BOOST_REQUIRE(udp);
+        for (int i = 0; i < 100; i++) {
+            udp->write("+a\r\n:1\r\n+1\r\n", 12);
+        }
+    }
+    IngestionCapture::stop();
+    int ndatagrams = 0;
+    for (auto const& rec: read_all(path)) {
+        if (rec.header.type == static_cast<u8>(CaptureRecordType::DATA)) {
+            ndatagrams++;
+        }
+    }
+    BOOST_REQUIRE_EQUAL(ndatagrams, 25);
+    boost::filesystem::remove(path);
+}
+
+BOOST_AUTO_TEST_CASE(Test_capture_max_size) {
+    auto path = temp_capture_path();
+    const u64 max_size = 4096;
+    IngestionCapture::start(make_settings(path, 1.0, max_size));
+    {
+        auto stream = IngestionCapture::open_stream(CaptureProtocol::RESP);
+        std::string chunk(100, 'x');
+        for (int i = 0; i < 100; i++) {
+            stream->write(chunk.data(), chunk.size());
+        }
+    }
+    IngestionCapture::stop();
+    BOOST_REQUIRE(boost::filesystem::file_size(path) <= max_size);
+    auto records = read_all(path);
+    BOOST_REQUIRE(records.size() > 1);
+    for (size_t i = 1; i < records.size(); i++) {
+        BOOST_REQUIRE(records[i].header.type == static_cast<u8>(CaptureRecordType::DATA));
+        BOOST_REQUIRE_EQUAL(records[i].payload.size(), 100);
+    }
+    boost::filesystem::remove(path);
+}
+
+BOOST_AUTO_TEST_CASE(Test_capture_generation) {
+    auto path = temp_capture_path();
+    auto gen0 = IngestionCapture::generation();
+    IngestionCapture::start(make_settings(path));
+    auto gen1 = IngestionCapture::generation();
+    BOOST_REQUIRE(gen1 != gen0);
+    IngestionCapture::stop();
+    auto gen2 = IngestionCapture::generation();
+    BOOST_REQUIRE(gen2 != gen1);
+    // New streams are not opened after stop
+    BOOST_REQUIRE(!IngestionCapture::open_stream(CaptureProtocol::UDP));
+    boost::filesystem::remove(path);
+}
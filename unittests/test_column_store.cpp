@@ -104,7 +104,9 @@ struct QueryProcessorMock : QP::IStreamProcessor {
 };
 
 
-void execute(std::shared_ptr<ColumnStore> cstore, IStreamProcessor* proc, ReshapeRequest const& req) {
+void execute(std::shared_ptr<ColumnStore> cstore, IStreamProcessor* proc, ReshapeRequest const& req,
+             QueryProfile* profile = nullptr)
+{
     aku_Status status;
     std::unique_ptr<QP::IQueryPlan> query_plan;
     std::tie(status, query_plan) = QP::QueryPlanBuilder::create(req);
@@ -113,7 +115,7 @@ void execute(std::shared_ptr<ColumnStore> cstore, IStreamProcessor* proc, Reshap
     }
     if (proc->start()) {
         QueryPlanExecutor executor;
-        executor.execute(*cstore, std::move(query_plan), *proc);
+        executor.execute(*cstore, std::move(query_plan), *proc, profile);
         proc->stop();
     }
 }
@@ -851,3 +853,145 @@ BOOST_AUTO_TEST_CASE(Test_column_store_aggregate_group_by_2) {
 BOOST_AUTO_TEST_CASE(Test_column_store_aggregate_group_by_3) {
     test_aggregate_and_group_by(1000, 11000);
 }
+
+BOOST_AUTO_TEST_CASE(Test_column_store_query_profile) {
+    aku_Timestamp begin = 100;
+    aku_Timestamp end = 100100;
+    auto cstore = create_cstore();
+    auto session = create_session(cstore);
+    std::vector<aku_ParamId> ids = {
+        10,11,12,13,14
+    };
+    for (auto id: ids) {
+        fill_data_in(cstore, session, id, begin, end);
+    }
+
+    // Scan decodes leaf nodes
+    {
+        QueryProcessorMock qproc;
+        QueryProfile profile;
+        ReshapeRequest req = {};
+        req.group_by.enabled = false;
+        req.select.begin = begin;
+        req.select.end = end;
+        req.select.columns.push_back({ids});
+        req.order_by = OrderBy::SERIES;
+        execute(cstore, &qproc, req, &profile);
+
+        BOOST_REQUIRE(qproc.error == AKU_SUCCESS);
+        BOOST_REQUIRE_EQUAL(profile.steps.size(), 2);
+        BOOST_REQUIRE_EQUAL(profile.steps.at(0), "scan");
+        BOOST_REQUIRE_EQUAL(profile.steps.at(1), "chain");
+        BOOST_REQUIRE_EQUAL(profile.noperators, ids.size());
+        BOOST_REQUIRE_EQUAL(profile.operator_samples, qproc.samples.size());
+        BOOST_REQUIRE_EQUAL(profile.materialized_samples, qproc.samples.size());
+        BOOST_REQUIRE(profile.counters.leaves_decoded > 0);
+        // Last leaf of every series is not committed yet
+        BOOST_REQUIRE(profile.counters.blocks_read + ids.size() >= profile.counters.leaves_decoded);
+        BOOST_REQUIRE_EQUAL(profile.counters.subtrees_reused, 0);
+
+        auto ptree = profile.to_ptree();
+        BOOST_REQUIRE_EQUAL(ptree.get<u64>("samples.operators"), qproc.samples.size());
+        BOOST_REQUIRE_EQUAL(ptree.get<u64>("nodes.leaves_decoded"), profile.counters.leaves_decoded);
+    }
+
+    // Aggregation uses precomputed values
+    {
+        QueryProcessorMock qproc;
+        QueryProfile profile;
+        ReshapeRequest req = {};
+        req.agg.enabled = true;
+        req.agg.func = { AggregationFunction::SUM };
+        req.group_by.enabled = false;
+        req.select.begin = begin;
+        req.select.end = end;
+        req.select.columns.push_back({ids});
+        req.order_by = OrderBy::SERIES;
+        execute(cstore, &qproc, req, &profile);
+
+        BOOST_REQUIRE(qproc.error == AKU_SUCCESS);
+        BOOST_REQUIRE_EQUAL(qproc.samples.size(), ids.size());
+        BOOST_REQUIRE_EQUAL(profile.steps.at(0), "aggregate");
+        BOOST_REQUIRE(profile.counters.subtrees_reused > 0);
+    }
+
+    // Counters are not collected without profile
+    {
+        QueryProcessorMock qproc;
+        ReshapeRequest req = {};
+        req.group_by.enabled = false;
+        req.select.begin = begin;
+        req.select.end = end;
+        req.select.columns.push_back({ids});
+        req.order_by = OrderBy::SERIES;
+        execute(cstore, &qproc, req);
+        BOOST_REQUIRE(QueryCounters::current() == nullptr);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(Test_series_activity_index) {
+    SeriesActivityIndex index(100);
+    index.add_new(1);
+    index.restore(2, std::make_pair(1000ull, 1999ull));
+    // Series 3 is unknown (created by the older version)
+
+    BOOST_REQUIRE(!index.is_active(1, 0, AKU_MAX_TIMESTAMP));
+    BOOST_REQUIRE(index.is_active(2, 1500, 2500));
+    BOOST_REQUIRE(index.is_active(2, 2500, 1500));
+    BOOST_REQUIRE(!index.is_active(2, 2000, 3000));
+    BOOST_REQUIRE(index.is_active(3, 2000, 3000));
+
+    // Range is aligned to partitions
+    auto range = index.update(1, 250);
+    BOOST_REQUIRE_EQUAL(range.first, 200);
+    BOOST_REQUIRE_EQUAL(range.second, 299);
+    range = index.update(1, 120);
+    BOOST_REQUIRE_EQUAL(range.first, 100);
+    BOOST_REQUIRE_EQUAL(range.second, 299);
+    BOOST_REQUIRE(!index.is_active(1, 300, 400));
+    BOOST_REQUIRE(index.is_active(1, 299, 400));
+
+    // Late add_new call shouldn't hide data written by the concurrent writer
+    index.add_new(1);
+    BOOST_REQUIRE(index.is_active(1, 100, 299));
+
+    // Unknown series can have data before the first update
+    range = index.update(3, 5000);
+    BOOST_REQUIRE_EQUAL(range.first, AKU_MIN_TIMESTAMP);
+    BOOST_REQUIRE_EQUAL(range.second, 5099);
+    BOOST_REQUIRE(index.is_active(3, 0, 10));
+
+    auto changes = index.pull_changes();
+    BOOST_REQUIRE_EQUAL(changes.size(), 2);
+    BOOST_REQUIRE(changes.at(1) == SeriesActivityIndex::Range(100, 299));
+    // Update inside the known range is not a change
+    index.update(3, 5050);
+    BOOST_REQUIRE(index.pull_changes().empty());
+}
+
+BOOST_AUTO_TEST_CASE(Test_column_store_drop_inactive) {
+    std::shared_ptr<BlockStore> bstore = BlockStoreBuilder::create_memstore();
+    auto cstore = std::make_shared<ColumnStore>(bstore, 1000);
+    auto session = create_session(cstore);
+    std::vector<aku_ParamId> ids = { 10, 11, 12 };
+    for (auto id: ids) {
+        cstore->create_new_column(id);
+    }
+    // 10 - old data, 11 - new data, 12 - no data
+    fill_data_in(cstore, session, 10, 100, 900);
+    fill_data_in(cstore, session, 11, 5000, 6000);
+
+    auto active = ids;
+    cstore->drop_inactive(&active, 5000, 6000);
+    BOOST_REQUIRE_EQUAL(active.size(), 1);
+    BOOST_REQUIRE_EQUAL(active.front(), 11);
+
+    active = ids;
+    cstore->drop_inactive(&active, 5500, 0);
+    BOOST_REQUIRE_EQUAL(active.size(), 2);
+
+    auto changes = cstore->pull_activity_changes();
+    BOOST_REQUIRE_EQUAL(changes.size(), 2);
+    BOOST_REQUIRE(changes.at(10) == SeriesActivityIndex::Range(0, 999));
+    BOOST_REQUIRE(changes.at(11) == SeriesActivityIndex::Range(5000, 5999));
+}
@@ -135,3 +135,70 @@ BOOST_AUTO_TEST_CASE(Test_cursor_error_100_7)
     test_cursor_error(100, 7);
 }
 
+
+BOOST_AUTO_TEST_CASE(Test_cursor_close_while_blocked)
+{
+    // Producer fills the queue and blocks, reader closes the cursor without reading
+    ConcurrentCursor cursor;
+    cursor.register_query("test");
+    BOOST_REQUIRE(RunningQueries::get_stats().size() > 0);
+    bool stopped = false;
+    QueryCancellation* token = nullptr;
+    auto generator = [&]() {
+        token = QueryCancellation::current();
+        while (true) {
+            aku_Sample r = {};
+            r.payload.type = AKU_PAYLOAD_FLOAT;
+            r.payload.size = sizeof(aku_Sample);
+            if (!cursor.put(r)) {
+                break;
+            }
+        }
+        stopped = true;
+    };
+    cursor.start(generator);
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    cursor.close();
+    BOOST_REQUIRE(stopped);
+    BOOST_REQUIRE(token == &cursor.cancellation_);
+    BOOST_REQUIRE_EQUAL(cursor.cancellation_.check(), AKU_ECANCELED);
+    BOOST_REQUIRE_EQUAL(RunningQueries::cancel(cursor.query_id_), AKU_ENOT_FOUND);
+}
+
+BOOST_AUTO_TEST_CASE(Test_cursor_cancel_running_query)
+{
+    ConcurrentCursor cursor;
+    cursor.register_query("test");
+    auto id = cursor.query_id_;
+    aku_Status reason = AKU_SUCCESS;
+    auto generator = [&]() {
+        // Query that doesn't produce any output
+        while (reason == AKU_SUCCESS) {
+            reason = QueryCancellation::check_current();
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        cursor.set_error(reason);
+    };
+    cursor.start(generator);
+    BOOST_REQUIRE_EQUAL(RunningQueries::cancel(id), AKU_SUCCESS);
+    while (!cursor.is_done()) {
+        char buffer[sizeof(aku_Sample)];
+        cursor.read(buffer, sizeof(buffer));
+    }
+    aku_Status status = AKU_SUCCESS;
+    BOOST_REQUIRE(cursor.is_error(&status));
+    BOOST_REQUIRE_EQUAL(status, AKU_ECANCELED);
+    cursor.close();
+}
+
+BOOST_AUTO_TEST_CASE(Test_cancellation_timeout)
+{
+    QueryCancellation token;
+    BOOST_REQUIRE_EQUAL(token.check(), AKU_SUCCESS);
+    token.set_timeout(1000000);  // 1ms
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    BOOST_REQUIRE_EQUAL(token.check(), AKU_ETIMEOUT);
+    // The first reason wins
+    token.cancel(AKU_ECANCELED);
+    BOOST_REQUIRE_EQUAL(token.check(), AKU_ETIMEOUT);
+}
@@ -76,3 +76,91 @@ BOOST_AUTO_TEST_CASE(Test_string_to_duration_minutes) {
     aku_Duration expected = 111*60*1000000000ul;
     BOOST_REQUIRE_EQUAL(actual, expected);
 }
+
+BOOST_AUTO_TEST_CASE(Test_string_to_duration_min) {
+
+    const char* test_case = "3min";
+    aku_Duration actual = DateTimeUtil::parse_duration(test_case, 4u);
+    aku_Duration expected = 3*60*1000000000ul;
+    BOOST_REQUIRE_EQUAL(actual, expected);
+}
+
+BOOST_AUTO_TEST_CASE(Test_string_to_duration_errors) {
+
+    aku_Duration result;
+    BOOST_REQUIRE_EQUAL(DateTimeUtil::parse_duration("10x", 3u, &result), AKU_EBAD_ARG);
+    BOOST_REQUIRE_EQUAL(DateTimeUtil::parse_duration("ms", 2u, &result), AKU_EBAD_ARG);
+    BOOST_REQUIRE_EQUAL(DateTimeUtil::parse_duration("10mss", 5u, &result), AKU_EBAD_ARG);
+    BOOST_REQUIRE_EQUAL(DateTimeUtil::parse_duration("99999999999999999999h", 21u, &result), AKU_EBAD_ARG);
+    BOOST_REQUIRE_THROW(DateTimeUtil::parse_duration("1d", 2u), BadDateTimeFormat);
+}
+
+static aku_Timestamp parse_with_boost(int y, int m, int d, int hh, int mm, int ss, int ns) {
+    auto date = boost::gregorian::date(y, m, d);
+    auto time = boost::posix_time::time_duration(hh, mm, ss, ns);
+    return DateTimeUtil::from_boost_ptime(boost::posix_time::ptime(date, time));
+}
+
+BOOST_AUTO_TEST_CASE(Test_string_iso_to_timestamp_basic_format) {
+
+    BOOST_REQUIRE_EQUAL(DateTimeUtil::from_iso_string("20060102T150405"),
+                        parse_with_boost(2006, 1, 2, 15, 4, 5, 0));
+    BOOST_REQUIRE_EQUAL(DateTimeUtil::from_iso_string("20060102T150405.5"),
+                        parse_with_boost(2006, 1, 2, 15, 4, 5, 500000000));
+    BOOST_REQUIRE_EQUAL(DateTimeUtil::from_iso_string("20060102T150405,123Z"),
+                        parse_with_boost(2006, 1, 2, 15, 4, 5, 123000000));
+    BOOST_REQUIRE_EQUAL(DateTimeUtil::from_iso_string("20000229T000000"),
+                        parse_with_boost(2000, 2, 29, 0, 0, 0, 0));
+    BOOST_REQUIRE_EQUAL(DateTimeUtil::from_iso_string("21001231T235959.999999999"),
+                        parse_with_boost(2100, 12, 31, 23, 59, 59, 999999999));
+    BOOST_REQUIRE_EQUAL(DateTimeUtil::from_iso_string("19700101T000000"), 0ul);
+}
+
+BOOST_AUTO_TEST_CASE(Test_string_iso_to_timestamp_rfc3339_format) {
+
+    aku_Timestamp expected = parse_with_boost(2006, 1, 2, 15, 4, 5, 0);
+    BOOST_REQUIRE_EQUAL(DateTimeUtil::from_iso_string("2006-01-02T15:04:05Z"), expected);
+    BOOST_REQUIRE_EQUAL(DateTimeUtil::from_iso_string("2006-01-02t15:04:05z"), expected);
+    BOOST_REQUIRE_EQUAL(DateTimeUtil::from_iso_string("2006-01-02 15:04:05"), expected);
+    BOOST_REQUIRE_EQUAL(DateTimeUtil::from_iso_string("2006-01-02T18:34:05+03:30"), expected);
+    BOOST_REQUIRE_EQUAL(DateTimeUtil::from_iso_string("2006-01-02T10:04:05-0500"), expected);
+    BOOST_REQUIRE_EQUAL(DateTimeUtil::from_iso_string("2006-01-02T17:04:05+02"), expected);
+    BOOST_REQUIRE_EQUAL(DateTimeUtil::from_iso_string("2006-01-02T15:04:05.999999999999Z"), expected + 999999999ul);
+    BOOST_REQUIRE_EQUAL(DateTimeUtil::from_iso_string("2006-01-02T15:04:05.001+00:00"), expected + 1000000ul);
+}
+
+BOOST_AUTO_TEST_CASE(Test_string_iso_to_timestamp_raw) {
+
+    BOOST_REQUIRE_EQUAL(DateTimeUtil::from_iso_string("1136214245999999999"), 1136214245999999999ul);
+    BOOST_REQUIRE_EQUAL(DateTimeUtil::from_iso_string("42"), 42ul);
+    BOOST_REQUIRE_THROW(DateTimeUtil::from_iso_string("99999999999999999999"), BadDateTimeFormat);
+    BOOST_REQUIRE_THROW(DateTimeUtil::from_iso_string("123abc"), BadDateTimeFormat);
+}
+
+BOOST_AUTO_TEST_CASE(Test_string_iso_to_timestamp_errors) {
+
+    const char* cases[] = {
+        "",
+        "20060230T150405",
+        "20061301T150405",
+        "20060102T250405",
+        "20060102T15a405",
+        "20060102T150405.",
+        "20060102T150405X",
+        "20060102T150405+5",
+        "2006-01-02X15:04:05",
+        "2006-01-02T15-04-05",
+        "2006-01-02T15:04:05+24:00",
+        "2006-01-02T15:04:05+05:",
+        "2006-01-02T15:04:05+05:3",
+        "2006-1-02T15:04:05Z",
+        "19690101T000000",
+    };
+    for (auto str: cases) {
+        aku_Timestamp ts;
+        const char* error = nullptr;
+        auto status = DateTimeUtil::parse_iso_string(str, strlen(str), &ts, &error);
+        BOOST_REQUIRE_MESSAGE(status == AKU_EBAD_ARG, str);
+        BOOST_REQUIRE(error != nullptr);
+    }
+}
@@ -8,6 +8,8 @@
 #include <apr.h>
 #include <queue>
 #include <fstream>
+#include <numeric>
+#include <algorithm>
 #include <stdlib.h>
 
 #include "akumuli.h"
@@ -48,6 +50,9 @@ enum class ScanDir {
     FWD, BWD
 };
 
+//! Number of leaf commits needed to build three levels (doesn't depend on the actual fanout)
+static const size_t THREE_LEVEL_COMMITS = 32*32;
+
 void test_nbtree_roots_collection(u32 N, u32 begin, u32 end) {
     ScanDir dir = begin < end ? ScanDir::FWD : ScanDir::BWD;
     std::shared_ptr<BlockStore> bstore = BlockStoreBuilder::create_memstore();
@@ -774,7 +779,7 @@ void test_nbtree_superblock_iter(aku_Timestamp begin, aku_Timestamp end) {
     std::shared_ptr<NBTreeExtentsList> extents(new NBTreeExtentsList(42, empty, bstore));
     extents->force_init();
     RandomWalk rwalk(1.0, 0.1, 0.1);
-    while(ncommits < AKU_NBTREE_FANOUT*AKU_NBTREE_FANOUT) {  // we should build three levels
+    while(ncommits < THREE_LEVEL_COMMITS) {  // we should build three levels
         double value = rwalk.next();
         aku_Timestamp ts = gen++;
         extents->append(ts, value);
@@ -844,7 +849,7 @@ void test_nbtree_superblock_aggregation(aku_Timestamp begin, aku_Timestamp end)
     std::shared_ptr<NBTreeExtentsList> extents(new NBTreeExtentsList(42, empty, bstore));
     extents->force_init();
     RandomWalk rwalk(1.0, 0.1, 0.1);
-    while(ncommits < AKU_NBTREE_FANOUT*AKU_NBTREE_FANOUT || gen <= 1000000ul) {  // we should build three levels
+    while(ncommits < THREE_LEVEL_COMMITS || gen <= 1000000ul) {  // we should build three levels
         double value = rwalk.next();
         aku_Timestamp ts = gen++;
         extents->append(ts, value);
@@ -1005,7 +1010,7 @@ void test_nbtree_superblock_candlesticks(size_t commit_limit, aku_Timestamp delt
     std::shared_ptr<NBTreeExtentsList> extents(new NBTreeExtentsList(42, empty, bstore));
     extents->force_init();
     RandomWalk rwalk(1.0, 0.1, 0.1);
-    while(ncommits < AKU_NBTREE_FANOUT*AKU_NBTREE_FANOUT) {  // we should build three levels
+    while(ncommits < THREE_LEVEL_COMMITS) {  // we should build three levels
         double value = rwalk.next();
         aku_Timestamp ts = end++;
         extents->append(ts, value);
@@ -1424,6 +1429,148 @@ BOOST_AUTO_TEST_CASE(Test_group_aggregate_backward) {
     }
 }
 
+static std::vector<AggregationResult> read_all_buckets(AggregateOperator* it) {
+    std::vector<AggregationResult> result;
+    aku_Status status = AKU_SUCCESS;
+    size_t out_size = 1;
+    // Operator can return AKU_SUCCESS with empty output at the end
+    while (status == AKU_SUCCESS && out_size != 0) {
+        size_t size = 0x100;
+        std::vector<aku_Timestamp> destts(size, 0);
+        std::vector<AggregationResult> destxs(size, INIT_AGGRES);
+        std::tie(status, out_size) = it->read(destts.data(), destxs.data(), size);
+        BOOST_REQUIRE(status == AKU_SUCCESS || status == AKU_ENO_DATA);
+        result.insert(result.end(), destxs.begin(), destxs.begin() + static_cast<ptrdiff_t>(out_size));
+    }
+    return result;
+}
+
+void test_nbtree_group_aggregate_approx(size_t commit_limit, u64 step, bool forward) {
+    aku_Timestamp begin = 1000;
+    aku_Timestamp end = begin;
+    size_t ncommits = 0;
+    auto commit_counter = [&ncommits](LogicAddr) {
+        ncommits++;
+    };
+    auto bstore = BlockStoreBuilder::create_memstore(commit_counter);
+    std::vector<LogicAddr> empty;
+    std::shared_ptr<NBTreeExtentsList> extents(new NBTreeExtentsList(42, empty, bstore));
+    extents->force_init();
+    RandomWalk rwalk(1.0, 0.1, 0.1);
+    while(ncommits < commit_limit) {
+        extents->append(end++, rwalk.next());
+    }
+    // Query range covers all data
+    auto query_begin = forward ? begin : end - 1;
+    auto query_end   = forward ? end : begin - 1;
+    auto exact = read_all_buckets(extents->group_aggregate(query_begin, query_end, step).get());
+    double exact_cnt = 0, exact_sum = 0;
+    std::map<u64, AggregationResult> exact_buckets;
+    for (auto const& agg: exact) {
+        exact_cnt += agg.cnt;
+        exact_sum += agg.sum;
+        auto ix = forward ? (agg._begin - query_begin) / step : (query_begin - agg._end) / step;
+        exact_buckets[ix] = agg;
+    }
+    for (u16 level = 0; level <= extents->get_height(); level++) {
+        auto approx = read_all_buckets(extents->group_aggregate(query_begin, query_end, step, level).get());
+        if (level == 0) {
+            BOOST_REQUIRE_EQUAL(approx.size(), exact.size());
+        }
+        double cnt = 0, sum = 0;
+        for (auto const& agg: approx) {
+            cnt += agg.cnt;
+            sum += agg.sum;
+            auto ix = forward ? (agg._begin - query_begin) / step : (query_begin - agg._end) / step;
+            auto it = exact_buckets.find(ix);
+            BOOST_REQUIRE(it != exact_buckets.end());
+            // Summaries of the larger ranges bound min and max of the bucket
+            BOOST_REQUIRE(agg.min <= it->second.min);
+            BOOST_REQUIRE(agg.max >= it->second.max);
+            if (level == 0) {
+                BOOST_REQUIRE_CLOSE(agg.cnt, it->second.cnt, 1E-10);
+                BOOST_REQUIRE_CLOSE(agg.sum, it->second.sum, 1E-10);
+            }
+        }
+        // Count and sum are spread proportionally, totals should be preserved
+        BOOST_REQUIRE_CLOSE(cnt, exact_cnt, 1E-6);
+        BOOST_REQUIRE_CLOSE(sum, exact_sum, 1E-6);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(Test_group_aggregate_approximate) {
+    std::vector<std::tuple<u32, u32>> cases = {
+        std::make_tuple(   32,   100),
+        std::make_tuple(32*32,   100),
+        std::make_tuple(32*32,  1000),
+        std::make_tuple(32*32, 10000),
+        std::make_tuple(32*40,  1000),
+    };
+    for (auto t: cases) {
+        test_nbtree_group_aggregate_approx(std::get<0>(t), std::get<1>(t), true);
+        test_nbtree_group_aggregate_approx(std::get<0>(t), std::get<1>(t), false);
+    }
+}
+
+//! Compute variance using two-pass algorithm
+static double calculate_variance(std::vector<double> const& xss) {
+    double mean = std::accumulate(xss.begin(), xss.end(), 0.0) / static_cast<double>(xss.size());
+    double m2 = 0;
+    for (auto x: xss) {
+        m2 += (x - mean)*(x - mean);
+    }
+    return m2 / static_cast<double>(xss.size());
+}
+
+void test_nbtree_group_aggregate_variance(size_t commit_limit, u64 step, bool forward) {
+    aku_Timestamp begin = 1000;
+    aku_Timestamp end = begin;
+    size_t ncommits = 0;
+    auto commit_counter = [&ncommits](LogicAddr) {
+        ncommits++;
+    };
+    auto bstore = BlockStoreBuilder::create_memstore(commit_counter);
+    std::vector<LogicAddr> empty;
+    std::shared_ptr<NBTreeExtentsList> extents(new NBTreeExtentsList(42, empty, bstore));
+    extents->force_init();
+    RandomWalk rwalk(1.0, 0.1, 0.1);
+    std::vector<double> xss;
+    while(ncommits < commit_limit) {
+        double value = rwalk.next();
+        extents->append(end++, value);
+        xss.push_back(value);
+    }
+    auto query_begin = forward ? begin : end - 1;
+    auto query_end   = forward ? end : begin - 1;
+
+    auto total = read_all_buckets(extents->aggregate(query_begin, query_end, true).get());
+    BOOST_REQUIRE_EQUAL(total.size(), 1);
+    BOOST_REQUIRE_CLOSE(total.front().m2 / total.front().cnt, calculate_variance(xss), 1E-6);
+
+    auto buckets = read_all_buckets(extents->group_aggregate(query_begin, query_end, step, 0, true).get());
+    BOOST_REQUIRE(!buckets.empty());
+    for (auto const& agg: buckets) {
+        auto first = xss.begin() + static_cast<ptrdiff_t>(agg._begin - begin);
+        auto last  = xss.begin() + static_cast<ptrdiff_t>(agg._end - begin + 1);
+        std::vector<double> bucket(first, last);
+        BOOST_REQUIRE_EQUAL(agg.cnt, bucket.size());
+        BOOST_REQUIRE_CLOSE(agg.m2 / agg.cnt, calculate_variance(bucket), 1E-6);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(Test_group_aggregate_variance) {
+    std::vector<std::tuple<u32, u32>> cases = {
+        std::make_tuple(   32,   100),
+        std::make_tuple(32*32,  1000),
+        std::make_tuple(32*32, 10000),
+        std::make_tuple(32*40, 100000),
+    };
+    for (auto t: cases) {
+        test_nbtree_group_aggregate_variance(std::get<0>(t), std::get<1>(t), true);
+        test_nbtree_group_aggregate_variance(std::get<0>(t), std::get<1>(t), false);
+    }
+}
+
 template<class Cont>
 static void fill_leaf(NBTreeLeaf* leaf, Cont tss) {
     for (auto ts: tss) {
@@ -1941,13 +2088,15 @@ static std::tuple<int, int> count_nbtree_nodes(std::shared_ptr<BlockStore> bstor
  * @brief Test node split in the case when the node is being split twice
  * @param pivot1 is the first pivot point (when the first split occurs)
  * @param pivot2 is the second pivot point
- * @param tss
+ * @param tss leaf nodes, leafs that doesn't fit into the inner node are skipped
+ * @param expected_inner_nodes
+ * @param expected_new_leaf_nodes is a number of leaf nodes created by both splits
  */
 void test_node_split_algorithm_lvl2_split_twice(aku_Timestamp pivot1,
                                                 aku_Timestamp pivot2,
                                                 std::map<int, std::vector<aku_Timestamp>>& tss,
                                                 int expected_inner_nodes,
-                                                int expected_leaf_nodes
+                                                int expected_new_leaf_nodes
                                                 )
 {
     std::shared_ptr<BlockStore> bstore = BlockStoreBuilder::create_memstore();
@@ -1955,7 +2104,12 @@ void test_node_split_algorithm_lvl2_split_twice(aku_Timestamp pivot1,
     LogicAddr prev = EMPTY_ADDR;
     NBTreeSuperblock sblock(id, EMPTY_ADDR, 0, 1);
 
+    int nleafs = 0;
     for(auto kv: tss) {
+        if (sblock.is_full()) {
+            break;
+        }
+        nleafs++;
         NBTreeLeaf leaf(id, prev, static_cast<u16>(kv.first));
         fill_leaf(&leaf, kv.second);
         prev = save_leaf(&leaf, &sblock, bstore);
@@ -2004,7 +2158,7 @@ void test_node_split_algorithm_lvl2_split_twice(aku_Timestamp pivot1,
     int num_inner_nodes, num_leaf_nodes;
     std::tie(num_inner_nodes, num_leaf_nodes) = count_nbtree_nodes(bstore, new_root2);
     BOOST_REQUIRE_EQUAL(num_inner_nodes, expected_inner_nodes);
-    BOOST_REQUIRE_EQUAL(num_leaf_nodes, expected_leaf_nodes);
+    BOOST_REQUIRE_EQUAL(num_leaf_nodes, nleafs + expected_new_leaf_nodes);
 }
 
 BOOST_AUTO_TEST_CASE(Test_node_split_algorithm_21) {
@@ -2030,27 +2184,27 @@ BOOST_AUTO_TEST_CASE(Test_node_split_algorithm_21) {
         { 1, { 11, 12, 13, 14, 15, 16, 17, 18, 19, 20 }},
         { 2, { 21, 22, 23, 24, 25, 26, 27, 28, 29, 30 }},
     };
-    test_node_split_algorithm_lvl2_split_twice(15, 17, tss, 1, 5);
+    test_node_split_algorithm_lvl2_split_twice(15, 17, tss, 1, 2);
 }
 
 BOOST_AUTO_TEST_CASE(Test_node_split_algorithm_22) {
 
-    /* Split middle node in:
+    /* Split middle node in (the inner node is full):
      *          [inner]
      *         /   |   \
-     *  [leaf0] [leaf1] [leaf2] ... [leaf31]
+     *  [leaf0] [leaf1] [leaf2] ... [leafN]
      *
      * The result of the first split should look like this:
      *          [inner]
      *         /   |   \
-     *  [leaf0] [inner] [leaf3] ... [leaf31]
+     *  [leaf0] [inner] [leaf3] ... [leafN]
      *           /   \
      *       [leaf1] [leaf2]
      *
      * The result of the first split should look like this:
      *          [inner]
      *         /   |   \
-     *  [leaf0] [inner] [leaf4] ... [leaf34]
+     *  [leaf0] [inner] [leaf4] ... [leafN+2]
      *         /   |   \
      *  [leaf1] [leaf2] [leaf2]
      */
@@ -2060,8 +2214,383 @@ BOOST_AUTO_TEST_CASE(Test_node_split_algorithm_22) {
         { 1, { 11, 12, 13, 14, 15, 16, 17, 18, 19, 20 }},
         { 2, { 21, 22, 23, 24, 25, 26, 27, 28, 29, 30 }},
     };
-    for (int i = 3; i < 32; i++) {
+    for (int i = 3; i < AKU_NBTREE_FANOUT; i++) {
         tss[i] = { static_cast<aku_Timestamp>(i*10 + 1) };
     }
-    test_node_split_algorithm_lvl2_split_twice(15, 17, tss, 2, 34);
+    test_node_split_algorithm_lvl2_split_twice(15, 17, tss, 2, 2);
+}
+
+//! Rewrite node in AKU_NBTREE_V1 format (without `m2` field)
+static LogicAddr save_v1_node(std::shared_ptr<BlockStore> bstore, LogicAddr addr) {
+    const size_t v1size = offsetof(SubtreeRef, m2);
+    auto block = read_block(bstore, addr);
+    auto src = block->get_cdata();
+    auto ref = reinterpret_cast<SubtreeRef const*>(src);
+    std::vector<u8> data(AKU_BLOCK_SIZE, 0);
+    if (ref->type == NBTreeBlockType::LEAF) {
+        memcpy(data.data(), src, v1size);
+        memcpy(data.data() + v1size, src + sizeof(SubtreeRef), ref->payload_size);
+    } else {
+        // Child refs are stored as an array of structs in old nodes
+        std::vector<SubtreeRef> refs;
+        BOOST_REQUIRE_EQUAL(NBTreeSuperblock(block).read_all(&refs), AKU_SUCCESS);
+        memcpy(data.data(), src, v1size);
+        for (u32 ix = 0; ix < refs.size(); ix++) {
+            memcpy(data.data() + (ix + 1)*v1size, &refs.at(ix), v1size);
+        }
+        reinterpret_cast<SubtreeRef*>(data.data())->payload_size = static_cast<u16>(refs.size());
+    }
+    auto header = reinterpret_cast<SubtreeRef*>(data.data());
+    header->version = AKU_NBTREE_V1;
+    header->checksum = bstore->checksum(data.data() + v1size, header->payload_size);
+    aku_Status status;
+    LogicAddr result;
+    std::tie(status, result) = bstore->append_block(std::make_shared<Block>(EMPTY_ADDR, std::move(data)));
+    BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+    return result;
+}
+
+BOOST_AUTO_TEST_CASE(Test_nbtree_v1_nodes_upgrade) {
+    std::shared_ptr<BlockStore> bstore = BlockStoreBuilder::create_memstore();
+    const aku_ParamId id = 42;
+    std::vector<double> xss;
+    NBTreeSuperblock sblock(id, EMPTY_ADDR, 0, 1);
+    LogicAddr prev = EMPTY_ADDR;
+    for (u16 i = 0; i < 4; i++) {
+        NBTreeLeaf leaf(id, prev, i);
+        for (int j = 0; j < 100; j++) {
+            auto ts = static_cast<aku_Timestamp>(i*100 + j);
+            double value = std::sin(ts*0.1);
+            BOOST_REQUIRE_EQUAL(leaf.append(ts, value), AKU_SUCCESS);
+            xss.push_back(value);
+        }
+        aku_Status status;
+        LogicAddr addr;
+        std::tie(status, addr) = leaf.commit(bstore);
+        BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+        prev = save_v1_node(bstore, addr);
+
+        // Old leaf is converted on load, its m2 is unknown
+        NBTreeLeaf old_leaf(bstore, prev);
+        BOOST_REQUIRE(std::isnan(old_leaf.get_leafmeta()->m2));
+        BOOST_REQUIRE_EQUAL(old_leaf.nelements(), 100);
+        SubtreeRef ref = {};
+        BOOST_REQUIRE_EQUAL(init_subtree_from_leaf(old_leaf, ref), AKU_SUCCESS);
+        ref.addr = prev;
+        BOOST_REQUIRE_EQUAL(sblock.append(ref), AKU_SUCCESS);
+    }
+    aku_Status status;
+    LogicAddr root;
+    std::tie(status, root) = sblock.commit(bstore);
+    BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+    NBTreeSuperblock old_sblock(read_block(bstore, save_v1_node(bstore, root)));
+    BOOST_REQUIRE_EQUAL(old_sblock.nelements(), 4);
+
+    auto expected = calculate_variance(xss);
+    auto buckets = read_all_buckets(old_sblock.aggregate(0, 400, bstore, true).get());
+    BOOST_REQUIRE_EQUAL(buckets.size(), 1);
+    BOOST_REQUIRE_EQUAL(buckets.front().cnt, 400);
+    BOOST_REQUIRE_CLOSE(buckets.front().m2 / buckets.front().cnt, expected, 1E-6);
+
+    // Other aggregates are still computed using metadata
+    buckets = read_all_buckets(old_sblock.aggregate(0, 400, bstore).get());
+    BOOST_REQUIRE_EQUAL(buckets.size(), 1);
+    BOOST_REQUIRE_EQUAL(buckets.front().cnt, 400);
+    BOOST_REQUIRE(std::isnan(buckets.front().m2));
+
+    buckets = read_all_buckets(old_sblock.group_aggregate(0, 400, 200, bstore, 0, true).get());
+    BOOST_REQUIRE_EQUAL(buckets.size(), 2);
+    for (size_t i = 0; i < buckets.size(); i++) {
+        std::vector<double> bucket(xss.begin() + static_cast<ptrdiff_t>(i*200),
+                                   xss.begin() + static_cast<ptrdiff_t>(i*200 + 200));
+        BOOST_REQUIRE_CLOSE(buckets.at(i).m2 / buckets.at(i).cnt, calculate_variance(bucket), 1E-6);
+    }
+}
+
+//! Make AKU_NBTREE_V1 leaf filled up to the block size (header is not complete)
+static std::vector<u8> make_full_v1_leaf(aku_ParamId id, aku_Timestamp begin, double step,
+                                         std::vector<aku_Timestamp>* tss, std::vector<double>* xss)
+{
+    const size_t v1size = offsetof(SubtreeRef, m2);
+    std::vector<u8> data(AKU_BLOCK_SIZE, 0);
+    DataBlockWriter writer(id, data.data() + v1size, static_cast<int>(AKU_BLOCK_SIZE - v1size));
+    for (aku_Timestamp ts = begin;; ts++) {
+        double value = std::sin(ts*step);
+        if (writer.put(ts, value) != AKU_SUCCESS) {
+            break;
+        }
+        tss->push_back(ts);
+        xss->push_back(value);
+    }
+    // `m2` field overlaps with the payload, it shouldn't be touched
+    auto header = reinterpret_cast<SubtreeRef*>(data.data());
+    header->payload_size = static_cast<u16>(writer.commit());
+    header->count = tss->size();
+    header->id = id;
+    header->begin = tss->front();
+    header->end = tss->back();
+    header->addr = EMPTY_ADDR;
+    auto minmax = std::minmax_element(xss->begin(), xss->end());
+    header->min = *minmax.first;
+    header->min_time = tss->at(static_cast<size_t>(minmax.first - xss->begin()));
+    header->max = *minmax.second;
+    header->max_time = tss->at(static_cast<size_t>(minmax.second - xss->begin()));
+    header->sum = std::accumulate(xss->begin(), xss->end(), .0);
+    header->first = xss->front();
+    header->last = xss->back();
+    header->type = NBTreeBlockType::LEAF;
+    header->level = 0;
+    header->version = AKU_NBTREE_V1;
+    header->fanout_index = 0;
+    return data;
+}
+
+BOOST_AUTO_TEST_CASE(Test_nbtree_v1_full_leaf_clone) {
+    /* Split the first leaf with horizontal links preserved in:
+     *       [inner]
+     *      /       \
+     *  [leaf0] [V1 leaf1]
+     *
+     * Second leaf is cloned to fix the backref. It's filled up to the block size in
+     * V1 format and can't be converted to the current format (header is larger).
+     */
+    std::shared_ptr<BlockStore> bstore = BlockStoreBuilder::create_memstore();
+    const aku_ParamId id = 42;
+    const size_t v1size = offsetof(SubtreeRef, m2);
+
+    std::vector<u8> data;
+    std::vector<aku_Timestamp> v1tss;
+    std::vector<double> v1xss;
+    for (int i = 1; i < 100; i++) {
+        v1tss.clear();
+        v1xss.clear();
+        data = make_full_v1_leaf(id, 100, 0.01*i, &v1tss, &v1xss);
+        if (sizeof(SubtreeRef) + reinterpret_cast<SubtreeRef*>(data.data())->payload_size > AKU_BLOCK_SIZE) {
+            break;
+        }
+    }
+    auto header = reinterpret_cast<SubtreeRef*>(data.data());
+    BOOST_REQUIRE_GT(sizeof(SubtreeRef) + header->payload_size, AKU_BLOCK_SIZE);
+
+    NBTreeSuperblock sblock(id, EMPTY_ADDR, 0, 1);
+    NBTreeLeaf l0(id, EMPTY_ADDR, 0);
+    fill_leaf(&l0, std::vector<aku_Timestamp>({ 1, 2, 3, 4, 5, 6, 7, 8, 9, 10 }));
+    LogicAddr prev = save_leaf(&l0, &sblock, bstore);
+
+    header->addr = prev;
+    header->fanout_index = 1;
+    header->checksum = bstore->checksum(data.data() + v1size, header->payload_size);
+    aku_Status status;
+    LogicAddr addr;
+    std::tie(status, addr) = bstore->append_block(std::make_shared<Block>(EMPTY_ADDR, std::move(data)));
+    BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+    NBTreeLeaf l1(bstore, addr);
+    SubtreeRef ref = {};
+    BOOST_REQUIRE_EQUAL(init_subtree_from_leaf(l1, ref), AKU_SUCCESS);
+    ref.addr = addr;
+    BOOST_REQUIRE_EQUAL(sblock.append(ref), AKU_SUCCESS);
+    LogicAddr root;
+    std::tie(status, root) = sblock.commit(bstore);
+    BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+
+    LogicAddr new_root;
+    LogicAddr last_child;
+    std::tie(status, new_root, last_child) = sblock.split(bstore, 5, true);
+    BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+
+    // Clone keeps V1 format and all the data
+    NBTreeLeaf clone(bstore, last_child);
+    BOOST_REQUIRE_EQUAL(clone.nelements(), v1tss.size());
+    BOOST_REQUIRE_NE(clone.get_prev_addr(), prev);
+    BOOST_REQUIRE_EQUAL(clone.get_fanout(), 2);
+    std::vector<aku_Timestamp> tss;
+    std::vector<double> xss;
+    BOOST_REQUIRE_EQUAL(clone.read_all(&tss, &xss), AKU_SUCCESS);
+    BOOST_REQUIRE_EQUAL_COLLECTIONS(tss.begin(), tss.end(), v1tss.begin(), v1tss.end());
+    BOOST_REQUIRE_EQUAL_COLLECTIONS(xss.begin(), xss.end(), v1xss.begin(), v1xss.end());
+    auto block = read_block(bstore, last_child);
+    BOOST_REQUIRE_EQUAL(reinterpret_cast<SubtreeRef const*>(block->get_cdata())->version, AKU_NBTREE_V1);
+
+    NBTreeSuperblock new_sblock(read_block(bstore, new_root));
+    std::unique_ptr<RealValuedOperator> it = new_sblock.search(0, AKU_MAX_TIMESTAMP, bstore);
+    auto actual = extract_timestamps(*it);
+    std::unique_ptr<RealValuedOperator> orig_it = sblock.search(0, AKU_MAX_TIMESTAMP, bstore);
+    auto expected = extract_timestamps(*orig_it);
+    BOOST_REQUIRE_EQUAL(actual.size(), 10 + v1tss.size());
+    BOOST_REQUIRE_EQUAL_COLLECTIONS(actual.begin(), actual.end(), expected.begin(), expected.end());
+}
+
+static void check_subtree_refs_equal(SubtreeRef const& lhs, SubtreeRef const& rhs) {
+    BOOST_REQUIRE_EQUAL(lhs.count, rhs.count);
+    BOOST_REQUIRE_EQUAL(lhs.id, rhs.id);
+    BOOST_REQUIRE_EQUAL(lhs.begin, rhs.begin);
+    BOOST_REQUIRE_EQUAL(lhs.end, rhs.end);
+    BOOST_REQUIRE_EQUAL(lhs.addr, rhs.addr);
+    BOOST_REQUIRE_EQUAL(lhs.min, rhs.min);
+    BOOST_REQUIRE_EQUAL(lhs.min_time, rhs.min_time);
+    BOOST_REQUIRE_EQUAL(lhs.max, rhs.max);
+    BOOST_REQUIRE_EQUAL(lhs.max_time, rhs.max_time);
+    BOOST_REQUIRE_EQUAL(lhs.sum, rhs.sum);
+    BOOST_REQUIRE_EQUAL(lhs.first, rhs.first);
+    BOOST_REQUIRE_EQUAL(lhs.last, rhs.last);
+    BOOST_REQUIRE_EQUAL(lhs.m2, rhs.m2);
+    BOOST_REQUIRE(lhs.type == rhs.type);
+    BOOST_REQUIRE_EQUAL(lhs.level, rhs.level);
+    BOOST_REQUIRE_EQUAL(lhs.version, rhs.version);
+    BOOST_REQUIRE_EQUAL(lhs.fanout_index, rhs.fanout_index);
+    BOOST_REQUIRE_EQUAL(lhs.payload_size, rhs.payload_size);
+    BOOST_REQUIRE_EQUAL(lhs.checksum, rhs.checksum);
+}
+
+BOOST_AUTO_TEST_CASE(Test_nbtree_superblock_compression) {
+    std::shared_ptr<BlockStore> bstore = BlockStoreBuilder::create_memstore();
+    const aku_ParamId id = 42;
+    NBTreeSuperblock sblock(id, EMPTY_ADDR, 0, 1);
+    std::vector<SubtreeRef> expected;
+    LogicAddr prev = EMPTY_ADDR;
+    for (u16 i = 0; !sblock.is_full(); i++) {
+        NBTreeLeaf leaf(id, prev, i);
+        for (int j = 0; j < 10; j++) {
+            auto ts = static_cast<aku_Timestamp>(i*10 + j);
+            BOOST_REQUIRE_EQUAL(leaf.append(ts, j), AKU_SUCCESS);
+        }
+        aku_Status status;
+        std::tie(status, prev) = leaf.commit(bstore);
+        BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+        SubtreeRef ref = {};
+        BOOST_REQUIRE_EQUAL(init_subtree_from_leaf(leaf, ref), AKU_SUCCESS);
+        ref.addr = prev;
+        BOOST_REQUIRE_EQUAL(sblock.append(ref), AKU_SUCCESS);
+        expected.push_back(ref);
+    }
+    // Fanout is not limited by the size of the SubtreeRef struct
+    BOOST_REQUIRE_GT(expected.size(), 32);
+    aku_Status status;
+    LogicAddr addr;
+    std::tie(status, addr) = sblock.commit(bstore);
+    BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+
+    NBTreeSuperblock actual(read_block(bstore, addr));
+    BOOST_REQUIRE_EQUAL(actual.nelements(), expected.size());
+    std::vector<SubtreeRef> refs;
+    BOOST_REQUIRE_EQUAL(actual.read_all(&refs), AKU_SUCCESS);
+    BOOST_REQUIRE_EQUAL(refs.size(), expected.size());
+    for (size_t i = 0; i < refs.size(); i++) {
+        check_subtree_refs_equal(refs.at(i), expected.at(i));
+    }
+    LogicAddr top;
+    BOOST_REQUIRE(actual.top(&top));
+    BOOST_REQUIRE_EQUAL(top, expected.back().addr);
+
+    // Only children that overlap with the range should be decoded
+    refs.clear();
+    BOOST_REQUIRE_EQUAL(actual.read_range(155, 175, &refs), AKU_SUCCESS);
+    BOOST_REQUIRE_EQUAL(refs.size(), 3);
+    for (size_t i = 0; i < refs.size(); i++) {
+        check_subtree_refs_equal(refs.at(i), expected.at(15 + i));
+    }
+    refs.clear();
+    BOOST_REQUIRE_EQUAL(actual.read_range(175, 155, &refs), AKU_SUCCESS);
+    BOOST_REQUIRE_EQUAL(refs.size(), 3);
+    refs.clear();
+    BOOST_REQUIRE_EQUAL(actual.read_range(100000, 200000, &refs), AKU_SUCCESS);
+    BOOST_REQUIRE(refs.empty());
+}
+
+BOOST_AUTO_TEST_CASE(Test_nbtree_dynamic_fanout) {
+    std::vector<LogicAddr> committed;
+    auto commit_counter = [&committed](LogicAddr addr) {
+        committed.push_back(addr);
+    };
+    auto bstore = BlockStoreBuilder::create_memstore(commit_counter);
+    std::vector<LogicAddr> empty;
+    std::shared_ptr<NBTreeExtentsList> extents(new NBTreeExtentsList(42, empty, bstore));
+    extents->force_init();
+    RandomWalk rwalk(1.0, 0.1, 0.1);
+    aku_Timestamp gen = 1000;
+    std::vector<double> expected;
+    while (committed.size() < 1000) {
+        double value = rwalk.next();
+        extents->append(gen++, value);
+        expected.push_back(value);
+    }
+    // `close` checks fanout indexes of the inner nodes
+    auto roots = extents->close();
+    BOOST_REQUIRE_EQUAL(roots.size(), 3);
+
+    size_t max_fanout = 0;
+    for (auto addr: committed) {
+        auto block = read_block(bstore, addr);
+        if (reinterpret_cast<SubtreeRef const*>(block->get_cdata())->type == NBTreeBlockType::INNER) {
+            NBTreeSuperblock inner(block);
+            max_fanout = std::max(max_fanout, inner.nelements());
+        }
+    }
+    BOOST_REQUIRE_GT(max_fanout, 32);
+
+    std::shared_ptr<NBTreeExtentsList> reopened(new NBTreeExtentsList(42, roots, bstore));
+    reopened->force_init();
+    auto it = reopened->search(1000, gen);
+    std::vector<aku_Timestamp> destts(expected.size(), 0);
+    std::vector<double> destxs(expected.size(), 0);
+    aku_Status status;
+    size_t sz;
+    std::tie(status, sz) = it->read(destts.data(), destxs.data(), destts.size());
+    BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+    BOOST_REQUIRE_EQUAL(sz, expected.size());
+    BOOST_REQUIRE_EQUAL_COLLECTIONS(expected.begin(), expected.end(), destxs.begin(), destxs.end());
+}
+
+BOOST_AUTO_TEST_CASE(Test_nbtree_reopen_full_root) {
+    std::vector<LogicAddr> leaves;
+    auto commit_counter = [&leaves](LogicAddr addr) {
+        leaves.push_back(addr);
+    };
+    auto bstore = BlockStoreBuilder::create_memstore(commit_counter);
+    const aku_ParamId id = 42;
+    NBTreeSuperblock sblock(id, EMPTY_ADDR, 0, 1);
+    LogicAddr prev = EMPTY_ADDR;
+    aku_Timestamp ts = 1000;
+    for (u16 i = 0; !sblock.is_full(); i++) {
+        NBTreeLeaf leaf(id, prev, i);
+        for (int j = 0; j < 10; j++, ts++) {
+            BOOST_REQUIRE_EQUAL(leaf.append(ts, static_cast<double>(ts)), AKU_SUCCESS);
+        }
+        aku_Status status;
+        std::tie(status, prev) = leaf.commit(bstore);
+        BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+        SubtreeRef ref = {};
+        BOOST_REQUIRE_EQUAL(init_subtree_from_leaf(leaf, ref), AKU_SUCCESS);
+        ref.addr = prev;
+        BOOST_REQUIRE_EQUAL(sblock.append(ref), AKU_SUCCESS);
+    }
+    aku_Status status;
+    LogicAddr root;
+    std::tie(status, root) = sblock.commit(bstore);
+    BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+
+    // Restored root is full, first leaf node becomes the first child of the new node
+    std::vector<LogicAddr> rescue_points = { EMPTY_ADDR, root };
+    std::shared_ptr<NBTreeExtentsList> extents(new NBTreeExtentsList(id, rescue_points, bstore));
+    extents->force_init();
+    aku_Timestamp begin = ts;
+    leaves.clear();
+    while (leaves.size() < 4) {
+        BOOST_REQUIRE(extents->append(ts, static_cast<double>(ts)) != NBTreeAppendResult::FAIL_BAD_VALUE);
+        ts++;
+    }
+    auto ext = extents->get_extents();
+    BOOST_REQUIRE_EQUAL(ext.size(), 3);
+    // Fanout index of every child of the level 1 node should match its position
+    NBTreeExtent::check_extent(ext.at(1), bstore, 1);
+
+    auto it = extents->search(begin, ts);
+    std::vector<aku_Timestamp> destts(ts - begin, 0);
+    std::vector<double> destxs(ts - begin, 0);
+    size_t sz;
+    std::tie(status, sz) = it->read(destts.data(), destxs.data(), destts.size());
+    BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+    BOOST_REQUIRE_EQUAL(sz, ts - begin);
+    BOOST_REQUIRE_EQUAL(destts.front(), begin);
+    BOOST_REQUIRE_EQUAL(destts.back(), ts - 1);
 }
@@ -82,6 +82,25 @@ BOOST_AUTO_TEST_CASE(Test_seriesmatcher_0) {
     BOOST_REQUIRE_EQUAL(buz_id, 0ul);
 }
 
+BOOST_AUTO_TEST_CASE(Test_seriesmatcher_names_since) {
+    SeriesMatcher matcher(1ul);
+    const char* foo = "foo ba=r";
+    const char* bar = "bar foo=bar";
+    matcher.add(foo, foo+8);
+    auto first = matcher.next_id();
+    BOOST_REQUIRE_EQUAL(first, 2ul);
+
+    std::vector<SeriesMatcher::SeriesNameT> names;
+    BOOST_REQUIRE_EQUAL(matcher.get_names_since(first, &names), first);
+    BOOST_REQUIRE(names.empty());
+
+    auto bar_id = matcher.add(bar, bar+11);
+    BOOST_REQUIRE_EQUAL(matcher.get_names_since(first, &names), 3ul);
+    BOOST_REQUIRE_EQUAL(names.size(), 1u);
+    BOOST_REQUIRE_EQUAL(std::get<2>(names.front()), bar_id);
+    BOOST_REQUIRE_EQUAL(std::string(std::get<0>(names.front()), std::get<0>(names.front()) + std::get<1>(names.front())), bar);
+}
+
 BOOST_AUTO_TEST_CASE(Test_seriesmatcher_1) {
 
     LegacyStringPool spool;
@@ -411,3 +430,65 @@ BOOST_AUTO_TEST_CASE(Test_index_4) {
         i++;
     }
 }
+
+BOOST_AUTO_TEST_CASE(Test_index_memory_accounting) {
+    const aku_MemoryCategory categories[] = {
+        AKU_MEM_INDEX_POOL, AKU_MEM_INDEX_TABLES, AKU_MEM_INDEX_POSTINGS,
+        AKU_MEM_INDEX_TOPOLOGY, AKU_MEM_MATCHER_TABLES,
+    };
+    std::vector<i64> before;
+    for (auto cat: categories) {
+        before.push_back(MemoryAccounting::get_bytes(cat));
+    }
+    {
+        SeriesMatcher matcher(10ul);
+        for (int i = 0; i < 1000; i++) {
+            std::string name = "foo tagA=" + std::to_string(i % 10) + " tagB=" + std::to_string(i);
+            BOOST_REQUIRE(matcher.add(name.data(), name.data() + name.size()) != 0);
+        }
+        for (size_t i = 0; i < before.size(); i++) {
+            BOOST_REQUIRE_GT(MemoryAccounting::get_bytes(categories[i]), before[i]);
+        }
+        BOOST_REQUIRE_EQUAL(MemoryAccounting::get_objects(AKU_MEM_INDEX_TABLES), 1000);
+        BOOST_REQUIRE_EQUAL(MemoryAccounting::get_objects(AKU_MEM_MATCHER_TABLES), 1000);
+    }
+    // Everything should be released when the matcher is destroyed
+    for (size_t i = 0; i < before.size(); i++) {
+        BOOST_REQUIRE_EQUAL(MemoryAccounting::get_bytes(categories[i]), before[i]);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(Test_seriesmatcher_join) {
+    SeriesMatcher matcher(10ul);
+    auto add = [&](std::string name) {
+        auto id = matcher.add(name.data(), name.data() + name.size());
+        BOOST_REQUIRE(id != 0);
+        return id;
+    };
+    auto a1 = add("cpu.user host=A region=X");
+    auto a2 = add("cpu.user host=B region=X");
+    auto a3 = add("cpu.user host=C region=Y");
+    // Tags are out of order, name is converted to canonical form before tag-set is extracted
+    auto b1 = add("cpu.syst region=X host=A");
+    auto b3 = add("cpu.syst host=C region=Y");
+    auto c2 = add("cpu.idle host=B region=X");
+    // Loaded series should be joined too
+    std::string loaded = "cpu.idle host=C region=Y";
+    matcher._add(loaded, 100);
+
+    auto res = matcher.join({ "cpu.syst", "cpu.idle", "cpu.none" }, { a1, a2, a3 });
+    std::vector<u64> expected = {
+        b1, 0,  b3,
+        0,  c2, 100,
+        0,  0,  0,
+    };
+    BOOST_REQUIRE_EQUAL_COLLECTIONS(res.begin(), res.end(), expected.begin(), expected.end());
+
+    // Join is symmetric
+    res = matcher.join({ "cpu.user" }, { c2, b3 });
+    expected = { a2, a3 };
+    BOOST_REQUIRE_EQUAL_COLLECTIONS(res.begin(), res.end(), expected.begin(), expected.end());
+
+    // One entry per series, metrics don't allocate slots for all known tag-sets
+    BOOST_REQUIRE_EQUAL(matcher.metric_tagsets.size(), 7);
+}
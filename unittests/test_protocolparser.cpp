@@ -38,6 +38,10 @@ struct ConsumerMock : DbSession {
         throw "Not implemented";
     }
 
+    virtual std::shared_ptr<DbCursor> prepare(std::string) override {
+        throw "Not implemented";
+    }
+
     virtual int param_id_to_series(aku_ParamId id, char* buf, size_t sz) override {
         auto str = std::to_string(id);
         assert(str.size() <= sz);
@@ -363,6 +367,10 @@ struct NameCheckingConsumer : DbSession {
         throw "Not implemented";
     }
 
+    virtual std::shared_ptr<DbCursor> prepare(std::string) override {
+        throw "Not implemented";
+    }
+
     virtual int param_id_to_series(aku_ParamId id, char* buf, size_t sz) override {
         if (series.count(id)) {
             std::string expected = series[id];
@@ -3,16 +3,20 @@
 #define BOOST_TEST_DYN_LINK
 #define BOOST_TEST_MODULE Main
 #include <boost/test/unit_test.hpp>
+#include <boost/property_tree/json_parser.hpp>
+#include <boost/filesystem.hpp>
 #include <vector>
 
 #include "queryprocessor_framework.h"
 #include "metadatastorage.h"
 #include "storage2.h"
 #include "query_processing/queryparser.h"
+#include "storage_engine/operators/aggregate.h"
 
 #include "akumuli.h"
 #include "log_iface.h"
 #include "status_util.h"
+#include "cancellation.h"
 
 // To initialize apr and sqlite properly
 #include <apr.h>
@@ -106,6 +110,14 @@ BOOST_AUTO_TEST_CASE(Test_metadata_storage_numeric_config) {
     success = db.get_config_param("db_name", &actual_db_name);
     BOOST_REQUIRE(success);
     BOOST_REQUIRE_EQUAL(db_name, actual_db_name);
+    std::string actual_stripe_width;
+    success = db.get_config_param("stripe_width", &actual_stripe_width);
+    BOOST_REQUIRE(!success);
+    db.set_config_param("stripe_width", "2", "Number of stripes.");
+    db.set_config_param("stripe_width", "4", "Number of stripes.");
+    success = db.get_config_param("stripe_width", &actual_stripe_width);
+    BOOST_REQUIRE(success);
+    BOOST_REQUIRE_EQUAL(actual_stripe_width, "4");
 }
 
 BOOST_AUTO_TEST_CASE(Test_storage_add_series_1) {
@@ -415,6 +427,1119 @@ BOOST_AUTO_TEST_CASE(Test_storage_query) {
     }
 }
 
+// Test prepared query
+
+//! Cursor that collects text output
+struct TextCursorMock : CursorMock {
+    std::string text;
+
+    virtual bool put(const aku_Sample &val) override {
+        BOOST_REQUIRE(val.payload.type & aku_PData::TEXT);
+        text.append(val.payload.data, val.payload.data + val.payload.size - sizeof(aku_Sample));
+        return CursorMock::put(val);
+    }
+};
+
+static u64 extract_prepared_id(TextCursorMock const& cursor) {
+    aku_Status status;
+    boost::property_tree::ptree ptree;
+    std::tie(status, ptree) = QueryParser::parse_json(cursor.text.c_str());
+    BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+    return ptree.get<u64>("prepared");
+}
+
+BOOST_AUTO_TEST_CASE(Test_storage_prepared_query) {
+    std::vector<std::string> series_names = {
+        "test key=0",
+        "test key=1",
+        "test key=2",
+    };
+    auto storage = create_storage();
+    auto session = storage->create_write_session();
+    fill_data(session, 100, 200, series_names);
+
+    TextCursorMock prep;
+    auto query = make_scan_query(100, 200, OrderBy::SERIES);
+    session->prepare(&prep, query.c_str());
+    BOOST_REQUIRE(prep.done);
+    BOOST_REQUIRE_EQUAL(prep.error, AKU_SUCCESS);
+    auto id = extract_prepared_id(prep);
+
+    // Same template should get the same id
+    TextCursorMock prep2;
+    session->prepare(&prep2, query.c_str());
+    BOOST_REQUIRE_EQUAL(prep2.error, AKU_SUCCESS);
+    BOOST_REQUIRE_EQUAL(extract_prepared_id(prep2), id);
+
+    // Execute with the default range
+    CursorMock cursor1;
+    auto exec = "{\"prepared\": " + std::to_string(id) + "}";
+    session->query(&cursor1, exec.c_str());
+    BOOST_REQUIRE(cursor1.done);
+    BOOST_REQUIRE_EQUAL(cursor1.error, AKU_SUCCESS);
+    BOOST_REQUIRE_EQUAL(cursor1.samples.size(), 100*series_names.size());
+
+    // Execute with the new range
+    CursorMock cursor2;
+    exec = "{\"prepared\": " + std::to_string(id) + ", \"range\": {\"from\": 150, \"to\": 160}}";
+    session->query(&cursor2, exec.c_str());
+    BOOST_REQUIRE_EQUAL(cursor2.error, AKU_SUCCESS);
+    std::vector<aku_Timestamp> expected;
+    for (aku_Timestamp ts = 150; ts < 160; ts++) {
+        expected.push_back(ts);
+    }
+    check_timestamps(cursor2, expected, OrderBy::SERIES, series_names);
+
+    // New series should invalidate cached ids
+    series_names.push_back("test key=3");
+    fill_data(session, 150, 160, {"test key=3"});
+    CursorMock cursor3;
+    session->query(&cursor3, exec.c_str());
+    BOOST_REQUIRE_EQUAL(cursor3.error, AKU_SUCCESS);
+    check_timestamps(cursor3, expected, OrderBy::SERIES, series_names);
+    check_paramids(*session, cursor3, OrderBy::SERIES, series_names, cursor3.samples.size(), false);
+
+    // Series of the other metric don't match the template
+    fill_data(session, 150, 160, {"other key=0"});
+    CursorMock cursor5;
+    session->query(&cursor5, exec.c_str());
+    BOOST_REQUIRE_EQUAL(cursor5.error, AKU_SUCCESS);
+    check_timestamps(cursor5, expected, OrderBy::SERIES, series_names);
+    check_paramids(*session, cursor5, OrderBy::SERIES, series_names, cursor5.samples.size(), false);
+
+    // Unknown id
+    CursorMock cursor4;
+    session->query(&cursor4, "{\"prepared\": 100500}");
+    BOOST_REQUIRE_EQUAL(cursor4.error, AKU_ENOT_FOUND);
+}
+
+// Test query batch
+
+/** Cursor that splits batch output into per-query results
+  */
+struct BatchCursorMock : CursorMock {
+    std::vector<std::vector<aku_Sample>> results;
+    std::vector<std::vector<double>> values;  //< First value of the tuple (or the value)
+    std::vector<std::string> errors;
+
+    virtual bool put(const aku_Sample &val) override {
+        if (val.payload.type & aku_PData::TEXT) {
+            std::string line(val.payload.data, val.payload.data + val.payload.size - sizeof(aku_Sample));
+            if (line.at(0) == ':') {
+                BOOST_REQUIRE_EQUAL(std::stoul(line.substr(1)), results.size());
+                results.emplace_back();
+                values.emplace_back();
+                errors.emplace_back();
+            } else {
+                BOOST_REQUIRE_EQUAL(line.at(0), '-');
+                errors.back() = line;
+            }
+        } else {
+            results.back().push_back(val);
+            values.back().push_back(sample_value(val));
+        }
+        return CursorMock::put(val);
+    }
+
+    static double sample_value(const aku_Sample &val) {
+        if (val.payload.size > sizeof(aku_Sample)) {
+            return *reinterpret_cast<double const*>(val.payload.data);
+        }
+        return val.payload.float64;
+    }
+};
+
+//! Cursor that saves the first value of the tuple
+struct TupleCursorMock : CursorMock {
+    std::vector<double> values;
+
+    virtual bool put(const aku_Sample &val) override {
+        values.push_back(BatchCursorMock::sample_value(val));
+        return CursorMock::put(val);
+    }
+};
+
+static std::vector<std::string> get_series_names(StorageSession& session, std::vector<aku_Sample> const& samples) {
+    std::vector<std::string> names;
+    char buffer[1024];
+    for (auto const& sample: samples) {
+        auto len = session.get_series_name(sample.paramid, buffer, sizeof(buffer));
+        BOOST_REQUIRE_GT(len, 0);
+        names.push_back(std::string(buffer, buffer + len));
+    }
+    return names;
+}
+
+BOOST_AUTO_TEST_CASE(Test_storage_batch_query) {
+    std::vector<std::string> series_names = {
+        "test key=0",
+        "test key=1",
+        "test key=2",
+    };
+    auto storage = create_storage();
+    auto session = storage->create_write_session();
+    fill_data(session, 100, 200, series_names);
+    // Queried range should be stored in the block store
+    fill_data(session, 200, 20000, series_names);
+
+    std::vector<std::string> queries = {
+        make_scan_query(100, 200, OrderBy::SERIES),
+        make_scan_query(180, 120, OrderBy::SERIES),
+        make_scan_query(150, 160, OrderBy::TIME),
+        "{\"aggregate\": {\"test\": \"sum\"}, \"range\": {\"from\": 110, \"to\": 190}}",
+        make_scan_query(199, 99, OrderBy::TIME),
+    };
+    std::string batch = "{\"queries\": [";
+    for (auto const& query: queries) {
+        batch += query + ",";
+    }
+    batch += "{\"select\": \"unknown\", \"range\": {\"from\": 100, \"to\": 200}}]}";
+
+    BatchCursorMock cursor;
+    QueryCounters batch_counters;
+    {
+        QueryCountersScope scope(&batch_counters);
+        session->query(&cursor, batch.c_str());
+    }
+    BOOST_REQUIRE(cursor.done);
+    BOOST_REQUIRE_EQUAL(cursor.error, AKU_SUCCESS);
+    BOOST_REQUIRE_EQUAL(cursor.results.size(), queries.size() + 1);
+
+    // Every query should produce the same output as the standalone query
+    QueryCounters standalone_counters;
+    for (size_t i = 0; i < queries.size(); i++) {
+        CursorMock expected;
+        {
+            QueryCountersScope scope(&standalone_counters);
+            session->query(&expected, queries.at(i).c_str());
+        }
+        BOOST_REQUIRE_EQUAL(expected.error, AKU_SUCCESS);
+        BOOST_REQUIRE(cursor.errors.at(i).empty());
+        auto const& actual = cursor.results.at(i);
+        BOOST_REQUIRE(!actual.empty());
+        BOOST_REQUIRE_EQUAL(actual.size(), expected.samples.size());
+        for (size_t j = 0; j < actual.size(); j++) {
+            BOOST_REQUIRE_EQUAL(actual.at(j).timestamp, expected.samples.at(j).timestamp);
+            BOOST_REQUIRE_EQUAL(actual.at(j).paramid, expected.samples.at(j).paramid);
+            BOOST_REQUIRE_EQUAL(actual.at(j).payload.float64, expected.samples.at(j).payload.float64);
+        }
+    }
+    // Series scanned by several queries of the batch are read once
+    BOOST_REQUIRE_GT(batch_counters.blocks_read, 0);
+    BOOST_REQUIRE_LT(batch_counters.blocks_read*2, standalone_counters.blocks_read);
+
+    // Failed query shouldn't break the batch
+    BOOST_REQUIRE(cursor.results.back().empty());
+    BOOST_REQUIRE(!cursor.errors.back().empty());
+
+    CursorMock cursor3;
+    session->query(&cursor3, "{\"queries\": []}");
+    BOOST_REQUIRE_EQUAL(cursor3.error, AKU_EQUERY_PARSING_ERROR);
+
+    // Timeout can't be set for the individual query of the batch
+    BatchCursorMock cursor4;
+    auto timeout = queries.front().substr(0, queries.front().size() - 1) + ", \"timeout\": \"10s\"}";
+    session->query(&cursor4, ("{\"queries\": [" + timeout + "]}").c_str());
+    BOOST_REQUIRE_EQUAL(cursor4.error, AKU_SUCCESS);
+    BOOST_REQUIRE_EQUAL(cursor4.errors.size(), 1);
+    BOOST_REQUIRE(!cursor4.errors.front().empty());
+}
+
+BOOST_AUTO_TEST_CASE(Test_storage_batch_query_aggregates) {
+    std::vector<std::string> series_names = {
+        "test key=0 group=0",
+        "test key=1 group=0",
+        "test key=2 group=1",
+    };
+    auto storage = create_storage();
+    auto session = storage->create_write_session();
+    fill_data(session, 100, 20000, series_names);
+
+    // Dashboard-like batch: different aggregations of the same series
+    std::vector<std::string> queries = {
+        make_scan_query(100, 20000, OrderBy::SERIES),
+        "{\"group-aggregate\": {\"metric\": \"test\", \"step\": \"100n\", \"func\": [\"max\"]},"
+        " \"range\": {\"from\": 100, \"to\": 20000}}",
+        "{\"group-aggregate\": {\"metric\": \"test\", \"step\": \"100n\", \"func\": [\"min\"]},"
+        " \"range\": {\"from\": 100, \"to\": 20000}}",
+        "{\"group-aggregate\": {\"metric\": \"test\", \"step\": \"1000n\", \"func\": [\"count\"]},"
+        " \"range\": {\"from\": 19999, \"to\": 150}}",
+        "{\"group-aggregate\": {\"metric\": \"test\", \"step\": \"500n\", \"func\": [\"mean\"]},"
+        " \"range\": {\"from\": 0, \"to\": 30000}}",
+        "{\"group-aggregate\": {\"metric\": \"test\", \"step\": \"500n\", \"func\": [\"max\"]},"
+        " \"range\": {\"from\": 0, \"to\": 30000}}",
+        "{\"aggregate\": {\"test\": \"sum\"}, \"range\": {\"from\": 110, \"to\": 19000}}",
+        "{\"aggregate\": {\"test\": \"max\"}, \"range\": {\"from\": 110, \"to\": 19000}, \"group-by\": [\"group\"]}",
+        "{\"join\": [\"test\", \"test\"], \"range\": {\"from\": 100, \"to\": 200}}",
+        "{\"select\": \"test\", \"range\": {\"from\": 100, \"to\": 200}, \"group-by\": [\"group\"]}",
+    };
+    std::string batch = "{\"queries\": [";
+    for (auto const& query: queries) {
+        batch += query + ",";
+    }
+    batch.back() = ']';
+    batch += "}";
+
+    BatchCursorMock cursor;
+    QueryCounters batch_counters;
+    {
+        QueryCountersScope scope(&batch_counters);
+        session->query(&cursor, batch.c_str());
+    }
+    BOOST_REQUIRE(cursor.done);
+    BOOST_REQUIRE_EQUAL(cursor.error, AKU_SUCCESS);
+    BOOST_REQUIRE_EQUAL(cursor.results.size(), queries.size());
+    // Series names should be resolved before the next query
+    std::vector<std::vector<std::string>> names;
+    for (auto const& result: cursor.results) {
+        names.push_back(get_series_names(*session, result));
+    }
+
+    QueryCounters standalone_counters;
+    for (size_t i = 0; i < queries.size(); i++) {
+        TupleCursorMock expected;
+        {
+            QueryCountersScope scope(&standalone_counters);
+            session->query(&expected, queries.at(i).c_str());
+        }
+        BOOST_REQUIRE_EQUAL(expected.error, AKU_SUCCESS);
+        BOOST_REQUIRE(cursor.errors.at(i).empty());
+        auto const& actual = cursor.results.at(i);
+        BOOST_REQUIRE(!actual.empty());
+        BOOST_REQUIRE_EQUAL(actual.size(), expected.samples.size());
+        auto expected_names = get_series_names(*session, expected.samples);
+        for (size_t j = 0; j < actual.size(); j++) {
+            BOOST_REQUIRE_EQUAL(actual.at(j).timestamp, expected.samples.at(j).timestamp);
+            BOOST_REQUIRE_EQUAL(names.at(i).at(j), expected_names.at(j));
+            BOOST_REQUIRE_CLOSE(cursor.values.at(i).at(j), expected.values.at(j), 1e-9);
+        }
+    }
+    // Aggregations of the scanned series are computed from the scan buffer
+    BOOST_REQUIRE_GT(batch_counters.blocks_read, 0);
+    BOOST_REQUIRE_LT(batch_counters.blocks_read*2, standalone_counters.blocks_read);
+}
+
+// Test progressive query
+
+/** Cursor that splits progressive query output into passes
+  */
+struct ProgressiveCursorMock : CursorMock {
+    std::vector<int> levels;
+    std::vector<std::vector<aku_Sample>> passes;
+    std::vector<std::vector<double>> values;
+
+    virtual bool put(const aku_Sample &val) override {
+        if (val.payload.type & aku_PData::TEXT) {
+            std::string line(val.payload.data, val.payload.data + val.payload.size - sizeof(aku_Sample));
+            BOOST_REQUIRE_EQUAL(line.at(0), '~');
+            levels.push_back(std::stoi(line.substr(1)));
+            passes.emplace_back();
+            values.emplace_back();
+        } else {
+            BOOST_REQUIRE(val.payload.size > sizeof(aku_Sample));
+            passes.back().push_back(val);
+            values.back().push_back(*reinterpret_cast<double const*>(val.payload.data));
+        }
+        return CursorMock::put(val);
+    }
+};
+
+static std::string make_group_aggregate_query(std::string extra) {
+    return "{\"group-aggregate\": {\"metric\": \"test\", \"step\": \"1000n\", \"func\": [\"count\"]},"
+           " \"range\": {\"from\": 100000, \"to\": 200000}" + extra + "}";
+}
+
+BOOST_AUTO_TEST_CASE(Test_storage_progressive_query) {
+    std::vector<std::string> series_names = {
+        "test key=0",
+        "test key=1",
+        "test key=2",
+    };
+    auto storage = create_storage();
+    auto session = storage->create_write_session();
+    fill_data(session, 100000, 200000, series_names);
+
+    struct ValueCursorMock : CursorMock {
+        std::vector<double> values;
+        virtual bool put(const aku_Sample &val) override {
+            values.push_back(*reinterpret_cast<double const*>(val.payload.data));
+            return CursorMock::put(val);
+        }
+    };
+    ValueCursorMock exact;
+    session->query(&exact, make_group_aggregate_query("").c_str());
+    BOOST_REQUIRE_EQUAL(exact.error, AKU_SUCCESS);
+    BOOST_REQUIRE_EQUAL(exact.samples.size(), 100*series_names.size());
+
+    ProgressiveCursorMock cursor;
+    session->query(&cursor, make_group_aggregate_query(", \"progressive\": true").c_str());
+    BOOST_REQUIRE(cursor.done);
+    BOOST_REQUIRE_EQUAL(cursor.error, AKU_SUCCESS);
+    BOOST_REQUIRE(cursor.levels.size() > 1);
+    for (size_t i = 0; i < cursor.levels.size(); i++) {
+        // Every pass goes one level deeper
+        BOOST_REQUIRE_EQUAL(cursor.levels.at(i), static_cast<int>(cursor.levels.size() - i - 1));
+        double total = 0;
+        for (auto x: cursor.values.at(i)) {
+            total += x;
+        }
+        BOOST_REQUIRE_CLOSE(total, 100000.0*series_names.size(), 1E-6);
+    }
+    // Last pass is exact
+    auto const& last = cursor.passes.back();
+    BOOST_REQUIRE_EQUAL(last.size(), exact.samples.size());
+    for (size_t i = 0; i < last.size(); i++) {
+        BOOST_REQUIRE_EQUAL(last.at(i).timestamp, exact.samples.at(i).timestamp);
+        BOOST_REQUIRE_EQUAL(last.at(i).paramid, exact.samples.at(i).paramid);
+        BOOST_REQUIRE_EQUAL(cursor.values.back().at(i), exact.values.at(i));
+    }
+
+    // Latency budget stops the refinement
+    ProgressiveCursorMock cursor2;
+    session->query(&cursor2, make_group_aggregate_query(", \"progressive\": {\"max-latency\": \"1n\"}").c_str());
+    BOOST_REQUIRE_EQUAL(cursor2.error, AKU_SUCCESS);
+    BOOST_REQUIRE_EQUAL(cursor2.levels.size(), 1);
+    BOOST_REQUIRE_EQUAL(cursor2.levels.front(), cursor.levels.front());
+
+    // Only group-aggregate query can be progressive
+    CursorMock cursor3;
+    auto query = "{\"select\": \"test\", \"range\": {\"from\": 100000, \"to\": 200000}, \"progressive\": true}";
+    session->query(&cursor3, query);
+    BOOST_REQUIRE_EQUAL(cursor3.error, AKU_EQUERY_PARSING_ERROR);
+}
+
+// Test counter functions
+
+static void test_counter_group_aggregate(bool forward, OrderBy order) {
+    std::vector<std::string> series_names = {
+        "counter key=0",
+        "counter key=1",
+    };
+    const int N = 9900;
+    const int RESET = 2550;  // counter is reset in the middle of the bucket
+    auto storage = create_storage();
+    auto session = storage->create_write_session();
+    for (int i = 0; i < N; i++) {
+        for (auto it: series_names) {
+            aku_Sample sample;
+            sample.timestamp = 1000 + 10*i;
+            sample.payload.type = AKU_PAYLOAD_FLOAT;
+            sample.payload.float64 = i % RESET;
+            auto status = session->init_series_id(it.data(), it.data() + it.size(), &sample);
+            BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+            status = session->write(sample);
+            BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+        }
+    }
+    struct TupleCursorMock : CursorMock {
+        std::map<aku_ParamId, double> total;
+        std::vector<double> rates;
+        virtual bool put(const aku_Sample &val) override {
+            auto tup = reinterpret_cast<double const*>(val.payload.data);
+            BOOST_REQUIRE(tup[0] >= 0);
+            total[val.paramid] += tup[0];
+            rates.push_back(tup[1]);
+            return CursorMock::put(val);
+        }
+    };
+    std::stringstream query;
+    query << "{\"group-aggregate\": {\"metric\": \"counter\", \"step\": \"1000n\", \"func\": [\"increase\", \"rate\"]},";
+    query << " \"order-by\": " << (order == OrderBy::SERIES ? "\"series\"" : "\"time\"") << ",";
+    if (forward) {
+        query << " \"range\": {\"from\": 0, \"to\": 200000}}";
+    } else {
+        // Buckets are aligned to the beginning of the range
+        query << " \"range\": {\"from\": 199990, \"to\": 0}}";
+    }
+    TupleCursorMock cursor;
+    session->query(&cursor, query.str().c_str());
+    BOOST_REQUIRE(cursor.done);
+    BOOST_REQUIRE_EQUAL(cursor.error, AKU_SUCCESS);
+    BOOST_REQUIRE_EQUAL(cursor.samples.size(), 99*series_names.size());
+    // Every step increments the counter except the resets
+    BOOST_REQUIRE_EQUAL(cursor.total.size(), series_names.size());
+    for (auto kv: cursor.total) {
+        BOOST_REQUIRE_CLOSE(kv.second, N - 1 - (N - 1)/RESET, 1E-9);
+    }
+    // One increment per 10ns
+    for (auto rate: cursor.rates) {
+        BOOST_REQUIRE(rate > 0.98E8);
+        BOOST_REQUIRE(rate < 1.01E8);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(Test_storage_counter_group_aggregate_1) {
+    test_counter_group_aggregate(true, OrderBy::SERIES);
+}
+
+BOOST_AUTO_TEST_CASE(Test_storage_counter_group_aggregate_2) {
+    test_counter_group_aggregate(false, OrderBy::SERIES);
+}
+
+BOOST_AUTO_TEST_CASE(Test_storage_counter_group_aggregate_3) {
+    test_counter_group_aggregate(true, OrderBy::TIME);
+}
+
+BOOST_AUTO_TEST_CASE(Test_storage_counter_group_aggregate_4) {
+    test_counter_group_aggregate(false, OrderBy::TIME);
+}
+
+//! Returns counter buckets in backward direction
+struct BackwardCounterMock : StorageEngine::AggregateOperator {
+    std::vector<AggregationResult> buckets;
+
+    BackwardCounterMock(int nbuckets) {
+        for (int k = nbuckets; k --> 0;) {
+            AggregationResult bucket = INIT_AGGRES;
+            bucket.cnt    = 10;
+            bucket.first  = bucket.min = 10*k;
+            bucket.last   = bucket.max = 10*k + 9;
+            bucket._begin = 1000u*static_cast<u32>(k);
+            bucket._end   = 1000u*static_cast<u32>(k) + 999;
+            buckets.push_back(bucket);
+        }
+    }
+
+    virtual std::tuple<aku_Status, size_t> read(aku_Timestamp *destts, AggregationResult *destval, size_t size) override {
+        size_t sz = std::min(size, buckets.size());
+        for (size_t i = 0; i < sz; i++) {
+            destts[i]  = buckets[i]._begin;
+            destval[i] = buckets[i];
+        }
+        buckets.erase(buckets.begin(), buckets.begin() + static_cast<ptrdiff_t>(sz));
+        return std::make_tuple(buckets.empty() ? AKU_ENO_DATA : AKU_SUCCESS, sz);
+    }
+
+    virtual Direction get_direction() override {
+        return Direction::BACKWARD;
+    }
+};
+
+static std::vector<std::pair<aku_ParamId, double>> read_counter_increase(size_t nsamples) {
+    std::vector<aku_ParamId> ids = { 1, 2 };
+    std::vector<std::unique_ptr<StorageEngine::AggregateOperator>> iters;
+    iters.emplace_back(new BackwardCounterMock(4));
+    iters.emplace_back(new BackwardCounterMock(3));
+    std::vector<StorageEngine::AggregationFunction> func = { StorageEngine::AggregationFunction::INCREASE };
+    StorageEngine::SeriesOrderAggregateMaterializer mat(std::move(ids), std::move(iters), func);
+    const size_t sample_size = TupleOutputUtils::get_tuple_size(func);
+    std::vector<u8> buffer(sample_size*nsamples);
+    std::vector<std::pair<aku_ParamId, double>> result;
+    aku_Status status = AKU_SUCCESS;
+    while (status == AKU_SUCCESS) {
+        size_t size;
+        std::tie(status, size) = mat.read(buffer.data(), buffer.size());
+        for (size_t off = 0; off < size; off += sample_size) {
+            auto sample = reinterpret_cast<aku_Sample const*>(buffer.data() + off);
+            auto tup = reinterpret_cast<double const*>(sample->payload.data);
+            result.push_back(std::make_pair(sample->paramid, tup[0]));
+        }
+    }
+    BOOST_REQUIRE_EQUAL(status, AKU_ENO_DATA);
+    return result;
+}
+
+BOOST_AUTO_TEST_CASE(Test_series_order_counter_backward_small_buffer) {
+    // Every bucket except the oldest one includes the increase since the previous bucket
+    std::vector<std::pair<aku_ParamId, double>> expected = {
+        { 1, 10 }, { 1, 10 }, { 1, 10 }, { 1, 9 },
+        { 2, 10 }, { 2, 10 }, { 2, 9 },
+    };
+    for (size_t nsamples: { 1, 2, 3, 100 }) {
+        auto actual = read_counter_increase(nsamples);
+        BOOST_REQUIRE_EQUAL(actual.size(), expected.size());
+        for (size_t i = 0; i < expected.size(); i++) {
+            BOOST_REQUIRE_EQUAL(actual.at(i).first, expected.at(i).first);
+            BOOST_REQUIRE_EQUAL(actual.at(i).second, expected.at(i).second);
+        }
+    }
+}
+
+// Test variance and stddev
+
+BOOST_AUTO_TEST_CASE(Test_storage_variance_aggregate) {
+    std::vector<std::string> series_names = {
+        "var key=0",
+        "var key=1",
+    };
+    auto storage = create_storage();
+    auto session = storage->create_write_session();
+    for (int i = 0; i < 10000; i++) {
+        for (auto it: series_names) {
+            aku_Sample sample;
+            sample.timestamp = 1000 + 10*i;
+            sample.payload.type = AKU_PAYLOAD_FLOAT;
+            sample.payload.float64 = i % 4;
+            auto status = session->init_series_id(it.data(), it.data() + it.size(), &sample);
+            BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+            status = session->write(sample);
+            BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+        }
+    }
+    struct TupleCursorMock : CursorMock {
+        std::vector<std::vector<double>> tuples;
+        virtual bool put(const aku_Sample &val) override {
+            auto tup = reinterpret_cast<double const*>(val.payload.data);
+            auto n = (val.payload.size - sizeof(aku_Sample)) / sizeof(double);
+            tuples.emplace_back(tup, tup + n);
+            return CursorMock::put(val);
+        }
+    };
+    // Values are 0, 1, 2, 3 repeated, every bucket contains 100 values
+    const double variance = 1.25;
+    TupleCursorMock cursor;
+    session->query(&cursor, "{\"group-aggregate\": {\"metric\": \"var\", \"step\": \"1000n\", \"func\": [\"variance\", \"stddev\"]},"
+                            " \"range\": {\"from\": 1000, \"to\": 101000}}");
+    BOOST_REQUIRE(cursor.done);
+    BOOST_REQUIRE_EQUAL(cursor.error, AKU_SUCCESS);
+    BOOST_REQUIRE_EQUAL(cursor.tuples.size(), 100*series_names.size());
+    for (auto const& tup: cursor.tuples) {
+        BOOST_REQUIRE_EQUAL(tup.size(), 2);
+        BOOST_REQUIRE_CLOSE(tup.at(0), variance, 1E-9);
+        BOOST_REQUIRE_CLOSE(tup.at(1), std::sqrt(variance), 1E-9);
+    }
+
+    struct ValueCursorMock : CursorMock {
+        std::vector<double> values;
+        virtual bool put(const aku_Sample &val) override {
+            values.push_back(val.payload.float64);
+            return CursorMock::put(val);
+        }
+    };
+    ValueCursorMock cursor2;
+    session->query(&cursor2, "{\"aggregate\": {\"var\": \"stddev\"}, \"range\": {\"from\": 1000, \"to\": 101000}}");
+    BOOST_REQUIRE_EQUAL(cursor2.error, AKU_SUCCESS);
+    BOOST_REQUIRE_EQUAL(cursor2.values.size(), series_names.size());
+    for (auto x: cursor2.values) {
+        BOOST_REQUIRE_CLOSE(x, std::sqrt(variance), 1E-9);
+    }
+}
+
+// Test time-ordered merge
+
+static void test_time_order_merge(aku_Timestamp begin, aku_Timestamp end) {
+    std::vector<std::string> series_names;
+    for (int i = 0; i < 8; i++) {
+        series_names.push_back("test key=" + std::to_string(i));
+    }
+    auto storage = create_storage();
+    auto session = storage->create_write_session();
+    // This series doesn't have data in the query range
+    fill_data(session, 0, 500, { "test key=none" });
+    fill_data(session, 1000, 11000, series_names);
+
+    bool forward = begin < end;
+    CursorMock cursor;
+    QueryCounters full_counters;
+    {
+        QueryCountersScope scope(&full_counters);
+        session->query(&cursor, make_scan_query(begin, end, OrderBy::TIME).c_str());
+    }
+    BOOST_REQUIRE(cursor.done);
+    BOOST_REQUIRE_EQUAL(cursor.error, AKU_SUCCESS);
+    BOOST_REQUIRE_EQUAL(cursor.samples.size(), 10000*series_names.size());
+    for (size_t i = 1; i < cursor.samples.size(); i++) {
+        auto prev = std::make_tuple(cursor.samples.at(i - 1).timestamp, cursor.samples.at(i - 1).paramid);
+        auto curr = std::make_tuple(cursor.samples.at(i).timestamp, cursor.samples.at(i).paramid);
+        BOOST_REQUIRE(forward ? prev < curr : curr < prev);
+    }
+
+    // Query with limit should return the head of the full output
+    CursorMock limited;
+    std::string query = make_scan_query(begin, end, OrderBy::TIME);
+    query.back() = ',';
+    query += "\"limit\": 100}";
+    QueryCounters limited_counters;
+    {
+        QueryCountersScope scope(&limited_counters);
+        session->query(&limited, query.c_str());
+    }
+    BOOST_REQUIRE(limited.done);
+    BOOST_REQUIRE_EQUAL(limited.error, AKU_SUCCESS);
+    BOOST_REQUIRE_EQUAL(limited.samples.size(), 100);
+
+    // Merge should stop as soon as the limit is met. Every series holds about
+    // a dozen leaves but only the first one (or two if the newest leaf is
+    // almost empty) should be read. Full scan should read all of them.
+    BOOST_REQUIRE(limited_counters.leaves_decoded > 0);
+    BOOST_REQUIRE_LE(limited_counters.leaves_decoded, 2*series_names.size());
+    BOOST_REQUIRE_LE(limited_counters.blocks_read, 3*series_names.size());
+    BOOST_REQUIRE_GT(full_counters.leaves_decoded, 4*limited_counters.leaves_decoded);
+    BOOST_REQUIRE_GT(full_counters.blocks_read, 4*limited_counters.blocks_read);
+    for (size_t i = 0; i < limited.samples.size(); i++) {
+        BOOST_REQUIRE_EQUAL(limited.samples.at(i).timestamp, cursor.samples.at(i).timestamp);
+        BOOST_REQUIRE_EQUAL(limited.samples.at(i).paramid, cursor.samples.at(i).paramid);
+        BOOST_REQUIRE_EQUAL(limited.samples.at(i).payload.float64, cursor.samples.at(i).payload.float64);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(Test_storage_time_order_merge_forward) {
+    test_time_order_merge(1000, 11000);
+}
+
+BOOST_AUTO_TEST_CASE(Test_storage_time_order_merge_backward) {
+    test_time_order_merge(10999, 999);
+}
+
+// Test series activity index
+
+BOOST_AUTO_TEST_CASE(Test_metadata_storage_series_activity) {
+    MetadataStorage db(":memory:");
+    std::unordered_map<aku_ParamId, MetadataStorage::ActivityT> ranges = {
+        { 1, std::make_pair(0ull, 999ull) },
+        { 2, std::make_pair(1000ull, AKU_MAX_TIMESTAMP) },
+    };
+    db.add_series_activity(std::move(ranges));
+    db.add_series_activity({{ 1, std::make_pair(0ull, 1999ull) }});
+    db.sync_with_metadata_storage([](std::vector<MetadataStorage::SeriesT>*) {});
+    std::unordered_map<aku_ParamId, MetadataStorage::ActivityT> actual;
+    auto status = db.load_series_activity(actual);
+    BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+    BOOST_REQUIRE_EQUAL(actual.size(), 2);
+    BOOST_REQUIRE(actual.at(1) == MetadataStorage::ActivityT(0, 1999));
+    BOOST_REQUIRE(actual.at(2) == MetadataStorage::ActivityT(1000, AKU_MAX_TIMESTAMP));
+}
+
+BOOST_AUTO_TEST_CASE(Test_metadata_storage_series_activity_with_rescue_points) {
+    MetadataStorage db(":memory:");
+    db.add_series_activity({{ 1, std::make_pair(0ull, 999ull) }});
+    db.add_rescue_point(1, { 10, 20 });
+    bool rescue_points_taken = false;
+    db.sync_with_metadata_storage([](std::vector<MetadataStorage::SeriesT>*) {}, [&]() {
+        // Pending rescue points should be already taken by the sync
+        std::lock_guard<std::mutex> guard(db.sync_lock_);
+        rescue_points_taken = db.pending_rescue_points_.empty();
+        std::unordered_map<aku_ParamId, MetadataStorage::ActivityT> result;
+        result[1] = std::make_pair(0ull, 1999ull);
+        result[2] = std::make_pair(100ull, 200ull);
+        return result;
+    });
+    BOOST_REQUIRE(rescue_points_taken);
+    std::unordered_map<aku_ParamId, MetadataStorage::ActivityT> actual;
+    auto status = db.load_series_activity(actual);
+    BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+    BOOST_REQUIRE_EQUAL(actual.size(), 2);
+    BOOST_REQUIRE(actual.at(1) == MetadataStorage::ActivityT(0, 1999));
+    BOOST_REQUIRE(actual.at(2) == MetadataStorage::ActivityT(100, 200));
+    std::unordered_map<u64, std::vector<u64>> rpoints;
+    status = db.load_rescue_points(rpoints);
+    BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+    BOOST_REQUIRE_EQUAL(rpoints.at(1).size(), 2);
+}
+
+BOOST_AUTO_TEST_CASE(Test_metadata_storage_volume_summaries) {
+    MetadataStorage db(":memory:");
+    MetadataStorage::VolumeSummary first = { 0, 3, 100, AKU_MAX_TIMESTAMP, 8, std::vector<u64>(64, 0) };
+    first.filter[0] = 0x8000000000000001ull;
+    first.filter[63] = ~0ull;
+    MetadataStorage::VolumeSummary second = { 1, 4, AKU_MAX_TIMESTAMP, AKU_MIN_TIMESTAMP, 0, std::vector<u64>(128, 0) };
+    second.filter[127] = 0xFull;
+    db.update_volume_summary(first);
+    db.update_volume_summary(second);
+    // Time range only, pending filter is preserved
+    MetadataStorage::VolumeSummary range = { 1, 4, 200, 300, 2, {} };
+    db.update_volume_summary(range);
+    db.sync_with_metadata_storage([](std::vector<MetadataStorage::SeriesT>*) {});
+    // Time range only, saved filter is preserved
+    range = { 0, 3, 100, 500, 10, {} };
+    db.update_volume_summary(range);
+    // Summary of the other generation is not updated
+    range = { 1, 5, 400, 500, 3, {} };
+    db.update_volume_summary(range);
+    db.sync_with_metadata_storage([](std::vector<MetadataStorage::SeriesT>*) {});
+    auto actual = db.get_volume_summaries();
+    BOOST_REQUIRE_EQUAL(actual.size(), 2);
+    std::sort(actual.begin(), actual.end(), [](MetadataStorage::VolumeSummary const& lhs,
+                                               MetadataStorage::VolumeSummary const& rhs) {
+        return lhs.id < rhs.id;
+    });
+    BOOST_REQUIRE_EQUAL(actual.at(0).generation, 3);
+    BOOST_REQUIRE_EQUAL(actual.at(0).begin, 100);
+    BOOST_REQUIRE_EQUAL(actual.at(0).end, 500);
+    BOOST_REQUIRE_EQUAL(actual.at(0).filter_nblocks, 10);
+    BOOST_REQUIRE(actual.at(0).filter == first.filter);
+    BOOST_REQUIRE_EQUAL(actual.at(1).generation, 4);
+    BOOST_REQUIRE_EQUAL(actual.at(1).begin, 200);
+    BOOST_REQUIRE_EQUAL(actual.at(1).end, 300);
+    BOOST_REQUIRE_EQUAL(actual.at(1).filter_nblocks, 2);
+    BOOST_REQUIRE(actual.at(1).filter == second.filter);
+}
+
+BOOST_AUTO_TEST_CASE(Test_storage_inactive_series) {
+    const aku_Timestamp hour = 3600000000000ull;
+    auto storage = create_storage();
+    auto session = storage->create_write_session();
+    fill_data(session, 100, 200, { "test key=0" });
+    fill_data(session, 10*hour, 10*hour + 100, { "test key=1", "test key=2" });
+
+    CursorMock cursor;
+    session->query(&cursor, make_scan_query(10*hour, 11*hour, OrderBy::SERIES).c_str());
+    BOOST_REQUIRE(cursor.done);
+    BOOST_REQUIRE_EQUAL(cursor.error, AKU_SUCCESS);
+    BOOST_REQUIRE_EQUAL(cursor.samples.size(), 200);
+
+    // Query that doesn't match any active series returns nothing
+    CursorMock cursor2;
+    session->query(&cursor2, make_scan_query(5*hour, 6*hour, OrderBy::SERIES).c_str());
+    BOOST_REQUIRE(cursor2.done);
+    BOOST_REQUIRE_EQUAL(cursor2.error, AKU_SUCCESS);
+    BOOST_REQUIRE(cursor2.samples.empty());
+
+    CursorMock cursor3;
+    session->query(&cursor3, "{\"aggregate\": {\"test\": \"count\"}, \"range\": {\"from\": 0, \"to\": 1000}}");
+    BOOST_REQUIRE(cursor3.done);
+    BOOST_REQUIRE_EQUAL(cursor3.error, AKU_SUCCESS);
+    BOOST_REQUIRE_EQUAL(cursor3.samples.size(), 1);
+}
+
+BOOST_AUTO_TEST_CASE(Test_storage_striped_database) {
+    namespace fs = boost::filesystem;
+    auto root  = fs::temp_directory_path() / fs::unique_path();
+    auto meta  = root / "meta";
+    auto disk0 = root / "disk0";
+    auto disk1 = root / "disk1";
+    std::string volpath = disk0.string() + ":" + disk1.string();
+    auto status = Storage::new_database("test", meta.c_str(), volpath.c_str(), 3, 0x100000, false);
+    BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+    // Number of volumes should be rounded up to fill both stripes
+    for (int i = 0; i < 4; i++) {
+        auto dir = i % 2 == 0 ? disk0 : disk1;
+        BOOST_REQUIRE(fs::exists(dir / ("test_" + std::to_string(i) + ".vol")));
+    }
+    auto dbpath = (meta / "test.akumuli").string();
+    {
+        MetadataStorage mstore(dbpath.c_str());
+        std::string value;
+        BOOST_REQUIRE(mstore.get_config_param("blockstore_type", &value));
+        BOOST_REQUIRE_EQUAL(value, "StripedFileStorage");
+        BOOST_REQUIRE(mstore.get_config_param("stripe_width", &value));
+        BOOST_REQUIRE_EQUAL(value, "2");
+    }
+    {
+        auto storage = std::make_shared<Storage>(dbpath.c_str());
+        auto session = storage->create_write_session();
+        fill_data(session, 100, 10000, { "test key=0", "test key=1" });
+        session.reset();
+        storage->close();
+    }
+    auto storage = std::make_shared<Storage>(dbpath.c_str());
+    auto session = storage->create_write_session();
+    CursorMock cursor;
+    session->query(&cursor, make_scan_query(100, 10000, OrderBy::SERIES).c_str());
+    BOOST_REQUIRE(cursor.done);
+    BOOST_REQUIRE_EQUAL(cursor.error, AKU_SUCCESS);
+    BOOST_REQUIRE_EQUAL(cursor.samples.size(), 2*9900);
+    session.reset();
+    storage->close();
+    storage.reset();
+    fs::remove_all(root);
+}
+
+BOOST_AUTO_TEST_CASE(Test_storage_direct_io_database) {
+    namespace fs = boost::filesystem;
+    // Temp directory can be on tmpfs that doesn't support O_DIRECT
+    auto root  = fs::current_path() / fs::unique_path();
+    auto meta  = root / "meta";
+    auto disk0 = root / "disk0";
+    auto disk1 = root / "disk1";
+    std::string volpath = disk0.string() + ":" + disk1.string();
+    auto status = Storage::new_database("test", meta.c_str(), volpath.c_str(), 4, 0x100000, false);
+    BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+    auto dbpath = (meta / "test.akumuli").string();
+    {
+        auto storage = std::make_shared<Storage>(dbpath.c_str());
+        auto session = storage->create_write_session();
+        fill_data(session, 100, 10000, { "test key=0", "test key=1" });
+        session.reset();
+        storage->close();
+    }
+    // Reopen in O_DIRECT mode
+    aku_FineTuneParams params = {};
+    params.direct_io = 1;
+    params.max_cache_size = 0x10000;
+    auto storage = std::make_shared<Storage>(dbpath.c_str(), params);
+    auto stats = storage->get_stats();
+    for (int i = 0; i < 4; i++) {
+        // Volume shouldn't fall back to the page cache
+        BOOST_REQUIRE(stats.get<bool>("volume_" + std::to_string(i) + ".direct_io"));
+    }
+    auto session = storage->create_write_session();
+    CursorMock cursor;
+    session->query(&cursor, make_scan_query(100, 10000, OrderBy::SERIES).c_str());
+    BOOST_REQUIRE(cursor.done);
+    BOOST_REQUIRE_EQUAL(cursor.error, AKU_SUCCESS);
+    BOOST_REQUIRE_EQUAL(cursor.samples.size(), 2*9900);
+    // Data written in O_DIRECT mode should be readable
+    fill_data(session, 10000, 11000, { "test key=0" });
+    CursorMock cursor2;
+    session->query(&cursor2, make_scan_query(10000, 11000, OrderBy::SERIES).c_str());
+    BOOST_REQUIRE_EQUAL(cursor2.error, AKU_SUCCESS);
+    BOOST_REQUIRE_EQUAL(cursor2.samples.size(), 1000);
+    session.reset();
+    storage->close();
+    storage.reset();
+    fs::remove_all(root);
+}
+
+BOOST_AUTO_TEST_CASE(Test_storage_split_superblocks) {
+    namespace fs = boost::filesystem;
+    auto root   = fs::temp_directory_path() / fs::unique_path();
+    auto meta   = root / "meta";
+    auto disk   = root / "disk";
+    auto sbdisk = root / "ssd";
+    auto status = Storage::new_database("test", meta.c_str(), disk.c_str(), 2, 0x100000, false, sbdisk.c_str());
+    BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+    BOOST_REQUIRE(fs::exists(sbdisk / "test_sb_0.vol"));
+    BOOST_REQUIRE(fs::exists(sbdisk / "test_sb_1.vol"));
+    auto dbpath = (meta / "test.akumuli").string();
+    {
+        auto storage = std::make_shared<Storage>(dbpath.c_str());
+        auto session = storage->create_write_session();
+        fill_data(session, 100, 100000, { "test key=0", "test key=1" });
+        session.reset();
+        storage->close();
+    }
+    {
+        MetadataStorage mstore(dbpath.c_str());
+        u32 nleaves = 0, nsblocks = 0;
+        for (auto const& vol: mstore.get_volumes()) {
+            if (vol.id >= StorageEngine::SUPERBLOCK_VOLUME_BASE) {
+                nsblocks += vol.nblocks;
+            } else {
+                nleaves += vol.nblocks;
+            }
+        }
+        BOOST_REQUIRE(nleaves > 0);
+        BOOST_REQUIRE(nsblocks > 0);
+    }
+    // Reopen with superblocks locked in memory
+    aku_FineTuneParams params = {};
+    params.mlock_superblocks = 1;
+    auto storage = std::make_shared<Storage>(dbpath.c_str(), params);
+    auto session = storage->create_write_session();
+    CursorMock cursor;
+    session->query(&cursor, make_scan_query(100, 100000, OrderBy::SERIES).c_str());
+    BOOST_REQUIRE(cursor.done);
+    BOOST_REQUIRE_EQUAL(cursor.error, AKU_SUCCESS);
+    BOOST_REQUIRE_EQUAL(cursor.samples.size(), 2*99900);
+    session.reset();
+    storage->close();
+    storage.reset();
+    BOOST_REQUIRE_EQUAL(Storage::remove_storage(dbpath.c_str(), true), AKU_SUCCESS);
+    BOOST_REQUIRE(!fs::exists(sbdisk / "test_sb_0.vol"));
+    fs::remove_all(root);
+}
+
+// Test paged query
+
+/** Cursor that separates page token from the page
+  */
+struct PageCursorMock : CursorMock {
+    std::string token;
+
+    virtual bool put(const aku_Sample &val) override {
+        if (val.payload.type & aku_PData::TEXT) {
+            std::string line(val.payload.data, val.payload.data + val.payload.size - sizeof(aku_Sample));
+            BOOST_REQUIRE_EQUAL(line.at(0), '@');
+            BOOST_REQUIRE(token.empty());
+            token = line.substr(1, line.size() - 3);
+            return true;
+        }
+        return CursorMock::put(val);
+    }
+};
+
+static void test_paged_query(aku_Timestamp begin, aku_Timestamp end, OrderBy order) {
+    std::vector<std::string> series_names = {
+        "test key=0",
+        "test key=1",
+        "test key=2",
+    };
+    auto storage = create_storage();
+    auto session = storage->create_write_session();
+    fill_data(session, std::min(begin, end), std::max(begin, end), series_names);
+
+    CursorMock expected;
+    auto query = make_scan_query(begin, end, order);
+    session->query(&expected, query.c_str());
+    BOOST_REQUIRE_EQUAL(expected.error, AKU_SUCCESS);
+
+    std::vector<aku_Sample> actual;
+    std::string token;
+    size_t npages = 0;
+    do {
+        PageCursorMock cursor;
+        auto page = query.substr(0, query.size() - 1) + ", \"limit\": 7, \"page-token\": \"" + token + "\"}";
+        session->query(&cursor, page.c_str());
+        BOOST_REQUIRE(cursor.done);
+        BOOST_REQUIRE_EQUAL(cursor.error, AKU_SUCCESS);
+        BOOST_REQUIRE(cursor.samples.size() <= 7);
+        BOOST_REQUIRE(cursor.token.empty() || cursor.samples.size() == 7);
+        actual.insert(actual.end(), cursor.samples.begin(), cursor.samples.end());
+        token = cursor.token;
+        npages++;
+    } while (!token.empty());
+
+    BOOST_REQUIRE_EQUAL(npages, (expected.samples.size() + 6) / 7);
+    BOOST_REQUIRE_EQUAL(actual.size(), expected.samples.size());
+    for (size_t i = 0; i < actual.size(); i++) {
+        BOOST_REQUIRE_EQUAL(actual.at(i).timestamp, expected.samples.at(i).timestamp);
+        BOOST_REQUIRE_EQUAL(actual.at(i).paramid, expected.samples.at(i).paramid);
+    }
+
+    // Offset without the page token
+    CursorMock cursor;
+    auto offset = query.substr(0, query.size() - 1) + ", \"limit\": 10, \"offset\": 20}";
+    session->query(&cursor, offset.c_str());
+    BOOST_REQUIRE_EQUAL(cursor.error, AKU_SUCCESS);
+    BOOST_REQUIRE_EQUAL(cursor.samples.size(), 10);
+    for (size_t i = 0; i < cursor.samples.size(); i++) {
+        BOOST_REQUIRE_EQUAL(cursor.samples.at(i).timestamp, expected.samples.at(i + 20).timestamp);
+        BOOST_REQUIRE_EQUAL(cursor.samples.at(i).paramid, expected.samples.at(i + 20).paramid);
+    }
+
+    // Token of the other order is rejected
+    CursorMock cursor2;
+    auto invalid = query.substr(0, query.size() - 1) + ", \"limit\": 10, \"page-token\": \""
+                 + (order == OrderBy::SERIES ? "t" : "s") + "1.64\"}";
+    session->query(&cursor2, invalid.c_str());
+    BOOST_REQUIRE_EQUAL(cursor2.error, AKU_EQUERY_PARSING_ERROR);
+}
+
+BOOST_AUTO_TEST_CASE(Test_storage_paged_query_1) {
+    test_paged_query(100, 200, OrderBy::SERIES);
+}
+
+BOOST_AUTO_TEST_CASE(Test_storage_paged_query_2) {
+    test_paged_query(100, 200, OrderBy::TIME);
+}
+
+BOOST_AUTO_TEST_CASE(Test_storage_paged_query_3) {
+    test_paged_query(200, 100, OrderBy::SERIES);
+}
+
+BOOST_AUTO_TEST_CASE(Test_storage_paged_query_4) {
+    test_paged_query(200, 100, OrderBy::TIME);
+}
+
+BOOST_AUTO_TEST_CASE(Test_storage_paged_query_non_select) {
+    std::vector<std::string> series_names = {
+        "test key=0",
+        "test key=1",
+    };
+    auto storage = create_storage();
+    auto session = storage->create_write_session();
+    fill_data(session, 100, 200, series_names);
+
+    // Only select query can be resumed from the page token
+    std::vector<std::string> queries = {
+        "{\"aggregate\": {\"test\": \"sum\"}, \"range\": {\"from\": 100, \"to\": 200},"
+        " \"limit\": 1, \"page-token\": \"\"}",
+        "{\"group-aggregate\": {\"metric\": \"test\", \"step\": \"10n\", \"func\": [\"max\"]},"
+        " \"range\": {\"from\": 100, \"to\": 200}, \"limit\": 5, \"page-token\": \"\"}",
+        "{\"join\": [\"test\", \"test\"], \"range\": {\"from\": 100, \"to\": 200},"
+        " \"limit\": 5, \"page-token\": \"\"}",
+    };
+    for (auto const& query: queries) {
+        CursorMock cursor;
+        session->query(&cursor, query.c_str());
+        BOOST_REQUIRE(cursor.done);
+        BOOST_REQUIRE_EQUAL(cursor.error, AKU_EQUERY_PARSING_ERROR);
+    }
+
+    // Token of the prepared query can't be changed by the execution
+    CursorMock prep;
+    auto query = make_scan_query(100, 200, OrderBy::SERIES);
+    auto page = query.substr(0, query.size() - 1) + ", \"limit\": 7, \"page-token\": \"\"}";
+    session->prepare(&prep, page.c_str());
+    BOOST_REQUIRE(prep.done);
+    BOOST_REQUIRE_EQUAL(prep.error, AKU_EQUERY_PARSING_ERROR);
+}
+
+// Test query cancellation
+
+BOOST_AUTO_TEST_CASE(Test_storage_query_cancellation) {
+    std::vector<std::string> series_names = {
+        "test key=0",
+        "test key=1",
+        "test key=2",
+    };
+    auto storage = create_storage();
+    auto session = storage->create_write_session();
+    fill_data(session, 100, 200, series_names);
+    auto query = make_scan_query(100, 200, OrderBy::SERIES);
+
+    QueryCancellation token;
+    QueryCancellationScope scope(&token);
+
+    CursorMock cursor;
+    session->query(&cursor, query.c_str());
+    BOOST_REQUIRE_EQUAL(cursor.error, AKU_SUCCESS);
+    BOOST_REQUIRE_EQUAL(cursor.samples.size(), 300);
+
+    // Timeout expires before the query plan is executed
+    CursorMock cursor2;
+    auto timeout = query.substr(0, query.size() - 1) + ", \"timeout\": \"1n\"}";
+    session->query(&cursor2, timeout.c_str());
+    BOOST_REQUIRE_EQUAL(cursor2.error, AKU_ETIMEOUT);
+    BOOST_REQUIRE(cursor2.samples.empty());
+
+    QueryCancellation token2;
+    QueryCancellationScope scope2(&token2);
+    token2.cancel(AKU_ECANCELED);
+    CursorMock cursor3;
+    session->query(&cursor3, query.c_str());
+    BOOST_REQUIRE_EQUAL(cursor3.error, AKU_ECANCELED);
+    BOOST_REQUIRE(cursor3.samples.empty());
+
+    CursorMock cursor4;
+    auto invalid = query.substr(0, query.size() - 1) + ", \"timeout\": \"soon\"}";
+    session->query(&cursor4, invalid.c_str());
+    BOOST_REQUIRE_EQUAL(cursor4.error, AKU_EQUERY_PARSING_ERROR);
+}
+
+BOOST_AUTO_TEST_CASE(Test_storage_prepared_query_timeout) {
+    std::vector<std::string> series_names = {
+        "test key=0",
+        "test key=1",
+    };
+    auto storage = create_storage();
+    auto session = storage->create_write_session();
+    fill_data(session, 100, 200, series_names);
+    auto query = make_scan_query(100, 200, OrderBy::SERIES);
+    auto with_timeout = query.substr(0, query.size() - 1) + ", \"timeout\": \"1n\"}";
+
+    TextCursorMock prep;
+    session->prepare(&prep, query.c_str());
+    BOOST_REQUIRE_EQUAL(prep.error, AKU_SUCCESS);
+    auto id = std::to_string(extract_prepared_id(prep));
+    TextCursorMock prep2;
+    session->prepare(&prep2, with_timeout.c_str());
+    BOOST_REQUIRE_EQUAL(prep2.error, AKU_SUCCESS);
+    auto id2 = std::to_string(extract_prepared_id(prep2));
+
+    // Timeout of the template is applied
+    QueryCancellation token1;
+    QueryCancellationScope scope1(&token1);
+    CursorMock cursor1;
+    session->query(&cursor1, ("{\"prepared\": " + id2 + "}").c_str());
+    BOOST_REQUIRE_EQUAL(cursor1.error, AKU_ETIMEOUT);
+
+    // Timeout of the execution request overrides the template
+    QueryCancellation token2;
+    QueryCancellationScope scope2(&token2);
+    CursorMock cursor2;
+    session->query(&cursor2, ("{\"prepared\": " + id2 + ", \"timeout\": \"1h\"}").c_str());
+    BOOST_REQUIRE_EQUAL(cursor2.error, AKU_SUCCESS);
+    BOOST_REQUIRE_EQUAL(cursor2.samples.size(), 200);
+
+    QueryCancellation token3;
+    QueryCancellationScope scope3(&token3);
+    CursorMock cursor3;
+    session->query(&cursor3, ("{\"prepared\": " + id + ", \"timeout\": \"1n\"}").c_str());
+    BOOST_REQUIRE_EQUAL(cursor3.error, AKU_ETIMEOUT);
+}
+
 // Test metadata query
 
 static void test_metadata_query() {
@@ -914,6 +2039,148 @@ BOOST_AUTO_TEST_CASE(Test_series_retreiver_1) {
     test_retreiver();
 }
 
+BOOST_AUTO_TEST_CASE(Test_series_retreiver_join) {
+    std::vector<std::string> test_data = {
+        "aaa foo=1 bar=1",
+        "aaa foo=1 bar=2",
+        "aaa foo=2 bar=1",
+        "bbb foo=1 bar=2",
+        "bbb foo=2 bar=1",
+        "ccc foo=1 bar=1",
+    };
+    SeriesMatcher m;
+    std::map<std::string, u64> ids;
+    for (auto s: test_data) {
+        char buffer[0x100];
+        const char* pkeys_begin;
+        const char* pkeys_end;
+        aku_Status status = SeriesParser::to_canonical_form(s.data(), s.data() + s.size(),
+                                                            buffer, buffer + 0x100,
+                                                            &pkeys_begin, &pkeys_end);
+        BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+        ids[s] = m.add(buffer, pkeys_end);
+    }
+    std::vector<u64> act;
+    aku_Status status;
+    SeriesRetreiver rt({"aaa", "bbb", "ccc"});
+    status = rt.add_tag("foo", "1");
+    BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+    std::tie(status, act) = rt.extract_ids(m);
+    BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+    // First metric ids followed by the ids of the other metrics with the same tags
+    std::vector<u64> exp = {
+        ids["aaa foo=1 bar=1"], ids["aaa foo=1 bar=2"],
+        0,                      ids["bbb foo=1 bar=2"],
+        ids["ccc foo=1 bar=1"], 0,
+    };
+    BOOST_REQUIRE_EQUAL(act.size(), exp.size());
+    // Order of the first metric ids is defined by the index
+    if (act.front() != exp.front()) {
+        std::swap(exp[0], exp[1]);
+        std::swap(exp[2], exp[3]);
+        std::swap(exp[4], exp[5]);
+    }
+    BOOST_REQUIRE_EQUAL_COLLECTIONS(exp.begin(), exp.end(), act.begin(), act.end());
+}
+
+BOOST_AUTO_TEST_CASE(Test_query_json_parser) {
+    std::vector<std::string> valid = {
+        "{}",
+        "[]",
+        "{ \"select\": \"cpu\", \"range\": { \"from\": \"20170101T000000\", \"to\": 1000 } }",
+        "{\"where\":{\"host\":[\"a\",\"b\"],\"region\":\"x\"},\"limit\":10,\"offset\":-1.5e3}",
+        "{\"apply\": [{\"name\": \"top\", \"N\": 3}, {\"name\": \"scale\", \"weights\": [1, 2.5, 0]}]}",
+        "{\"flags\": [true, false, null], \"empty\": {}, \"list\": [[], [1], {\"a\": []}]}",
+        "{\"escape\": \"\\\"\\\\\\/\\b\\f\\n\\r\\t\\u0041\\u00e9\\u20ac\\ud83d\\ude00\"}",
+        "{\"dup\": 1, \"dup\": 2}",
+        " \t\r\n{ \"ws\" : [ 1 , 2 ] } \n",
+    };
+    for (auto const& doc: valid) {
+        aku_Status status;
+        boost::property_tree::ptree actual, expected;
+        std::tie(status, actual) = QueryParser::parse_json(doc.c_str());
+        BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+        std::stringstream stream(doc);
+        boost::property_tree::json_parser::read_json(stream, expected);
+        BOOST_REQUIRE(actual == expected);
+    }
+    std::vector<std::string> invalid = {
+        "",
+        "{",
+        "{\"a\": }",
+        "{\"a\": 1,}",
+        "{\"a\" 1}",
+        "[1 2]",
+        "{\"a\": tru}",
+        "{\"a\": 01}",
+        "{\"a\": 1.}",
+        "{\"a\": \"unterminated}",
+        "{\"a\": \"\\x\"}",
+        "{\"a\": \"\\ud83d\"}",
+        "{} {}",
+        std::string(100, '[') + std::string(100, ']'),
+    };
+    for (auto const& doc: invalid) {
+        aku_Status status;
+        boost::property_tree::ptree actual;
+        std::tie(status, actual) = QueryParser::parse_json(doc.c_str());
+        BOOST_REQUIRE_EQUAL(status, AKU_EQUERY_PARSING_ERROR);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(Test_prepared_execution_parser) {
+    aku_Status status;
+    PreparedExecution exec;
+    status = QueryParser::parse_prepared_execution("{\"select\": \"cpu\"}", &exec);
+    BOOST_REQUIRE_EQUAL(status, AKU_ENOT_FOUND);
+    status = QueryParser::parse_prepared_execution("{\"select\": \"prepared\"}", &exec);
+    BOOST_REQUIRE_EQUAL(status, AKU_ENOT_FOUND);
+
+    status = QueryParser::parse_prepared_execution("{\"prepared\": 42}", &exec);
+    BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+    BOOST_REQUIRE_EQUAL(exec.id, 42);
+    BOOST_REQUIRE(!exec.range);
+    BOOST_REQUIRE(!exec.profile);
+
+    status = QueryParser::parse_prepared_execution(
+                "{\"output\": {\"format\": \"csv\"}, \"range\": {\"from\": 100, \"to\": \"200\"},"
+                " \"profile\": true, \"prepared\": \"7\"}", &exec);
+    BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+    BOOST_REQUIRE_EQUAL(exec.id, 7);
+    BOOST_REQUIRE(exec.range);
+    BOOST_REQUIRE_EQUAL(exec.begin, 100);
+    BOOST_REQUIRE_EQUAL(exec.end, 200);
+    BOOST_REQUIRE(exec.profile);
+    BOOST_REQUIRE_EQUAL(exec.timeout, 0);
+
+    status = QueryParser::parse_prepared_execution("{\"prepared\": 1, \"timeout\": \"10ms\"}", &exec);
+    BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+    BOOST_REQUIRE_EQUAL(exec.timeout, 10000000ull);
+
+    status = QueryParser::parse_prepared_execution("{\"prepared\": 18446744073709551615}", &exec);
+    BOOST_REQUIRE_EQUAL(status, AKU_SUCCESS);
+    BOOST_REQUIRE_EQUAL(exec.id, 18446744073709551615ull);
+
+    std::vector<std::string> invalid = {
+        "{\"prepared\": -1}",
+        "{\"prepared\": 18446744073709551616}",
+        "{\"prepared\": 99999999999999999999}",
+        "{\"prepared\": \"999999999999999999999999\"}",
+        "{\"prepared\": [1]}",
+        "{\"prepared\": 1, \"range\": {\"from\": 100}}",
+        "{\"prepared\": 1, \"range\": {\"from\": \"bad\", \"to\": 200}}",
+        "{\"prepared\": 1, \"profile\": 1}",
+        "{\"prepared\": 1, \"select\": \"cpu\"}",
+        "{\"prepared\": 1, \"timeout\": \"0s\"}",
+        "{\"prepared\": 1, \"timeout\": \"soon\"}",
+        "{\"prepared\": 1",
+    };
+    for (auto const& doc: invalid) {
+        status = QueryParser::parse_prepared_execution(doc.c_str(), &exec);
+        BOOST_REQUIRE_EQUAL(status, AKU_EQUERY_PARSING_ERROR);
+    }
+}
+
 BOOST_AUTO_TEST_CASE(Test_series_add_1) {
     const char* sname = "hello|world tag=1";
     const char* end = sname + strlen(sname);
@@ -42,6 +42,10 @@ struct SessionMock : DbSession {
         throw "not implemented";
     }
 
+    virtual std::shared_ptr<DbCursor> prepare(std::string) override {
+        throw "not implemented";
+    }
+
     virtual int param_id_to_series(aku_ParamId id, char* buf, size_t sz) override {
         auto str = std::to_string(id);
         assert(str.size() <= sz);
@@ -102,6 +106,9 @@ struct DbSessionErrorMock : DbSession {
     virtual std::shared_ptr<DbCursor> search(std::string) override {
         throw "not implemented";
     }
+    virtual std::shared_ptr<DbCursor> prepare(std::string) override {
+        throw "not implemented";
+    }
     virtual int param_id_to_series(aku_ParamId id, char* buf, size_t sz) override {
         auto str = std::to_string(id);
         assert(str.size() <= sz);
@@ -1,4 +1,5 @@
 #include <iostream>
+#include <thread>
 
 #define BOOST_TEST_DYN_LINK
 #define BOOST_TEST_MODULE Main
@@ -9,6 +10,8 @@
 #include "util.h"
 #include "crc32c.h"
 #include "log_iface.h"
+#include "instrumentation.h"
+#include "pool.h"
 
 using namespace Akumuli;
 
@@ -139,3 +142,226 @@ BOOST_AUTO_TEST_CASE(test_crc32c_0) {
 
     BOOST_REQUIRE_EQUAL(hw, sw);
 }
+
+BOOST_AUTO_TEST_CASE(test_shared_lock_is_not_exclusive) {
+    RWLock lock;
+    SharedLock first(lock);
+    BOOST_REQUIRE(lock.try_rdlock());
+    lock.unlock();
+    BOOST_REQUIRE(!lock.try_wrlock());
+}
+
+BOOST_AUTO_TEST_CASE(test_scalable_rwlock_1) {
+    // Readers shouldn't block each other
+    ScalableRWLock lock;
+    std::vector<int> slots;
+    for (int i = 0; i < 8; i++) {
+        slots.push_back(lock.rdlock());
+    }
+    for (auto slot: slots) {
+        lock.rdunlock(slot);
+    }
+    ScalableUniqueLock guard(lock);
+}
+
+BOOST_AUTO_TEST_CASE(test_scalable_rwlock_2) {
+    // Writer should exclude readers and other writers
+    ScalableRWLock lock;
+    const int NTHREADS = 4;
+    const int NITER = 10000;
+    u64 counter = 0;
+    std::atomic<u64> nerrors = {0};
+    auto writer = [&]() {
+        for (int i = 0; i < NITER; i++) {
+            ScalableUniqueLock guard(lock);
+            counter++;
+            counter++;
+        }
+    };
+    auto reader = [&]() {
+        for (int i = 0; i < NITER; i++) {
+            ScalableSharedLock guard(lock);
+            if (counter % 2 != 0) {
+                nerrors++;
+            }
+        }
+    };
+    std::vector<std::thread> threads;
+    for (int i = 0; i < NTHREADS; i++) {
+        threads.emplace_back(writer);
+        threads.emplace_back(reader);
+    }
+    for (auto& th: threads) {
+        th.join();
+    }
+    BOOST_REQUIRE_EQUAL(counter, 2ull*NTHREADS*NITER);
+    BOOST_REQUIRE_EQUAL(nerrors.load(), 0ull);
+    auto stats = ScalableRWLock::get_stats();
+    BOOST_REQUIRE(stats.revocations > 0);
+}
+
+BOOST_AUTO_TEST_CASE(test_latency_histogram_buckets) {
+    // Bucket index should be monotonic and upper bound should cover the value
+    int prev = 0;
+    for (u64 value = 0; value < 100000; value++) {
+        int ix = LatencyHistogram::bucket_index(value);
+        BOOST_REQUIRE(ix >= prev);
+        BOOST_REQUIRE(ix < LatencyHistogram::NBUCKETS);
+        BOOST_REQUIRE(LatencyHistogram::bucket_upper_bound(ix) >= value);
+        if (ix > 0) {
+            BOOST_REQUIRE(LatencyHistogram::bucket_upper_bound(ix - 1) < value);
+        }
+        prev = ix;
+    }
+    BOOST_REQUIRE_EQUAL(LatencyHistogram::bucket_index(~0ull), LatencyHistogram::NBUCKETS - 1);
+}
+
+BOOST_AUTO_TEST_CASE(test_latency_histogram_quantiles) {
+    LatencyHistogram hist;
+    for (u64 value = 1; value <= 1000; value++) {
+        hist.add(value*1000);
+    }
+    BOOST_REQUIRE_EQUAL(hist.count, 1000ull);
+    BOOST_REQUIRE_EQUAL(hist.max, 1000000ull);
+    // Relative error should be within 1/16
+    auto check = [&](double q, double expected) {
+        double actual = static_cast<double>(hist.quantile(q));
+        BOOST_REQUIRE(actual >= expected);
+        BOOST_REQUIRE(actual <= expected*(1.0 + 1.0/16));
+    };
+    check(0.5, 500000);
+    check(0.9, 900000);
+    check(0.99, 990000);
+    BOOST_REQUIRE_EQUAL(hist.quantile(1.0), 1000000ull);
+}
+
+BOOST_AUTO_TEST_CASE(test_instrumentation_probes) {
+    Instrumentation::reset();
+    const int NTHREADS = 4;
+    const int NITER = 1000;
+    auto worker = [&]() {
+        for (int i = 0; i < NITER; i++) {
+            ProbeScope probe(AKU_PROBE_NBTREE_APPEND);
+        }
+    };
+    std::vector<std::thread> threads;
+    for (int i = 0; i < NTHREADS; i++) {
+        threads.emplace_back(worker);
+    }
+    for (auto& th: threads) {
+        th.join();
+    }
+    // Live thread
+    for (int i = 0; i < NITER; i++) {
+        ProbeScope probe(AKU_PROBE_NBTREE_APPEND);
+    }
+    BOOST_REQUIRE_EQUAL(Instrumentation::get_count(AKU_PROBE_NBTREE_APPEND), (NTHREADS + 1ull)*NITER);
+    auto hist = Instrumentation::get_histogram(AKU_PROBE_NBTREE_APPEND);
+    u64 nsamples = (NITER + Instrumentation::SAMPLE_RATE - 1) / Instrumentation::SAMPLE_RATE;
+    BOOST_REQUIRE_EQUAL(hist.count, (NTHREADS + 1ull)*nsamples);
+    BOOST_REQUIRE_EQUAL(Instrumentation::get_count(AKU_PROBE_FLUSH), 0ull);
+
+    auto stats = Instrumentation::get_stats();
+    BOOST_REQUIRE_EQUAL(stats.get<u64>("nbtree_append.count"), (NTHREADS + 1ull)*NITER);
+
+    // Disabled probes shouldn't count events
+    Instrumentation::set_enabled(false);
+    {
+        ProbeScope probe(AKU_PROBE_FLUSH);
+    }
+    Instrumentation::set_enabled(true);
+    BOOST_REQUIRE_EQUAL(Instrumentation::get_count(AKU_PROBE_FLUSH), 0ull);
+}
+
+BOOST_AUTO_TEST_CASE(test_memory_tracker) {
+    auto bytes = MemoryAccounting::get_bytes(AKU_MEM_CURSOR_BUFFERS);
+    auto objects = MemoryAccounting::get_objects(AKU_MEM_CURSOR_BUFFERS);
+    {
+        MemoryTracker a(AKU_MEM_CURSOR_BUFFERS, 100, 1);
+        MemoryTracker b(AKU_MEM_CURSOR_BUFFERS);
+        b.set(50, 1);
+        b.add(25, 0);
+        BOOST_REQUIRE_EQUAL(MemoryAccounting::get_bytes(AKU_MEM_CURSOR_BUFFERS), bytes + 175);
+        BOOST_REQUIRE_EQUAL(MemoryAccounting::get_objects(AKU_MEM_CURSOR_BUFFERS), objects + 2);
+
+        auto stats = MemoryAccounting::get_stats();
+        BOOST_REQUIRE_EQUAL(stats.get<i64>("cursors.buffers.bytes"), bytes + 175);
+        BOOST_REQUIRE_EQUAL(stats.get<i64>("cursors.total_bytes"), bytes + 175);
+        BOOST_REQUIRE(stats.get<i64>("total_bytes") >= bytes + 175);
+
+        // Counters should be updated from any thread
+        std::thread th([]() {
+            MemoryAccounting::add(AKU_MEM_CURSOR_BUFFERS, 10, 1);
+        });
+        th.join();
+        BOOST_REQUIRE_EQUAL(MemoryAccounting::get_bytes(AKU_MEM_CURSOR_BUFFERS), bytes + 185);
+        MemoryAccounting::add(AKU_MEM_CURSOR_BUFFERS, -10, -1);
+    }
+    BOOST_REQUIRE_EQUAL(MemoryAccounting::get_bytes(AKU_MEM_CURSOR_BUFFERS), bytes);
+    BOOST_REQUIRE_EQUAL(MemoryAccounting::get_objects(AKU_MEM_CURSOR_BUFFERS), objects);
+}
+
+BOOST_AUTO_TEST_CASE(test_thread_local_pool_reuse) {
+    auto stats = ThreadLocalPool::get_stats();
+    void* p1 = ThreadLocalPool::allocate(40);
+    ThreadLocalPool::deallocate(p1, 40);
+    // Same size class should reuse the chunk
+    void* p2 = ThreadLocalPool::allocate(48);
+    BOOST_REQUIRE_EQUAL(p1, p2);
+    ThreadLocalPool::deallocate(p2, 48);
+    BOOST_REQUIRE_EQUAL(ThreadLocalPool::get_stats().hits, stats.hits + 1);
+
+    // Large objects are not pooled
+    void* p3 = ThreadLocalPool::allocate(ThreadLocalPool::MAX_SIZE + 1);
+    ThreadLocalPool::deallocate(p3, ThreadLocalPool::MAX_SIZE + 1);
+    BOOST_REQUIRE_EQUAL(ThreadLocalPool::get_stats().misses, stats.misses + 1);
+}
+
+BOOST_AUTO_TEST_CASE(test_thread_local_pool_cross_thread) {
+    // Memory allocated by one thread can be freed by another one
+    std::vector<std::shared_ptr<std::string>> objects;
+    std::thread th([&objects]() {
+        for (int i = 0; i < 1000; i++) {
+            objects.push_back(make_pooled<std::string>(std::to_string(i)));
+        }
+    });
+    th.join();
+    for (int i = 0; i < 1000; i++) {
+        BOOST_REQUIRE_EQUAL(*objects.at(static_cast<size_t>(i)), std::to_string(i));
+    }
+    objects.clear();
+}
+
+struct PooledTestObject : PooledObject {
+    u64 value;
+    virtual ~PooledTestObject() = default;
+};
+
+struct PooledTestObjectEx : PooledTestObject {
+    char payload[100];
+};
+
+BOOST_AUTO_TEST_CASE(test_pooled_object) {
+    std::unique_ptr<PooledTestObject> base(new PooledTestObjectEx());
+    void* addr = base.get();
+    base.reset();
+    // Object should be returned to the size class of the derived type
+    std::unique_ptr<PooledTestObject> ex(new PooledTestObjectEx());
+    BOOST_REQUIRE_EQUAL(addr, static_cast<void*>(ex.get()));
+}
+
+BOOST_AUTO_TEST_CASE(test_buffer_pool) {
+    std::vector<double> buf;
+    BufferPool<double>::acquire(&buf);
+    buf.resize(1000);
+    const double* data = buf.data();
+    BufferPool<double>::release(&buf);
+    BOOST_REQUIRE(buf.empty());
+    BOOST_REQUIRE_EQUAL(buf.capacity(), 0);
+
+    std::vector<double> other;
+    BufferPool<double>::acquire(&other);
+    BOOST_REQUIRE(other.empty());
+    BOOST_REQUIRE(other.capacity() >= 1000);
+    BOOST_REQUIRE_EQUAL(other.data(), data);
+}